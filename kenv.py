@@ -97,25 +97,28 @@ def Link(target, source, env):
     return 0
     
 def extract_serializable(target, source, env):
-    """Extract All serializable_ops declarations from the sources and generate a serializable_array with it."""
+    """Extract All serializable_ops declarations from the sources and generate a serializable_array with it.
+    The array is indexed by the type id of the ops, so that it is initialized at compile time."""
     target = map(str,target)
     source = map(str,source)
-    files = ""
-    for f in source:
-	files += " " + f
+    decl = re.compile(r"DECLARE_KSERIALIZABLE_OPS\(([A-Za-z_][A-Za-z0-9_]*)\)\s*=\s*\{\s*(?:\.type\s*=\s*)?([A-Za-z_][A-Za-z0-9_]*)")
+    serializable = []
+    for s in source:
+	serializable += decl.findall(open(s).read())
 
-    serializable = map(str.strip, os.popen("sed -nre s/'.*DECLARE_KSERIALIZABLE_OPS\(([A-Za-z_][A-Za-z0-9_]*)\).*/\\1_serializable_ops/p'" + files).readlines())
     f = file(target[0], "w")
-    for s in serializable:
-	f.write("extern struct kserializable_ops %s;\n" % s)
+    f.write("#include \"kserializable.h\"\n\n")
+    for (name, type) in serializable:
+	f.write("extern struct kserializable_ops %s_serializable_ops;\n" % name)
 
+    # A type out of the dense range fails to compile here, and a duplicate
+    # type id is reported by -Woverride-init.
     f.write("\n")
-    f.write("const struct kserializable_ops *%s[] = {\n" % os.path.splitext(os.path.basename(f.name))[0])
+    f.write("const struct kserializable_ops *%s[KSERIALIZABLE_DENSE_COUNT] = {\n" % os.path.splitext(os.path.basename(f.name))[0])
     
-    for s in serializable:
-	f.write("    &%s,\n" % s)
+    for (name, type) in serializable:
+	f.write("    [%s] = &%s_serializable_ops,\n" % (type, name))
 
-    f.write("    (void *)0\n")
     f.write("};\n")
     f.close()
 
@@ -1,6 +1,12 @@
 #include <assert.h>
 #include "base64.h"
 #include "kerror.h"
+#include "kpool.h"
+#include "kcpu.h"
+
+#ifdef KCPU_X86
+#include <immintrin.h>
+#endif
 
 /* This table maps values to base64 ASCII characters. */
 static const unsigned char base64_table[] = {
@@ -14,54 +20,163 @@ static const unsigned char base64_table[] = {
     '4', '5', '6', '7', '8', '9', '+', '/'
 };
 
-/* This function converts 3 bytes of 'data' to 4 base64 ASCII characters. */ 
-static inline void do_convert_and_write(kbuffer *base64, uint8_t *data) {
-    uint8_t out[4];
+/* Same as above for the URL and filename safe alphabet of RFC 4648. */
+static const unsigned char base64_url_table[] = {
+    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
+    'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
+    'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X',
+    'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
+    'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n',
+    'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
+    'w', 'x', 'y', 'z', '0', '1', '2', '3',
+    '4', '5', '6', '7', '8', '9', '-', '_'
+};
+
+/* Vector implementations, see kcpu.h. The encoder and the decoder use the
+ * shuffle and multiply techniques of W. Mula and D. Lemire: the 3-byte groups
+ * are spread over 32-bit lanes and the 6-bit fields are moved in place with
+ * multiplications, then translated to ASCII with a byte shuffle.
+ */
+#ifdef KCPU_X86
+#define KB64_SSSE3 __attribute__((target("ssse3")))
+#define KB64_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* Room needed after the decoded bytes by the vector stores. */
+#define B64_SLACK 16
+
+/* Number of characters decoded per reservation of the output buffer. */
+#define B64_CHUNK 4096
+
+/* This function converts the 'n' bytes of 'src' to base64 in 'dst', with
+ * padding, and returns the number of characters written. 'table' is the
+ * alphabet.
+ */
+static size_t bin2b64_scalar(uint8_t *dst, const uint8_t *src, size_t n, const unsigned char *table) {
+    uint8_t *out = dst;
+
+    for (; n >= 3; n -= 3, src += 3, out += 4) {
+        out[0] = table[src[0]>>2];
+        out[1] = table[(src[0]&0x3)<<4 | src[1]>>4];
+        out[2] = table[(src[1]&0xF)<<2 | src[2]>>6];
+        out[3] = table[src[2]&0x3F];
+    }
 
-    out[0] = base64_table[data[0]>>2];
-    out[1] = base64_table[(data[0]&0x3)<<4 | (data)[1]>>4];
-    out[2] = base64_table[(data[1]&0xF)<<2 | (data)[2]>>6];
-    out[3] = base64_table[data[2]&0x3F];
-    kbuffer_write(base64, out, 4);
+    /* Pad the last group. */
+    if (n) {
+        uint8_t in1 = (n == 2) ? src[1] : 0;
+        out[0] = table[src[0]>>2];
+        out[1] = table[(src[0]&0x3)<<4 | in1>>4];
+        out[2] = (n == 2) ? table[(in1&0xF)<<2] : '=';
+        out[3] = '=';
+        out += 4;
+    }
+
+    return out - dst;
 }
 
-/* This function converts the end of the buffer specified into 4 base64 ASCII
-   characters, dealing with padding as necessary. */
-static void do_convert_and_write_tail(kbuffer *base64, uint8_t *data, uint32_t len) {
-    uint8_t out[4];
-    uint8_t in[2];
+#ifdef KCPU_X86
+/* This function spreads 12 bytes over 16 bytes and returns the 6-bit values. */
+KB64_SSSE3 static inline __m128i bin2b64_split_ssse3(__m128i v) {
+    __m128i t0, t1, t2, t3;
+    v = _mm_shuffle_epi8(v, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    t0 = _mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00));
+    t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    t2 = _mm_and_si128(v, _mm_set1_epi32(0x003f03f0));
+    t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
 
-    assert(base64);
-    assert(len < 3);
+/* This function translates 6-bit values to base64 characters. The values are
+ * reduced to the index of the offset of their range: 0 for a-z, 1-10 for
+ * 0-9, 11 for value 62 ('+'), 12 for value 63 ('/') and 13 for A-Z.
+ */
+KB64_SSSE3 static inline __m128i bin2b64_ascii_ssse3(__m128i v, __m128i offsets) {
+    __m128i index = _mm_subs_epu8(v, _mm_set1_epi8(51));
+    __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), v);
+    index = _mm_or_si128(index, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, index), v);
+}
 
-    if (len == 0) return;
+KB64_SSSE3 static size_t bin2b64_ssse3(uint8_t *dst, const uint8_t *src, size_t n, const unsigned char *table) {
+    __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, table[62] - 62,
+                                    table[63] - 63, 'A', 0, 0);
+    size_t i = 0, o = 0;
 
-    /* Copy the data first then pad the buffer with 0s. */
-    in[0] = data[0];
-    in[1] = (len == 2) ? data[1] : 0;
+    /* 16 bytes are loaded for 12 bytes converted. */
+    for (; i + 16 <= n; i += 12, o += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+        _mm_storeu_si128((__m128i *) (dst + o), bin2b64_ascii_ssse3(bin2b64_split_ssse3(v), offsets));
+    }
 
-    out[0] = base64_table[in[0]>>2];
-    out[1] = base64_table[(in[0]&0x3)<<4 | in[1]>>4];
-    out[2] = (len == 2) ?  base64_table[(in[1]&0xF)<<2] : '=';
-    out[3] = '=';
-    
-    kbuffer_write(base64, out, 4);
+    return o + bin2b64_scalar(dst + o, src + i, n - i, table);
 }
 
-/* This function converts a binary buffer to a base64 buffer. */
+KB64_AVX2 static size_t bin2b64_avx2(uint8_t *dst, const uint8_t *src, size_t n, const unsigned char *table) {
+    __m256i shuf = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                   10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                       '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, table[62] - 62,
+                                       table[63] - 63, 'A', 0, 0,
+                                       'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                       '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, table[62] - 62,
+                                       table[63] - 63, 'A', 0, 0);
+    size_t i = 0, o = 0;
+
+    /* Each lane converts 12 bytes. The second lane is loaded at offset 12. */
+    for (; i + 28 <= n; i += 24, o += 32) {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (src + i + 12));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        __m256i t0, t1, t2, t3, index, upper;
+
+        v = _mm256_shuffle_epi8(v, shuf);
+        t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+        t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+        t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        v = _mm256_or_si256(t1, t3);
+
+        index = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+        upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), v);
+        index = _mm256_or_si256(index, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+        v = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, index), v);
+        _mm256_storeu_si256((__m256i *) (dst + o), v);
+    }
+
+    return o + bin2b64_ssse3(dst + o, src + i, n - i, table);
+}
+#endif
+
+/* This function dispatches the conversion to base64. */
+static size_t bin2b64(uint8_t *dst, const uint8_t *src, size_t n, const unsigned char *table) {
+#ifdef KCPU_X86
+    int level = kcpu_get_level();
+    if (level >= KCPU_LEVEL_AVX2) return bin2b64_avx2(dst, src, n, table);
+    if (level >= KCPU_LEVEL_SSSE3) return bin2b64_ssse3(dst, src, n, table);
+#endif
+
+    return bin2b64_scalar(dst, src, n, table);
+}
+
+/* This function converts a binary buffer to a base64 buffer. The characters
+ * are written directly in the space reserved in the base64 buffer.
+ */
 void kbin2b64(kbuffer *buffer, kbuffer *base64_buffer) {
-    uint32_t nb2write = buffer->len;
-    
-    kbuffer_begin_write(base64_buffer, (buffer->len * 4 + 2) / 3);
+    uint8_t *out;
 
-    while (nb2write >= 3) {
-        do_convert_and_write(base64_buffer, (uint8_t *)(buffer->data + buffer->len - nb2write));
-        nb2write -=3;
+    /* Work on a flat copy of a chained buffer. */
+    if (kbuffer_is_chained(buffer)) {
+        kbuffer *flat = kbuffer_acquire(buffer->len);
+        kbuffer_write_buffer(flat, buffer);
+        kbin2b64(flat, base64_buffer);
+        kbuffer_release(flat);
+        return;
     }
     
-    do_convert_and_write_tail(base64_buffer, (uint8_t *)(buffer->data + buffer->len - nb2write), nb2write);
-
-    kbuffer_end_write(base64_buffer, 0);
+    out = kbuffer_begin_write(base64_buffer, (buffer->len + 2) / 3 * 4);
+    kbuffer_end_write(base64_buffer, bin2b64(out, buffer->data, buffer->len, base64_table));
 }
 
 /******************** b642bin **********************/
@@ -72,7 +187,7 @@ void kbin2b64(kbuffer *buffer, kbuffer *base64_buffer) {
  * value. For instance, b642bin_tbl['/'] == 63. '=' is the padding character.
  * Base 64 characters are, in order, A-Z, a-z, 0-9, +, /.
  */
-static signed char b642bin_tbl[256] = {
+static const signed char b642bin_tbl[256] = {
     INV,INV,INV,INV,    INV,INV,INV,INV,
     INV,INV,INV,INV,    INV,INV,INV,INV,
     INV,INV,INV,INV,    INV,INV,INV,INV,
@@ -107,6 +222,181 @@ static signed char b642bin_tbl[256] = {
     INV,INV,INV,INV,    INV,INV,INV,INV,
 };
 
+/* Same as above for the URL and filename safe alphabet, where '-' and '_'
+ * replace '+' and '/'.
+ */
+static const signed char b642bin_url_tbl[256] = {
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV, 62,INV,INV,
+     52, 53, 54, 55,     56, 57, 58, 59,
+     60, 61,INV,INV,    INV,PAD,INV,INV,
+    INV,  0,  1,  2,      3,  4,  5,  6,
+      7,  8,  9, 10,     11, 12, 13, 14,
+     15, 16, 17, 18,     19, 20, 21, 22,
+     23, 24, 25,INV,    INV,INV,INV, 63,
+    INV, 26, 27, 28,     29, 30, 31, 32,
+     33, 34, 35, 36,     37, 38, 39, 40,
+     41, 42, 43, 44,     45, 46, 47, 48,
+     49, 50, 51,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+};
+
+/* This function decodes the groups of 4 characters of 'src' in 'dst' until
+ * the end of the input or a group containing padding or an invalid character.
+ * It returns the number of characters decoded and sets 'out_len' to the
+ * number of bytes written. 'tbl' is the table of the alphabet.
+ */
+static size_t b642bin_run_scalar(uint8_t *dst, const uint8_t *src, size_t n, size_t *out_len,
+                                 const signed char *tbl) {
+    size_t i = 0, o = 0;
+
+    for (; i + 4 <= n; i += 4, o += 3) {
+        signed char a = tbl[src[i]], b = tbl[src[i + 1]];
+        signed char c = tbl[src[i + 2]], d = tbl[src[i + 3]];
+        if ((a | b | c | d) < 0) break;
+        dst[o] = a << 2 | b >> 4;
+        dst[o + 1] = b << 4 | c >> 2;
+        dst[o + 2] = c << 6 | d;
+    }
+
+    *out_len = o;
+    return i;
+}
+
+#ifdef KCPU_X86
+/* This function returns the 6-bit values of 16 characters. 'invalid' is set
+ * if a character is outside the alphabet, including the padding. 'c62' and
+ * 'c63' are the characters of the values 62 and 63.
+ */
+KB64_SSSE3 static inline __m128i b642bin_values_ssse3(__m128i v, char c62, char c63, int *invalid) {
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i plus = _mm_cmpeq_epi8(v, _mm_set1_epi8(c62));
+    __m128i slash = _mm_cmpeq_epi8(v, _mm_set1_epi8(c63));
+    __m128i shift = _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                                 _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+    shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+    shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(62 - c62)));
+    shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(63 - c63)));
+    *invalid = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(plus, slash)))) != 0xffff;
+    return _mm_add_epi8(v, shift);
+}
+
+/* This function packs 16 6-bit values in the first 12 bytes. */
+KB64_SSSE3 static inline __m128i b642bin_pack_ssse3(__m128i v) {
+    v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+KB64_SSSE3 static size_t b642bin_run_ssse3(uint8_t *dst, const uint8_t *src, size_t n, size_t *out_len,
+                                           const signed char *tbl) {
+    char c62 = (tbl == b642bin_tbl) ? '+' : '-', c63 = (tbl == b642bin_tbl) ? '/' : '_';
+    size_t i = 0, o = 0, i2, o2;
+
+    for (; i + 16 <= n; i += 16, o += 12) {
+        int invalid;
+        __m128i v = b642bin_values_ssse3(_mm_loadu_si128((const __m128i *) (src + i)), c62, c63, &invalid);
+        if (invalid) break;
+        _mm_storeu_si128((__m128i *) (dst + o), b642bin_pack_ssse3(v));
+    }
+
+    i2 = b642bin_run_scalar(dst + o, src + i, n - i, &o2, tbl);
+    *out_len = o + o2;
+    return i + i2;
+}
+
+KB64_AVX2 static size_t b642bin_run_avx2(uint8_t *dst, const uint8_t *src, size_t n, size_t *out_len,
+                                         const signed char *tbl) {
+    char c62 = (tbl == b642bin_tbl) ? '+' : '-', c63 = (tbl == b642bin_tbl) ? '/' : '_';
+    size_t i = 0, o = 0, i2, o2;
+
+    for (; i + 32 <= n; i += 32, o += 24) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+        __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('a' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), v));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+        __m256i plus = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c62));
+        __m256i slash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c63));
+        __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, _mm256_or_si256(plus, slash)));
+        __m256i shift;
+
+        if ((uint32_t) _mm256_movemask_epi8(valid) != 0xffffffff) break;
+
+        shift = _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+                                _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(plus, _mm256_set1_epi8(62 - c62)));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(slash, _mm256_set1_epi8(63 - c63)));
+        v = _mm256_add_epi8(v, shift);
+
+        /* Pack each lane in its first 12 bytes, then join the lanes. */
+        v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i *) (dst + o), v);
+    }
+
+    i2 = b642bin_run_ssse3(dst + o, src + i, n - i, &o2, tbl);
+    *out_len = o + o2;
+    return i + i2;
+}
+#endif
+
+/* This function dispatches the decoding of a run of groups. */
+static size_t b642bin_run(uint8_t *dst, const uint8_t *src, size_t n, size_t *out_len, const signed char *tbl) {
+#ifdef KCPU_X86
+    int level = kcpu_get_level();
+    if (level >= KCPU_LEVEL_AVX2) return b642bin_run_avx2(dst, src, n, out_len, tbl);
+    if (level >= KCPU_LEVEL_SSSE3) return b642bin_run_ssse3(dst, src, n, out_len, tbl);
+#endif
+
+    return b642bin_run_scalar(dst, src, n, out_len, tbl);
+}
+
+/* This function decodes the groups of 4 significant characters found at the
+ * read position of a flat buffer, directly in the space reserved in the binary
+ * buffer. The padding and the invalid characters are left to the automaton
+ * below, which produces the same output for the other groups.
+ */
+static void b642bin_fast(kbuffer *b64, kbuffer *bin) {
+    if (kbuffer_is_chained(b64)) return;
+
+    while (b64->len - b64->pos >= 4) {
+        size_t n = MIN(b64->len - b64->pos, (size_t) B64_CHUNK), used, out_len;
+        uint8_t *out = kbuffer_begin_write(bin, n / 4 * 3 + B64_SLACK);
+        used = b642bin_run(out, b64->data + b64->pos, n, &out_len, b642bin_tbl);
+        b64->pos += used;
+        kbuffer_end_write(bin, out_len);
+        if (used < n / 4 * 4) break;
+    }
+}
+
 /* This function handles padding when padding is detected in the third state of
    the automaton.
    This function returns -1 on error, 1 if decoding has ended and 0 otherwise. */
@@ -117,7 +407,7 @@ static inline int b642bin_pad(kbuffer *in, kbuffer *out, unsigned char *cs, int
 	
 	/* There are no more characters. Error. */
 	if (kbuffer_read8(in, &cs[3])) {
-            KTOOLS_ERROR_SET("premature end of buffer reached at %i", in->pos);
+            KTOOLS_ERROR_SET("premature end of buffer reached at %zu", in->pos);
     	    return -1;
 	}
     
@@ -126,7 +416,7 @@ static inline int b642bin_pad(kbuffer *in, kbuffer *out, unsigned char *cs, int
 
 	    /* Error, we don't ignore invalid characters. */
 	    if (! ignore_invalid) {
-                KTOOLS_ERROR_SET("invalid character (0x%X) in buffer at %i", cs[0], in->pos -1);
+                KTOOLS_ERROR_SET("invalid character (0x%X) in buffer at %zu", cs[0], in->pos -1);
                 return -1;
             }
 	}
@@ -149,7 +439,7 @@ static inline int b642bin_q3(kbuffer *in, kbuffer *out, unsigned char *cs, int i
 	
 	/* There are no more characters. Error. */
 	if (kbuffer_read8(in, &cs[3])) {
-            KTOOLS_ERROR_SET("premature end of buffer reached at %i", in->pos);
+            KTOOLS_ERROR_SET("premature end of buffer reached at %zu", in->pos);
     	    return -1;
 	}
     
@@ -158,7 +448,7 @@ static inline int b642bin_q3(kbuffer *in, kbuffer *out, unsigned char *cs, int i
 
 	    /* Error, we don't ignore invalid characters. */
 	    if (! ignore_invalid) {
-                KTOOLS_ERROR_SET("invalid character (0x%X) in buffer at %i", cs[0], in->pos -1);
+                KTOOLS_ERROR_SET("invalid character (0x%X) in buffer at %zu", cs[0], in->pos -1);
                 return -1;
             }
 	}
@@ -197,7 +487,7 @@ static inline int b642bin_q2(kbuffer *in, kbuffer *out, unsigned char *cs, int i
 	
 	/* There are no more characters. Error. */
 	if (kbuffer_read8(in, &cs[2])) {
-            KTOOLS_ERROR_SET("premature end of buffer reached at %i", in->pos);
+            KTOOLS_ERROR_SET("premature end of buffer reached at %zu", in->pos);
     	    return -1;
 	}
     
@@ -206,7 +496,7 @@ static inline int b642bin_q2(kbuffer *in, kbuffer *out, unsigned char *cs, int i
 
 	    /* Error, we don't ignore invalid characters. */
 	    if (! ignore_invalid) {
-                KTOOLS_ERROR_SET("invalid character (0x%X) in buffer at %i", cs[0], in->pos -1);
+                KTOOLS_ERROR_SET("invalid character (0x%X) in buffer at %zu", cs[0], in->pos -1);
                 return -1;
             }
 	}
@@ -232,7 +522,7 @@ static inline int b642bin_q1(kbuffer *in, kbuffer *out, unsigned char *cs, int i
 	
 	/* There are no more characters. Error. */
 	if (kbuffer_read8(in, &cs[1])) {
-            KTOOLS_ERROR_SET("premature end of buffer reached at %i", in->pos);
+            KTOOLS_ERROR_SET("premature end of buffer reached at %zu", in->pos);
     	    return -1;
 	}
     
@@ -241,7 +531,7 @@ static inline int b642bin_q1(kbuffer *in, kbuffer *out, unsigned char *cs, int i
 
 	    /* Error, we don't ignore invalid characters. */
 	    if (! ignore_invalid) {
-                KTOOLS_ERROR_SET("invalid character (0x%X) in buffer at %i", cs[0], in->pos -1);
+                KTOOLS_ERROR_SET("invalid character (0x%X) in buffer at %zu", cs[0], in->pos -1);
                 return -1;
             }
 	}
@@ -263,6 +553,7 @@ int kb642bin(kbuffer *b64, kbuffer *bin, int ignore_invalid) {
 
     /* Get the first character. */
     while (42) {
+        b642bin_fast(b64, bin);
       
 	/* There are no more characters. We decoded the whole buffer. */
 	if (kbuffer_read8(b64, &cs[0])) {
@@ -275,7 +566,7 @@ int kb642bin(kbuffer *b64, kbuffer *bin, int ignore_invalid) {
 
 	    /* Error, we don't ignore invalid characters. */
 	    if (! ignore_invalid) {
-                KTOOLS_ERROR_SET("invalid character (0x%X) in buffer at %i", cs[0], b64->pos -1);
+                KTOOLS_ERROR_SET("invalid character (0x%X) in buffer at %zu", cs[0], b64->pos -1);
                 return -1;
             }
 	}
@@ -305,3 +596,226 @@ int kb642bin(kbuffer *b64, kbuffer *bin, int ignore_invalid) {
 	}
     }
 }
+
+/******************** Streaming codec **********************/
+
+/* Number of bytes converted at a time when the lines are broken. */
+#define B64_ENC_BLOCK 3072
+
+/* This function writes 'n' characters in the output buffer, breaking the
+ * lines if requested. A line break is written before the first character of
+ * a line, so that the output never ends with a line break.
+ */
+static void kb64_enc_write(kb64_state *self, const uint8_t *chars, size_t n, kbuffer *out) {
+    if (self->line_len == 0) {
+        kbuffer_write(out, chars, n);
+        return;
+    }
+
+    while (n) {
+        size_t len;
+
+        if (self->col == self->line_len) {
+            if (self->flags & KB64_CRLF) kbuffer_write8(out, '\r');
+            kbuffer_write8(out, '\n');
+            self->col = 0;
+        }
+
+        len = MIN(n, self->line_len - self->col);
+        kbuffer_write(out, chars, len);
+        self->col += len;
+        chars += len;
+        n -= len;
+    }
+}
+
+/* This function initializes an encoder. 'line_len' is the maximum number of
+ * characters per line (76 for MIME), or 0 for a single line.
+ */
+void kb64_enc_init(kb64_state *self, int flags, size_t line_len) {
+    memset(self, 0, sizeof(kb64_state));
+    self->flags = flags;
+    self->line_len = line_len;
+    self->pad = -1;
+}
+
+/* This function encodes the 'n' bytes of 'in' in the output buffer. The last 1
+ * or 2 bytes are kept in the state if they do not complete a group.
+ */
+void kb64_enc_update(kb64_state *self, const uint8_t *in, size_t n, kbuffer *out) {
+    const unsigned char *table = (self->flags & KB64_URL) ? base64_url_table : base64_table;
+    uint8_t chars[B64_ENC_BLOCK / 3 * 4];
+    size_t len;
+
+    if (n == 0) return;
+
+    /* Complete the pending group. */
+    if (self->group_len) {
+        len = MIN(n, 3 - self->group_len);
+        memcpy(self->group + self->group_len, in, len);
+        self->group_len += len;
+        in += len;
+        n -= len;
+        if (self->group_len < 3) return;
+
+        kb64_enc_write(self, chars, bin2b64_scalar(chars, self->group, 3, table), out);
+        self->group_len = 0;
+    }
+
+    /* Convert the complete groups. Without line breaks, the characters are
+     * written directly in the space reserved in the output buffer.
+     */
+    len = n / 3 * 3;
+
+    if (self->line_len == 0) {
+        uint8_t *dst = kbuffer_begin_write(out, len / 3 * 4);
+        kbuffer_end_write(out, bin2b64(dst, in, len, table));
+    }
+
+    else {
+        size_t i, block;
+
+        for (i = 0; i < len; i += block) {
+            block = MIN(len - i, (size_t) B64_ENC_BLOCK);
+            kb64_enc_write(self, chars, bin2b64(chars, in + i, block, table), out);
+        }
+    }
+
+    memcpy(self->group, in + len, n - len);
+    self->group_len = n - len;
+}
+
+/* This function writes the pending group with its padding and resets the
+ * encoder.
+ */
+void kb64_enc_final(kb64_state *self, kbuffer *out) {
+    const unsigned char *table = (self->flags & KB64_URL) ? base64_url_table : base64_table;
+    uint8_t chars[4];
+
+    if (self->group_len) {
+        bin2b64_scalar(chars, self->group, self->group_len, table);
+        kb64_enc_write(self, chars, (self->flags & KB64_NO_PAD) ? self->group_len + 1 : 4, out);
+    }
+
+    kb64_enc_init(self, self->flags, self->line_len);
+}
+
+/* This function initializes a decoder. */
+void kb64_dec_init(kb64_state *self, int flags) {
+    kb64_enc_init(self, flags, 0);
+}
+
+/* This function writes the bytes of the incomplete group found before the
+ * padding or at the end of the input. This function returns -1 on error.
+ */
+static int kb64_dec_flush(kb64_state *self, kbuffer *out) {
+    uint8_t *g = self->group;
+
+    /* The bits of the last character beyond the last byte must be 0. */
+    if (self->group_len == 2 ? g[1] & 0xF : g[2] & 0x3) {
+        KTOOLS_ERROR_SET("overlaping data found with padding");
+        return -1;
+    }
+
+    kbuffer_write8(out, g[0] << 2 | g[1] >> 4);
+    if (self->group_len == 3) kbuffer_write8(out, g[1] << 4 | g[2] >> 2);
+    self->group_len = 0;
+    return 0;
+}
+
+/* This function decodes the 'n' characters of 'in' in the output buffer. The
+ * characters of an incomplete group are kept in the state. This function
+ * returns -1 on error, 0 otherwise.
+ */
+int kb64_dec_update(kb64_state *self, const char *in, size_t n, kbuffer *out) {
+    const signed char *tbl = (self->flags & KB64_URL) ? b642bin_url_tbl : b642bin_tbl;
+    int ignore_invalid = self->flags & KB64_IGNORE_INVALID;
+    const uint8_t *p = (const uint8_t *) in, *end = p + n;
+
+    while (p < end) {
+        signed char v;
+
+        /* Decode the groups of 4 significant characters directly in the space
+         * reserved in the output buffer. The other characters are handled one
+         * by one below.
+         */
+        if (self->group_len == 0 && self->pad < 0 && end - p >= 4) {
+            size_t len = MIN((size_t) (end - p), (size_t) B64_CHUNK), used, out_len;
+            uint8_t *dst = kbuffer_begin_write(out, len / 4 * 3 + B64_SLACK);
+            used = b642bin_run(dst, p, len, &out_len, tbl);
+            kbuffer_end_write(out, out_len);
+            p += used;
+            if (used == len / 4 * 4) continue;
+        }
+
+        v = tbl[*p++];
+
+        if (v == INV) {
+            if (p[-1] == '\r' || p[-1] == '\n' || ignore_invalid) continue;
+            KTOOLS_ERROR_SET("invalid character (0x%X) in input", p[-1]);
+            return -1;
+        }
+
+        if (v == PAD) {
+
+            /* First padding character: 1 or 2 characters are missing. */
+            if (self->pad < 0 && self->group_len >= 2) {
+                self->pad = (self->group_len == 2);
+                if (kb64_dec_flush(self, out)) return -1;
+            }
+
+            else if (self->pad > 0) self->pad--;
+
+            else if (! ignore_invalid) {
+                KTOOLS_ERROR_SET("misplaced padding character in input");
+                return -1;
+            }
+
+            continue;
+        }
+
+        /* Data after the padding. */
+        if (self->pad >= 0) {
+            if (ignore_invalid) continue;
+            KTOOLS_ERROR_SET("pending characters after the padding");
+            return -1;
+        }
+
+        self->group[self->group_len++] = v;
+
+        if (self->group_len == 4) {
+            uint8_t *g = self->group;
+            kbuffer_write8(out, g[0] << 2 | g[1] >> 4);
+            kbuffer_write8(out, g[1] << 4 | g[2] >> 2);
+            kbuffer_write8(out, g[2] << 6 | g[3]);
+            self->group_len = 0;
+        }
+    }
+
+    return 0;
+}
+
+/* This function checks the end of the input, writes the last bytes if the
+ * padding is omitted (KB64_NO_PAD) and resets the decoder. This function
+ * returns -1 on error, 0 otherwise.
+ */
+int kb64_dec_final(kb64_state *self, kbuffer *out) {
+    int flags = self->flags, ret = 0;
+
+    if (self->group_len == 1) {
+        KTOOLS_ERROR_SET("premature end of input");
+        ret = -1;
+    }
+
+    else if (self->group_len || self->pad > 0) {
+        if (! (flags & KB64_NO_PAD)) {
+            KTOOLS_ERROR_SET("missing padding at end of input");
+            ret = -1;
+        }
+
+        else if (self->group_len) ret = kb64_dec_flush(self, out);
+    }
+
+    kb64_dec_init(self, flags);
+    return ret;
+}
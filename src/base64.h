@@ -9,4 +9,63 @@ void kbin2b64(kbuffer *bin, kbuffer *b64);
 
 int kb642bin(kbuffer *b64, kbuffer *bin, int ignore_invalid);
 
+/* Streaming codec. The input is given in chunks of any size; the state
+ * carries the incomplete group of a chunk to the next, so that the memory used
+ * does not depend on the size of the input. The complete groups are converted
+ * directly in the output buffer.
+ *
+ * Encoding:
+ *   kb64_enc_init(&state, KB64_MIME, 76);
+ *   while (...) kb64_enc_update(&state, chunk, chunk_len, out);
+ *   kb64_enc_final(&state, out);
+ *
+ * Decoding is the same with kb64_dec_init(), kb64_dec_update() and
+ * kb64_dec_final(), which return -1 on error.
+ */
+
+/* Use the URL and filename safe alphabet ('-' and '_' instead of '+' and '/'). */
+#define KB64_URL                (1 << 0)
+
+/* Encoder: do not write the padding. Decoder: accept a last group without
+ * padding.
+ */
+#define KB64_NO_PAD             (1 << 1)
+
+/* Encoder: end the lines with "\r\n" instead of "\n". */
+#define KB64_CRLF               (1 << 2)
+
+/* Decoder: skip the characters outside the alphabet silently. The line breaks
+ * are always skipped.
+ */
+#define KB64_IGNORE_INVALID     (1 << 3)
+
+/* MIME encoding (RFC 2045) with lines of 76 characters. */
+#define KB64_MIME               KB64_CRLF
+
+typedef struct kb64_state {
+    int flags;
+
+    /* Encoder: maximum number of characters per line, 0 for no line breaks,
+     * and number of characters written on the current line.
+     */
+    size_t line_len;
+    size_t col;
+
+    /* Incomplete group: bytes for the encoder, 6-bit values for the decoder. */
+    uint8_t group[4];
+    size_t group_len;
+
+    /* Decoder: number of padding characters still expected, or -1 if the
+     * padding has not been reached yet.
+     */
+    int pad;
+} kb64_state;
+
+void kb64_enc_init(kb64_state *self, int flags, size_t line_len);
+void kb64_enc_update(kb64_state *self, const uint8_t *in, size_t n, kbuffer *out);
+void kb64_enc_final(kb64_state *self, kbuffer *out);
+void kb64_dec_init(kb64_state *self, int flags);
+int kb64_dec_update(kb64_state *self, const char *in, size_t n, kbuffer *out);
+int kb64_dec_final(kb64_state *self, kbuffer *out);
+
 #endif /*__K_BASE64_H__*/
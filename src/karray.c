@@ -107,7 +107,7 @@ void *karray_get(karray *self, int pos) {
         eff_pos = self->size - eff_pos;
 
     if (eff_pos < 0 || eff_pos >= self->size) {
-        KTOOLS_ERROR_SET("element %i is out of range [%d, %d]", pos, 0, self->size);
+        KTOOLS_ERROR_SET("element %i is out of range [%d, %zd]", pos, 0, self->size);
         return NULL;
     }
 
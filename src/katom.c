@@ -0,0 +1,194 @@
+/**
+ * src/katom.c
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ *
+ * String interning.
+ */
+
+#include "katom.h"
+#include "khash.h"
+#include "kmem.h"
+#include "kthread.h"
+#include "kutils.h"
+
+/* Size of the arena chunks. Strings larger than a quarter of a chunk get a
+ * chunk of their own.
+ */
+#define KATOM_CHUNK_SIZE (16 * 1024)
+
+/* Chunk of memory containing atoms. The atoms follow the header. */
+struct katom_chunk {
+
+    /* Next chunk in the list. */
+    struct katom_chunk *next;
+
+    /* Number of bytes allocated after the header. */
+    size_t size;
+
+    /* Number of bytes used after the header. */
+    size_t used;
+};
+
+/* The interning table. The keys and the values are the atoms. */
+static khash katom_table;
+
+/* List of chunks. The first chunk is the one being filled. */
+static struct katom_chunk *katom_chunk_list;
+
+/* Mutex protecting the table and the arena. */
+static struct kmutex katom_mutex;
+
+/* Size of the chunk header, rounded to keep the atoms aligned. */
+#define KATOM_HEADER_SIZE ((sizeof(struct katom_chunk) + 7) & ~(size_t) 7)
+
+/* This function hashes the interning table keys. */
+static unsigned int katom_table_key(void *key) {
+    return ((katom *) key)->hash;
+}
+
+/* This function compares the interning table keys by content. */
+static int katom_table_cmp(void *key_1, void *key_2) {
+    katom *atom_1 = (katom *) key_1;
+    katom *atom_2 = (katom *) key_2;
+    return (atom_1->hash == atom_2->hash && atom_1->len == atom_2->len &&
+            ! memcmp(atom_1->data, atom_2->data, atom_1->len));
+}
+
+/* This function allocates 'size' bytes in the arena. */
+static void * katom_arena_alloc(size_t size) {
+    struct katom_chunk *chunk = katom_chunk_list;
+    
+    /* Keep the atoms aligned. */
+    size = (size + 7) & ~(size_t) 7;
+    
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        
+        /* Large string. Allocate a dedicated chunk and keep filling the
+         * current one.
+         */
+        if (size > KATOM_CHUNK_SIZE / 4) {
+            struct katom_chunk *big = (struct katom_chunk *) kmalloc(KATOM_HEADER_SIZE + size);
+            big->size = big->used = size;
+            
+            if (chunk) {
+                big->next = chunk->next;
+                chunk->next = big;
+            }
+            
+            else {
+                big->next = NULL;
+                katom_chunk_list = big;
+            }
+            
+            return (char *) big + KATOM_HEADER_SIZE;
+        }
+        
+        chunk = (struct katom_chunk *) kmalloc(KATOM_HEADER_SIZE + KATOM_CHUNK_SIZE);
+        chunk->next = katom_chunk_list;
+        chunk->size = KATOM_CHUNK_SIZE;
+        chunk->used = 0;
+        katom_chunk_list = chunk;
+    }
+    
+    chunk->used += size;
+    return (char *) chunk + KATOM_HEADER_SIZE + chunk->used - size;
+}
+
+/* initialize/finalize the atom module, call at begining/end of program. */
+void katom_initialize() {
+    khash_init_func(&katom_table, katom_table_key, katom_table_cmp);
+    kmutex_init(&katom_mutex);
+    katom_chunk_list = NULL;
+}
+
+/* This function frees all the atoms. */
+void katom_finalize() {
+    while (katom_chunk_list) {
+        struct katom_chunk *next = katom_chunk_list->next;
+        kfree(katom_chunk_list);
+        katom_chunk_list = next;
+    }
+    
+    khash_clean(&katom_table);
+    kmutex_clean(&katom_mutex);
+}
+
+/* This function returns the hash of the bytes specified. It is the same as
+ * khash_buf_hash().
+ */
+unsigned int katom_hash_buf(const void *buf, size_t len) {
+    return khash_buf_hash(buf, len);
+}
+
+/* This function returns the atom having the bytes specified. The atom is
+ * created if it does not exist.
+ */
+const katom * katom_get_buf(const void *buf, size_t len) {
+    katom probe;
+    void *found;
+    katom *atom;
+    char *data;
+    
+    probe.data = (const char *) buf;
+    probe.len = len;
+    probe.hash = katom_hash_buf(buf, len);
+    
+    kmutex_lock(&katom_mutex);
+    
+    if (khash_get(&katom_table, &probe, &found, NULL) == 0) {
+        atom = (katom *) found;
+    }
+    
+    else {
+        atom = (katom *) katom_arena_alloc(sizeof(katom) + len + 1);
+        data = (char *) (atom + 1);
+        memcpy(data, buf, len);
+        data[len] = 0;
+        atom->data = data;
+        atom->len = len;
+        atom->hash = probe.hash;
+        khash_add(&katom_table, atom, atom);
+    }
+    
+    kmutex_unlock(&katom_mutex);
+    
+    return atom;
+}
+
+/* This function returns the atom having the bytes specified, or NULL if no
+ * such atom exists.
+ */
+const katom * katom_find_buf(const void *buf, size_t len) {
+    katom probe;
+    void *found = NULL;
+    
+    probe.data = (const char *) buf;
+    probe.len = len;
+    probe.hash = katom_hash_buf(buf, len);
+    
+    kmutex_lock(&katom_mutex);
+    if (khash_get(&katom_table, &probe, &found, NULL)) found = NULL;
+    kmutex_unlock(&katom_mutex);
+    
+    return (const katom *) found;
+}
+
+/* This function returns the number of atoms. */
+int katom_count() {
+    int count;
+    kmutex_lock(&katom_mutex);
+    count = katom_table.size;
+    kmutex_unlock(&katom_mutex);
+    return count;
+}
+
+/* Hash functions for khash tables keyed by atoms. The hash is the cached hash
+ * and atoms are compared by pointer.
+ */
+unsigned int khash_katom_key(void *key) {
+    return ((katom *) key)->hash;
+}
+
+int khash_katom_cmp(void *key_1, void *key_2) {
+    return key_1 == key_2;
+}
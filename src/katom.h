@@ -0,0 +1,57 @@
+/**
+ * src/katom.h
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ */
+
+#ifndef __KATOM_H__
+#define __KATOM_H__
+
+#include <string.h>
+#include <sys/types.h>
+#include "kstr.h"
+
+/* Struct katom is an interned byte string. Interning a string returns the
+ * unique atom having the same bytes, creating it if needed, so that two atoms
+ * are equal if and only if their pointers are equal. The hash and the length
+ * of an atom are computed once, when the atom is created.
+ *
+ * The atoms are stored in a process-wide table protected by a mutex, thus
+ * they can be interned from any thread. The bytes are copied in an arena and
+ * are never freed individually: an atom stays valid until katom_finalize() is
+ * called (by ktools_finalize()). Intern the names that are reused over and
+ * over (field names, paths, etc.), not arbitrary input.
+ */
+typedef struct katom {
+
+    /* The interned bytes, terminated by a '0'. There may be other '0' in the
+     * string. Do not modify.
+     */
+    const char *data;
+
+    /* Number of bytes, not including the final '0'. */
+    size_t len;
+
+    /* Hash of the bytes, as returned by katom_hash_buf(). */
+    unsigned int hash;
+} katom;
+
+void katom_initialize();
+void katom_finalize();
+unsigned int katom_hash_buf(const void *buf, size_t len);
+const katom * katom_get_buf(const void *buf, size_t len);
+const katom * katom_find_buf(const void *buf, size_t len);
+int katom_count();
+unsigned int khash_katom_key(void *key);
+int khash_katom_cmp(void *key_1, void *key_2);
+
+/* Same as katom_get_buf(), for a C string. */
+static inline const katom * katom_get_cstr(const char *str) {
+    return katom_get_buf(str, strlen(str));
+}
+
+/* Same as katom_get_buf(), for a kstr. */
+static inline const katom * katom_get_kstr(kstr *str) {
+    return katom_get_buf(str->data, str->slen);
+}
+
+#endif
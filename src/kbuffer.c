@@ -1,15 +1,24 @@
 #include <assert.h>
 #include <string.h>
+#ifdef __UNIX__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "kbuffer.h"
 #include "kmem.h"
 #include "kutils.h"
 #include "base64.h"
 #include "kerror.h"
+#include "kfmt.h"
+#include "kfs.h"
+#include "kpool.h"
 
 static int kbuffer_serialize_serializable(kserializable *serializable, kbuffer *buffer) {
     kbuffer *self = (kbuffer *)serializable;
     kbuffer_write32(buffer, self->len);
-    kbuffer_write(buffer, self->data, self->len);
+    kbuffer_write_buffer(buffer, self);
     return 0;
 }
 
@@ -17,18 +26,37 @@ static int kbuffer_serialize_serializable(kserializable *serializable, kbuffer *
 static int kbuffer_deserialize(kserializable *serializable, kbuffer *buffer) {
     kbuffer *self = (kbuffer *)serializable;
     uint32_t len;
-    uint8_t *ptr;
 
-    if (kbuffer_read32(buffer, &len)) {
+    if (kbuffer_read32(buffer, &len) || kbuffer_read_buffer(buffer, self, len)) {
         KTOOLS_ERROR_SET("not enough data");
         return -1;
     }
 
-    ptr = kbuffer_write_nbytes(self, len);
-    if (kbuffer_read(buffer, ptr, len)) {
+    return 0;
+}
+
+static int kbuffer_serialize_compact(kserializable *serializable, kbuffer *buffer) {
+    kbuffer *self = (kbuffer *)serializable;
+    kbuffer_write_varint32(buffer, self->len);
+    kbuffer_write_buffer(buffer, self);
+    return 0;
+}
+
+/* This function returns the size of the serialized buffer. */
+static ssize_t kbuffer_serialized_size(kserializable *serializable, int compact_flag) {
+    kbuffer *self = (kbuffer *)serializable;
+    return (compact_flag ? kvarint_size64(self->len) : 4) + self->len;
+}
+
+static int kbuffer_deserialize_compact(kserializable *serializable, kbuffer *buffer) {
+    kbuffer *self = (kbuffer *)serializable;
+    uint32_t len;
+
+    if (kbuffer_read_varint32(buffer, &len) || kbuffer_read_buffer(buffer, self, len)) {
         KTOOLS_ERROR_SET("not enough data");
         return -1;
     }
+
     return 0;
 }
 
@@ -41,12 +69,11 @@ static void kbuffer_destroy_serializable(kserializable *self) {
 }
 
 static void kbuffer_dump(kserializable *self, FILE *file) {
-    kbuffer b64;
-    kbuffer_init(&b64);
-    kbin2b64((kbuffer *)self, &b64);
-    kbuffer_write8(&b64, '\0');
-    fprintf(file, "b64 (%s)", (char *)b64.data);
-    kbuffer_clean(&b64);
+    kbuffer *b64 = kbuffer_acquire(0);
+    kbin2b64((kbuffer *)self, b64);
+    kbuffer_write8(b64, '\0');
+    fprintf(file, "b64 (%s)", (char *)b64->data);
+    kbuffer_release(b64);
 }
 
 DECLARE_KSERIALIZABLE_OPS(kbuffer) = {
@@ -56,6 +83,9 @@ DECLARE_KSERIALIZABLE_OPS(kbuffer) = {
     kbuffer_new_serializable,
     kbuffer_destroy_serializable,
     kbuffer_dump,
+    kbuffer_serialize_compact,
+    kbuffer_deserialize_compact,
+    kbuffer_serialized_size,
 };
 
 kbuffer *kbuffer_new() {
@@ -76,37 +106,430 @@ void kbuffer_init(kbuffer *self) {
     self->pos = 0;
     self->allocated = 256;
     self->data = (uint8_t *)kmalloc (self->allocated);
+    self->seg_size = 0;
+    self->first_seg = self->last_seg = self->write_seg = self->read_seg = NULL;
+    self->read_seg_pos = 0;
+    self->scratch_list = NULL;
+    self->store = NULL;
+    kserializable_init((kserializable *)self, &KSERIALIZABLE_OPS(kbuffer));
+}
+
+/* This function initializes a chained buffer. The segments are 'seg_size'
+ * bytes long, or KBUFFER_SEG_SIZE if 'seg_size' is 0. A write larger than the
+ * segment size gets a segment of its own.
+ */
+void kbuffer_init_chained(kbuffer *self, size_t seg_size) {
+    assert (self);
+
+    self->len = 0;
+    self->pos = 0;
+    self->allocated = 0;
+    self->data = NULL;
+    self->seg_size = seg_size ? seg_size : KBUFFER_SEG_SIZE;
+    self->first_seg = self->last_seg = self->write_seg = self->read_seg = NULL;
+    self->read_seg_pos = 0;
+    self->scratch_list = NULL;
+    self->store = NULL;
+    kserializable_init((kserializable *)self, &KSERIALIZABLE_OPS(kbuffer));
+}
+
+static struct kbuffer_seg * kbuffer_chain_read_seg(kbuffer *self, size_t *offset);
+
+/* Stores of the views, see kbuffer_init_view(). The bytes of a view belong to
+ * its source, so these stores are not reference counted.
+ */
+static struct kbuffer_store kbuffer_view_store = { 1, NULL, 0 };
+static struct kbuffer_store kbuffer_borrow_store = { 1, NULL, 0 };
+
+/* Bytes of the empty views. */
+static uint8_t kbuffer_view_empty[1];
+
+/* This function releases a reference to a shared block. */
+static void kbuffer_store_release(struct kbuffer_store *store) {
+    if (store == &kbuffer_view_store || store == &kbuffer_borrow_store) return;
+
+    if (__sync_sub_and_fetch(&store->ref_count, 1) == 0) {
+#ifdef __UNIX__
+        if (store->map_len) munmap(store->data, store->map_len);
+        else
+#endif
+        kfree(store->data);
+        kfree(store);
+    }
+}
+
+/* This function returns the shared block of the flat buffer 'src', which is
+ * not a view, with a reference for the caller.
+ */
+static struct kbuffer_store * kbuffer_ref_store(kbuffer *src) {
+    struct kbuffer_store *store = src->store;
+
+    /* Move the block of the source in a shared block. */
+    if (store == NULL) {
+        store = (struct kbuffer_store *) kmalloc(sizeof(struct kbuffer_store));
+        store->ref_count = 1;
+        store->data = src->data;
+        store->map_len = 0;
+        src->store = store;
+    }
+
+    if (store != &kbuffer_borrow_store) __sync_add_and_fetch(&store->ref_count, 1);
+    return store;
+}
+
+/* This function makes the flat buffer 'self' share 'len' bytes of the flat
+ * buffer 'src' from 'offset'. The range has been validated.
+ */
+static void kbuffer_share(kbuffer *self, kbuffer *src, size_t offset, size_t len) {
+    struct kbuffer_store *store;
+
+    /* The bytes of a view may not outlive it. Copy them, unless the view
+     * lends them.
+     */
+    if (src->store == &kbuffer_view_store) {
+        self->pos = self->len = 0;
+        kbuffer_write(self, src->data + offset, len);
+        return;
+    }
+
+    store = kbuffer_ref_store(src);
+
+    if (self->store) kbuffer_store_release(self->store);
+    else kfree(self->data);
+
+    self->store = store;
+    self->data = src->data + offset;
+    self->len = len;
+    self->pos = 0;
+    self->allocated = 0;
+}
+
+/* This function gives the buffer a block of its own, with room for 'size'
+ * bytes, before it is written.
+ */
+static void kbuffer_unshare(kbuffer *self, size_t size) {
+    struct kbuffer_store *store = self->store;
+    uint8_t *data;
+
+    /* The other buffers are gone. Take the block back if it starts with our
+     * data, so that it can be reallocated. A mapped file is always copied.
+     */
+    if (store != &kbuffer_view_store && store != &kbuffer_borrow_store &&
+        __sync_add_and_fetch(&store->ref_count, 0) == 1 && self->data == store->data && ! store->map_len) {
+        kfree(store);
+        self->store = NULL;
+        return;
+    }
+
+    self->allocated = next_power_of_2_size(MAX(size, self->len));
+    data = (uint8_t *) kmalloc(self->allocated);
+    memcpy(data, self->data, self->len);
+    kbuffer_store_release(store);
+    self->store = NULL;
+    self->data = data;
+}
+
+/* This function initializes a buffer containing 'len' bytes of 'src' from
+ * 'offset'. The bytes of a flat buffer are shared, not copied: the slice can
+ * be read while the source is modified or cleaned. The bytes of a chained
+ * buffer are copied. This function returns -1 if the range is out of bounds.
+ */
+int kbuffer_init_slice(kbuffer *self, kbuffer *src, size_t offset, size_t len) {
+    if (offset > src->len || len > src->len - offset) {
+        kbuffer_init(self);
+        KTOOLS_ERROR_SET("slice of %zu bytes at %zu is out of the buffer of %zu bytes", len, offset, src->len);
+        return -1;
+    }
+
+    /* The bytes are copied in a block of the slice. */
+    if (kbuffer_is_chained(src) || src->store == &kbuffer_view_store) {
+        kbuffer_init(self);
+        if (kbuffer_is_chained(src)) {
+            size_t pos = src->pos;
+            src->pos = offset;
+            kbuffer_read_buffer(src, self, len);
+            src->pos = pos;
+        }
+        else kbuffer_write(self, src->data + offset, len);
+        return 0;
+    }
+
+    /* The slice owns no block, so nothing is allocated but the shared block
+     * the first time the source is sliced.
+     */
+    self->store = kbuffer_ref_store(src);
+    self->data = src->data + offset;
+    self->len = len;
+    self->pos = 0;
+    self->allocated = 0;
+    self->seg_size = 0;
+    self->first_seg = self->last_seg = self->write_seg = self->read_seg = NULL;
+    self->read_seg_pos = 0;
+    self->scratch_list = NULL;
+    kserializable_init((kserializable *)self, &KSERIALIZABLE_OPS(kbuffer));
+    return 0;
+}
+
+/* This function initializes a view of the next 'len' bytes of 'src', from its
+ * position, which does not move. The view is a flat buffer that reads the
+ * bytes of 'src' in place, without allocating memory: it must be cleaned before
+ * 'src' is modified, reset or cleaned. Writing to the view copies the bytes
+ * first. If the bytes span several segments of a chained buffer, the view
+ * holds a copy of them instead, which is freed with the view.
+ *
+ * The slices of a view and the buffers read from it with
+ * kbuffer_read_buffer() copy its bytes, since they may outlive it. With the
+ * flag KBUFFER_VIEW_BORROW, they refer to the bytes of 'src' instead and must
+ * not outlive them either. The views of a borrowing view borrow as well.
+ *
+ * The buffer is initialized even on failure. This function returns -1 if the
+ * range is out of bounds.
+ */
+int kbuffer_init_view(kbuffer *self, kbuffer *src, size_t len, int flags) {
+    uint8_t *data = kbuffer_view_empty;
+    size_t pos = src->pos;
+    int ret = 0;
+
+    if (len > src->len - src->pos) {
+        KTOOLS_ERROR_SET("view of %zu bytes at %zu is out of the buffer of %zu bytes", len, src->pos, src->len);
+        len = 0;
+        ret = -1;
+    }
+
+    /* The copy of the bytes spanning several segments belongs to the view, so
+     * that it does not pile up in the scratch list of 'src'.
+     */
+    if (len && kbuffer_is_chained(src)) {
+        size_t offset;
+        struct kbuffer_seg *seg = kbuffer_chain_read_seg(src, &offset);
+
+        if (len > seg->len - offset) {
+            kbuffer_init(self);
+            kbuffer_read(src, kbuffer_write_nbytes(self, len), len);
+            src->pos = pos;
+            return 0;
+        }
+    }
+
+    if (len) {
+        data = kbuffer_read_nbytes(src, len);
+        src->pos = pos;
+    }
+
+    self->data = data;
+    self->len = len;
+    self->pos = 0;
+    self->allocated = 0;
+    self->seg_size = 0;
+    self->first_seg = self->last_seg = self->write_seg = self->read_seg = NULL;
+    self->read_seg_pos = 0;
+    self->scratch_list = NULL;
+    self->store = (flags & KBUFFER_VIEW_BORROW) || src->store == &kbuffer_borrow_store ?
+                  &kbuffer_borrow_store : &kbuffer_view_store;
     kserializable_init((kserializable *)self, &KSERIALIZABLE_OPS(kbuffer));
+    return ret;
+}
+
+/* This function initializes a flat buffer containing the file specified. The
+ * file is mapped in memory instead of being read, so its pages are loaded as
+ * the buffer is read. 'flags' is a combination of the KBUFFER_MMAP_* flags.
+ *
+ * The mapping is read-only unless KBUFFER_MMAP_WRITE is specified. Writing to
+ * the buffer with the kbuffer functions first copies the file in memory, as
+ * for a slice. The file must not be truncated while it is mapped. On Windows,
+ * the file is read instead of mapped.
+ *
+ * The buffer is initialized even on failure. This function returns -1 on
+ * failure.
+ */
+int kbuffer_init_mmap(kbuffer *self, const char *path, int flags) {
+#ifdef __UNIX__
+    struct kbuffer_store *store;
+    struct stat st;
+    void *map;
+    int fd;
+
+    kbuffer_init(self);
+    fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        KTOOLS_ERROR_SET("cannot open %s: %s", path, kerror_syserror());
+        return -1;
+    }
+
+    if (fstat(fd, &st)) {
+        KTOOLS_ERROR_SET("cannot stat %s: %s", path, kerror_syserror());
+        close(fd);
+        return -1;
+    }
+
+    if ((uint64_t) st.st_size > SIZE_MAX) {
+        KTOOLS_ERROR_SET("cannot map %s: file too large", path);
+        close(fd);
+        return -1;
+    }
+
+    /* An empty file cannot be mapped. */
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ | ((flags & KBUFFER_MMAP_WRITE) ? PROT_WRITE : 0), MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        KTOOLS_ERROR_SET("cannot map %s: %s", path, kerror_syserror());
+        return -1;
+    }
+
+    if (flags & KBUFFER_MMAP_SEQUENTIAL) madvise(map, st.st_size, MADV_SEQUENTIAL);
+    if (flags & KBUFFER_MMAP_WILLNEED) madvise(map, st.st_size, MADV_WILLNEED);
+
+    store = (struct kbuffer_store *) kmalloc(sizeof(struct kbuffer_store));
+    store->ref_count = 1;
+    store->data = (uint8_t *) map;
+    store->map_len = st.st_size;
+
+    kfree(self->data);
+    self->data = store->data;
+    self->len = st.st_size;
+    self->allocated = 0;
+    self->store = store;
+    return 0;
+#else
+    kbuffer_init(self);
+    (void) flags;
+    return kfs_read_file((char *) path, self);
+#endif
+}
+
+/* Same as above, for a new buffer. This function returns NULL if the range is
+ * out of bounds. The slice is destroyed with kbuffer_destroy().
+ */
+kbuffer *kbuffer_slice(kbuffer *src, size_t offset, size_t len) {
+    kbuffer *self = kmalloc(sizeof(kbuffer));
+
+    if (kbuffer_init_slice(self, src, offset, len)) {
+        kbuffer_destroy(self);
+        return NULL;
+    }
+
+    return self;
 }
 
 int kbuffer_init_b64(kbuffer *self, kstr *b64) {
     int ret = 0;
-    kbuffer b64buf;
+    kbuffer *b64buf = kbuffer_acquire(b64->slen);
     kbuffer_init(self);
-    kbuffer_init(&b64buf);
-    kbuffer_write_kstr(&b64buf, b64);
-    if (kb642bin(&b64buf, self, 0)) {
+    kbuffer_write_kstr(b64buf, b64);
+    if (kb642bin(b64buf, self, 0)) {
         KTOOLS_ERROR_PUSH("cannot initialize buffer from base64");
         ret = -1;
     }
-    kbuffer_clean(&b64buf);
+    kbuffer_release(b64buf);
     return ret;
 }
 
+/* This function frees a list of segments. */
+static void kbuffer_free_seg_list(struct kbuffer_seg *seg) {
+    while (seg) {
+        struct kbuffer_seg *next = seg->next;
+        kfree(seg);
+        seg = next;
+    }
+}
+
 void kbuffer_clean(kbuffer *self) {
-    if (self)
-        kfree (self->data);
+    if (self) {
+        if (self->store) kbuffer_store_release(self->store);
+        else if (self->data) kfree (self->data);
+        kbuffer_free_seg_list(self->first_seg);
+        kbuffer_free_seg_list(self->scratch_list);
+    }
+}
+
+/* This function allocates a segment of 'size' bytes. */
+static struct kbuffer_seg * kbuffer_seg_new(size_t size) {
+    struct kbuffer_seg *seg = (struct kbuffer_seg *) kmalloc(sizeof(struct kbuffer_seg) + size);
+    seg->next = NULL;
+    seg->data = (uint8_t *) (seg + 1);
+    seg->len = 0;
+    seg->size = size;
+    return seg;
+}
+
+/* This function appends a segment of at least 'min_size' bytes to the chained
+ * buffer.
+ */
+static struct kbuffer_seg * kbuffer_chain_append_seg(kbuffer *self, size_t min_size) {
+    struct kbuffer_seg *seg = kbuffer_seg_new(MAX(self->seg_size, min_size));
+    
+    if (self->last_seg) self->last_seg->next = seg;
+    else self->first_seg = seg;
+    self->last_seg = seg;
+    return seg;
+}
+
+/* This function returns the last segment of the chained buffer if it has room
+ * for 'size' bytes. Otherwise, it appends a new segment and returns it.
+ */
+static struct kbuffer_seg * kbuffer_chain_reserve(kbuffer *self, size_t size) {
+    struct kbuffer_seg *seg = self->last_seg;
+    if (seg && seg->size - seg->len >= size) return seg;
+    return kbuffer_chain_append_seg(self, size);
 }
 
+/* This function empties the chained buffer. The first segment is kept for the
+ * next writes.
+ */
+void kbuffer_reset_chained(kbuffer *self) {
+    if (self->first_seg) {
+        kbuffer_free_seg_list(self->first_seg->next);
+        self->first_seg->next = NULL;
+        self->first_seg->len = 0;
+    }
+
+    kbuffer_free_seg_list(self->scratch_list);
+    self->scratch_list = NULL;
+    self->last_seg = self->first_seg;
+    self->write_seg = self->read_seg = NULL;
+    self->read_seg_pos = 0;
+    self->len = self->pos = 0;
+}
+
+/* This function ensures that the flat buffer can hold 'size' bytes. It does
+ * nothing for a chained buffer since its segments are allocated as it is
+ * written.
+ */
 void kbuffer_grow(kbuffer *self, size_t size) {
-    if (self->allocated >= size) return;
+    if (self->store) kbuffer_unshare(self, size);
+    if (self->allocated >= size || kbuffer_is_chained(self)) return;
 
-    self->allocated = next_power_of_2 (size);
+    self->allocated = next_power_of_2_size (size);
     self->data = krealloc(self->data, self->allocated); 
 }
 
-void kbuffer_write(kbuffer *self, const uint8_t *const data, size_t len) {
-    uint8_t *ptr = kbuffer_write_nbytes(self, len);
+void kbuffer_write(kbuffer *self, const uint8_t *data, size_t len) {
+    uint8_t *ptr;
+
+    /* Fill the last segment, then put the rest in a new segment. */
+    if (kbuffer_is_chained(self)) {
+        struct kbuffer_seg *seg = self->last_seg;
+
+        if (seg) {
+            size_t n = MIN(len, seg->size - seg->len);
+            memcpy(seg->data + seg->len, data, n);
+            seg->len += n;
+            self->len += n;
+            data += n;
+            len -= n;
+        }
+
+        if (len == 0) return;
+    }
+
+    ptr = kbuffer_write_nbytes(self, len);
     memcpy(ptr, data, len);
 }
 
@@ -120,14 +543,23 @@ void kbuffer_write_kstr(kbuffer *self, const kstr *str) {
 }
 
 void kbuffer_write_buffer(kbuffer *self, const kbuffer *src) {
-    kbuffer_write(self, src->data, src->len);
+    struct kbuffer_seg *seg;
+
+    if (src->seg_size == 0) {
+        kbuffer_write(self, src->data, src->len);
+        return;
+    }
+
+    for (seg = src->first_seg; seg; seg = seg->next) kbuffer_write(self, seg->data, seg->len);
+}
+
+/* This function appends 'len' bytes to the buffer for the formatter. */
+static char * kbuffer_write_nbytes_fmt(void *dst, size_t len) {
+    return (char *) kbuffer_write_nbytes((kbuffer *) dst, len);
 }
 
 void kbuffer_writefv(kbuffer *self, const char *format, va_list args) {
-    kstr str;
-    kstr_init_sfv(&str, format, args);
-    kbuffer_write_kstr(self, &str);
-    kstr_clean(&str);
+    kfmt_vformat(kbuffer_write_nbytes_fmt, self, format, args);
 }
 
 void kbuffer_writef(kbuffer *self, const char *format, ...) {
@@ -139,6 +571,18 @@ void kbuffer_writef(kbuffer *self, const char *format, ...) {
 
 uint8_t *kbuffer_write_nbytes (kbuffer *self, size_t size) {
     uint8_t *ptr;
+
+    /* The bytes must be contiguous, so they are put in a new segment if the
+     * last one is too small.
+     */
+    if (kbuffer_is_chained(self)) {
+        struct kbuffer_seg *seg = kbuffer_chain_reserve(self, size);
+        ptr = seg->data + seg->len;
+        seg->len += size;
+        self->len += size;
+        return ptr;
+    }
+
     kbuffer_grow(self, self->len + size);
     ptr = self->data + self->len;
     self->len += size;
@@ -146,24 +590,297 @@ uint8_t *kbuffer_write_nbytes (kbuffer *self, size_t size) {
 }
 
 uint8_t *kbuffer_begin_write(kbuffer *self, size_t max_size) {
-    kbuffer_grow(self, self->len + max_size);
 #ifndef NDEBUG
     self->write_max_size = max_size;
 #endif
+
+    if (kbuffer_is_chained(self)) {
+        self->write_seg = kbuffer_chain_reserve(self, max_size);
+        return self->write_seg->data + self->write_seg->len;
+    }
+
+    kbuffer_grow(self, self->len + max_size);
     return self->data + self->len;
 }
 
+/* This function is the same as kbuffer_begin_write(), except that the space
+ * reserved may be split in two parts, e.g. to be filled with readv(). In a
+ * chained buffer, the end of the last segment is used before a new segment is
+ * allocated. The parts are stored in 'iov', which must have 2 entries, and
+ * the function returns the number of parts. The data is committed with
+ * kbuffer_end_write().
+ */
+int kbuffer_begin_write_iovec(kbuffer *self, size_t max_size, struct iovec *iov) {
+    struct kbuffer_seg *seg = self->last_seg;
+    size_t n;
+
+    if (! kbuffer_is_chained(self) || ! seg || seg->len == seg->size || seg->size - seg->len >= max_size) {
+        iov[0].iov_base = kbuffer_begin_write(self, max_size);
+        iov[0].iov_len = max_size;
+        return 1;
+    }
+
+#ifndef NDEBUG
+    self->write_max_size = max_size;
+#endif
+    n = seg->size - seg->len;
+    self->write_seg = seg;
+    iov[0].iov_base = seg->data + seg->len;
+    iov[0].iov_len = n;
+    seg = kbuffer_chain_append_seg(self, max_size - n);
+    iov[1].iov_base = seg->data;
+    iov[1].iov_len = max_size - n;
+    return 2;
+}
+
 void kbuffer_end_write(kbuffer *self, size_t size_written) {
     assert(size_written <= self->write_max_size);
     self->len += size_written;
+
+    /* Distribute the bytes over the segments reserved. */
+    if (kbuffer_is_chained(self)) {
+        struct kbuffer_seg *seg;
+
+        for (seg = self->write_seg; size_written; seg = seg->next) {
+            size_t n = MIN(size_written, seg->size - seg->len);
+            seg->len += n;
+            size_written -= n;
+        }
+    }
+}
+
+/* This function stores the segments of the unread data of the buffer, from
+ * the read position to the end, in 'iov', e.g. to write them with writev(). It
+ * returns the number of segments stored, at most 'max_count'. If 'iov' is NULL,
+ * the function returns the number of segments needed. The segments are valid
+ * until the buffer is modified.
+ */
+int kbuffer_to_iovec(kbuffer *self, struct iovec *iov, int max_count) {
+    struct kbuffer_seg *seg;
+    size_t offset;
+    int count = 0;
+
+    if (! kbuffer_is_chained(self)) {
+        if (self->pos == self->len) return 0;
+        if (iov == NULL) return 1;
+        if (max_count < 1) return 0;
+        iov[0].iov_base = self->data + self->pos;
+        iov[0].iov_len = self->len - self->pos;
+        return 1;
+    }
+
+    /* Skip the data read. */
+    for (seg = self->first_seg, offset = self->pos; seg && offset >= seg->len; seg = seg->next) offset -= seg->len;
+
+    for (; seg && (iov == NULL || count < max_count); seg = seg->next) {
+        if (seg->len == offset) continue;
+
+        if (iov) {
+            iov[count].iov_base = seg->data + offset;
+            iov[count].iov_len = seg->len - offset;
+        }
+
+        count++;
+        offset = 0;
+    }
+
+    return count;
+}
+
+/* The functions below support streaming, e.g. a socket read into the buffer
+ * with kbuffer_reserve_tail() and kbuffer_end_write() and parsed with the
+ * read functions. They discard the bytes before the read position, so the
+ * buffer does not grow without bound. Discarding the bytes shifts 'pos' and
+ * 'len', and invalidates the pointers to the data of a flat buffer.
+ */
+
+/* This function discards the bytes before the read position of the buffer if
+ * it is worth it. A flat buffer is compacted by moving the unread bytes to
+ * the start of the buffer, only when the bytes discarded are at least as many
+ * as the bytes moved, so that each byte is moved at most once on average. The
+ * consumed segments of a chained buffer are freed, except the last one, which
+ * is emptied once it has been read, and so are the pointers returned by
+ * kbuffer_read_nbytes().
+ */
+void kbuffer_compact(kbuffer *self) {
+    size_t left = self->len - self->pos;
+
+    if (kbuffer_is_chained(self)) {
+        /* The copies made by kbuffer_read_nbytes() are of bytes already read. */
+        kbuffer_free_seg_list(self->scratch_list);
+        self->scratch_list = NULL;
+
+        while (self->first_seg != self->last_seg && self->pos >= self->first_seg->len) {
+            struct kbuffer_seg *seg = self->first_seg;
+            self->first_seg = seg->next;
+            self->pos -= seg->len;
+            self->len -= seg->len;
+            if (self->write_seg == seg) self->write_seg = NULL;
+            kfree(seg);
+        }
+
+        /* Reuse the last segment if it has been read. */
+        if (self->first_seg && self->pos == self->len) {
+            self->first_seg->len = 0;
+            self->pos = self->len = 0;
+        }
+
+        self->read_seg = NULL;
+        self->read_seg_pos = 0;
+        return;
+    }
+
+    if (self->pos == 0 || self->pos < left) return;
+
+    /* A shared block cannot be modified. Copy the unread bytes in a block of
+     * our own.
+     */
+    if (self->store) {
+        uint8_t *data;
+        self->allocated = next_power_of_2_size(left);
+        data = (uint8_t *) kmalloc(self->allocated);
+        memcpy(data, self->data + self->pos, left);
+        kbuffer_store_release(self->store);
+        self->store = NULL;
+        self->data = data;
+    }
+
+    else {
+        memmove(self->data, self->data + self->pos, left);
+    }
+
+    self->len = left;
+    self->pos = 0;
+}
+
+/* This function marks the next 'len' bytes of the buffer as read. They may be
+ * discarded. A flat buffer is reset when all the bytes have been read.
+ */
+void kbuffer_consume(kbuffer *self, size_t len) {
+    self->pos += MIN(len, self->len - self->pos);
+
+    if (kbuffer_is_chained(self)) {
+        kbuffer_compact(self);
+    }
+
+    else if (self->pos == self->len) {
+        self->pos = self->len = 0;
+    }
+}
+
+/* This function discards the bytes of the buffer after the first 'len' bytes.
+ * It does nothing if the buffer is not longer than 'len'.
+ */
+void kbuffer_truncate(kbuffer *self, size_t len) {
+    if (len >= self->len) return;
+
+    /* Cut the segment containing the new end and free the next ones. */
+    if (kbuffer_is_chained(self)) {
+        struct kbuffer_seg *seg = self->first_seg;
+        size_t seg_pos = 0;
+
+        while (seg_pos + seg->len < len) {
+            seg_pos += seg->len;
+            seg = seg->next;
+        }
+
+        seg->len = len - seg_pos;
+        kbuffer_free_seg_list(seg->next);
+        seg->next = NULL;
+        self->last_seg = seg;
+        self->write_seg = self->read_seg = NULL;
+        self->read_seg_pos = 0;
+    }
+
+    self->len = len;
+    self->pos = MIN(self->pos, len);
+}
+
+/* This function returns a pointer to at least 'min_size' contiguous bytes at
+ * the end of the buffer, e.g. to read() directly into the buffer, and stores
+ * the number of contiguous bytes available in 'avail'. The buffer is compacted
+ * first if it is worth it. The bytes written are committed with
+ * kbuffer_end_write().
+ */
+uint8_t *kbuffer_reserve_tail(kbuffer *self, size_t min_size, size_t *avail) {
+    uint8_t *ptr;
+
+    kbuffer_compact(self);
+
+    if (kbuffer_is_chained(self)) {
+        self->write_seg = kbuffer_chain_reserve(self, min_size);
+        *avail = self->write_seg->size - self->write_seg->len;
+        ptr = self->write_seg->data + self->write_seg->len;
+    }
+
+    else {
+        kbuffer_grow(self, self->len + min_size);
+        *avail = self->allocated - self->len;
+        ptr = self->data + self->len;
+    }
+
+#ifndef NDEBUG
+    self->write_max_size = *avail;
+#endif
+    return ptr;
+}
+
+/* This function returns the segment of the chained buffer containing the
+ * read position, and the offset of the read position in that segment. It
+ * returns NULL if the read position is at the end of the buffer.
+ */
+static struct kbuffer_seg * kbuffer_chain_read_seg(kbuffer *self, size_t *offset) {
+    struct kbuffer_seg *seg = self->read_seg;
+
+    /* Restart from the beginning after a backward seek. */
+    if (seg == NULL || self->pos < self->read_seg_pos) {
+        seg = self->first_seg;
+        self->read_seg_pos = 0;
+    }
+
+    while (seg && self->pos >= self->read_seg_pos + seg->len) {
+        self->read_seg_pos += seg->len;
+        seg = seg->next;
+    }
+
+    /* Keep the last segment to avoid walking the list again. */
+    if (seg) self->read_seg = seg;
+    else {
+        self->read_seg = NULL;
+        self->read_seg_pos = 0;
+    }
+
+    *offset = self->pos - self->read_seg_pos;
+    return seg;
+}
+
+/* This function reads 'len' bytes from a chained buffer. The length has been
+ * validated.
+ */
+static void kbuffer_chain_read(kbuffer *self, uint8_t *data, size_t len) {
+    size_t offset;
+
+    while (len) {
+        struct kbuffer_seg *seg = kbuffer_chain_read_seg(self, &offset);
+        size_t n = MIN(len, seg->len - offset);
+        memcpy(data, seg->data + offset, n);
+        self->pos += n;
+        data += n;
+        len -= n;
+    }
 }
 
 int kbuffer_read(kbuffer *self, uint8_t *data, size_t len) {
     if (len > self->len - self->pos) {
-        KTOOLS_ERROR_SET("buffer is too short to read %u bytes at bytes %i of %i", len, self->pos, self->len);
+        KTOOLS_ERROR_SET("buffer is too short to read %zu bytes at bytes %zu of %zu", len, self->pos, self->len);
 	return -1;
     }
     
+    if (kbuffer_is_chained(self)) {
+        kbuffer_chain_read(self, data, len);
+        return 0;
+    }
+
     memcpy (data, self->data + self->pos, len);
     self->pos += len;
     return 0;
@@ -172,20 +889,202 @@ int kbuffer_read(kbuffer *self, uint8_t *data, size_t len) {
 uint8_t *kbuffer_read_nbytes (kbuffer *self, size_t size) {
     uint8_t *ptr;
     if (self->len - self->pos < size) {
-        KTOOLS_ERROR_SET("buffer is too short to read %u bytes at bytes %i of %i", size, self->pos, self->len);
+        KTOOLS_ERROR_SET("buffer is too short to read %zu bytes at bytes %zu of %zu", size, self->pos, self->len);
         return NULL;
     }
+
+    /* The bytes span several segments. Return a copy that stays valid until
+     * the buffer is reset or compacted.
+     */
+    if (kbuffer_is_chained(self)) {
+        size_t offset;
+        struct kbuffer_seg *seg = kbuffer_chain_read_seg(self, &offset);
+
+        if (size <= seg->len - offset) {
+            self->pos += size;
+            return seg->data + offset;
+        }
+
+        seg = kbuffer_seg_new(size);
+        seg->next = self->scratch_list;
+        self->scratch_list = seg;
+        kbuffer_chain_read(self, seg->data, size);
+        return seg->data;
+    }
+
     ptr = self->data + self->pos;
     self->pos += size;
     return ptr;
 }
 
+/* This function writes the 'count' integers of 'width' bytes of 'data' in
+ * network byte order. The space is reserved once and the bytes are swapped
+ * in a single pass.
+ */
+void kbuffer_write_array(kbuffer *self, const void *data, size_t count, size_t width) {
+    uint8_t *ptr = kbuffer_begin_write(self, count * width);
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+    memcpy(ptr, data, count * width);
+#else
+    kutil_bswap_array(ptr, data, count, width);
+#endif
+
+    kbuffer_end_write(self, count * width);
+}
+
+/* This function reads 'count' integers of 'width' bytes in network byte
+ * order into 'data'.
+ */
+int kbuffer_read_array(kbuffer *self, void *data, size_t count, size_t width) {
+    if (count > (self->len - self->pos) / width) {
+        KTOOLS_ERROR_SET("buffer is too short to read %zu values at bytes %zu of %zu", count, self->pos, self->len);
+        return -1;
+    }
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+    kbuffer_read(self, data, count * width);
+#else
+    if (kbuffer_is_chained(self)) {
+        kbuffer_chain_read(self, data, count * width);
+        kutil_bswap_array(data, data, count, width);
+    } else {
+        kutil_bswap_array(data, self->data + self->pos, count, width);
+        self->pos += count * width;
+    }
+#endif
+
+    return 0;
+}
+
+/* This function returns a pointer to the next 'size' bytes of the buffer,
+ * which must be available, without moving the read position. The bytes are
+ * copied in 'tmp' if they span several segments.
+ */
+static const uint8_t *kbuffer_peek(kbuffer *self, uint8_t *tmp, size_t size) {
+    struct kbuffer_seg *seg;
+    size_t offset, i, n;
+
+    if (! kbuffer_is_chained(self)) return self->data + self->pos;
+    if (size == 0) return tmp;
+
+    seg = kbuffer_chain_read_seg(self, &offset);
+    if (size <= seg->len - offset) return seg->data + offset;
+
+    for (i = 0; i < size; seg = seg->next, offset = 0) {
+        n = MIN(size - i, seg->len - offset);
+        memcpy(tmp + i, seg->data + offset, n);
+        i += n;
+    }
+
+    return tmp;
+}
+
+int kbuffer_read_varint32(kbuffer *self, uint32_t *data) {
+    uint8_t tmp[KVARINT_MAX32];
+    size_t n = MIN(self->len - self->pos, (size_t) KVARINT_MAX32);
+    size_t used = kvarint_decode32(kbuffer_peek(self, tmp, n), n, data);
+
+    if (used == 0) {
+        KTOOLS_ERROR_SET("invalid 32-bit varint at byte %zu of %zu", self->pos, self->len);
+        return -1;
+    }
+
+    self->pos += used;
+    return 0;
+}
+
+int kbuffer_read_varint64(kbuffer *self, uint64_t *data) {
+    uint8_t tmp[KVARINT_MAX64];
+    size_t n = MIN(self->len - self->pos, (size_t) KVARINT_MAX64);
+    size_t used = kvarint_decode64(kbuffer_peek(self, tmp, n), n, data);
+
+    if (used == 0) {
+        KTOOLS_ERROR_SET("invalid 64-bit varint at byte %zu of %zu", self->pos, self->len);
+        return -1;
+    }
+
+    self->pos += used;
+    return 0;
+}
+
+/* This function reads 'count' varints into 'data'. The values of a flat buffer
+ * are decoded in one batch. The read position is not moved on error.
+ */
+int kbuffer_read_varint32_array(kbuffer *self, uint32_t *data, size_t count) {
+    size_t pos = self->pos, i;
+    ssize_t used;
+
+    if (kbuffer_is_chained(self)) {
+        for (i = 0; i < count; i++) {
+            if (kbuffer_read_varint32(self, data + i)) {
+                self->pos = pos;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    used = kvarint_decode32_array(self->data + pos, self->len - pos, data, count);
+    if (used < 0) {
+        KTOOLS_ERROR_SET("invalid 32-bit varint array at byte %zu of %zu", self->pos, self->len);
+        return -1;
+    }
+
+    self->pos += used;
+    return 0;
+}
+
+int kbuffer_read_varint64_array(kbuffer *self, uint64_t *data, size_t count) {
+    size_t pos = self->pos, i;
+    ssize_t used;
+
+    if (kbuffer_is_chained(self)) {
+        for (i = 0; i < count; i++) {
+            if (kbuffer_read_varint64(self, data + i)) {
+                self->pos = pos;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    used = kvarint_decode64_array(self->data + pos, self->len - pos, data, count);
+    if (used < 0) {
+        KTOOLS_ERROR_SET("invalid 64-bit varint array at byte %zu of %zu", self->pos, self->len);
+        return -1;
+    }
+
+    self->pos += used;
+    return 0;
+}
+
+void kbuffer_write_varint32_array(kbuffer *self, const uint32_t *data, size_t count) {
+    uint8_t *ptr = kbuffer_begin_write(self, count * KVARINT_MAX32);
+    size_t i, n = 0;
+
+    for (i = 0; i < count; i++) n += kvarint_encode32(ptr + n, data[i]);
+    kbuffer_end_write(self, n);
+}
+
 int kbuffer_read_buffer(kbuffer *self, kbuffer *into, uint32_t len) {
     if (self->len - self->pos < len) {
         KTOOLS_ERROR_SET("not enough data");
         return -1;
     }
     
+    if (kbuffer_is_chained(self)) {
+        kbuffer_chain_read(self, kbuffer_write_nbytes(into, len), len);
+        return 0;
+    }
+
+    if ((len >= KBUFFER_SLICE_MIN || self->store == &kbuffer_borrow_store) && into->len == 0 &&
+        ! kbuffer_is_chained(into)) {
+        kbuffer_share(into, self, self->pos, len);
+        self->pos += len;
+        return 0;
+    }
+
     kbuffer_write(into, self->data + self->pos, len);
     self->pos += len;
 
@@ -10,13 +10,106 @@
 #include <stdlib.h>
 #include <kutils.h>
 #include <kserializable.h>
+#include <kvarint.h>
 
 #ifdef __UNIX__
 #include <arpa/inet.h>
+#include <sys/uio.h>
 #else
 #include <winsock2.h>
+
+/* Same layout as the UNIX structure. */
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
 #endif
 
+/* Default segment size of the chained buffers. */
+#define KBUFFER_SEG_SIZE (64 * 1024)
+
+/* A kbuffer is either flat or chained.
+ *
+ * A flat buffer (kbuffer_init()) stores its content in a single block,
+ * 'data', which is reallocated as the buffer grows.
+ *
+ * A chained buffer (kbuffer_init_chained()) stores its content in a list of
+ * segments. A segment is never reallocated, so writing never moves the bytes
+ * written before, and the buffer size is only limited by the memory. The
+ * content can be output with writev() through kbuffer_to_iovec(). The read
+ * and write functions below work on both kinds of buffers, and 'len' and
+ * 'pos' keep their meaning. However, 'data' is NULL in a chained buffer, so the
+ * functions that expose it (kbuffer_current_pos(), kbuffer_current_write_pos())
+ * and the code accessing it directly require a flat buffer.
+ */
+
+/* A flat buffer may share its bytes with other buffers, e.g. with the slices
+ * created by kbuffer_init_slice(). The shared block is reference counted and
+ * freed by the last buffer using it. A buffer that is written while it shares
+ * its bytes first copies them in a block of its own (copy-on-write), so
+ * sharing is invisible to the users, provided they only modify the buffers
+ * through the functions below.
+ *
+ * kbuffer_read_buffer(), kbuffer_read_serialized() and the deserializer share
+ * the bytes instead of copying them when they fill an empty buffer with at
+ * least KBUFFER_SLICE_MIN bytes.
+ *
+ * A view (kbuffer_init_view()) reads the bytes of another buffer in place
+ * without holding a reference to them, so it costs no allocation but must not
+ * outlive them. kserializable_deserialize() passes the payload of each element
+ * to its deserializer in a view.
+ */
+#define KBUFFER_SLICE_MIN 1024
+
+/* Flags of kbuffer_init_view(). */
+
+/* The slices and the buffers read from the view refer to the bytes of the
+ * source instead of copying them.
+ */
+#define KBUFFER_VIEW_BORROW     (1 << 0)
+
+/* Shared block of a flat buffer. */
+struct kbuffer_store {
+
+    /* Number of buffers using the block. */
+    int ref_count;
+
+    /* The block. */
+    uint8_t *data;
+
+    /* Length of the mapping if the block is a file mapped by
+     * kbuffer_init_mmap(), 0 if the block was allocated.
+     */
+    size_t map_len;
+};
+
+/* Flags of kbuffer_init_mmap(). */
+
+/* Map the file in a private writable mapping. The bytes can be modified in
+ * place through 'data'; the modifications are not written to the file.
+ */
+#define KBUFFER_MMAP_WRITE      (1 << 0)
+
+/* Tell the system that the file will be read sequentially. */
+#define KBUFFER_MMAP_SEQUENTIAL (1 << 1)
+
+/* Tell the system to read the file ahead of the accesses. */
+#define KBUFFER_MMAP_WILLNEED   (1 << 2)
+
+/* Segment of a chained buffer. The data follows the header. */
+struct kbuffer_seg {
+
+    /* Next segment in the list. */
+    struct kbuffer_seg *next;
+
+    /* Pointer to the data of the segment. */
+    uint8_t *data;
+
+    /* Number of bytes used and allocated. */
+    size_t len;
+    size_t size;
+};
+
 typedef struct kbuffer {
     kserializable serializable;
     uint8_t *data;
@@ -26,6 +119,30 @@ typedef struct kbuffer {
 #ifndef NDEBUG
     size_t write_max_size;
 #endif
+
+    /* Size of the segments of a chained buffer, or 0 if the buffer is flat. */
+    size_t seg_size;
+
+    /* List of segments. Data is appended to the last segment. */
+    struct kbuffer_seg *first_seg;
+    struct kbuffer_seg *last_seg;
+
+    /* Segment receiving the data of kbuffer_end_write(). */
+    struct kbuffer_seg *write_seg;
+
+    /* Segment containing the read position, and the position of its first
+     * byte in the buffer. It is updated lazily after kbuffer_seek().
+     */
+    struct kbuffer_seg *read_seg;
+    size_t read_seg_pos;
+
+    /* Copies of the data read with kbuffer_read_nbytes() across segments.
+     * They are freed when the buffer is reset or compacted.
+     */
+    struct kbuffer_seg *scratch_list;
+
+    /* Shared block containing 'data', or NULL if the buffer owns 'data'. */
+    struct kbuffer_store *store;
 } kbuffer;
 
 /* After struct declaration for circular dependency. */
@@ -35,6 +152,11 @@ kbuffer *kbuffer_new();
 void kbuffer_destroy(kbuffer *self);
 
 void kbuffer_init(kbuffer *self);
+void kbuffer_init_chained(kbuffer *self, size_t seg_size);
+int kbuffer_init_slice(kbuffer *self, kbuffer *src, size_t offset, size_t len);
+int kbuffer_init_view(kbuffer *self, kbuffer *src, size_t len, int flags);
+int kbuffer_init_mmap(kbuffer *self, const char *path, int flags);
+kbuffer *kbuffer_slice(kbuffer *src, size_t offset, size_t len);
 int kbuffer_init_b64(kbuffer *self, kstr *b64);
 void kbuffer_clean(kbuffer *self);
 
@@ -47,9 +169,21 @@ void kbuffer_writefv(kbuffer *self, const char *format, va_list args);
 uint8_t *kbuffer_write_nbytes (kbuffer *self, size_t size);
 uint8_t *kbuffer_begin_write(kbuffer *self, size_t max_size);
 void kbuffer_end_write(kbuffer *self, size_t size_written);
+int kbuffer_begin_write_iovec(kbuffer *self, size_t max_size, struct iovec *iov);
+int kbuffer_to_iovec(kbuffer *self, struct iovec *iov, int max_count);
+void kbuffer_consume(kbuffer *self, size_t len);
+void kbuffer_truncate(kbuffer *self, size_t len);
+void kbuffer_compact(kbuffer *self);
+uint8_t *kbuffer_reserve_tail(kbuffer *self, size_t min_size, size_t *avail);
 int kbuffer_eof(kbuffer *self);
 
 void kbuffer_grow(kbuffer *self, size_t size);
+void kbuffer_reset_chained(kbuffer *self);
+
+/* This function returns true if the buffer is chained. */
+static inline int kbuffer_is_chained(kbuffer *self) {
+    return self->seg_size != 0;
+}
 
 static inline void kbuffer_seek(kbuffer *self, ssize_t offset, int whence) {
     switch (whence) {
@@ -121,6 +255,73 @@ static inline int kbuffer_read64(kbuffer *self, uint64_t *data) {
     return 0;
 }
 
+void kbuffer_write_array(kbuffer *self, const void *data, size_t count, size_t width);
+int kbuffer_read_array(kbuffer *self, void *data, size_t count, size_t width);
+
+/* Arrays of integers in network byte order. */
+static inline void kbuffer_write16_array(kbuffer *self, const uint16_t *data, size_t count) {
+    kbuffer_write_array(self, data, count, sizeof(uint16_t));
+}
+
+static inline void kbuffer_write32_array(kbuffer *self, const uint32_t *data, size_t count) {
+    kbuffer_write_array(self, data, count, sizeof(uint32_t));
+}
+
+static inline void kbuffer_write64_array(kbuffer *self, const uint64_t *data, size_t count) {
+    kbuffer_write_array(self, data, count, sizeof(uint64_t));
+}
+
+static inline int kbuffer_read16_array(kbuffer *self, uint16_t *data, size_t count) {
+    return kbuffer_read_array(self, data, count, sizeof(uint16_t));
+}
+
+static inline int kbuffer_read32_array(kbuffer *self, uint32_t *data, size_t count) {
+    return kbuffer_read_array(self, data, count, sizeof(uint32_t));
+}
+
+static inline int kbuffer_read64_array(kbuffer *self, uint64_t *data, size_t count) {
+    return kbuffer_read_array(self, data, count, sizeof(uint64_t));
+}
+
+int kbuffer_read_varint32(kbuffer *self, uint32_t *data);
+int kbuffer_read_varint64(kbuffer *self, uint64_t *data);
+int kbuffer_read_varint32_array(kbuffer *self, uint32_t *data, size_t count);
+int kbuffer_read_varint64_array(kbuffer *self, uint64_t *data, size_t count);
+void kbuffer_write_varint32_array(kbuffer *self, const uint32_t *data, size_t count);
+
+/* Variable-length integers, see kvarint.h. */
+static inline void kbuffer_write_varint32(kbuffer *self, uint32_t data) {
+    kbuffer_end_write(self, kvarint_encode32(kbuffer_begin_write(self, KVARINT_MAX32), data));
+}
+
+static inline void kbuffer_write_varint64(kbuffer *self, uint64_t data) {
+    kbuffer_end_write(self, kvarint_encode64(kbuffer_begin_write(self, KVARINT_MAX64), data));
+}
+
+static inline void kbuffer_write_zigzag32(kbuffer *self, int32_t data) {
+    kbuffer_write_varint32(self, kvarint_zigzag32(data));
+}
+
+static inline void kbuffer_write_zigzag64(kbuffer *self, int64_t data) {
+    kbuffer_write_varint64(self, kvarint_zigzag64(data));
+}
+
+static inline int kbuffer_read_zigzag32(kbuffer *self, int32_t *data) {
+    uint32_t v;
+    if (kbuffer_read_varint32(self, &v))
+        return -1;
+    *data = kvarint_unzigzag32(v);
+    return 0;
+}
+
+static inline int kbuffer_read_zigzag64(kbuffer *self, int64_t *data) {
+    uint64_t v;
+    if (kbuffer_read_varint64(self, &v))
+        return -1;
+    *data = kvarint_unzigzag64(v);
+    return 0;
+}
+
 static inline void kbuffer_serialize(kbuffer *self, kbuffer *out) {
     kbuffer_write32(out, self->len);
     kbuffer_write_buffer(out, self);
@@ -128,22 +329,24 @@ static inline void kbuffer_serialize(kbuffer *self, kbuffer *out) {
 
 static inline int kbuffer_read_serialized(kbuffer *self, kbuffer *into) {
     uint32_t size;
-    uint8_t *buf_ptr;
 
     if (kbuffer_read32(self, &size))
         return -1;
-    buf_ptr = kbuffer_write_nbytes(into, size);
-    if (kbuffer_read(self, buf_ptr, size))
-        return -1;
 
-    return 0;
+    return kbuffer_read_buffer(self, into, size);
 }
 
 static inline void kbuffer_reset(kbuffer *self) {
+    if (kbuffer_is_chained(self)) {
+        kbuffer_reset_chained(self);
+        return;
+    }
+
     self->len = 0;
     self->pos = 0;
 }
 
+/* The two functions below require a flat buffer. */
 static inline uint8_t *kbuffer_current_write_pos(kbuffer *self) {
     return self->data + self->len;
 }
@@ -159,9 +362,14 @@ static inline uint8_t *kbuffer_current_pos(kbuffer *self) {
 /* This function ensures that the memory pool allocated to the buffer does not
  * get bigger than 'max_size'. When the memory pool is too large, the memory
  * pool is shrunk to 'max_size'. In all cases, both 'pos' and 'len' are set to
- * 0.
+ * 0. A chained buffer keeps a single segment.
  */
 static inline void kbuffer_shrink(kbuffer *self, uint32_t max_size) {   
+    if (kbuffer_is_chained(self)) {
+        kbuffer_reset_chained(self);
+        return;
+    }
+
     if (self->allocated > max_size) {
     	kbuffer_clean(self);
 	kbuffer_init(self);
@@ -0,0 +1,46 @@
+/**
+ * src/kcpu.c
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ *
+ * Run-time processor feature detection.
+ */
+
+#include "kcpu.h"
+
+int kcpu_level = -1;
+
+/* Level supported by the processor, or -1 if not probed yet. */
+static int kcpu_detected_level = -1;
+
+/* This function probes the processor and sets the current level to the best
+ * level supported. It is called by ktools_initialize() and by the first call
+ * to kcpu_get_level().
+ */
+void kcpu_detect() {
+    int level = KCPU_LEVEL_SCALAR;
+    
+#ifdef KCPU_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) level = KCPU_LEVEL_SSE2;
+    if (__builtin_cpu_supports("ssse3")) level = KCPU_LEVEL_SSSE3;
+    if (__builtin_cpu_supports("avx2")) level = KCPU_LEVEL_AVX2;
+#endif
+    
+    kcpu_detected_level = level;
+    kcpu_level = level;
+}
+
+/* This function returns the best level supported by the processor. */
+int kcpu_get_detected_level() {
+    if (kcpu_detected_level < 0) kcpu_detect();
+    return kcpu_detected_level;
+}
+
+/* This function sets the level in use, e.g. to test or benchmark the
+ * implementations of a lower level. The level is capped to the level
+ * supported by the processor.
+ */
+void kcpu_set_level(int level) {
+    int detected = kcpu_get_detected_level();
+    kcpu_level = (level < detected) ? level : detected;
+}
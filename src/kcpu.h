@@ -0,0 +1,41 @@
+/**
+ * src/kcpu.h
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ */
+
+#ifndef __KCPU_H__
+#define __KCPU_H__
+
+/* The kcpu module detects the vector instructions supported by the processor
+ * at run time, so that the library can use them without requiring them at
+ * compile time. The functions having vector implementations (e.g.
+ * kutil_ascii_tolower()) check the current level and use the best
+ * implementation available.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KCPU_X86
+#endif
+
+/* Levels of vector support. Each level implies the previous ones. */
+#define KCPU_LEVEL_SCALAR   0
+#define KCPU_LEVEL_SSE2     1
+#define KCPU_LEVEL_SSSE3    2
+#define KCPU_LEVEL_AVX2     3
+
+/* Current level, or -1 if the processor has not been probed yet. Use
+ * kcpu_get_level().
+ */
+extern int kcpu_level;
+
+void kcpu_detect();
+int kcpu_get_detected_level();
+void kcpu_set_level(int level);
+
+/* This function returns the level of vector support in use. */
+static inline int kcpu_get_level() {
+    if (kcpu_level < 0) kcpu_detect();
+    return kcpu_level;
+}
+
+#endif
@@ -86,6 +86,12 @@ char * kerror_sys_buf(int error, char buf[1000]);
 /* This function calls kerror_sys with errno as its parameter. */
 static inline char * kerror_syserror() { return kerror_sys(errno); }
 
+/* Let the compiler check the format of the error messages. */
+#ifdef __GNUC__
+static inline struct kerror_node *kerror_node_new(const char *file, int line, const char *function, int module, int level, 
+    	    	    	    	    	    	  const char *format, ...) __attribute__((format(printf, 6, 7)));
+#endif
+
 static inline struct kerror_node *kerror_node_new(const char *file, int line, const char *function, int module, int level, 
     	    	    	    	    	    	  const char *format, ...) {
     struct kerror_node *node;
@@ -0,0 +1,548 @@
+/**
+ * src/kfmt.c
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ *
+ * printf() formatting engine.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <wchar.h>
+#include "kfmt.h"
+#include "kmem.h"
+#include "kutils.h"
+
+/* Flags of a conversion specification. */
+#define KFMT_MINUS  (1<<0)
+#define KFMT_ZERO   (1<<1)
+#define KFMT_PLUS   (1<<2)
+#define KFMT_SPACE  (1<<3)
+#define KFMT_HASH   (1<<4)
+#define KFMT_QUOTE  (1<<5)
+
+/* Length modifiers. */
+enum kfmt_length {
+    KFMT_LEN_NONE,
+    KFMT_LEN_HH,
+    KFMT_LEN_H,
+    KFMT_LEN_L,
+    KFMT_LEN_LL,
+    KFMT_LEN_J,
+    KFMT_LEN_Z,
+    KFMT_LEN_T,
+    KFMT_LEN_BIG_L
+};
+
+/* Conversion specification. */
+struct kfmt_spec {
+    int flags;
+    
+    /* Width and precision, or -1 if not specified. */
+    int width;
+    int precision;
+    
+    enum kfmt_length length;
+    char conv;
+};
+
+/* Pairs of decimal digits from "00" to "99". */
+static const char kfmt_dec_table[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char kfmt_hex_lower[] = "0123456789abcdef";
+static const char kfmt_hex_upper[] = "0123456789ABCDEF";
+
+/* This function writes the decimal representation of 'value' in 'buf', which
+ * must have room for 20 characters. No '0' is appended. The number of
+ * characters written is returned.
+ */
+int kfmt_u64_dec(char *buf, uint64_t value) {
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    int len;
+    
+    /* Convert two digits at a time, from the right. */
+    while (value >= 100) {
+        int pair = (int) (value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        p[0] = kfmt_dec_table[pair];
+        p[1] = kfmt_dec_table[pair + 1];
+    }
+    
+    if (value >= 10) {
+        p -= 2;
+        p[0] = kfmt_dec_table[value * 2];
+        p[1] = kfmt_dec_table[value * 2 + 1];
+    }
+    
+    else {
+        *--p = '0' + (char) value;
+    }
+    
+    len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+/* This function writes the hexadecimal representation of 'value' in 'buf',
+ * which must have room for 16 characters. No '0' is appended. The number of
+ * characters written is returned.
+ */
+int kfmt_u64_hex(char *buf, uint64_t value, int upper_flag) {
+    const char *digits = upper_flag ? kfmt_hex_upper : kfmt_hex_lower;
+    char tmp[16];
+    char *p = tmp + sizeof(tmp);
+    int len;
+    
+    do {
+        *--p = digits[value & 0xf];
+        value >>= 4;
+    } while (value);
+    
+    len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+/* This function writes a buffer to the destination. */
+static inline void kfmt_write(kfmt_write_func write_func, void *dst, const char *buf, size_t len) {
+    if (len) memcpy(write_func(dst, len), buf, len);
+}
+
+/* This function writes 'nb' times the character 'c' to the destination. */
+static inline void kfmt_pad(kfmt_write_func write_func, void *dst, char c, int nb) {
+    if (nb > 0) memset(write_func(dst, nb), c, nb);
+}
+
+/* This function writes a field made of a prefix (e.g. a sign) and a body,
+ * padded to the width of the specification.
+ */
+static size_t kfmt_write_field(kfmt_write_func write_func, void *dst, struct kfmt_spec *spec,
+                               const char *prefix, int prefix_len, const char *body, size_t body_len) {
+    size_t len = prefix_len + body_len;
+    int pad = (spec->width > 0 && (size_t) spec->width > len) ? spec->width - (int) len : 0;
+    
+    if (spec->flags & KFMT_MINUS) {
+        kfmt_write(write_func, dst, prefix, prefix_len);
+        kfmt_write(write_func, dst, body, body_len);
+        kfmt_pad(write_func, dst, ' ', pad);
+    }
+    
+    else if (spec->flags & KFMT_ZERO) {
+        kfmt_write(write_func, dst, prefix, prefix_len);
+        kfmt_pad(write_func, dst, '0', pad);
+        kfmt_write(write_func, dst, body, body_len);
+    }
+    
+    else {
+        kfmt_pad(write_func, dst, ' ', pad);
+        kfmt_write(write_func, dst, prefix, prefix_len);
+        kfmt_write(write_func, dst, body, body_len);
+    }
+    
+    return len + pad;
+}
+
+/* This function formats a single conversion with snprintf() and writes the
+ * result to the destination. The format contains exactly one conversion.
+ */
+static size_t kfmt_write_libc(kfmt_write_func write_func, void *dst, const char *format, ...) {
+    char buf[128];
+    va_list arg, arg2;
+    int len;
+    
+    va_start(arg, format);
+    va_copy(arg2, arg);
+    len = vsnprintf(buf, sizeof(buf), format, arg);
+    va_end(arg);
+    
+    if (len < 0) {
+        len = 0;
+    }
+    
+    else if ((size_t) len < sizeof(buf)) {
+        kfmt_write(write_func, dst, buf, len);
+    }
+    
+    /* The output is large. Format it again in a temporary buffer. */
+    else {
+        char *tmp = (char *) kmalloc(len + 1);
+        vsnprintf(tmp, len + 1, format, arg2);
+        kfmt_write(write_func, dst, tmp, len);
+        kfree(tmp);
+    }
+    
+    va_end(arg2);
+    return len;
+}
+
+/* This function rebuilds the specification for snprintf(). The width and the
+ * precision are expanded and the length modifier is replaced by 'length'.
+ */
+static void kfmt_spec_str(char *buf, struct kfmt_spec *spec, const char *length) {
+    char *p = buf;
+    
+    *p++ = '%';
+    if (spec->flags & KFMT_MINUS) *p++ = '-';
+    if (spec->flags & KFMT_ZERO) *p++ = '0';
+    if (spec->flags & KFMT_PLUS) *p++ = '+';
+    if (spec->flags & KFMT_SPACE) *p++ = ' ';
+    if (spec->flags & KFMT_HASH) *p++ = '#';
+    if (spec->flags & KFMT_QUOTE) *p++ = '\'';
+    if (spec->width >= 0) p += kfmt_u64_dec(p, spec->width);
+    
+    if (spec->precision >= 0) {
+        *p++ = '.';
+        p += kfmt_u64_dec(p, spec->precision);
+    }
+    
+    while (*length) *p++ = *length++;
+    *p++ = spec->conv;
+    *p = 0;
+}
+
+/* This function fetches a signed integer argument. */
+static intmax_t kfmt_get_signed(va_list *arg, enum kfmt_length length) {
+    switch (length) {
+        case KFMT_LEN_HH: return (signed char) va_arg(*arg, int);
+        case KFMT_LEN_H: return (short) va_arg(*arg, int);
+        case KFMT_LEN_L: return va_arg(*arg, long);
+        case KFMT_LEN_LL: return va_arg(*arg, long long);
+        case KFMT_LEN_J: return va_arg(*arg, intmax_t);
+        case KFMT_LEN_Z: return va_arg(*arg, ssize_t);
+        case KFMT_LEN_T: return va_arg(*arg, ptrdiff_t);
+        default: return va_arg(*arg, int);
+    }
+}
+
+/* This function fetches an unsigned integer argument. */
+static uintmax_t kfmt_get_unsigned(va_list *arg, enum kfmt_length length) {
+    switch (length) {
+        case KFMT_LEN_HH: return (unsigned char) va_arg(*arg, unsigned int);
+        case KFMT_LEN_H: return (unsigned short) va_arg(*arg, unsigned int);
+        case KFMT_LEN_L: return va_arg(*arg, unsigned long);
+        case KFMT_LEN_LL: return va_arg(*arg, unsigned long long);
+        case KFMT_LEN_J: return va_arg(*arg, uintmax_t);
+        case KFMT_LEN_Z: return va_arg(*arg, size_t);
+        case KFMT_LEN_T: return (uintmax_t) va_arg(*arg, ptrdiff_t);
+        default: return va_arg(*arg, unsigned int);
+    }
+}
+
+/* This function parses a conversion specification. 'p' points after the '%'.
+ * It returns a pointer after the specification.
+ */
+static const char * kfmt_parse_spec(const char *p, struct kfmt_spec *spec, va_list *arg) {
+    spec->flags = 0;
+    spec->width = -1;
+    spec->precision = -1;
+    spec->length = KFMT_LEN_NONE;
+    
+    /* Flags. */
+    while (1) {
+        if (*p == '-') spec->flags |= KFMT_MINUS;
+        else if (*p == '0') spec->flags |= KFMT_ZERO;
+        else if (*p == '+') spec->flags |= KFMT_PLUS;
+        else if (*p == ' ') spec->flags |= KFMT_SPACE;
+        else if (*p == '#') spec->flags |= KFMT_HASH;
+        else if (*p == '\'') spec->flags |= KFMT_QUOTE;
+        else break;
+        p++;
+    }
+    
+    /* Width. A negative width means left adjustment. */
+    if (*p == '*') {
+        spec->width = va_arg(*arg, int);
+        
+        if (spec->width < 0) {
+            spec->flags |= KFMT_MINUS;
+            spec->width = -spec->width;
+        }
+        
+        p++;
+    }
+    
+    else if (is_digit(*p)) {
+        spec->width = 0;
+        while (is_digit(*p)) spec->width = spec->width * 10 + (*p++ - '0');
+    }
+    
+    /* Precision. A negative precision is ignored. */
+    if (*p == '.') {
+        p++;
+        
+        if (*p == '*') {
+            spec->precision = va_arg(*arg, int);
+            if (spec->precision < 0) spec->precision = -1;
+            p++;
+        }
+        
+        else {
+            spec->precision = 0;
+            while (is_digit(*p)) spec->precision = spec->precision * 10 + (*p++ - '0');
+        }
+    }
+    
+    /* '-' overrides '0'. */
+    if (spec->flags & KFMT_MINUS) spec->flags &= ~KFMT_ZERO;
+    
+    /* Length modifier. */
+    switch (*p) {
+        case 'h':
+            if (p[1] == 'h') { spec->length = KFMT_LEN_HH; p += 2; }
+            else { spec->length = KFMT_LEN_H; p++; }
+            break;
+        case 'l':
+            if (p[1] == 'l') { spec->length = KFMT_LEN_LL; p += 2; }
+            else { spec->length = KFMT_LEN_L; p++; }
+            break;
+        case 'q': spec->length = KFMT_LEN_LL; p++; break;
+        case 'j': spec->length = KFMT_LEN_J; p++; break;
+        case 'z': spec->length = KFMT_LEN_Z; p++; break;
+        case 't': spec->length = KFMT_LEN_T; p++; break;
+        case 'L': spec->length = KFMT_LEN_BIG_L; p++; break;
+        
+        /* Windows modifiers. */
+        case 'I':
+            if (p[1] == '6' && p[2] == '4') { spec->length = KFMT_LEN_LL; p += 3; }
+            else if (p[1] == '3' && p[2] == '2') { p += 3; }
+            else { spec->length = KFMT_LEN_Z; p++; }
+            break;
+    }
+    
+    spec->conv = *p;
+    if (*p) p++;
+    return p;
+}
+
+/* This function formats a conversion natively. It returns the number of bytes
+ * written, or -1 if the conversion must be delegated to snprintf().
+ */
+static ssize_t kfmt_native(kfmt_write_func write_func, void *dst, struct kfmt_spec *spec, va_list *arg) {
+    char buf[24];
+    char sign = '-';
+    int len;
+    
+    /* Keep the exotic flags for the C library. */
+    if (spec->flags & (KFMT_PLUS | KFMT_SPACE | KFMT_HASH | KFMT_QUOTE)) return -1;
+    
+    switch (spec->conv) {
+        case 'd':
+        case 'i': {
+            intmax_t value;
+            if (spec->precision >= 0) return -1;
+            value = kfmt_get_signed(arg, spec->length);
+            
+            if (value < 0) {
+                len = kfmt_u64_dec(buf, - (uintmax_t) value);
+                return kfmt_write_field(write_func, dst, spec, &sign, 1, buf, len);
+            }
+            
+            len = kfmt_u64_dec(buf, value);
+            return kfmt_write_field(write_func, dst, spec, NULL, 0, buf, len);
+        }
+        
+        case 'u':
+        case 'x':
+        case 'X': {
+            uintmax_t value;
+            if (spec->precision >= 0) return -1;
+            value = kfmt_get_unsigned(arg, spec->length);
+            if (spec->conv == 'u') len = kfmt_u64_dec(buf, value);
+            else len = kfmt_u64_hex(buf, value, spec->conv == 'X');
+            return kfmt_write_field(write_func, dst, spec, NULL, 0, buf, len);
+        }
+        
+        case 'c': {
+            if (spec->length != KFMT_LEN_NONE || (spec->flags & KFMT_ZERO)) return -1;
+            buf[0] = (char) va_arg(*arg, int);
+            return kfmt_write_field(write_func, dst, spec, NULL, 0, buf, 1);
+        }
+        
+        case 's': {
+            const char *str;
+            size_t str_len;
+            va_list peek;
+            
+            /* Let the C library print NULL strings its own way. */
+            if (spec->length != KFMT_LEN_NONE || (spec->flags & KFMT_ZERO)) return -1;
+            va_copy(peek, *arg);
+            str = va_arg(peek, const char *);
+            va_end(peek);
+            if (str == NULL) return -1;
+            
+            (void) va_arg(*arg, const char *);
+            
+            if (spec->precision >= 0) {
+                const char *end = (const char *) memchr(str, 0, spec->precision);
+                str_len = end ? (size_t) (end - str) : (size_t) spec->precision;
+            }
+            
+            else {
+                str_len = strlen(str);
+            }
+            
+            return kfmt_write_field(write_func, dst, spec, NULL, 0, str, str_len);
+        }
+        
+#ifndef __WINDOWS__
+        case 'p': {
+            void *ptr;
+            va_list peek;
+            
+            if (spec->precision >= 0 || (spec->flags & KFMT_ZERO)) return -1;
+            va_copy(peek, *arg);
+            ptr = va_arg(peek, void *);
+            va_end(peek);
+            if (ptr == NULL) return -1;
+            
+            (void) va_arg(*arg, void *);
+            len = kfmt_u64_hex(buf, (uintptr_t) ptr, 0);
+            return kfmt_write_field(write_func, dst, spec, "0x", 2, buf, len);
+        }
+#endif
+        
+        case '%':
+            kfmt_write(write_func, dst, "%", 1);
+            return 1;
+    }
+    
+    return -1;
+}
+
+/* This function formats a conversion with snprintf(). */
+static size_t kfmt_libc(kfmt_write_func write_func, void *dst, struct kfmt_spec *spec, va_list *arg) {
+    char format[64];
+    
+    switch (spec->conv) {
+        case 'd':
+        case 'i':
+            kfmt_spec_str(format, spec, "j");
+            return kfmt_write_libc(write_func, dst, format, kfmt_get_signed(arg, spec->length));
+        
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            kfmt_spec_str(format, spec, "j");
+            return kfmt_write_libc(write_func, dst, format, kfmt_get_unsigned(arg, spec->length));
+        
+        case 'c':
+            if (spec->length == KFMT_LEN_L) {
+                kfmt_spec_str(format, spec, "l");
+                return kfmt_write_libc(write_func, dst, format, va_arg(*arg, wint_t));
+            }
+            
+            kfmt_spec_str(format, spec, "");
+            return kfmt_write_libc(write_func, dst, format, va_arg(*arg, int));
+        
+        case 's':
+            if (spec->length == KFMT_LEN_L) {
+                kfmt_spec_str(format, spec, "l");
+                return kfmt_write_libc(write_func, dst, format, va_arg(*arg, wchar_t *));
+            }
+            
+            kfmt_spec_str(format, spec, "");
+            return kfmt_write_libc(write_func, dst, format, va_arg(*arg, char *));
+        
+        case 'C':
+            kfmt_spec_str(format, spec, "");
+            return kfmt_write_libc(write_func, dst, format, va_arg(*arg, wint_t));
+        
+        case 'S':
+            kfmt_spec_str(format, spec, "");
+            return kfmt_write_libc(write_func, dst, format, va_arg(*arg, wchar_t *));
+        
+        case 'p':
+            kfmt_spec_str(format, spec, "");
+            return kfmt_write_libc(write_func, dst, format, va_arg(*arg, void *));
+        
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (spec->length == KFMT_LEN_BIG_L) {
+                kfmt_spec_str(format, spec, "L");
+                return kfmt_write_libc(write_func, dst, format, va_arg(*arg, long double));
+            }
+            
+            kfmt_spec_str(format, spec, "");
+            return kfmt_write_libc(write_func, dst, format, va_arg(*arg, double));
+        
+        /* Conversions without argument, e.g. %m. */
+        default:
+            kfmt_spec_str(format, spec, "");
+            return kfmt_write_libc(write_func, dst, format);
+    }
+}
+
+/* This function formats the arguments specified in the manner of vsprintf().
+ * The output is written with 'write_func' to 'dst'; no '0' is appended. The
+ * number of bytes written is returned.
+ */
+size_t kfmt_vformat(kfmt_write_func write_func, void *dst, const char *format, va_list arg) {
+    const char *p = format;
+    size_t total = 0;
+    va_list ap;
+    
+    va_copy(ap, arg);
+    
+    while (1) {
+        struct kfmt_spec spec;
+        const char *next = strchr(p, '%');
+        ssize_t len;
+        
+        /* Copy the literal text. */
+        if (next == NULL) {
+            len = strlen(p);
+            kfmt_write(write_func, dst, p, len);
+            total += len;
+            break;
+        }
+        
+        kfmt_write(write_func, dst, p, next - p);
+        total += next - p;
+        p = kfmt_parse_spec(next + 1, &spec, &ap);
+        
+        /* Incomplete specification at the end of the format. */
+        if (spec.conv == 0) break;
+        
+        /* Store the number of bytes written so far. */
+        if (spec.conv == 'n') {
+            switch (spec.length) {
+                case KFMT_LEN_HH: *va_arg(ap, signed char *) = total; break;
+                case KFMT_LEN_H: *va_arg(ap, short *) = total; break;
+                case KFMT_LEN_L: *va_arg(ap, long *) = total; break;
+                case KFMT_LEN_LL: *va_arg(ap, long long *) = total; break;
+                case KFMT_LEN_J: *va_arg(ap, intmax_t *) = total; break;
+                case KFMT_LEN_Z: *va_arg(ap, ssize_t *) = total; break;
+                case KFMT_LEN_T: *va_arg(ap, ptrdiff_t *) = total; break;
+                default: *va_arg(ap, int *) = total; break;
+            }
+            
+            continue;
+        }
+        
+        len = kfmt_native(write_func, dst, &spec, &ap);
+        if (len == -1) len = kfmt_libc(write_func, dst, &spec, &ap);
+        total += len;
+    }
+    
+    va_end(ap);
+    return total;
+}
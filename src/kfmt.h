@@ -0,0 +1,34 @@
+/**
+ * src/kfmt.h
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ */
+
+#ifndef __KFMT_H__
+#define __KFMT_H__
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* The kfmt module implements printf() formatting for kstr_append_sfv(),
+ * kbuffer_writefv() and kstrbuf_append_sfv().
+ *
+ * The output is written in a single pass directly into the destination. The
+ * common conversions (%d %i %u %x %X %c %s %p %%, with the '-' and '0' flags, a
+ * width, a precision for %s and any length modifier, including 'I64') are
+ * handled natively. The other conversions (floats, %o, the '+', ' ', '#' and
+ * '\'' flags, etc.) are delegated to snprintf(), one conversion at a time, so
+ * that the output is the same as the C library's.
+ */
+
+/* Function used to write to the destination. It appends 'len' bytes at the end
+ * of the destination 'dst' and returns a pointer to them. The formatter
+ * fills the bytes.
+ */
+typedef char * (*kfmt_write_func) (void *dst, size_t len);
+
+size_t kfmt_vformat(kfmt_write_func write_func, void *dst, const char *format, va_list arg);
+int kfmt_u64_dec(char *buf, uint64_t value);
+int kfmt_u64_hex(char *buf, uint64_t value, int upper_flag);
+
+#endif
@@ -121,8 +121,9 @@ int kfs_fwrite(FILE *file, void *buf, size_t size) {
     return 0;
 }
 
-/* Read the content of the file specified in the buffer specified. The maximum
- * file size is 1GB.
+/* Read the content of the file specified in the buffer specified. The buffer
+ * holds a copy of the file, which may then be modified or written back to the
+ * same path. Use kbuffer_init_mmap() to map a file instead.
  */
 int kfs_read_file(char *path, kbuffer *buf) {
     int error = 0;
@@ -137,13 +138,25 @@ int kfs_read_file(char *path, kbuffer *buf) {
             break;
         }
         
-        if (size > 1024*1024*1024) {
+        if (size > SIZE_MAX) {
             KTOOLS_ERROR_SET("file too large");
             error = -1;
             break;
         }
         
-        if (kfs_fread(file, kbuffer_write_nbytes(buf, size), size) || kfs_fclose(&file, 0)) {
+        /* Read a chained buffer one segment at a time. */
+        while (size) {
+            size_t n = kbuffer_is_chained(buf) ? MIN(size, buf->seg_size) : size;
+            
+            if (kfs_fread(file, kbuffer_write_nbytes(buf, n), n)) {
+                error = -1;
+                break;
+            }
+            
+            size -= n;
+        }
+        
+        if (error || kfs_fclose(&file, 0)) {
             error = -1;
             break;
         }
@@ -158,10 +171,19 @@ int kfs_read_file(char *path, kbuffer *buf) {
 int kfs_write_file(char *path, kbuffer *buf) {
     int error = 0;
     FILE *file = NULL;
+    struct kbuffer_seg *seg;
     
-    if (kfs_fopen(&file, path, "wb") ||
-        kfs_fwrite(file, buf->data, buf->len) ||
-        kfs_fclose(&file, 0)) {
+    if (kfs_fopen(&file, path, "wb")) return -1;
+
+    if (! kbuffer_is_chained(buf)) {
+        error = kfs_fwrite(file, buf->data, buf->len);
+    }
+
+    for (seg = buf->first_seg; seg && ! error; seg = seg->next) {
+        error = kfs_fwrite(file, seg->data, seg->len);
+    }
+
+    if (error || kfs_fclose(&file, 0)) {
         error = -1;
     }
     
@@ -478,6 +478,29 @@ int khash_kstr_cmp(void *key_1, void *key_2) {
     return (str_1->slen == str_2->slen && ! memcmp(str_1->data, str_2->data, str_1->slen));
 }
 
+/* This function returns the hash of the bytes specified (32 bits FNV-1a). */
+unsigned int khash_buf_hash(const void *buf, size_t len) {
+    const unsigned char *p = (const unsigned char *) buf;
+    uint32_t hash = 2166136261u;
+    size_t i;
+    
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    
+    return hash;
+}
+
+unsigned int khash_view_key(void *key) {
+    kstr_view *view = (kstr_view *) key;
+    return khash_buf_hash(view->p, view->n);
+}
+
+int khash_view_cmp(void *key_1, void *key_2) {
+    return kstr_view_equal(*(kstr_view *) key_1, *(kstr_view *) key_2);
+}
+
 unsigned int khash_int_key(void *key) {
     unsigned int *i = (unsigned *) key;
 
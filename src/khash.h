@@ -6,6 +6,7 @@
 #ifndef __K_HASH_H__
 #define __K_HASH_H__
 
+#include <sys/types.h>
 #include <kiter.h>
 
 /* A cell in the hash table: a key and its associated value. */
@@ -83,13 +84,20 @@ static inline int khash_exist(khash *self, void *key) {
     return (khash_locate_key(self, key) != -1);
 }
 
-/* Some hash functions frequently used. */
+/* This function returns a hash of the bytes specified. */
+unsigned int khash_buf_hash(const void *buf, size_t len);
+
+/* Some hash functions frequently used. The view functions take pointers to
+ * kstr_view structures as keys.
+ */
 unsigned int khash_pointer_key(void *key);
 int khash_pointer_cmp(void *key_1, void *key_2);
 unsigned int khash_cstr_key(void *key);
 int khash_cstr_cmp(void *key_1, void *key_2);
 unsigned int khash_kstr_key(void *key);
 int khash_kstr_cmp(void *key_1, void *key_2);
+unsigned int khash_view_key(void *key);
+int khash_view_cmp(void *key_1, void *key_2);
 unsigned int khash_int_key(void *key);
 int khash_int_cmp(void *key_1, void *key_2);
 
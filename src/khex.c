@@ -0,0 +1,279 @@
+/**
+ * src/khex.c
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ *
+ * Hexadecimal encoding.
+ */
+
+#include "khex.h"
+#include "kerror.h"
+#include "kpool.h"
+#include "kcpu.h"
+
+#ifdef KCPU_X86
+#include <immintrin.h>
+#define KHEX_SSSE3 __attribute__((target("ssse3")))
+#define KHEX_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* Number of characters decoded at a time from a chained buffer. */
+#define KHEX_CHUNK 4096
+
+static const char khex_digits[] = "0123456789abcdef";
+
+#define INV (-1)
+
+/* This table converts a hexadecimal digit to its value, or INV. */
+static const signed char khex_tbl[256] = {
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+      0,  1,  2,  3,      4,  5,  6,  7,
+      8,  9,INV,INV,    INV,INV,INV,INV,
+    INV, 10, 11, 12,     13, 14, 15,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV, 10, 11, 12,     13, 14, 15,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+    INV,INV,INV,INV,    INV,INV,INV,INV,
+};
+
+static void khex_encode_scalar(char *dst, const uint8_t *src, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[2 * i] = khex_digits[src[i] >> 4];
+        dst[2 * i + 1] = khex_digits[src[i] & 0xf];
+    }
+}
+
+/* This function decodes the 'n' pairs of digits of 'src' and returns the
+ * number of pairs decoded before an invalid digit.
+ */
+static size_t khex_decode_scalar(uint8_t *dst, const char *src, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        int hi = khex_tbl[(uint8_t) src[2 * i]], lo = khex_tbl[(uint8_t) src[2 * i + 1]];
+        if ((hi | lo) < 0) break;
+        dst[i] = hi << 4 | lo;
+    }
+
+    return i;
+}
+
+#ifdef KCPU_X86
+KHEX_SSSE3 static size_t khex_encode_ssse3(char *dst, const uint8_t *src, size_t n) {
+    __m128i digits = _mm_loadu_si128((const __m128i *) khex_digits);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, mask));
+        _mm_storeu_si128((__m128i *) (dst + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *) (dst + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+
+    return i;
+}
+
+KHEX_AVX2 static size_t khex_encode_avx2(char *dst, const uint8_t *src, size_t n) {
+    __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) khex_digits));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+        __m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(v, mask));
+        __m256i a = _mm256_unpacklo_epi8(hi, lo), b = _mm256_unpackhi_epi8(hi, lo);
+
+        /* The unpacking works within the lanes. */
+        _mm256_storeu_si256((__m256i *) (dst + 2 * i), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *) (dst + 2 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+
+    return i + khex_encode_ssse3(dst + 2 * i, src + i, n - i);
+}
+
+/* This function returns the values of 16 digits. 'invalid' is set if a
+ * character is not a digit.
+ */
+KHEX_SSSE3 static inline __m128i khex_values_ssse3(__m128i v, int *invalid) {
+    __m128i low = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(low, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(low, _mm_set1_epi8('f' + 1)));
+    *invalid |= _mm_movemask_epi8(_mm_or_si128(digit, letter)) != 0xffff;
+    return _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+                        _mm_and_si128(letter, _mm_sub_epi8(low, _mm_set1_epi8('a' - 10))));
+}
+
+KHEX_SSSE3 static size_t khex_decode_ssse3(uint8_t *dst, const char *src, size_t n) {
+    __m128i weights = _mm_set1_epi16(0x0110);
+    size_t i = 0;
+
+    /* 32 digits, packed by pairs: the first digit of a pair is multiplied by
+     * 16, the second by 1.
+     */
+    for (; i + 16 <= n; i += 16) {
+        int invalid = 0;
+        __m128i a = khex_values_ssse3(_mm_loadu_si128((const __m128i *) (src + 2 * i)), &invalid);
+        __m128i b = khex_values_ssse3(_mm_loadu_si128((const __m128i *) (src + 2 * i + 16)), &invalid);
+        if (invalid) break;
+        a = _mm_maddubs_epi16(a, weights);
+        b = _mm_maddubs_epi16(b, weights);
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(a, b));
+    }
+
+    return i;
+}
+
+KHEX_AVX2 static inline __m256i khex_values_avx2(__m256i v, int *invalid) {
+    __m256i low = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+    __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(low, _mm256_set1_epi8('a' - 1)),
+                                      _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), low));
+    *invalid |= (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(digit, letter)) != 0xffffffff;
+    return _mm256_or_si256(_mm256_and_si256(digit, _mm256_sub_epi8(v, _mm256_set1_epi8('0'))),
+                           _mm256_and_si256(letter, _mm256_sub_epi8(low, _mm256_set1_epi8('a' - 10))));
+}
+
+KHEX_AVX2 static size_t khex_decode_avx2(uint8_t *dst, const char *src, size_t n) {
+    __m256i weights = _mm256_set1_epi16(0x0110);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        int invalid = 0;
+        __m256i a = khex_values_avx2(_mm256_loadu_si256((const __m256i *) (src + 2 * i)), &invalid);
+        __m256i b = khex_values_avx2(_mm256_loadu_si256((const __m256i *) (src + 2 * i + 32)), &invalid);
+        if (invalid) break;
+        a = _mm256_maddubs_epi16(a, weights);
+        b = _mm256_maddubs_epi16(b, weights);
+
+        /* The packing works within the lanes. */
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8));
+    }
+
+    return i + khex_decode_ssse3(dst + i, src + 2 * i, n - i);
+}
+#endif
+
+/* This function dispatches the decoding of 'n' pairs of digits. */
+static size_t khex_decode_run(uint8_t *dst, const char *src, size_t n) {
+    size_t i = 0;
+
+#ifdef KCPU_X86
+    int level = kcpu_get_level();
+    if (level >= KCPU_LEVEL_AVX2) i = khex_decode_avx2(dst, src, n);
+    else if (level >= KCPU_LEVEL_SSSE3) i = khex_decode_ssse3(dst, src, n);
+#endif
+
+    return i + khex_decode_scalar(dst + i, src + 2 * i, n - i);
+}
+
+/* This function writes the 2 * 'n' digits of the 'n' bytes of 'src' in 'dst'. */
+void khex_encode(char *dst, const uint8_t *src, size_t n) {
+    size_t i = 0;
+
+#ifdef KCPU_X86
+    int level = kcpu_get_level();
+    if (level >= KCPU_LEVEL_AVX2) i = khex_encode_avx2(dst, src, n);
+    else if (level >= KCPU_LEVEL_SSSE3) i = khex_encode_ssse3(dst, src, n);
+#endif
+
+    khex_encode_scalar(dst + 2 * i, src + i, n - i);
+}
+
+/* This function decodes the 'n' digits of 'src' in 'dst'. It returns the
+ * number of bytes written, or -1 if 'n' is odd or a character is not a digit.
+ */
+ssize_t khex_decode(uint8_t *dst, const char *src, size_t n) {
+    if (n & 1) return -1;
+    return (khex_decode_run(dst, src, n / 2) == n / 2) ? (ssize_t) n / 2 : -1;
+}
+
+/* This function converts a binary buffer to a hexadecimal buffer. The digits
+ * are written directly in the space reserved in the hexadecimal buffer.
+ */
+void kbin2hex(kbuffer *bin, kbuffer *hex) {
+    uint8_t *out;
+
+    /* Work on a flat copy of a chained buffer. */
+    if (kbuffer_is_chained(bin)) {
+        kbuffer *flat = kbuffer_acquire(bin->len);
+        kbuffer_write_buffer(flat, bin);
+        kbin2hex(flat, hex);
+        kbuffer_release(flat);
+        return;
+    }
+
+    out = kbuffer_begin_write(hex, bin->len * 2);
+    khex_encode((char *) out, bin->data, bin->len);
+    kbuffer_end_write(hex, bin->len * 2);
+}
+
+/* This function converts the characters of a hexadecimal buffer, from its
+ * position to its end, to a binary buffer. This function sets the error
+ * string. It returns -1 if the number of characters is odd or a character is
+ * not a digit.
+ */
+int khex2bin(kbuffer *hex, kbuffer *bin) {
+    size_t n = hex->len - hex->pos;
+
+    if (n & 1) {
+        KTOOLS_ERROR_SET("odd number of hexadecimal digits");
+        return -1;
+    }
+
+    while (n) {
+        char chunk[KHEX_CHUNK];
+        const char *src;
+        size_t len = n;
+
+        /* The digits of a chained buffer are copied by chunks. */
+        if (kbuffer_is_chained(hex)) {
+            len = MIN(n, (size_t) KHEX_CHUNK);
+            kbuffer_read(hex, (uint8_t *) chunk, len);
+            src = chunk;
+        }
+
+        else {
+            src = (char *) hex->data + hex->pos;
+            hex->pos += len;
+        }
+
+        if (khex_decode(kbuffer_begin_write(bin, len / 2), src, len) < 0) {
+            KTOOLS_ERROR_SET("invalid hexadecimal digit");
+            return -1;
+        }
+
+        kbuffer_end_write(bin, len / 2);
+        n -= len;
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+/**
+ * src/khex.h
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ */
+
+#ifndef __KHEX_H__
+#define __KHEX_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <kbuffer.h>
+
+/* The khex module converts binary data to hexadecimal, two lowercase digits
+ * per byte, and back. The decoder accepts both cases.
+ *
+ * The conversions use the vector instructions reported by kcpu: the nibbles
+ * of 16 or 32 bytes are translated to digits with a byte shuffle, and the
+ * digits are classified and packed by pairs with a multiplication.
+ */
+
+void khex_encode(char *dst, const uint8_t *src, size_t n);
+ssize_t khex_decode(uint8_t *dst, const char *src, size_t n);
+void kbin2hex(kbuffer *bin, kbuffer *hex);
+int khex2bin(kbuffer *hex, kbuffer *bin);
+
+#endif
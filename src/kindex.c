@@ -13,40 +13,88 @@
 
 static const uint8_t KINDEX_FORMAT_VERSION = 1;
 
-int kindex_serialize(kserializable *serializable, kbuffer *buffer) {
-    kindex *self = (kindex *)serializable;
+/* The compact format stores the number of elements and the keys as varints,
+ * and the values in their compact format. */
+static const uint8_t KINDEX_COMPACT_FORMAT_VERSION = 2;
+
+static int kindex_serialize_format(kindex *self, kbuffer *buffer, int compact_flag) {
     struct khash_iter hash_iter;
     kiter *iter = (kiter *)&hash_iter;
     struct khash_cell *cell;
 
-    kbuffer_write8(buffer, KINDEX_FORMAT_VERSION);
-    kbuffer_write32(buffer, self->hash.size);
+    if (compact_flag) {
+        kbuffer_write8(buffer, KINDEX_COMPACT_FORMAT_VERSION);
+        kbuffer_write_varint32(buffer, self->hash.size);
+    } else {
+        kbuffer_write8(buffer, KINDEX_FORMAT_VERSION);
+        kbuffer_write32(buffer, self->hash.size);
+    }
     
     khash_iter_init(&hash_iter, &self->hash);
     while (kiter_next(iter, (void **)&cell) == 0) {
-        kbuffer_write32(buffer, (uint32_t)*(int *)cell->key);
-        if (kserializable_serialize((kserializable *)cell->value, buffer))
-            return -1;
+        uint32_t key = (uint32_t)*(int *)cell->key;
+
+        if (compact_flag) {
+            kbuffer_write_varint32(buffer, key);
+            if (kserializable_serialize_compact((kserializable *)cell->value, buffer))
+                return -1;
+        } else {
+            kbuffer_write32(buffer, key);
+            if (kserializable_serialize((kserializable *)cell->value, buffer))
+                return -1;
+        }
     }
     return 0;
 }
 
+int kindex_serialize(kserializable *serializable, kbuffer *buffer) {
+    return kindex_serialize_format((kindex *)serializable, buffer, 0);
+}
+
+int kindex_serialize_compact(kserializable *serializable, kbuffer *buffer) {
+    return kindex_serialize_format((kindex *)serializable, buffer, 1);
+}
+
+/* This function returns the size of the serialized index, or -1 if the size
+ * of an element is unknown.
+ */
+ssize_t kindex_serialized_size(kserializable *serializable, int compact_flag) {
+    kindex *self = (kindex *)serializable;
+    struct khash_iter hash_iter;
+    kiter *iter = (kiter *)&hash_iter;
+    struct khash_cell *cell;
+    ssize_t size = 1 + (compact_flag ? kvarint_size64(self->hash.size) : 4);
+
+    khash_iter_init(&hash_iter, &self->hash);
+    while (kiter_next(iter, (void **)&cell) == 0) {
+        ssize_t value_size = kserializable_serialized_size((kserializable *)cell->value, compact_flag);
+        if (value_size < 0) return -1;
+        size += (compact_flag ? kvarint_size64((uint32_t)*(int *)cell->key) : 4) + value_size;
+    }
+
+    return size;
+}
+
+/* This function reads both formats. */
 int kindex_deserialize(kserializable *serializable, kbuffer *buffer) {
     kindex *self = (kindex *)serializable;
     uint8_t version;
     uint32_t nb_elem;
     unsigned int i;
+    int compact_flag;
 
     do {
         if (kbuffer_read8(buffer, &version)) {
             KTOOLS_ERROR_PUSH("could not read khash version");
             break;
         }
-        if (version != KINDEX_FORMAT_VERSION) {
+        if (version != KINDEX_FORMAT_VERSION && version != KINDEX_COMPACT_FORMAT_VERSION) {
             KTOOLS_ERROR_PUSH("unknown khash format");
             break;
         }
-        if (kbuffer_read32(buffer, &nb_elem)) {
+        compact_flag = (version == KINDEX_COMPACT_FORMAT_VERSION);
+
+        if (compact_flag ? kbuffer_read_varint32(buffer, &nb_elem) : kbuffer_read32(buffer, &nb_elem)) {
             KTOOLS_ERROR_PUSH("cannot read the number of element");
             break;
         }
@@ -55,7 +103,7 @@ int kindex_deserialize(kserializable *serializable, kbuffer *buffer) {
             uint32_t key;
             kserializable *value = NULL;
 
-            if (kbuffer_read32(buffer, &key)) {
+            if (compact_flag ? kbuffer_read_varint32(buffer, &key) : kbuffer_read32(buffer, &key)) {
                 KTOOLS_ERROR_PUSH("could not read key");
                 break;
             }
@@ -111,6 +159,9 @@ DECLARE_KSERIALIZABLE_OPS(kindex) = {
     kindex_new_serializable,
     kindex_destroy_serializable,
     kindex_dump,
+    kindex_serialize_compact,
+    kindex_deserialize,
+    kindex_serialized_size,
 };
 
 kindex *kindex_new() {
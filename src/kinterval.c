@@ -0,0 +1,150 @@
+/**
+ * src/kinterval.c
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ */
+
+#include "kinterval.h"
+#include "kmem.h"
+#include "kutils.h"
+
+/* This function orders the intervals by low endpoint, then by high endpoint,
+ * then by address.
+ */
+static int kinterval_cmp(void *key_1, void *key_2) {
+    struct kinterval *a = (struct kinterval *) key_1;
+    struct kinterval *b = (struct kinterval *) key_2;
+    if (a->low != b->low) return (a->low < b->low) ? -1 : 1;
+    if (a->high != b->high) return (a->high < b->high) ? -1 : 1;
+    return krb_tree_cmp(key_1, key_2);
+}
+
+/* This function computes the maximum high endpoint of the subtree of the node
+ * specified.
+ */
+static void kinterval_augment(struct krb_node *node, struct krb_node *nil) {
+    struct kinterval *interval = (struct kinterval *) node;
+    interval->max_high = interval->high;
+
+    if (node->left != nil) {
+        interval->max_high = MAX(interval->max_high, ((struct kinterval *) node->left)->max_high);
+    }
+
+    if (node->right != nil) {
+        interval->max_high = MAX(interval->max_high, ((struct kinterval *) node->right)->max_high);
+    }
+}
+
+/* Helper function for kinterval_tree_overlap(). */
+static int kinterval_overlap_helper(struct krb_node *node, struct krb_node *nil,
+                                    int64_t low, int64_t high, karray *result) {
+    int count = 0;
+
+    while (node != nil) {
+        struct kinterval *interval = (struct kinterval *) node;
+
+        /* No interval of this subtree ends at or after 'low'. */
+        if (interval->max_high < low) break;
+
+        /* Search the left subtree. */
+        if (node->left != nil) {
+            count += kinterval_overlap_helper(node->left, nil, low, high, result);
+        }
+
+        /* This interval and the intervals of the right subtree start after
+         * 'high'.
+         */
+        if (interval->low > high) break;
+
+        /* This interval overlaps. */
+        if (interval->high >= low) {
+            karray_push(result, interval);
+            count++;
+        }
+
+        /* Search the right subtree. */
+        node = node->right;
+    }
+
+    return count;
+}
+
+/* Helper function for kinterval_tree_check_consistency(). */
+static void kinterval_check_consistency_helper(struct krb_node *node, struct krb_node *nil) {
+    struct kinterval *interval = (struct kinterval *) node;
+    int64_t max_high = interval->high;
+
+    assert(interval->low <= interval->high);
+    assert(node->key == interval);
+
+    if (node->left != nil) {
+        kinterval_check_consistency_helper(node->left, nil);
+        max_high = MAX(max_high, ((struct kinterval *) node->left)->max_high);
+    }
+
+    if (node->right != nil) {
+        kinterval_check_consistency_helper(node->right, nil);
+        max_high = MAX(max_high, ((struct kinterval *) node->right)->max_high);
+    }
+
+    assert(interval->max_high == max_high);
+}
+
+/* This function initializes the tree. */
+void kinterval_tree_init(kinterval_tree *self) {
+    krb_tree_init_func(&self->tree, kinterval_cmp);
+    krb_tree_set_augment_func(&self->tree, kinterval_augment);
+}
+
+/* This function destroys all the intervals and cleans the tree. */
+void kinterval_tree_clean(kinterval_tree *self) {
+    krb_tree_clean(&self->tree);
+}
+
+/* This method adds the interval [low, high] to the tree. The interval added is
+ * returned.
+ */
+struct kinterval * kinterval_tree_add(kinterval_tree *self, int64_t low, int64_t high, void *value) {
+    struct kinterval *interval = (struct kinterval *) kmalloc(sizeof(struct kinterval));
+    struct krb_node *parent = NULL, *node = self->tree.root_node, *nil = NULL;
+    int order = 0;
+
+    assert(low <= high);
+    interval->low = low;
+    interval->high = high;
+    interval->max_high = high;
+    interval->value = value;
+    interval->node.key = interval;
+    interval->node.value = value;
+
+    /* Find the position of the interval. */
+    if (node != NULL) nil = node->parent;
+
+    while (node != nil) {
+        order = kinterval_cmp(interval, node->key);
+        parent = node;
+        node = (order < 0) ? node->left : node->right;
+    }
+
+    krb_tree_link_node(&self->tree, &interval->node, parent, order < 0);
+    return interval;
+}
+
+/* This method removes the interval specified from the tree and destroys it. */
+void kinterval_tree_remove(kinterval_tree *self, struct kinterval *interval) {
+    krb_tree_remove_node(&self->tree, &interval->node);
+}
+
+/* This method appends the intervals overlapping the interval [low, high] to the
+ * array specified, in order. The number of intervals appended is returned.
+ */
+int kinterval_tree_overlap(kinterval_tree *self, int64_t low, int64_t high, karray *result) {
+    if (self->tree.root_node == NULL || low > high) return 0;
+    return kinterval_overlap_helper(self->tree.root_node, self->tree.root_node->parent, low, high, result);
+}
+
+/* This method verifies the internal consistency of the tree. */
+void kinterval_tree_check_consistency(kinterval_tree *self) {
+    krb_tree_check_consistency(&self->tree);
+    if (self->tree.root_node == NULL) return;
+    kinterval_check_consistency_helper(self->tree.root_node, self->tree.root_node->parent);
+}
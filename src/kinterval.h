@@ -0,0 +1,69 @@
+/**
+ * src/kinterval.h
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ */
+
+#ifndef __KINTERVAL_H__
+#define __KINTERVAL_H__
+
+#include <stdint.h>
+#include "krb_tree.h"
+#include "karray.h"
+
+/* Struct kinterval_tree is an interval tree. It maintains a set of closed
+ * intervals [low, high] of 64 bits integers, e.g. time windows expressed in
+ * milliseconds, and it finds the intervals overlapping a point or another
+ * interval.
+ *
+ * The tree is a krb_tree ordered by low endpoint and augmented with the
+ * maximum high endpoint of each subtree. Adding and removing an interval is
+ * O(lg(n)). A query reporting k intervals is O(lg(n) + k) when the intervals
+ * reported are grouped in the tree, and O(min(n, k lg(n))) at worst. Several
+ * intervals may have the same endpoints.
+ */
+
+/* Interval stored in the tree. */
+struct kinterval {
+
+    /* Node of the tree. The key of the node is the interval itself. */
+    struct krb_node node;
+
+    /* Endpoints of the interval, inclusive. Do not modify. */
+    int64_t low;
+    int64_t high;
+
+    /* Maximum high endpoint in the subtree of this interval. */
+    int64_t max_high;
+
+    /* Value associated to the interval. */
+    void *value;
+};
+
+/* Interval tree. */
+typedef struct kinterval_tree {
+
+    /* Tree of the intervals. */
+    krb_tree tree;
+
+} kinterval_tree;
+
+void kinterval_tree_init(kinterval_tree *self);
+void kinterval_tree_clean(kinterval_tree *self);
+struct kinterval * kinterval_tree_add(kinterval_tree *self, int64_t low, int64_t high, void *value);
+void kinterval_tree_remove(kinterval_tree *self, struct kinterval *interval);
+int kinterval_tree_overlap(kinterval_tree *self, int64_t low, int64_t high, karray *result);
+void kinterval_tree_check_consistency(kinterval_tree *self);
+
+/* This method returns the number of intervals in the tree. */
+static inline int kinterval_tree_size(kinterval_tree *self) {
+    return krb_tree_size(&self->tree);
+}
+
+/* This method appends the intervals containing the point specified to the
+ * array specified. The number of intervals appended is returned.
+ */
+static inline int kinterval_tree_stab(kinterval_tree *self, int64_t point, karray *result) {
+    return kinterval_tree_overlap(self, point, point, result);
+}
+
+#endif
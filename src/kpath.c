@@ -72,35 +72,21 @@ void kpath_add_delim(kstr *path, int format) {
     }
 }
 
-/* This function splits the path into 3 components, directory (with trailing
- * delimiter), file name (without extension), and extension (without '.').
- *
- * The path '/etc/ld.so.conf' will yield directory '/etc/', file name 'ld', and extension 'so.conf'.
- * The path '/etc/' will yield directory '/etc/', file name '', and extension ''.
- * The path '/etc' will yield directory '/', file name 'etc', and extension ''.
- * The path 'foo.' will yield directory './', file name 'foo.' and extension '', i.e. the extension must not be empty.
- * The path '.foo' will yield directory './', file name '.foo' and extension '', i.e. the file name must not be empty.
- * The path '.' will yield directory './', file name '', and extension ''.
- * The path '..' will yield directory '../', file name '', and extension ''.
- * The path '' will yield directory '', file name '', and extension ''.
- * Rule of thumb: If the extension is not empty, then <dir><filename>.<extension> is the path.
- *		  If the extension is empty, then <dir><filename> is the path.
- * Arguments:
- * String containing the path.
- * Directory string pointer, can be NULL.
- * File name string pointer, can be NULL.
- * Extension string pointer, can be NULL.
+/* This function locates the file name and the extension in a path. It sets
+ * 'filename_start_pos' to the position of the file name and 'first_dot_pos' to
+ * the position of the dot before the extension, or -1 if there is no
+ * extension. See kpath_split().
  */
-void kpath_split(kstr *path, kstr *dir, kstr *name, kstr *ext, int format) {
-    int i;
-    int last_delim_pos = -1;
-    int filename_start_pos = 0;
-    int first_dot_pos = -1;
+static void kpath_split_pos(const char *path, size_t len, int format, size_t *filename_start_pos,
+                            ssize_t *first_dot_pos) {
+    size_t i, start = 0;
+    
+    *first_dot_pos = -1;
     
     /* Locate the last path delimiter, if any. */
-    for (i = path->slen - 1; i >= 0; i--) {
-        if (kpath_is_delim(path->data[i], format)) {
-            last_delim_pos = i;
+    for (i = len; i > 0; i--) {
+        if (kpath_is_delim(path[i - 1], format)) {
+            start = i;
             break;
         }
     }
@@ -110,21 +96,61 @@ void kpath_split(kstr *path, kstr *dir, kstr *name, kstr *ext, int format) {
      * '.' or '..'. In that case, consider the whole path to be a directory
      * path.
      */
-    if (last_delim_pos != -1) filename_start_pos = last_delim_pos + 1;
-    if (! strcmp(path->data + filename_start_pos, ".")) filename_start_pos += 1;
-    else if (! strcmp(path->data + filename_start_pos, "..")) filename_start_pos += 2;
+    if (len - start == 1 && path[start] == '.') start += 1;
+    else if (len - start == 2 && path[start] == '.' && path[start + 1] == '.') start += 2;
     
     /* Locate the first dot in the file name, if any. */
-    for (i = filename_start_pos; i < path->slen; i++) {
+    for (i = start; i < len; i++) {
         
         /* We found a dot. */
-        if (path->data[i] == '.') {
+        if (path[i] == '.') {
             
             /* If there's nothing before or after the dot, consider there is no dot. */
-            if (i != filename_start_pos && i != path->slen - 1) first_dot_pos = i;
+            if (i != start && i != len - 1) *first_dot_pos = i;
             break;
         }
     }
+    
+    *filename_start_pos = start;
+}
+
+/* This function returns the position of the file name in a path, i.e. the
+ * position following the last delimiter.
+ */
+static size_t kpath_basename_pos(const char *path, size_t len, int format) {
+    size_t i;
+    
+    for (i = len; i > 0; i--) {
+        if (kpath_is_delim(path[i - 1], format)) return i;
+    }
+    
+    return 0;
+}
+
+/* This function splits the path into 3 components, directory (with trailing
+ * delimiter), file name (without extension), and extension (without '.').
+ *
+ * The path '/etc/ld.so.conf' will yield directory '/etc/', file name 'ld', and extension 'so.conf'.
+ * The path '/etc/' will yield directory '/etc/', file name '', and extension ''.
+ * The path '/etc' will yield directory '/', file name 'etc', and extension ''.
+ * The path 'foo.' will yield directory './', file name 'foo.' and extension '', i.e. the extension must not be empty.
+ * The path '.foo' will yield directory './', file name '.foo' and extension '', i.e. the file name must not be empty.
+ * The path '.' will yield directory './', file name '', and extension ''.
+ * The path '..' will yield directory '../', file name '', and extension ''.
+ * The path '' will yield directory '', file name '', and extension ''.
+ * Rule of thumb: If the extension is not empty, then <dir><filename>.<extension> is the path.
+ *		  If the extension is empty, then <dir><filename> is the path.
+ * Arguments:
+ * String containing the path.
+ * Directory string pointer, can be NULL.
+ * File name string pointer, can be NULL.
+ * Extension string pointer, can be NULL.
+ */
+void kpath_split(kstr *path, kstr *dir, kstr *name, kstr *ext, int format) {
+    size_t filename_start_pos;
+    ssize_t first_dot_pos;
+    
+    kpath_split_pos(path->data, path->slen, format, &filename_start_pos, &first_dot_pos);
 
     /* Get the directory portion. */
     if (dir) {
@@ -146,7 +172,7 @@ void kpath_split(kstr *path, kstr *dir, kstr *name, kstr *ext, int format) {
 
     /* Get the file name. */
     if (name) {
-        int filename_size;
+        size_t filename_size;
 
         /* No extension case. */
         if (first_dot_pos == -1) filename_size = path->slen - filename_start_pos;
@@ -168,39 +194,61 @@ void kpath_split(kstr *path, kstr *dir, kstr *name, kstr *ext, int format) {
     }
 }
 
+/* Same as kpath_split(), but the components are returned as views on the path.
+ * Since nothing is copied, the directory is returned exactly as it appears in
+ * the path: no './' is returned for a relative path without directory and no
+ * delimiter is added. For instance, the path 'foo.txt' yields directory '',
+ * and the path '..' yields directory '..'.
+ */
+void kpath_split_view(kstr_view path, kstr_view *dir, kstr_view *name, kstr_view *ext, int format) {
+    size_t filename_start_pos;
+    ssize_t first_dot_pos;
+    
+    kpath_split_pos(path.p, path.n, format, &filename_start_pos, &first_dot_pos);
+    
+    if (dir) *dir = kstr_view_buf(path.p, filename_start_pos);
+    
+    if (name) {
+        if (first_dot_pos == -1) *name = kstr_view_buf(path.p + filename_start_pos, path.n - filename_start_pos);
+        else *name = kstr_view_buf(path.p + filename_start_pos, first_dot_pos - filename_start_pos);
+    }
+    
+    if (ext) {
+        if (first_dot_pos == -1) *ext = kstr_view_buf(path.p + path.n, 0);
+        else *ext = kstr_view_buf(path.p + first_dot_pos + 1, path.n - first_dot_pos - 1);
+    }
+}
+
 /* This function extracts the file name with the extension from the path
  * specified.
  */
 void kpath_basename(kstr *path, kstr *name, int format) {
-    int i, last_delim_pos = -1, filename_start_pos = 0;
-
-    /* Locate the last path delimiter, if any. */
-    for (i = path->slen - 1; i >= 0; i--) {
-        if (kpath_is_delim(path->data[i], format)) {
-            last_delim_pos = i;
-            break;
-        }
-    }
-
-    /* Get the position where the file name starts. */
-    if (last_delim_pos != -1) filename_start_pos = last_delim_pos + 1;
-    
-    /* Extract the filename and extension. */
+    size_t filename_start_pos = kpath_basename_pos(path->data, path->slen, format);
     kstr_mid(path, name, filename_start_pos, path->slen - filename_start_pos);
 }
 
-/* This function returns true if a path is an absolute path. */
-int kpath_is_absolute(kstr *path, int format) {
-    
-    /* Get the platform format. */
-    int platform_format = kpath_get_platform_format(format);
+/* Same as kpath_basename(), but returns a view on the path. */
+kstr_view kpath_basename_view(kstr_view path, int format) {
+    size_t filename_start_pos = kpath_basename_pos(path.p, path.n, format);
+    return kstr_view_buf(path.p + filename_start_pos, path.n - filename_start_pos);
+}
+
+/* This function returns the length of the absolute part of a path, or 0 if
+ * the path is relative.
+ */
+static size_t kpath_abs_len(const char *path, size_t len, int format) {
     
     /* Windows format. Path must start with something like "C:\". */
-    if (platform_format == KPATH_FORMAT_WINDOWS)
-	return (path->slen >= 3 && path->data[1] == ':' && kpath_is_delim(path->data[2], format));
+    if (kpath_get_platform_format(format) == KPATH_FORMAT_WINDOWS)
+        return (len >= 3 && path[1] == ':' && kpath_is_delim(path[2], format)) ? 3 : 0;
     
     /* UNIX format. Path must start with "/". */
-    else return (path->data[0] == '/');
+    return (len >= 1 && path[0] == '/') ? 1 : 0;
+}
+
+/* This function returns true if a path is an absolute path. */
+int kpath_is_absolute(kstr *path, int format) {
+    return (kpath_abs_len(path->data, path->slen, format) != 0);
 }
 
 /* This function converts a path to an absolute path, if needed. */
@@ -222,6 +270,22 @@ void kpath_make_absolute(kstr *path, int format) {
     kstr_clean(&tmp);
 }
 
+/* This function finds the next component of a path, starting at 'pos'. The
+ * empty components are skipped. It returns false if there are no more
+ * components.
+ */
+static int kpath_next_component(const char *path, size_t len, size_t *pos, kstr_view *component, int format) {
+    size_t start;
+    
+    while (*pos < len && kpath_is_delim(path[*pos], format)) (*pos)++;
+    if (*pos == len) return 0;
+    
+    start = *pos;
+    while (*pos < len && ! kpath_is_delim(path[*pos], format)) (*pos)++;
+    *component = kstr_view_buf(path + start, *pos - start);
+    return 1;
+}
+
 /* This function decomposes the directory path specified into an array of
  * subcomponents. If the path is absolute, the absolute part will be something
  * like 'C:\' on Windows and '/' on UNIX, otherwise it will be empty. The
@@ -234,66 +298,48 @@ void kpath_make_absolute(kstr *path, int format) {
  * The path '' will yield ().
  */
 void kpath_decompose_dir(kstr *path, struct kpath_dir *dir, int format) {
-    int scan_pos = 0;
-    kstr cur_component;
-    
-    /* Get the platform format. */
-    int platform_format = kpath_get_platform_format(format);
+    size_t scan_pos = kpath_abs_len(path->data, path->slen, format);
+    kstr_view component;
     
-    /* Determine if the path is absolute. */
-    int is_absolute = kpath_is_absolute(path, format);
-    
-    kstr_init(&cur_component);
     kpath_dir_reset(dir);
     
     /* If the path is absolute, obtain the absolute part. */
-    if (is_absolute) {
-    
-        if (platform_format == KPATH_FORMAT_UNIX) {
-            kstr_append_char(&dir->abs_part, '/');
-            scan_pos = 1;
-        }
-        
-        else {
-            kstr_append_buf(&dir->abs_part, path->data, 2);
-            kstr_append_char(&dir->abs_part, kpath_delim(format));
-            scan_pos = 3;
-        }
+    if (scan_pos == 1) {
+        kstr_append_char(&dir->abs_part, '/');
     }
     
-    /* Scan the rest of the path. */
-    while (scan_pos < path->slen) {
-        
-        /* We encountered a delimiter. */
-        if (kpath_is_delim(path->data[scan_pos], format)) {
-            
-            /* If the current component is empty, ignore it. Otherwise, add the
-             * component in the component array.
-             */
-            if (cur_component.slen) {
-                kstr *s = kstr_new();
-                kstr_assign_kstr(s, &cur_component);
-                karray_push(&dir->components, s);
-            }
-            
-            /* Reset the current component. */
-            kstr_reset(&cur_component);
-        }
-        
-        /* Append the current character. */
-        else kstr_append_char(&cur_component, path->data[scan_pos]);
-        
-        scan_pos++;
+    else if (scan_pos == 3) {
+        kstr_append_buf(&dir->abs_part, path->data, 2);
+        kstr_append_char(&dir->abs_part, kpath_delim(format));
     }
     
-    /* Add the last component, if any, in the component array. */
-    if (cur_component.slen) {
+    /* Add the components in the component array. */
+    while (kpath_next_component(path->data, path->slen, &scan_pos, &component, format)) {
         kstr *s = kstr_new();
-        kstr_assign_kstr(s, &cur_component);
+        kstr_assign_view(s, component);
         karray_push(&dir->components, s);
     }
+}
+
+/* Same as kpath_decompose_dir(), but the absolute part and the components are
+ * returned as views on the path, without allocating memory. The absolute part
+ * is returned as it appears in the path (e.g. 'C:/'). At most 'max' components
+ * are stored in 'components'. The number of components in the path is
+ * returned; it may be larger than 'max'.
+ */
+int kpath_decompose_dir_view(kstr_view path, kstr_view *abs_part, kstr_view *components, int max, int format) {
+    size_t scan_pos = kpath_abs_len(path.p, path.n, format);
+    kstr_view component;
+    int count = 0;
+    
+    if (abs_part) *abs_part = kstr_view_buf(path.p, scan_pos);
+    
+    while (kpath_next_component(path.p, path.n, &scan_pos, &component, format)) {
+        if (count < max) components[count] = component;
+        count++;
+    }
     
-    kstr_clean(&cur_component);
+    return count;
 }
 
 /* This function recomposes a directory path from its subcomponents. If the
@@ -56,10 +56,13 @@ int kpath_is_delim(char c, int format);
 char kpath_delim(int format);
 void kpath_add_delim(kstr *path, int format);
 void kpath_split(kstr *path, kstr *dir, kstr *name, kstr *ext, int format);
+void kpath_split_view(kstr_view path, kstr_view *dir, kstr_view *name, kstr_view *ext, int format);
 void kpath_basename(kstr *path, kstr *name, int format);
+kstr_view kpath_basename_view(kstr_view path, int format);
 int kpath_is_absolute(kstr *path, int format);
 void kpath_make_absolute(kstr *path, int format);
 void kpath_decompose_dir(kstr *path, struct kpath_dir *dir, int format);
+int kpath_decompose_dir_view(kstr_view path, kstr_view *abs_part, kstr_view *components, int max, int format);
 void kpath_recompose_dir(kstr *path, struct kpath_dir *dir, int format);
 void kpath_simplify_dir(struct kpath_dir *dir);
 void kpath_normalize(kstr *path, int absolute_flag, int format);
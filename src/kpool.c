@@ -0,0 +1,165 @@
+/**
+ * src/kpool.c
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ */
+
+#include <string.h>
+#include "kpool.h"
+#include "kthread.h"
+#include "kmem.h"
+
+/* This pool is used when the library is operating in single-threaded mode. */
+static struct kpool single_thread_instance;
+
+/* This function returns the size of the class specified. */
+static inline size_t kpool_class_size(int c) {
+    return (size_t) KPOOL_MIN_SIZE << (2 * c);
+}
+
+/* This function returns the smallest class that holds 'size' bytes, or -1 if
+ * the size is larger than all the classes.
+ */
+static int kpool_class_above(size_t size) {
+    int c;
+
+    for (c = 0; c < KPOOL_NB_CLASS; c++)
+        if (kpool_class_size(c) >= size) return c;
+
+    return -1;
+}
+
+/* This function returns the largest class that fits in 'size' bytes, or -1 if
+ * the size is smaller than all the classes.
+ */
+static int kpool_class_below(size_t size) {
+    int c;
+
+    for (c = KPOOL_NB_CLASS - 1; c >= 0; c--)
+        if (kpool_class_size(c) <= size) return c;
+
+    return -1;
+}
+
+void kpool_init(struct kpool *self) {
+    memset(self, 0, sizeof(struct kpool));
+}
+
+/* This function frees the objects kept in the pool. */
+void kpool_clean(struct kpool *self) {
+    int c;
+
+    for (c = 0; c < KPOOL_NB_CLASS; c++) {
+        while (self->nb_buffers[c]) kbuffer_destroy(self->buffers[c][--self->nb_buffers[c]]);
+        while (self->nb_strs[c]) kstr_destroy(self->strs[c][--self->nb_strs[c]]);
+    }
+}
+
+/* This function returns the pool of the current thread. */
+struct kpool * kpool_get_current() {
+    if (! ktools_use_mt) {
+	return &single_thread_instance;
+    }
+    
+    else {
+	return &kthread_get_specific()->pool;
+    }
+}
+
+/* initialize/finalize the pool module, call at begining/end of program. */
+void kpool_initialize() {
+    assert(! ktools_use_mt);
+    kpool_init(&single_thread_instance);
+}
+
+void kpool_finalize() {
+    assert(! ktools_use_mt);
+    kpool_clean(&single_thread_instance);
+}
+
+/* This function returns an empty buffer that can hold 'hint' bytes without
+ * growing. The buffer is taken from the pool if possible. It must be released
+ * with kbuffer_release().
+ */
+kbuffer * kbuffer_acquire(size_t hint) {
+    struct kpool *pool = kpool_get_current();
+    int first = kpool_class_above(hint), c;
+    kbuffer *self;
+
+    if (first >= 0) {
+        for (c = first; c < KPOOL_NB_CLASS; c++)
+            if (pool->nb_buffers[c]) return pool->buffers[c][--pool->nb_buffers[c]];
+    }
+
+    self = kbuffer_new();
+    kbuffer_grow(self, first >= 0 ? kpool_class_size(first) - 1 : hint);
+    return self;
+}
+
+/* This function returns the buffer to the pool of the current thread, or
+ * destroys it if it cannot be reused.
+ */
+void kbuffer_release(kbuffer *self) {
+    struct kpool *pool = kpool_get_current();
+    int c;
+
+    if (self == NULL) return;
+
+    /* The chained and shared buffers do not own a reusable block. */
+    if (kbuffer_is_chained(self) || self->store) {
+        kbuffer_destroy(self);
+        return;
+    }
+
+    kbuffer_shrink(self, KPOOL_MAX_SIZE);
+    c = kpool_class_below(self->allocated);
+
+    if (c < 0 || pool->nb_buffers[c] == KPOOL_CLASS_DEPTH) {
+        kbuffer_destroy(self);
+        return;
+    }
+
+    pool->buffers[c][pool->nb_buffers[c]++] = self;
+}
+
+/* This function returns an empty string that can hold 'hint' characters
+ * without growing. It must be released with kstr_release().
+ */
+kstr * kstr_acquire(size_t hint) {
+    struct kpool *pool = kpool_get_current();
+    int first = kpool_class_above(hint + 1), c;
+    kstr *self;
+
+    if (first >= 0) {
+        for (c = first; c < KPOOL_NB_CLASS; c++)
+            if (pool->nb_strs[c]) return pool->strs[c][--pool->nb_strs[c]];
+    }
+
+    self = kstr_new();
+    if (hint >= KSTR_SSO_SIZE) kstr_grow(self, first >= 0 ? kpool_class_size(first) - 1 : hint);
+    return self;
+}
+
+/* This function returns the string to the pool of the current thread, or
+ * destroys it if it cannot be reused.
+ */
+void kstr_release(kstr *self) {
+    struct kpool *pool = kpool_get_current();
+    int c;
+
+    if (self == NULL) return;
+
+    if (self->mlen > KPOOL_MAX_SIZE) {
+        kstr_clean(self);
+        kstr_init(self);
+    }
+
+    kstr_reset(self);
+    c = kpool_class_below(self->mlen);
+
+    if (c < 0 || pool->nb_strs[c] == KPOOL_CLASS_DEPTH) {
+        kstr_destroy(self);
+        return;
+    }
+
+    pool->strs[c][pool->nb_strs[c]++] = self;
+}
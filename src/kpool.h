@@ -0,0 +1,51 @@
+/**
+ * src/kpool.h
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ */
+
+#ifndef __KPOOL_H__
+#define __KPOOL_H__
+
+#include "kbuffer.h"
+#include "kstr.h"
+
+/* The kpool module keeps released kbuffer and kstr objects so that the
+ * temporary objects do not have to be allocated and grown again on every
+ * call. Each thread has its own pool, like its error stack, so no locking is
+ * needed.
+ *
+ * The objects are sorted by size class: the classes are 256 bytes, 1KB, 4KB,
+ * 16KB and 64KB. An object larger than the largest class is trimmed when it is
+ * released, the way kbuffer_shrink() does, so that a single large request does
+ * not pin its memory in the pool. At most KPOOL_CLASS_DEPTH objects are kept
+ * per class; the others are freed.
+ *
+ * The objects acquired must be released with the matching function, not
+ * destroyed, for the pool to be useful. Releasing them with kbuffer_destroy()
+ * or kstr_destroy() is still correct.
+ */
+
+#define KPOOL_NB_CLASS      5
+#define KPOOL_CLASS_DEPTH   4
+#define KPOOL_MIN_SIZE      256
+#define KPOOL_MAX_SIZE      (KPOOL_MIN_SIZE << (2 * (KPOOL_NB_CLASS - 1)))
+
+struct kpool {
+    kbuffer *buffers[KPOOL_NB_CLASS][KPOOL_CLASS_DEPTH];
+    int nb_buffers[KPOOL_NB_CLASS];
+    kstr *strs[KPOOL_NB_CLASS][KPOOL_CLASS_DEPTH];
+    int nb_strs[KPOOL_NB_CLASS];
+};
+
+void kpool_init(struct kpool *self);
+void kpool_clean(struct kpool *self);
+struct kpool * kpool_get_current();
+void kpool_initialize();
+void kpool_finalize();
+
+kbuffer * kbuffer_acquire(size_t hint);
+void kbuffer_release(kbuffer *self);
+kstr * kstr_acquire(size_t hint);
+void kstr_release(kstr *self);
+
+#endif
@@ -0,0 +1,463 @@
+/**
+ * src/kprb_tree.c
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ */
+
+#include "kprb_tree.h"
+#include "kmem.h"
+#include "kutils.h"
+
+/* This function returns true if the node specified is red. Missing nodes are
+ * black.
+ */
+static inline int kprb_node_is_red(struct kprb_node *node) {
+    return (node != NULL && node->color);
+}
+
+/* This function returns the size of the subtree of the node specified. */
+static inline int kprb_node_size(struct kprb_node *node) {
+    return (node == NULL ? 0 : node->size);
+}
+
+/* This function adds a reference to the node specified, if any. */
+static inline void kprb_node_ref(struct kprb_node *node) {
+    if (node) __sync_add_and_fetch(&node->ref_count, 1);
+}
+
+/* This function removes a reference to the node specified, if any. The node is
+ * freed when its last reference goes away, which releases the references held
+ * on its children.
+ */
+static void kprb_node_unref(struct kprb_node *node) {
+    while (node && __sync_sub_and_fetch(&node->ref_count, 1) == 0) {
+        struct kprb_node *right = node->right;
+        kprb_node_unref(node->left);
+        kfree(node);
+        node = right;
+    }
+}
+
+/* This function creates a new red node holding the key and value specified. */
+static struct kprb_node * kprb_node_new(void *key, void *value) {
+    struct kprb_node *self = (struct kprb_node *) kmalloc(sizeof(struct kprb_node));
+    self->left = NULL;
+    self->right = NULL;
+    self->key = key;
+    self->value = value;
+    self->ref_count = 1;
+    self->size = 1;
+    self->color = 1;
+    return self;
+}
+
+/* This function returns a version of the node specified that the writer may
+ * modify. If the node is referenced only by the caller, it is returned as is.
+ * Otherwise, the node is shared with other versions of the tree: a copy is
+ * returned and the reference held by the caller is transferred to the copy.
+ */
+static struct kprb_node * kprb_node_touch(struct kprb_node *node) {
+    struct kprb_node *copy;
+
+    assert(node);
+    if (__sync_add_and_fetch(&node->ref_count, 0) == 1) return node;
+
+    copy = kprb_node_new(node->key, node->value);
+    copy->left = node->left;
+    copy->right = node->right;
+    copy->size = node->size;
+    copy->color = node->color;
+    kprb_node_ref(copy->left);
+    kprb_node_ref(copy->right);
+    kprb_node_unref(node);
+    return copy;
+}
+
+/* This function rotates the subtree left at the node specified, which must have
+ * been touched. The new root of the subtree is returned.
+ */
+static struct kprb_node * kprb_rotate_left(struct kprb_node *h) {
+    struct kprb_node *x = kprb_node_touch(h->right);
+    h->right = x->left;
+    x->left = h;
+    x->color = h->color;
+    h->color = 1;
+    x->size = h->size;
+    h->size = kprb_node_size(h->left) + kprb_node_size(h->right) + 1;
+    return x;
+}
+
+/* This function rotates the subtree right at the node specified, which must
+ * have been touched. The new root of the subtree is returned.
+ */
+static struct kprb_node * kprb_rotate_right(struct kprb_node *h) {
+    struct kprb_node *x = kprb_node_touch(h->left);
+    h->left = x->right;
+    x->right = h;
+    x->color = h->color;
+    h->color = 1;
+    x->size = h->size;
+    h->size = kprb_node_size(h->left) + kprb_node_size(h->right) + 1;
+    return x;
+}
+
+/* This function flips the colors of the node specified, which must have been
+ * touched, and of its children.
+ */
+static void kprb_flip_colors(struct kprb_node *h) {
+    h->color = ! h->color;
+    h->left = kprb_node_touch(h->left);
+    h->left->color = ! h->left->color;
+    h->right = kprb_node_touch(h->right);
+    h->right->color = ! h->right->color;
+}
+
+/* This function restores the left-leaning red-black properties at the node
+ * specified, which must have been touched, and updates its size. The new root
+ * of the subtree is returned.
+ */
+static struct kprb_node * kprb_balance(struct kprb_node *h) {
+    if (kprb_node_is_red(h->right) && ! kprb_node_is_red(h->left)) h = kprb_rotate_left(h);
+    if (kprb_node_is_red(h->left) && kprb_node_is_red(h->left->left)) h = kprb_rotate_right(h);
+    if (kprb_node_is_red(h->left) && kprb_node_is_red(h->right)) kprb_flip_colors(h);
+    h->size = kprb_node_size(h->left) + kprb_node_size(h->right) + 1;
+    return h;
+}
+
+/* This function makes the left child of the node specified or one of its
+ * children red, so that we can delete in the left subtree.
+ */
+static struct kprb_node * kprb_move_red_left(struct kprb_node *h) {
+    kprb_flip_colors(h);
+
+    if (kprb_node_is_red(h->right->left)) {
+        h->right = kprb_rotate_right(h->right);
+        h = kprb_rotate_left(h);
+        kprb_flip_colors(h);
+    }
+
+    return h;
+}
+
+/* This function makes the right child of the node specified or one of its
+ * children red, so that we can delete in the right subtree.
+ */
+static struct kprb_node * kprb_move_red_right(struct kprb_node *h) {
+    kprb_flip_colors(h);
+
+    if (kprb_node_is_red(h->left->left)) {
+        h = kprb_rotate_right(h);
+        kprb_flip_colors(h);
+    }
+
+    return h;
+}
+
+/* This method inserts the key-value pair in the subtree specified. The caller's
+ * reference on the subtree is consumed and a reference on the new subtree is
+ * returned.
+ */
+static struct kprb_node * kprb_tree_insert(kprb_tree *self, struct kprb_node *h, void *key, void *value) {
+    int order;
+
+    if (h == NULL) return kprb_node_new(key, value);
+
+    h = kprb_node_touch(h);
+    order = self->cmp_func(key, h->key);
+
+    if (order < 0) {
+        h->left = kprb_tree_insert(self, h->left, key, value);
+    }
+
+    else if (order > 0) {
+        h->right = kprb_tree_insert(self, h->right, key, value);
+    }
+
+    else {
+        h->key = key;
+        h->value = value;
+    }
+
+    return kprb_balance(h);
+}
+
+/* This method deletes the minimum node of the subtree specified. */
+static struct kprb_node * kprb_tree_delete_min(struct kprb_node *h) {
+    h = kprb_node_touch(h);
+
+    if (h->left == NULL) {
+        assert(h->right == NULL);
+        kprb_node_unref(h);
+        return NULL;
+    }
+
+    if (! kprb_node_is_red(h->left) && ! kprb_node_is_red(h->left->left)) {
+        h = kprb_move_red_left(h);
+    }
+
+    h->left = kprb_tree_delete_min(h->left);
+    return kprb_balance(h);
+}
+
+/* This method deletes the key specified from the subtree specified. The method
+ * assumes that the key exists.
+ */
+static struct kprb_node * kprb_tree_delete(kprb_tree *self, struct kprb_node *h, void *key) {
+    h = kprb_node_touch(h);
+
+    /* The key is in the left subtree. */
+    if (self->cmp_func(key, h->key) < 0) {
+        if (! kprb_node_is_red(h->left) && ! kprb_node_is_red(h->left->left)) {
+            h = kprb_move_red_left(h);
+        }
+
+        h->left = kprb_tree_delete(self, h->left, key);
+    }
+
+    /* The key is this node or it is in the right subtree. */
+    else {
+        if (kprb_node_is_red(h->left)) {
+            h = kprb_rotate_right(h);
+        }
+
+        /* This is a leaf. Remove it. */
+        if (self->cmp_func(key, h->key) == 0 && h->right == NULL) {
+            assert(h->left == NULL);
+            kprb_node_unref(h);
+            return NULL;
+        }
+
+        if (! kprb_node_is_red(h->right) && ! kprb_node_is_red(h->right->left)) {
+            h = kprb_move_red_right(h);
+        }
+
+        /* Replace this node by its successor, then delete the successor. */
+        if (self->cmp_func(key, h->key) == 0) {
+            struct kprb_node *min = h->right;
+            while (min->left) min = min->left;
+            h->key = min->key;
+            h->value = min->value;
+            h->right = kprb_tree_delete_min(h->right);
+        }
+
+        else {
+            h->right = kprb_tree_delete(self, h->right, key);
+        }
+    }
+
+    return kprb_balance(h);
+}
+
+/* This method makes the root specified the published root of the tree. The
+ * reference held by the writer on the root is transferred to the tree.
+ */
+static void kprb_tree_publish(kprb_tree *self, struct kprb_node *root) {
+    struct kprb_node *old_root;
+
+    kmutex_lock(&self->mutex);
+    old_root = self->root_node;
+    self->root_node = root;
+    kmutex_unlock(&self->mutex);
+
+    /* The old version goes away unless a snapshot references it. */
+    kprb_node_unref(old_root);
+}
+
+/* This function returns the node of the subtree specified corresponding to the
+ * key specified, or NULL if the key cannot be found.
+ */
+static struct kprb_node * kprb_tree_find(struct kprb_node *node, int (*cmp_func) (void *, void *), void *key) {
+    while (node) {
+        int order = cmp_func(key, node->key);
+        if (order < 0) node = node->left;
+        else if (order > 0) node = node->right;
+        else return node;
+    }
+
+    return NULL;
+}
+
+/* Helper function for kprb_snapshot_check_consistency(). */
+static int kprb_snapshot_check_consistency_helper(struct kprb_snapshot *self, struct kprb_node *node) {
+    int left_black, right_black;
+
+    /* Missing nodes are black. */
+    if (node == NULL) return 0;
+
+    /* The node is referenced. */
+    assert(node->ref_count > 0);
+
+    /* Red nodes lean left. A red node's children must be black. */
+    assert(! kprb_node_is_red(node->right));
+    if (node->color) assert(! kprb_node_is_red(node->left));
+
+    /* Check keys consistency. */
+    assert(node->left == NULL || self->cmp_func(node->key, node->left->key) > 0);
+    assert(node->right == NULL || self->cmp_func(node->key, node->right->key) < 0);
+
+    /* Check size. */
+    assert(node->size == kprb_node_size(node->left) + kprb_node_size(node->right) + 1);
+
+    /* Check black-height. Line 'right_black += 0;' is used to shut up gcc. */
+    left_black = kprb_snapshot_check_consistency_helper(self, node->left);
+    right_black = kprb_snapshot_check_consistency_helper(self, node->right);
+    right_black += 0;
+    assert(left_black == right_black);
+
+    /* Return black-height of this subtree. */
+    if (node->color) return left_black;
+    return (left_black + 1);
+}
+
+/* This function initializes the tree with the comparison function specified. */
+void kprb_tree_init(kprb_tree *self, int (*cmp_func) (void *, void *)) {
+    self->root_node = NULL;
+    self->cmp_func = cmp_func;
+    kmutex_init(&self->mutex);
+}
+
+/* This function cleans the tree. The snapshots of the tree remain valid. */
+void kprb_tree_clean(kprb_tree *self) {
+    kprb_node_unref(self->root_node);
+    self->root_node = NULL;
+    kmutex_clean(&self->mutex);
+}
+
+/* This method adds a key-value pair to the tree. If the key already exists, the
+ * pair is replaced.
+ */
+void kprb_tree_add(kprb_tree *self, void *key, void *value) {
+    struct kprb_node *root = self->root_node;
+
+    /* The new version of the tree holds its own reference on the current root,
+     * so the current root is copied rather than modified.
+     */
+    kprb_node_ref(root);
+    root = kprb_tree_insert(self, root, key, value);
+    root->color = 0;
+    kprb_tree_publish(self, root);
+}
+
+/* This method removes the pair corresponding to the key specified, if any. If
+ * the pair exists, its value is returned, otherwise NULL is returned.
+ */
+void * kprb_tree_remove(kprb_tree *self, void *key) {
+    struct kprb_node *root;
+    struct kprb_node *node = kprb_tree_find(self->root_node, self->cmp_func, key);
+    void *value;
+
+    if (node == NULL) return NULL;
+    value = node->value;
+
+    /* See kprb_tree_add(). */
+    root = self->root_node;
+    kprb_node_ref(root);
+    root = kprb_node_touch(root);
+
+    if (! kprb_node_is_red(root->left) && ! kprb_node_is_red(root->right)) {
+        root->color = 1;
+    }
+
+    root = kprb_tree_delete(self, root, key);
+    if (root) root->color = 0;
+    kprb_tree_publish(self, root);
+
+    return value;
+}
+
+/* This method returns the value corresponding to the key specified if it
+ * exists. Otherwise NULL is returned. Only the writer can call this method.
+ */
+void * kprb_tree_get(kprb_tree *self, void *key) {
+    struct kprb_node *node = kprb_tree_find(self->root_node, self->cmp_func, key);
+    if (node == NULL) return NULL;
+    return node->value;
+}
+
+/* This method takes a snapshot of the tree. The snapshot must be released with
+ * kprb_snapshot_release().
+ */
+void kprb_tree_snapshot(kprb_tree *self, struct kprb_snapshot *snapshot) {
+    kmutex_lock(&self->mutex);
+    snapshot->root_node = self->root_node;
+    kprb_node_ref(snapshot->root_node);
+    kmutex_unlock(&self->mutex);
+    snapshot->cmp_func = self->cmp_func;
+}
+
+/* This function releases the snapshot specified. */
+void kprb_snapshot_release(struct kprb_snapshot *snapshot) {
+    kprb_node_unref(snapshot->root_node);
+    snapshot->root_node = NULL;
+}
+
+/* This method returns the node corresponding to the key specified, or NULL if
+ * the key cannot be found.
+ */
+struct kprb_node * kprb_snapshot_get_node(struct kprb_snapshot *self, void *key) {
+    return kprb_tree_find(self->root_node, self->cmp_func, key);
+}
+
+/* This method returns the node corresponding to the index specified (from 0 to
+ * size - 1). The method assumes that the index is valid.
+ */
+struct kprb_node * kprb_snapshot_get_node_by_index(struct kprb_snapshot *self, int index) {
+    struct kprb_node *node = self->root_node;
+
+    assert(index >= 0 && index <= kprb_snapshot_size(self) - 1);
+
+    while (1) {
+        int left_size = kprb_node_size(node->left);
+
+        /* We found it. */
+        if (index == left_size) return node;
+
+        /* The node we look for is at the left. */
+        else if (index < left_size) {
+            node = node->left;
+        }
+
+        /* The node we look for is at the right. */
+        else {
+            index -= left_size + 1;
+            node = node->right;
+        }
+    }
+}
+
+/* This method verifies the internal consistency of the snapshot. */
+void kprb_snapshot_check_consistency(struct kprb_snapshot *self) {
+    if (self->root_node == NULL) return;
+    assert(self->root_node->color == 0);
+    kprb_snapshot_check_consistency_helper(self, self->root_node);
+}
+
+/* This function initializes an iterator over the nodes of the snapshot
+ * specified. The iterator is valid as long as the snapshot is not released.
+ */
+void kprb_iter_start(struct kprb_snapshot *snapshot, struct kprb_iter *iter) {
+    struct kprb_node *node;
+
+    iter->depth = 0;
+
+    for (node = snapshot->root_node; node; node = node->left) {
+        assert(iter->depth < KPRB_MAX_HEIGHT);
+        iter->stack[iter->depth++] = node;
+    }
+}
+
+/* This function returns the next node of the iteration, or NULL if there are
+ * no more nodes.
+ */
+struct kprb_node * kprb_iter_next(struct kprb_iter *iter) {
+    struct kprb_node *node, *cur;
+
+    if (iter->depth == 0) return NULL;
+    node = iter->stack[--iter->depth];
+
+    for (cur = node->right; cur; cur = cur->left) {
+        assert(iter->depth < KPRB_MAX_HEIGHT);
+        iter->stack[iter->depth++] = cur;
+    }
+
+    return node;
+}
@@ -0,0 +1,139 @@
+/**
+ * src/kprb_tree.h
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ */
+
+#ifndef __KPRB_TREE_H__
+#define __KPRB_TREE_H__
+
+#include "kthread.h"
+
+/* Struct kprb_tree is a persistent red-black tree. Like krb_tree, it maintains
+ * a set of ordered key-value pairs and it uses the same comparison functions
+ * (e.g. krb_tree_int_cmp()). Unlike krb_tree, the nodes are never modified
+ * once they have been published: the writer copies the path from the root to
+ * the nodes it modifies, and publishes the new root when it is done.
+ *
+ * This allows reader threads to take a snapshot of the tree in O(1) time. A
+ * snapshot is an immutable view of the tree as it was when the snapshot was
+ * taken. The readers can search and iterate over the snapshot for as long as
+ * they wish without blocking the writer, and the writer never blocks the
+ * readers for more than the time required to swap the root pointer.
+ *
+ * The nodes are reference counted. A node is freed when the last tree version
+ * referencing it goes away, i.e. when the writer has replaced it and all the
+ * snapshots containing it have been released.
+ *
+ * Usage notes:
+ * - Only one thread may modify the tree at a time. The modification methods
+ *   (add, remove, clean) and kprb_tree_get() must be called by the writer.
+ * - The keys and values are not owned by the tree. They must stay valid as long
+ *   as a snapshot referencing them may exist.
+ *
+ * Implementation note:
+ * The tree is a left-leaning red-black tree. Its height is at most 2 lg(n), so
+ * all the operations are O(lg(n)). A modification allocates O(lg(n)) nodes.
+ * The nodes created by the current modification are not shared yet (their
+ * reference count is 1), so they are modified in place instead of being copied
+ * again.
+ */
+
+/* Maximum height of the tree. This is enough for 2^32 nodes. */
+#define KPRB_MAX_HEIGHT 64
+
+/* Persistent red-black tree node. */
+struct kprb_node {
+
+    /* Pointer to the left and right nodes. There are no parent pointers since a
+     * node may belong to several versions of the tree.
+     */
+    struct kprb_node *left;
+    struct kprb_node *right;
+
+    /* Key contained in this node. Do not modify. */
+    void *key;
+
+    /* The value corresponding to the key. Do not modify. */
+    void *value;
+
+    /* Number of references to this node (parent nodes, tree and snapshots). */
+    int ref_count;
+
+    /* Size of this node's subtree. */
+    int size;
+
+    /* Color of this node. */
+    char color;
+};
+
+/* Persistent red-black tree. */
+typedef struct kprb_tree {
+
+    /* The published root, or NULL if the tree is empty. */
+    struct kprb_node *root_node;
+
+    /* The comparison function. */
+    int (*cmp_func) (void *, void *);
+
+    /* Mutex protecting the root pointer. It is never held for more than a few
+     * instructions.
+     */
+    struct kmutex mutex;
+
+} kprb_tree;
+
+/* Immutable view of a tree. */
+struct kprb_snapshot {
+
+    /* The root of the snapshot, or NULL if the tree was empty. */
+    struct kprb_node *root_node;
+
+    /* The comparison function of the tree. */
+    int (*cmp_func) (void *, void *);
+};
+
+/* Iterator over the nodes of a snapshot, in order. */
+struct kprb_iter {
+
+    /* Stack of the nodes whose left subtree is being visited. */
+    struct kprb_node *stack[KPRB_MAX_HEIGHT];
+
+    /* Number of nodes in the stack. */
+    int depth;
+};
+
+void kprb_tree_init(kprb_tree *self, int (*cmp_func) (void *, void *));
+void kprb_tree_clean(kprb_tree *self);
+void kprb_tree_add(kprb_tree *self, void *key, void *value);
+void * kprb_tree_remove(kprb_tree *self, void *key);
+void * kprb_tree_get(kprb_tree *self, void *key);
+void kprb_tree_snapshot(kprb_tree *self, struct kprb_snapshot *snapshot);
+void kprb_snapshot_release(struct kprb_snapshot *snapshot);
+struct kprb_node * kprb_snapshot_get_node(struct kprb_snapshot *self, void *key);
+struct kprb_node * kprb_snapshot_get_node_by_index(struct kprb_snapshot *self, int index);
+void kprb_snapshot_check_consistency(struct kprb_snapshot *self);
+void kprb_iter_start(struct kprb_snapshot *snapshot, struct kprb_iter *iter);
+struct kprb_node * kprb_iter_next(struct kprb_iter *iter);
+
+/* This method returns the tree size. Only the writer can call this method. */
+static inline int kprb_tree_size(kprb_tree *self) {
+    if (self->root_node == NULL) return 0;
+    return self->root_node->size;
+}
+
+/* This method returns the size of the snapshot. */
+static inline int kprb_snapshot_size(struct kprb_snapshot *self) {
+    if (self->root_node == NULL) return 0;
+    return self->root_node->size;
+}
+
+/* This method returns the value corresponding to the key specified if it
+ * exists in the snapshot. Otherwise NULL is returned.
+ */
+static inline void * kprb_snapshot_get(struct kprb_snapshot *self, void *key) {
+    struct kprb_node *node = kprb_snapshot_get_node(self, key);
+    if (node == NULL) return NULL;
+    return node->value;
+}
+
+#endif
@@ -40,9 +40,14 @@ static void krb_tree_left_rotate(krb_tree *self, struct krb_node *node) {
     y->left = node;
     node->parent = y;
 
-    /* Update sizes. */
+    /* Update sizes and augmented data. */
     y->size = node->size;
     node->size = node->left->size + node->right->size + 1;
+
+    if (self->augment_func) {
+        self->augment_func(node, self->root_node->parent);
+        self->augment_func(y, self->root_node->parent);
+    }
 }
 
 /* This method rotates the tree right at the node specified. */
@@ -74,9 +79,116 @@ static void krb_tree_right_rotate(krb_tree *self, struct krb_node *node) {
     y->right = node;
     node->parent = y;
 
-    /* Update sizes. */
+    /* Update sizes and augmented data. */
     y->size = node->size;
     node->size = node->left->size + node->right->size + 1;
+
+    if (self->augment_func) {
+        self->augment_func(node, self->root_node->parent);
+        self->augment_func(y, self->root_node->parent);
+    }
+}
+
+/* This method recomputes the augmented data of the node specified and of its
+ * ancestors, if the tree is augmented.
+ */
+static void krb_tree_augment_path(krb_tree *self, struct krb_node *node) {
+    struct krb_node *nil = self->root_node->parent;
+    if (self->augment_func == NULL) return;
+    for (; node != nil; node = node->parent) self->augment_func(node, nil);
+}
+
+/* This method restores the red-black properties of the tree after the red node
+ * specified has been linked in the tree. The method returns true if the
+ * black-height of the tree has increased.
+ */
+static int krb_tree_insert_fixup(krb_tree *self, struct krb_node *node) {
+    int grown;
+
+    while (node->parent->color) {
+
+        /* The parent node of this node is the left node of its parent. */
+        if (node->parent == node->parent->parent->left) {
+
+            /* Get the uncle of this node. */
+            struct krb_node *uncle = node->parent->parent->right;
+
+            /* Case 1: uncle is red. Color the uncle's parent red and keep
+             * going.
+             */
+            if (uncle->color) {
+                node->parent->color = 0;
+                uncle->color = 0;
+
+                node = node->parent->parent;
+                node->color = 1;
+            }
+
+            /* Case 2 and 3: uncle is black. Fix and stop. */
+            else {
+
+                /* Case 2. Node is the right child of its parent. We'll perform
+                 * a swap to fall in case 3.
+                 */
+                if (node == node->parent->right) {
+                    node = node->parent;
+                    krb_tree_left_rotate(self, node);
+                }
+
+                /* Case 3. Node is the left child of its parent. Color correctly
+                 * (except root perhaps).
+                 */
+                node->parent->color = 0;
+                node->parent->parent->color = 1;
+                krb_tree_right_rotate(self, node->parent->parent);
+                break;
+            }
+        }
+
+        /* The parent node of this node is the right node of its parent. This
+         * code is symmetric with above.
+         */
+        else {
+            /* Get the uncle of this node. */
+            struct krb_node *uncle = node->parent->parent->left;
+
+            /* Case 1: uncle is red. Color the uncle's parent red and keep
+             * going.
+             */
+            if (uncle->color) {
+                node->parent->color = 0;
+                uncle->color = 0;
+
+                node = node->parent->parent;
+                node->color = 1;
+            }
+
+            /* Case 2 and 3: uncle is black. Fix and stop. */
+            else {
+
+                /* Case 2. Node is the left child of its parent. We'll perform a
+                 * swap to fall in case 3.
+                 */
+                if (node == node->parent->left) {
+                    node = node->parent;
+                    krb_tree_right_rotate(self, node);
+                }
+
+                /* Case 3. Node is the right child of its parent. Color
+                 * correctly (except root perhaps).
+                 */
+                node->parent->color = 0;
+                node->parent->parent->color = 1;
+                krb_tree_left_rotate(self, node->parent->parent);
+                break;
+            }
+        }
+    }
+
+    /* We have to color the root black in case it was colored red. */
+    grown = self->root_node->color;
+    self->root_node->color = 0;
+    return grown;
 }
 
 /* Helper method for krb_tree_reset(). */
@@ -124,6 +236,202 @@ static int krb_tree_check_consistency_helper(krb_tree *self, struct krb_node *no
     return (left_black + 1);
 }
 
+/* This method returns the black-height of the subtree specified, counting the
+ * root of the subtree if it is black but not the nil node.
+ */
+static int krb_tree_black_height(struct krb_node *node, struct krb_node *nil) {
+    int height = 0;
+
+    for (; node != nil; node = node->left) {
+        if (node->color == 0) height++;
+    }
+
+    return height;
+}
+
+/* This method joins the subtrees 'left' and 'right' using 'node' as the glue.
+ * All the keys of 'left' must come before the key of 'node', which must come
+ * before all the keys of 'right'. 'left_height' and 'right_height' are the
+ * black-heights of the subtrees. The root of the joined tree is returned and
+ * its black-height is stored in 'height'. The joined tree is valid by itself,
+ * i.e. its root is black and its parent is nil. The cost is proportional to the
+ * difference of black-height between the subtrees.
+ */
+static struct krb_node * krb_tree_join(krb_tree *self, struct krb_node *nil,
+                                       struct krb_node *left, int left_height,
+                                       struct krb_node *node,
+                                       struct krb_node *right, int right_height,
+                                       int *height) {
+    krb_tree tmp = *self;
+    struct krb_node *parent, *cur;
+    int cur_height;
+
+    /* Detach the subtrees and make their roots black. */
+    if (left != nil) {
+        left->parent = nil;
+        if (left->color) { left->color = 0; left_height++; }
+    }
+
+    if (right != nil) {
+        right->parent = nil;
+        if (right->color) { right->color = 0; right_height++; }
+    }
+
+    /* The subtrees have the same black-height. The node becomes the black root
+     * of the joined tree.
+     */
+    if (left_height == right_height) {
+        node->parent = nil;
+        node->left = left;
+        node->right = right;
+        node->color = 0;
+        node->size = left->size + right->size + 1;
+        if (left != nil) left->parent = node;
+        if (right != nil) right->parent = node;
+        if (self->augment_func) self->augment_func(node, nil);
+        *height = left_height + 1;
+        return node;
+    }
+
+    /* The left subtree is higher. Walk down its right spine until we find a
+     * black node having the same black-height as the right subtree. That node
+     * becomes the left child of the (red) node, the right subtree becomes its
+     * right child.
+     */
+    if (left_height > right_height) {
+        parent = nil;
+        cur = left;
+        cur_height = left_height;
+
+        while (cur->color || cur_height != right_height) {
+            if (cur->color == 0) cur_height--;
+            cur->size += right->size + 1;
+            parent = cur;
+            cur = cur->right;
+        }
+
+        parent->right = node;
+        node->left = cur;
+        node->right = right;
+        tmp.root_node = left;
+        *height = left_height;
+    }
+
+    /* The right subtree is higher. This code is symmetric with above. */
+    else {
+        parent = nil;
+        cur = right;
+        cur_height = right_height;
+
+        while (cur->color || cur_height != left_height) {
+            if (cur->color == 0) cur_height--;
+            cur->size += left->size + 1;
+            parent = cur;
+            cur = cur->left;
+        }
+
+        parent->left = node;
+        node->left = left;
+        node->right = cur;
+        tmp.root_node = right;
+        *height = right_height;
+    }
+
+    /* Link the node as a red node and restore the red-black properties. */
+    node->parent = parent;
+    node->color = 1;
+    node->size = node->left->size + node->right->size + 1;
+    if (node->left != nil) node->left->parent = node;
+    if (node->right != nil) node->right->parent = node;
+    krb_tree_augment_path(&tmp, node);
+    if (krb_tree_insert_fixup(&tmp, node)) (*height)++;
+
+    return tmp.root_node;
+}
+
+/* This method splits the subtree specified, of black-height 'height', in two
+ * trees. The nodes having a key that comes before the key specified (or that is
+ * equal to the key specified if 'inclusive' is true) go in the left tree, the
+ * other nodes go in the right tree. The roots and black-heights of the trees
+ * are stored in the last four arguments.
+ */
+static void krb_tree_split(krb_tree *self, struct krb_node *node, int height, struct krb_node *nil,
+                           void *key, int inclusive,
+                           struct krb_node **left, int *left_height,
+                           struct krb_node **right, int *right_height) {
+    struct krb_node *sub_left, *sub_right;
+    int sub_left_height, sub_right_height, order;
+
+    /* Nothing to split. */
+    if (node == nil) {
+        *left = *right = nil;
+        *left_height = *right_height = 0;
+        return;
+    }
+
+    /* The black-height of the children of the node. */
+    if (node->color == 0) height--;
+
+    order = self->cmp_func(node->key, key);
+
+    /* The node goes left. Split its right subtree and join the left part. */
+    if (order < 0 || (inclusive && order == 0)) {
+        sub_left = node->left;
+        krb_tree_split(self, node->right, height, nil, key, inclusive,
+                       &sub_right, &sub_right_height, right, right_height);
+        *left = krb_tree_join(self, nil, sub_left, height, node, sub_right, sub_right_height, left_height);
+    }
+
+    /* The node goes right. Split its left subtree and join the right part. */
+    else {
+        sub_right = node->right;
+        krb_tree_split(self, node->left, height, nil, key, inclusive,
+                       left, left_height, &sub_left, &sub_left_height);
+        *right = krb_tree_join(self, nil, sub_left, sub_left_height, node, sub_right, height, right_height);
+    }
+}
+
+/* Helper method for krb_tree_remove_range(). This method makes the nodes of the
+ * subtree specified point to the new nil node specified.
+ */
+static void krb_tree_move_helper(struct krb_node *node, struct krb_node *old_nil, struct krb_node *new_nil) {
+    if (node->left == old_nil) node->left = new_nil;
+    else krb_tree_move_helper(node->left, old_nil, new_nil);
+
+    if (node->right == old_nil) node->right = new_nil;
+    else krb_tree_move_helper(node->right, old_nil, new_nil);
+}
+
+/* This method returns the number of keys in the tree that come before the key
+ * specified, or that are equal to the key specified if 'inclusive' is true.
+ */
+static int krb_tree_rank(krb_tree *self, void *key, int inclusive) {
+    struct krb_node *node, *nil;
+    int rank = 0;
+
+    if (self->root_node == NULL) return 0;
+
+    node = self->root_node;
+    nil = self->root_node->parent;
+
+    while (node != nil) {
+        int order = self->cmp_func(node->key, key);
+
+        /* The node and its left subtree are counted. Go right. */
+        if (order < 0 || (inclusive && order == 0)) {
+            rank += node->left->size + 1;
+            node = node->right;
+        }
+
+        /* Go left. */
+        else {
+            node = node->left;
+        }
+    }
+
+    return rank;
+}
+
 /* This method returns the node corresponding to the key specified, or NULL if
  * the key cannot be found.
  */
@@ -256,6 +564,111 @@ void * krb_tree_iter_next(krb_tree *self, struct krb_node **iter_handle) {
     return (*iter_handle)->value;
 }
 
+/* This method returns the successor of the node specified, or NULL if the node
+ * is the last node of the tree.
+ */
+struct krb_node * krb_tree_get_next(krb_tree *self, struct krb_node *node) {
+    struct krb_node *nil = self->root_node->parent;
+
+    /* The node has a right subtree, get the minimum node in it. */
+    if (node->right != nil) {
+        node = node->right;
+        while (node->left != nil) node = node->left;
+        return node;
+    }
+
+    /* Get the first parent for which the current node is a left node. Note
+     * that nil->right may point to the root, so we check for nil first.
+     */
+    while (node->parent != nil && node == node->parent->right) node = node->parent;
+    if (node->parent == nil) return NULL;
+    return node->parent;
+}
+
+/* This method returns the first node having a key that does not come before the
+ * key specified, or NULL if there is no such node.
+ */
+struct krb_node * krb_tree_lower_bound(krb_tree *self, void *key) {
+    struct krb_node *node, *nil, *bound = NULL;
+
+    if (self->root_node == NULL) return NULL;
+
+    node = self->root_node;
+    nil = self->root_node->parent;
+
+    while (node != nil) {
+
+        /* The node is a candidate. Look for a better one at the left. */
+        if (self->cmp_func(key, node->key) <= 0) {
+            bound = node;
+            node = node->left;
+        }
+
+        /* Go right. */
+        else {
+            node = node->right;
+        }
+    }
+
+    return bound;
+}
+
+/* This method returns the first node having a key that comes after the key
+ * specified, or NULL if there is no such node.
+ */
+struct krb_node * krb_tree_upper_bound(krb_tree *self, void *key) {
+    struct krb_node *node, *nil, *bound = NULL;
+
+    if (self->root_node == NULL) return NULL;
+
+    node = self->root_node;
+    nil = self->root_node->parent;
+
+    while (node != nil) {
+
+        /* The node is a candidate. Look for a better one at the left. */
+        if (self->cmp_func(key, node->key) < 0) {
+            bound = node;
+            node = node->left;
+        }
+
+        /* Go right. */
+        else {
+            node = node->right;
+        }
+    }
+
+    return bound;
+}
+
+/* This method returns the first node of the range [low_key, high_key], or NULL
+ * if the range is empty. Use krb_tree_range_next() to get the other nodes of
+ * the range:
+ *
+ * for (node = krb_tree_range_start(tree, low, high); node;
+ *      node = krb_tree_range_next(tree, node, high)) { ... }
+ */
+struct krb_node * krb_tree_range_start(krb_tree *self, void *low_key, void *high_key) {
+    struct krb_node *node = krb_tree_lower_bound(self, low_key);
+    if (node == NULL || self->cmp_func(node->key, high_key) > 0) return NULL;
+    return node;
+}
+
+/* This method returns the node following the node specified in the range ending
+ * at 'high_key', or NULL if the end of the range has been reached.
+ */
+struct krb_node * krb_tree_range_next(krb_tree *self, struct krb_node *node, void *high_key) {
+    node = krb_tree_get_next(self, node);
+    if (node == NULL || self->cmp_func(node->key, high_key) > 0) return NULL;
+    return node;
+}
+
+/* This method returns the number of nodes in the range [low_key, high_key]. */
+int krb_tree_count_range(krb_tree *self, void *low_key, void *high_key) {
+    if (self->cmp_func(low_key, high_key) > 0) return 0;
+    return krb_tree_rank(self, high_key, 1) - krb_tree_rank(self, low_key, 0);
+}
+
 /* This method adds a key-value pair to the tree. If the pair already exists,
  * the method replaces it. The node is returned.
  */
@@ -282,11 +695,49 @@ struct krb_node* krb_tree_add(krb_tree *self, void *key, void *value) {
  * key is not already in the tree. The node is returned.
  */
 struct krb_node* krb_tree_add_fast(krb_tree *self, void *key, void *value) {	
-    struct krb_node *ret_node, *node, *nil;
+    struct krb_node *node, *parent = NULL, *nil;
+    int order = 0;
+
+    /* Find position to insert, starting at the root. */
+    if (self->root_node != NULL) {
+        parent = self->root_node;
+        nil = self->root_node->parent;
+
+        while (1) {
+
+            /* Compare the key to add with the key of the current node. */
+            order = self->cmp_func(key, parent->key);
+            assert(order != 0);
+
+            /* Go left or right. */
+            node = (order < 0) ? parent->left : parent->right;
+            if (node == nil) break;
+            parent = node;
+        }
+    }
+
+    /* Create the node and link it. */
+    node = krb_node_new();
+    node->key = key;
+    node->value = value;
+    krb_tree_link_node(self, node, parent, order < 0);
+
+    return node;
+}
+
+/* This method links the node specified in the tree, as the left child of
+ * 'parent' if 'left_flag' is true, or as its right child otherwise. The child
+ * must be nil. If the tree is empty, 'parent' is ignored and the node becomes
+ * the root. The key and value of the node must be set by the caller, and the
+ * key must respect the order of the tree. This method does not allocate
+ * anything except the nil node when the tree is empty. It allows the caller to
+ * allocate the nodes itself, e.g. within a larger structure.
+ */
+void krb_tree_link_node(krb_tree *self, struct krb_node *node, struct krb_node *parent, int left_flag) {
+    struct krb_node *nil;
 
-    /* There is no root. Create it (with nil node) and return. */
+    /* There is no root. Create the nil node and make the node the root. */
     if (self->root_node == NULL) {
-        self->root_node = krb_node_new();
         nil = krb_node_new();
 
         /* nil is black and has size 0. The other fields are best left
@@ -298,358 +749,352 @@ struct krb_node* krb_tree_add_fast(krb_tree *self, void *key, void *value) {
         /* The root is black, and its parent, left and right pointers point to
          * the nil node.
          */
-        krb_node_set(self->root_node, key, value, nil, nil, nil, 0);
-
-        return self->root_node;
+        krb_node_set(node, node->key, node->value, nil, nil, nil, 0);
+        self->root_node = node;
+        if (self->augment_func) self->augment_func(node, nil);
+        return;
     }
 
-    /* Find position to insert, starting at the root. */
-    node = self->root_node;
+    /* Link the node as a red leaf. */
     nil = self->root_node->parent;
+    krb_node_set(node, node->key, node->value, parent, nil, nil, 1);
 
-    while (1) {
+    if (left_flag) {
+        assert(parent->left == nil);
+        parent->left = node;
+    }
 
-        /* Increment the size of the current node. */
-        node->size++;
+    else {
+        assert(parent->right == nil);
+        parent->right = node;
+    }
 
-        /* Compare the key to add with the key of the current node. */
-        int order = self->cmp_func(key, node->key);
+    /* Increment the size of the nodes from the parent up to the root. */
+    for (; parent != nil; parent = parent->parent) parent->size++;
 
-        /* Go left. */
-        if (order < 0) {
-            if (node->left == nil) {
-                node->left = krb_node_new();
-                krb_node_set(node->left, key, value, node, nil, nil, 1);
-                node = node->left;
-                break;
-            }
+    /* Update the augmented data of the node and its ancestors. */
+    krb_tree_augment_path(self, node);
 
-            node = node->left;
-        }
+    /* Restore red-black properties. */
+    krb_tree_insert_fixup(self, node);
+}
 
-        /* Go right. */
-        else {
-            assert(order != 0);
+/* This method removes the node corresponding to the key specified, if any. If
+ * the node exists, its value is returned, otherwise NULL is returned.
+ */
+void * krb_tree_remove(krb_tree *self, void *key) {
+    void *value;
 
-            if (node->right == nil) {
-                node->right = krb_node_new();
-                krb_node_set(node->right, key, value, node, nil, nil, 1);
-                node = node->right;
-                break;
-            }
+    /* Get the node. */
+    struct krb_node *node = krb_tree_get_node(self, key);
 
-            node = node->right;
-        }
-    }
-    
-    /* Remember the node to return. */
-    ret_node = node;
+    /* Not found. */
+    if (node == NULL) return NULL;
 
-    /* Restore red-black properties. */
-    while (node->parent->color) {
+    /* Get the data. */
+    value = node->value;
 
-        /* The parent node of this node is the left node of its parent. */
-        if (node->parent == node->parent->parent->left) {
+    /* Remove the node. */
+    krb_tree_remove_node(self, node);
 
-            /* Get the uncle of this node. */
-            struct krb_node *uncle = node->parent->parent->right;
+    return value;
+}
 
-            /* Case 1: uncle is red. Color the uncle's parent red and keep
-             * going.
+/* This method removes the node corresponding to the index specified (from 0 to
+ * size - 1). The method assumes that the index is valid. The value of the node
+ * is returned.
+ */
+void * krb_tree_remove_by_index(krb_tree *self, int index) {
+
+    /* Get the node and the data. */
+    struct krb_node *node = krb_tree_get_node_by_index(self, index);
+    void *value = node->value;
+
+    /* Remove the node. */
+    krb_tree_remove_node(self, node);
+
+    return value;
+}
+
+/* This method restores the red-black properties of the tree after a black node
+ * has been unlinked from the tree. 'x' is the node (possibly nil) that took the
+ * place of the node unlinked.
+ */
+static void krb_tree_remove_fixup(krb_tree *self, struct krb_node *x) {
+
+    /* This loop finishes any time we do not enter directly in case 2. */
+    while (x != self->root_node && x->color == 0) {
+
+        /* X is the left child of its parent. */
+        if (x == x->parent->left) {
+
+            /* Get X's parent and uncle. */
+            struct krb_node *parent = x->parent;
+            struct krb_node *uncle = parent->right;
+
+            /* Case 1: the uncle is red. We'll exit the loop through cases
+             * 2, 3 or 4.
              */
             if (uncle->color) {
-                node->parent->color = 0;
                 uncle->color = 0;
+                parent->color = 1;
+                krb_tree_left_rotate(self, parent);
+                uncle = parent->right;
+            }
 
-                node = node->parent->parent;
-                node->color = 1;
+            /* Case 2: Both the children of the uncle are black. */
+            if (uncle->left->color == 0 && uncle->right->color == 0) {	
+                uncle->color = 1;
+                x = parent;
             }
 
-            /* Case 2 and 3: uncle is black. Fix and stop. */
+            /* Case 3 and 4. */
             else {
 
-                /* Case 2. Node is the right child of its parent. We'll perform
-                 * a swap to fall in case 3.
-                 */
-                if (node == node->parent->right) {
-                    node = node->parent;
-                    krb_tree_left_rotate(self, node);
+                /* Case 3: the right child of the uncle is black. */
+                if (uncle->right->color == 0) {
+                    uncle->left->color = 0;
+                    uncle->color = 1;
+                    krb_tree_right_rotate(self, uncle);
+                    uncle = parent->right;
                 }
 
-                /* Case 3. Node is the left child of its parent. Color correctly
-                 * (except root perhaps).
-                 */
-                node->parent->color = 0;
-                node->parent->parent->color = 1;
-                krb_tree_right_rotate(self, node->parent->parent);
-                break;
+                /* Case 4: the right child of the uncle is red. */
+                uncle->color = parent->color;
+                parent->color = 0;
+                uncle->right->color = 0;
+                krb_tree_left_rotate(self, parent);
+                x = self->root_node;
             }
         }
 
-        /* The parent node of this node is the right node of its parent. This
-         * code is symmetric with above.
-         */
+        /* X is the right child of its parent. */
         else {
-            /* Get the uncle of this node. */
-            struct krb_node *uncle = node->parent->parent->left;
+            /* Get X's parent and uncle. */
+            struct krb_node *parent = x->parent;
+            struct krb_node *uncle = parent->left;
 
-            /* Case 1: uncle is red. Color the uncle's parent red and keep
-             * going.
+            /* Case 1: the uncle is red. We'll exit the loop through cases
+             * 2, 3 or 4.
              */
             if (uncle->color) {
-                node->parent->color = 0;
                 uncle->color = 0;
+                parent->color = 1;
+                krb_tree_right_rotate(self, parent);
+                uncle = parent->left;
+            }
 
-                node = node->parent->parent;
-                node->color = 1;
+            /* Case 2: Both the children of the uncle are black. */
+            if (uncle->right->color == 0 && uncle->left->color == 0) {
+                uncle->color = 1;
+                x = parent;
             }
 
-            /* Case 2 and 3: uncle is black. Fix and stop. */
+            /* Case 3 and 4. */
             else {
 
-                /* Case 2. Node is the left child of its parent. We'll perform a
-                 * swap to fall in case 3.
-                 */
-                if (node == node->parent->left) {
-                    node = node->parent;
-                    krb_tree_right_rotate(self, node);
+                /* Case 3: the left child of the uncle is black. */
+                if (uncle->left->color == 0) {
+                    uncle->right->color = 0;
+                    uncle->color = 1;
+                    krb_tree_left_rotate(self, uncle);
+                    uncle = parent->left;
                 }
 
-                /* Case 3. Node is the right child of its parent. Color
-                 * correctly (except root perhaps).
-                 */
-                node->parent->color = 0;
-                node->parent->parent->color = 1;
-                krb_tree_left_rotate(self, node->parent->parent);
-                break;
+                /* Case 4: the left child of the uncle is red. */
+                uncle->color = parent->color;
+                parent->color = 0;
+                uncle->left->color = 0;
+                krb_tree_right_rotate(self, parent);
+                x = self->root_node;
             }
         }
     }
 
-    /* We have to color the root black in case it was colored red. */
-    self->root_node->color = 0;
-    
-    return ret_node;
+    /* Color X black. */
+    x->color = 0;
 }
 
-/* This method removes the node corresponding to the key specified, if any. If
- * the node exists, its value is returned, otherwise NULL is returned.
+/* This method replaces the subtree rooted at 'u' by the subtree rooted at 'v'.
+ * Note that 'v' might be nil; its parent pointer is set nevertheless, since
+ * krb_tree_remove_fixup() relies on it.
  */
-void * krb_tree_remove(krb_tree *self, void *key) {
-    void *value;
-
-    /* Get the node. */
-    struct krb_node *node = krb_tree_get_node(self, key);
-
-    /* Not found. */
-    if (node == NULL) return NULL;
-
-    /* Get the data. */
-    value = node->value;
-
-    /* Remove the node. */
-    krb_tree_remove_node(self, node);
-
-    return value;
+static void krb_tree_transplant(krb_tree *self, struct krb_node *u, struct krb_node *v, struct krb_node *nil) {
+    if (u->parent == nil) self->root_node = v;
+    else if (u == u->parent->left) u->parent->left = v;
+    else u->parent->right = v;
+    v->parent = u->parent;
 }
 
-/* This method removes the node corresponding to the index specified (from 0 to
- * size - 1). The method assumes that the index is valid. The value of the node
- * is returned.
+/* This method unlinks the node specified from the tree without destroying it.
+ * The other nodes of the tree are not modified, except for their links, so
+ * pointers to them remain valid. If the tree becomes empty, the root pointer is
+ * cleared but the nil node is not destroyed.
  */
-void * krb_tree_remove_by_index(krb_tree *self, int index) {
-
-    /* Get the node and the data. */
-    struct krb_node *node = krb_tree_get_node_by_index(self, index);
-    void *value = node->value;
-
-    /* Remove the node. */
-    krb_tree_remove_node(self, node);
-
-    return value;
-}
-
-/* This method removes a node from the tree. */
-void krb_tree_remove_node(krb_tree *self, struct krb_node *node) {
+void krb_tree_unlink_node(krb_tree *self, struct krb_node *node) {
 
     /* Get the nil node and get some temporary pointers. */
     struct krb_node *nil = self->root_node->parent;
     struct krb_node *y, *x;
+    int y_color;
 
-    /* Get the node that we will really remove to fill the gap left by the key
-     * removal. If this node has one or zero child, we use this node. Otherwise,
-     * we use this node's successor.
+    /* Get the node that is removed from its position in the tree. If the node
+     * has one or zero child, this is the node itself. Otherwise, this is the
+     * node's successor, which is guaranteed to have no left child, and which
+     * then takes the place of the node.
      */
     if (node->left == nil || node->right == nil) {
         y = node;
     }
 
     else {
-        /* The successor is guaranteed to have at most one child. */
-        y = krb_tree_get_successor(self, node);
+        y = node->right;
+        while (y->left != nil) y = y->left;
     }
 
-    /* Decrement the size of the nodes from y->parent up to the root. */
-    x = y->parent;
+    y_color = y->color;
 
-    while (x != nil) {
-        x->size--;
-        x= x->parent;
-    }
+    /* Decrement the size of the nodes from y->parent up to the root. */
+    for (x = y->parent; x != nil; x = x->parent) x->size--;
 
-    /* Get the child of the node we're about to remove (or nil). */
-    if (y->left != nil) {
-        x = y->left;
+    /* The node has at most one child. Replace the node by its child (or nil). */
+    if (y == node) {
+        x = (node->left != nil) ? node->left : node->right;
+        krb_tree_transplant(self, node, x, nil);
     }
 
+    /* Replace the successor by its right child (or nil), then replace the node
+     * by its successor.
+     */
     else {
         x = y->right;
-    }
-
-    /* Make the child (or nil) node points to the parent of the node we're about
-     * to remove.
-     */
-    x->parent = y->parent;
 
-    /* We're removing the root. */
-    if (y->parent == nil) {
-
-        /* If there's no child, we delete the nil and root nodes and clear the
-         * root node pointer.
-         */
-        if (x == nil) {
-            krb_node_destroy(nil);
-            krb_node_destroy(self->root_node);
-            self->root_node = NULL;
-            return;
+        if (y->parent == node) {
+            x->parent = y;
         }
 
-        /* Otherwise, we make the child the root. */
         else {
-            self->root_node = x;
-            assert(self->root_node->parent == nil);
+            krb_tree_transplant(self, y, x, nil);
+            y->right = node->right;
+            y->right->parent = y;
         }
-    }
 
-    /* The node we're removing is the left child of its parent. */
-    else if (y == y->parent->left) {
-        y->parent->left = x;
+        krb_tree_transplant(self, node, y, nil);
+        y->left = node->left;
+        y->left->parent = y;
+        y->color = node->color;
+        y->size = node->size;
     }
 
-    /* The node we're removing is the right child of its parent. */
-    else {
-        y->parent->right = x;
+    /* The tree is now empty. */
+    if (self->root_node == nil) {
+        self->root_node = NULL;
+        return;
     }
 
-    /* Copy the key and value if the node we're actually removing is not the
-     * node we wanted to remove initially.
+    /* Update the augmented data from the lowest position modified up to the
+     * root. Note that x->parent is set even if x is nil.
      */
-    if (y != node) {
-        node->key = y->key;
-        node->value = y->value;
-    }
+    krb_tree_augment_path(self, x->parent);
 
-    /* If the node we removed is black, the red-black properties are no longer
-     * respected. Fix them.
+    /* If the node removed from its position is black, the red-black properties
+     * are no longer respected. Fix them.
      */
-    if (y->color == 0) {
+    if (y_color == 0) krb_tree_remove_fixup(self, x);
 
-        /* This loop finishes any time we do not enter directly in case 2. */
-        while (x != self->root_node && x->color == 0) {
-
-            /* X is the left child of its parent. */
-            if (x == x->parent->left) {
+    assert(self->root_node->parent == nil && self->root_node != node);
+}
 
-                /* Get X's parent and uncle. */
-                struct krb_node *parent = x->parent;
-                struct krb_node *uncle = parent->right;
+/* This method removes a node from the tree and destroys it. The other nodes are
+ * not affected.
+ */
+void krb_tree_remove_node(krb_tree *self, struct krb_node *node) {
+    struct krb_node *nil = self->root_node->parent;
 
-                /* Case 1: the uncle is red. We'll exit the loop through cases
-                 * 2, 3 or 4.
-                 */
-                if (uncle->color) {
-                    uncle->color = 0;
-                    parent->color = 1;
-                    krb_tree_left_rotate(self, parent);
-                    uncle = parent->right;
-                }
+    /* Unlink and delete the node. */
+    krb_tree_unlink_node(self, node);
+    krb_node_destroy(node);
 
-                /* Case 2: Both the children of the uncle are black. */
-                if (uncle->left->color == 0 && uncle->right->color == 0) {	
-                    uncle->color = 1;
-                    x = parent;
-                }
+    /* Delete the nil node if the tree is now empty. */
+    if (self->root_node == NULL) krb_node_destroy(nil);
+}
 
-                /* Case 3 and 4. */
-                else {
+/* This method removes the nodes in the range [low_key, high_key] from the tree.
+ * If 'removed' is not NULL, the removed nodes are transferred to that tree,
+ * which must be empty and should use the same comparison function. Otherwise,
+ * the removed nodes are destroyed. The number of nodes removed is returned.
+ */
+int krb_tree_remove_range(krb_tree *self, void *low_key, void *high_key, krb_tree *removed) {
+    krb_tree tmp;
+    struct krb_node *nil, *before, *rest, *middle, *after, *first;
+    int before_height, rest_height, middle_height, after_height, height, count;
 
-                    /* Case 3: the right child of the uncle is black. */
-                    if (uncle->right->color == 0) {
-                        uncle->left->color = 0;
-                        uncle->color = 1;
-                        krb_tree_right_rotate(self, uncle);
-                        uncle = parent->right;
-                    }
+    if (self->root_node == NULL || self->cmp_func(low_key, high_key) > 0) return 0;
 
-                    /* Case 4: the right child of the uncle is red. */
-                    uncle->color = parent->color;
-                    parent->color = 0;
-                    uncle->right->color = 0;
-                    krb_tree_left_rotate(self, parent);
-                    x = self->root_node;
-                }
-            }
+    /* Split the tree in three parts: the nodes before the range, the nodes in
+     * the range and the nodes after the range.
+     */
+    nil = self->root_node->parent;
+    height = krb_tree_black_height(self->root_node, nil);
+    krb_tree_split(self, self->root_node, height, nil, low_key, 0,
+                   &before, &before_height, &rest, &rest_height);
+    krb_tree_split(self, rest, rest_height, nil, high_key, 1,
+                   &middle, &middle_height, &after, &after_height);
+    count = middle->size;
+
+    /* Join the nodes before and after the range. We need a node to glue the
+     * trees, so we unlink the first node of the nodes after the range.
+     */
+    if (before == nil) {
+        self->root_node = after;
+    }
 
-            /* X is the right child of its parent. */
-            else {
-                /* Get X's parent and uncle. */
-                struct krb_node *parent = x->parent;
-                struct krb_node *uncle = parent->left;
+    else if (after == nil) {
+        self->root_node = before;
+    }
 
-                /* Case 1: the uncle is red. We'll exit the loop through cases
-                 * 2, 3 or 4.
-                 */
-                if (uncle->color) {
-                    uncle->color = 0;
-                    parent->color = 1;
-                    krb_tree_right_rotate(self, parent);
-                    uncle = parent->left;
-                }
+    else {
+        first = after;
+        while (first->left != nil) first = first->left;
 
-                /* Case 2: Both the children of the uncle are black. */
-                if (uncle->right->color == 0 && uncle->left->color == 0) {
-                    uncle->color = 1;
-                    x = parent;
-                }
+        tmp = *self;
+        tmp.root_node = after;
+        krb_tree_unlink_node(&tmp, first);
+        after = (tmp.root_node == NULL) ? nil : tmp.root_node;
+        after_height = krb_tree_black_height(after, nil);
 
-                /* Case 3 and 4. */
-                else {
+        self->root_node = krb_tree_join(self, nil, before, before_height, first, after, after_height, &height);
+    }
 
-                    /* Case 3: the left child of the uncle is black. */
-                    if (uncle->left->color == 0) {
-                        uncle->right->color = 0;
-                        uncle->color = 1;
-                        krb_tree_left_rotate(self, uncle);
-                        uncle = parent->left;
-                    }
+    if (self->root_node == nil) self->root_node = NULL;
 
-                    /* Case 4: the left child of the uncle is red. */
-                    uncle->color = parent->color;
-                    parent->color = 0;
-                    uncle->left->color = 0;
-                    krb_tree_right_rotate(self, parent);
-                    x = self->root_node;
-                }
-            }
-        }
+    /* Transfer the removed nodes to the other tree with their own nil node. */
+    if (removed && middle != nil) {
+        assert(removed->root_node == NULL);
+        removed->root_node = middle;
+        middle->parent = krb_node_new();
+        middle->parent->color = 0;
+        middle->parent->size = 0;
+        krb_tree_move_helper(middle, nil, middle->parent);
+    }
 
-        /* Color X black. */
-        x->color = 0;
+    /* Destroy the removed nodes. */
+    else if (middle != nil) {
+        krb_tree_reset_helper(middle, nil);
     }
 
-    /* Delete the node we actually removed. */
-    assert(y != nil && self->root_node->parent == nil && self->root_node != y);
-    krb_node_destroy(y);
+    /* Destroy the nil node if the tree is now empty. */
+    if (self->root_node == NULL) krb_node_destroy(nil);
+
+    return count;
+}
+
+/* This method recomputes the augmented data of the node specified and of its
+ * ancestors. Call this method after modifying the data on which the augmented
+ * data of the node depends.
+ */
+void krb_tree_update_augment(krb_tree *self, struct krb_node *node) {
+    krb_tree_augment_path(self, node);
 }
 
 /* This method destroys all the nodes in the tree. */
@@ -7,6 +7,7 @@
 #define __KRB_TREE_H__
 
 #include <assert.h>
+#include <stddef.h>
 #include "kmem.h"
 
 /* Struct krb_tree is a red-black tree implementation. Such trees are always
@@ -20,6 +21,16 @@
  * key, and 0 if the keys are equal. By default, the code compares the keys by
  * address.
  *
+ * Range operations are also supported. The lower and upper bound searches and
+ * the range count are O(lg(n)), iterating over the k nodes of a range is
+ * O(k + lg(n)) and removing a range of k keys is O(k + lg(n)) (the tree is
+ * split and joined back in O(lg(n)), and the removed nodes are visited once to
+ * be freed or moved to the other tree).
+ *
+ * The tree can be augmented with data computed from the subtree of each node,
+ * like the subtree sizes used for the index operations. See
+ * krb_tree_set_augment_func().
+ *
  * Implementation note:
  * An effort was made to minimize the memory usage and initialization time of
  * empty trees. An empty tree contains only two pointers, the NULL root pointer
@@ -64,6 +75,9 @@ typedef struct krb_tree {
     /* The comparison function. */
     int (*cmp_func) (void *, void *);
 
+    /* The augmentation function, or NULL. See krb_tree_set_augment_func(). */
+    void (*augment_func) (struct krb_node *node, struct krb_node *nil);
+
 } krb_tree;
 
 static inline struct krb_node * krb_node_new() {
@@ -101,11 +115,21 @@ int krb_tree_get_node_index(krb_tree *self, struct krb_node *node);
 struct krb_node * krb_tree_get_successor(krb_tree *self, struct krb_node *node);
 struct krb_node * krb_tree_iter_start(krb_tree *self);
 void * krb_tree_iter_next(krb_tree *self, struct krb_node **iter_handle);
+struct krb_node * krb_tree_get_next(krb_tree *self, struct krb_node *node);
+struct krb_node * krb_tree_lower_bound(krb_tree *self, void *key);
+struct krb_node * krb_tree_upper_bound(krb_tree *self, void *key);
+struct krb_node * krb_tree_range_start(krb_tree *self, void *low_key, void *high_key);
+struct krb_node * krb_tree_range_next(krb_tree *self, struct krb_node *node, void *high_key);
+int krb_tree_count_range(krb_tree *self, void *low_key, void *high_key);
 struct krb_node* krb_tree_add(krb_tree *self, void *key, void *value);
 struct krb_node* krb_tree_add_fast(krb_tree *self, void *key, void *value);
+void krb_tree_link_node(krb_tree *self, struct krb_node *node, struct krb_node *parent, int left_flag);
+void krb_tree_unlink_node(krb_tree *self, struct krb_node *node);
 void * krb_tree_remove(krb_tree *self, void *key);
 void * krb_tree_remove_by_index(krb_tree *self, int index);
 void krb_tree_remove_node(krb_tree *self, struct krb_node *node);
+int krb_tree_remove_range(krb_tree *self, void *low_key, void *high_key, krb_tree *removed);
+void krb_tree_update_augment(krb_tree *self, struct krb_node *node);
 void krb_tree_reset(krb_tree *self);
 void krb_tree_check_consistency(krb_tree *self);
 int krb_tree_cmp(void *key_1, void *key_2);
@@ -117,12 +141,14 @@ int krb_tree_str_cmp(void *key_1, void *key_2);
 static inline void krb_tree_init(krb_tree *self) {
     self->root_node = NULL;
     self->cmp_func = krb_tree_int_cmp;
+    self->augment_func = NULL;
 }
 
 /* This function initializes the tree with the comparison function specified. */
 static inline void krb_tree_init_func(krb_tree *self, int (*cmp_func) (void *, void *)) {
     self->root_node = NULL;
     self->cmp_func = cmp_func;
+    self->augment_func = NULL;
 }
 
 /* This function cleans the tree. */
@@ -148,6 +174,19 @@ static inline void krb_tree_set_func(krb_tree *self, int (*cmp_func) (void *, vo
     self->cmp_func = cmp_func;
 }
 
+/* This function sets the augmentation function of the tree. The tree must be
+ * empty. The function is called with a node and the nil node whenever the
+ * children of the node change, after the children have been updated. It must
+ * recompute the augmented data of the node from the node and its children,
+ * e.g. the maximum of a value over the subtree. The children may be the nil
+ * node, which holds no data.
+ */
+static inline void krb_tree_set_augment_func(krb_tree *self,
+                                             void (*augment_func) (struct krb_node *, struct krb_node *)) {
+    assert(self->root_node == NULL);
+    self->augment_func = augment_func;
+}
+
 /* This method returns the tree size. */
 static inline int krb_tree_size(krb_tree *self) {
     if (self->root_node == NULL) return 0;
@@ -184,4 +223,143 @@ static inline void * krb_tree_get_by_index(krb_tree *self, int index) {
     return krb_tree_get_node_by_index(self, index)->value;
 }
 
+/* Typed trees with inline keys.
+ *
+ * KRB_TREE_DECLARE(name, key_t, val_t, cmp) declares a node type and a set of
+ * static inline functions operating on a krb_tree whose keys of type 'key_t'
+ * and values of type 'val_t' are stored inline in the nodes:
+ *
+ * struct name_node { struct krb_node rb; key_t key; val_t value; };
+ *
+ * The searches compare the keys directly with 'cmp', a function or macro that
+ * receives two keys by value and returns a negative number, 0 or a positive
+ * number like strcmp(). Use KRB_TREE_NUM_CMP for the integer types. There is
+ * no indirect call nor dereference of a separately allocated key. The
+ * rebalancing code is shared with krb_tree.
+ *
+ * The node's rb.key and rb.value fields point to its key and value fields, and
+ * the tree's comparison function is set to compare keys through pointers. Hence
+ * the generic krb_tree functions (ranges, indexes, iteration, etc.) can be used
+ * on typed trees as well, with pointers to 'key_t' as the keys. Do not use the
+ * generic add functions on typed trees, though.
+ *
+ * Example:
+ *
+ * KRB_TREE_DECLARE(u64_map, uint64_t, void *, KRB_TREE_NUM_CMP)
+ *
+ * krb_tree tree;
+ * u64_map_init(&tree);
+ * u64_map_add(&tree, 42, ptr);
+ * node = u64_map_get_node(&tree, 42);
+ */
+
+/* This macro compares two numbers. */
+#define KRB_TREE_NUM_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+
+#define KRB_TREE_DECLARE(name, key_t, val_t, cmp)                                           \
+                                                                                            \
+struct name##_node {                                                                        \
+    struct krb_node rb;                                                                     \
+    key_t key;                                                                              \
+    val_t value;                                                                            \
+};                                                                                          \
+                                                                                            \
+/* Comparison function used by the generic functions. */                                    \
+static inline int name##_key_cmp(void *key_1, void *key_2) {                                \
+    return cmp(*(key_t *) key_1, *(key_t *) key_2);                                         \
+}                                                                                           \
+                                                                                            \
+static inline void name##_init(krb_tree *self) {                                            \
+    krb_tree_init_func(self, name##_key_cmp);                                               \
+}                                                                                           \
+                                                                                            \
+static inline void name##_clean(krb_tree *self) {                                           \
+    krb_tree_clean(self);                                                                   \
+}                                                                                           \
+                                                                                            \
+/* This function returns the node corresponding to the key specified, or NULL. */           \
+static inline struct name##_node * name##_get_node(krb_tree *self, key_t key) {             \
+    struct krb_node *node = self->root_node, *nil;                                          \
+    if (node == NULL) return NULL;                                                          \
+    nil = node->parent;                                                                     \
+    while (node != nil) {                                                                   \
+        int order = cmp(key, ((struct name##_node *) node)->key);                           \
+        if (order == 0) return (struct name##_node *) node;                                 \
+        node = (order < 0) ? node->left : node->right;                                      \
+    }                                                                                       \
+    return NULL;                                                                            \
+}                                                                                           \
+                                                                                            \
+/* This function returns a pointer to the value of the key specified, or NULL. */           \
+static inline val_t * name##_get(krb_tree *self, key_t key) {                               \
+    struct name##_node *node = name##_get_node(self, key);                                  \
+    return (node == NULL) ? NULL : &node->value;                                            \
+}                                                                                           \
+                                                                                            \
+/* This function returns the first node whose key is not before 'key', or NULL. */          \
+static inline struct name##_node * name##_lower_bound(krb_tree *self, key_t key) {          \
+    struct krb_node *node = self->root_node, *nil, *bound = NULL;                           \
+    if (node == NULL) return NULL;                                                          \
+    nil = node->parent;                                                                     \
+    while (node != nil) {                                                                   \
+        if (cmp(key, ((struct name##_node *) node)->key) <= 0) {                            \
+            bound = node;                                                                   \
+            node = node->left;                                                              \
+        }                                                                                   \
+        else node = node->right;                                                            \
+    }                                                                                       \
+    return (struct name##_node *) bound;                                                    \
+}                                                                                           \
+                                                                                            \
+/* This function adds or replaces a key-value pair. The node is returned. */                \
+static inline struct name##_node * name##_add(krb_tree *self, key_t key, val_t value) {     \
+    struct krb_node *node = self->root_node, *parent = NULL, *nil = NULL;                   \
+    struct name##_node *new_node;                                                           \
+    int order = 0;                                                                          \
+    if (node != NULL) nil = node->parent;                                                   \
+    while (node != nil) {                                                                   \
+        order = cmp(key, ((struct name##_node *) node)->key);                               \
+        if (order == 0) {                                                                   \
+            ((struct name##_node *) node)->value = value;                                   \
+            return (struct name##_node *) node;                                             \
+        }                                                                                   \
+        parent = node;                                                                      \
+        node = (order < 0) ? node->left : node->right;                                      \
+    }                                                                                       \
+    new_node = (struct name##_node *) kmalloc(sizeof(struct name##_node));                  \
+    new_node->key = key;                                                                    \
+    new_node->value = value;                                                                \
+    new_node->rb.key = &new_node->key;                                                      \
+    new_node->rb.value = &new_node->value;                                                  \
+    krb_tree_link_node(self, &new_node->rb, parent, order < 0);                             \
+    return new_node;                                                                        \
+}                                                                                           \
+                                                                                            \
+/* This function removes the node specified from the tree and destroys it. */               \
+static inline void name##_remove_node(krb_tree *self, struct name##_node *node) {           \
+    krb_tree_remove_node(self, &node->rb);                                                  \
+}                                                                                           \
+                                                                                            \
+/* This function removes the pair of the key specified and returns true if found. */        \
+static inline int name##_remove(krb_tree *self, key_t key, val_t *value) {                  \
+    struct name##_node *node = name##_get_node(self, key);                                  \
+    if (node == NULL) return 0;                                                             \
+    if (value != NULL) *value = node->value;                                                \
+    name##_remove_node(self, node);                                                         \
+    return 1;                                                                               \
+}                                                                                           \
+                                                                                            \
+/* This function returns the first node of the tree, or NULL if it is empty. */             \
+static inline struct name##_node * name##_first(krb_tree *self) {                           \
+    struct krb_node *node = self->root_node;                                                \
+    if (node == NULL) return NULL;                                                          \
+    while (node->left != self->root_node->parent) node = node->left;                        \
+    return (struct name##_node *) node;                                                     \
+}                                                                                           \
+                                                                                            \
+/* This function returns the node following the node specified, or NULL. */                 \
+static inline struct name##_node * name##_next(krb_tree *self, struct name##_node *node) {  \
+    return (struct name##_node *) krb_tree_get_next(self, &node->rb);                       \
+}
+
 #endif
@@ -1,37 +1,78 @@
 #include "kserializable.h"
 #include "kbuffer.h"
+#include "karray.h"
 #include "kerror.h"
 #include "kmem.h"
+#include "kpool.h"
 
-extern const struct kserializable_ops *kserializable_array[];
-khash *kserializable_ops_index = NULL;
+/* Ops of the library, indexed by type id. This table is generated at build
+ * time. */
+extern const struct kserializable_ops *kserializable_array[KSERIALIZABLE_DENSE_COUNT];
 
+/* Ops added with kserializable_add_ops(), sorted by type id. */
+static karray kserializable_sparse_array = { 0, 0, NULL };
+
+/* The ops of the library are in kserializable_array, which needs no
+ * initialization.
+ */
 void kserializable_initialize() {
-    int i;
-    const struct kserializable_ops *ops = kserializable_array[0];
-    kserializable_ops_index = khash_new();
+}
 
-    for (ops = kserializable_array[(i = 0)] ; ops != NULL ; ops = kserializable_array[++i]) {
-        kserializable_add_ops(ops);
+/* This function returns the position of 'type' in the sparse array, or the
+ * position where it should be inserted.
+ */
+static ssize_t kserializable_sparse_search(unsigned int type) {
+    const struct kserializable_ops **data = (const struct kserializable_ops **)kserializable_sparse_array.data;
+    ssize_t lo = 0, hi = kserializable_sparse_array.size;
+
+    while (lo < hi) {
+        ssize_t mid = lo + (hi - lo) / 2;
+        if ((unsigned int)data[mid]->type < type)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+
+    return lo;
 }
 
 int kserializable_add_ops(const struct kserializable_ops *ops) {
-    unsigned int *index = kmalloc(sizeof(unsigned int));
-    *index = ops->type;
-    return khash_add(kserializable_ops_index, (void *)index, (void *)ops);
+    karray *array = &kserializable_sparse_array;
+    ssize_t pos;
+
+    if (kserializable_get_ops(ops->type)) {
+        KTOOLS_ERROR_SET("serializable type %u already exists", (unsigned int)ops->type);
+        return -1;
+    }
+
+    pos = kserializable_sparse_search(ops->type);
+    karray_grow(array, array->size + 1);
+    memmove(array->data + pos + 1, array->data + pos, (array->size - pos) * sizeof(void *));
+    array->data[pos] = (void *)ops;
+    array->size++;
+
+    return 0;
 }
 
-void kserializable_finalize() {
-    struct khash_iter khash_iter;
-    kiter *iter = (kiter *)&khash_iter;
-    struct khash_cell *cell;
+const struct kserializable_ops *kserializable_get_ops(unsigned int type) {
+    ssize_t pos;
 
-    khash_iter_init(&khash_iter, kserializable_ops_index);
-    while (kiter_next(iter, (void **)&cell) == 0)
-        kfree(cell->key);
+    if (type < KSERIALIZABLE_DENSE_COUNT && kserializable_array[type])
+        return kserializable_array[type];
 
-    khash_destroy(kserializable_ops_index);
+    pos = kserializable_sparse_search(type);
+    if (pos < kserializable_sparse_array.size) {
+        const struct kserializable_ops *ops = kserializable_sparse_array.data[pos];
+        if ((unsigned int)ops->type == type)
+            return ops;
+    }
+
+    return NULL;
+}
+
+void kserializable_finalize() {
+    karray_clean(&kserializable_sparse_array);
+    karray_init(&kserializable_sparse_array);
 }
 
 void kserializable_init(kserializable *self, struct kserializable_ops *ops) {
@@ -42,22 +83,70 @@ int kserializable_serialize_no_header (kserializable *self, struct kbuffer *buff
     return self->ops->serialize(self, buffer);
 }
 
+/* The element is serialized in place after its header, and the length in the
+ * header is written afterwards. Nothing is written on failure.
+ */
 int kserializable_serialize (kserializable *self, struct kbuffer *buffer) {
-    kbuffer tmp_buf;
-    kbuffer_init(&tmp_buf);
+    size_t start = buffer->len;
+    uint8_t *header = kbuffer_write_nbytes(buffer, 8);
+    uint32_t field;
+
+    if (kserializable_serialize_no_header(self, buffer)) {
+        kbuffer_truncate(buffer, start);
+        return -1;
+    }
+
+    /* The bytes of a flat buffer may have moved. The segments of a chained
+     * buffer do not move.
+     */
+    if (! kbuffer_is_chained(buffer))
+        header = buffer->data + start;
+
+    field = htonl((uint32_t)self->ops->type);
+    memcpy(header, &field, 4);
+    field = htonl(buffer->len - start - 8);
+    memcpy(header + 4, &field, 4);
+    return 0;
+}
+
+/* This function serializes the element in the compact format if its type
+ * has one, and in the regular format otherwise. kserializable_deserialize()
+ * reads both formats. The element is serialized in place if the size of its
+ * type is known, since the varint length must be written first, and in a
+ * temporary buffer otherwise.
+ */
+int kserializable_serialize_compact (kserializable *self, struct kbuffer *buffer) {
+    kbuffer *tmp_buf;
+    ssize_t size;
     int ret = -1;
-    
-    /* TRY */
-    do {
-        if (kserializable_serialize_no_header(self, &tmp_buf))
-            break;
-        kbuffer_write32(buffer, (uint32_t)self->ops->type);
-        kbuffer_write32(buffer, tmp_buf.len);
-        kbuffer_write_buffer(buffer, &tmp_buf);
+
+    if (self->ops->serialize_compact == NULL)
+        return kserializable_serialize(self, buffer);
+
+    size = self->ops->serialized_size ? self->ops->serialized_size(self, 1) : -1;
+
+    if (size >= 0) {
+        size_t start = buffer->len;
+        kbuffer_write32(buffer, (uint32_t)self->ops->type | KSERIALIZABLE_COMPACT_FLAG);
+        kbuffer_write_varint32(buffer, size);
+        if (self->ops->serialize_compact(self, buffer)) {
+            kbuffer_truncate(buffer, start);
+            return -1;
+        }
+        assert(buffer->len - start == 4 + kvarint_size64(size) + size);
+        return 0;
+    }
+
+    tmp_buf = kbuffer_acquire(0);
+
+    if (self->ops->serialize_compact(self, tmp_buf) == 0) {
+        kbuffer_write32(buffer, (uint32_t)self->ops->type | KSERIALIZABLE_COMPACT_FLAG);
+        kbuffer_write_varint32(buffer, tmp_buf->len);
+        kbuffer_write_buffer(buffer, tmp_buf);
         ret = 0;
-    } while (0);
+    }
 
-    kbuffer_clean(&tmp_buf);
+    kbuffer_release(tmp_buf);
     return ret;
 }
 
@@ -66,15 +155,17 @@ int kserializable_deserialize_no_header (kserializable *self, struct kbuffer *bu
     return self->ops->deserialize(self, buffer);
 }
 
-/* *self will be allocated by ops->deserialized if it's NULL. */
+/* *self will be allocated by ops->deserialized if it's NULL. The payload is
+ * passed to ops->deserialize in a view of 'buffer', so it is not copied.
+ */
 int kserializable_deserialize (kserializable **serializable, struct kbuffer *buffer) {
     uint32_t type;
     uint32_t len;
-    uint8_t *ptr;
-    kbuffer tmp_buf;
+    kbuffer view;
+    int view_flag = 0;
     int ret = -1;
+    int compact;
     kserializable *self = *serializable;
-    kbuffer_init(&tmp_buf);
 
     /* Try */
     do {
@@ -84,7 +175,10 @@ int kserializable_deserialize (kserializable **serializable, struct kbuffer *buf
             break;
         }
 
-        if (kbuffer_read32(buffer, &len)) {
+        compact = (type & KSERIALIZABLE_COMPACT_FLAG) != 0;
+        type &= ~KSERIALIZABLE_COMPACT_FLAG;
+
+        if (compact ? kbuffer_read_varint32(buffer, &len) : kbuffer_read32(buffer, &len)) {
             KTOOLS_ERROR_PUSH("cannot deserialize");
             break;
         }
@@ -92,15 +186,14 @@ int kserializable_deserialize (kserializable **serializable, struct kbuffer *buf
         /* Get the ops. */
         if (self) {
             if (self->ops->type != type) {
-                KTOOLS_ERROR_SET("trying to deserialize the wrong type, %lu instead of %lu", self->ops->type, type);
+                KTOOLS_ERROR_SET("trying to deserialize the wrong type, %u instead of %u", (unsigned int) self->ops->type, (unsigned int) type);
                 break;
             }
         } else {
-            struct kserializable_ops *ops;
-            unsigned int u = (unsigned int)type;
-            if (khash_get(kserializable_ops_index, (void *)&u, NULL, (void **)&ops)) {
+            const struct kserializable_ops *ops = kserializable_get_ops(type);
+            if (ops == NULL) {
                 buffer->pos += len;
-                KTOOLS_ERROR_SET("unknown serializable type %lu", type);
+                KTOOLS_ERROR_SET("unknown serializable type %u", (unsigned int) type);
                 break;
             } else {
                 self = ops->allocate();
@@ -108,13 +201,19 @@ int kserializable_deserialize (kserializable **serializable, struct kbuffer *buf
         }
         
         /* deserialize */
-        ptr = kbuffer_write_nbytes(&tmp_buf, len);
-        if (kbuffer_read(buffer, ptr, len)) {
+        view_flag = 1;
+        if (kbuffer_init_view(&view, buffer, len, 0)) {
             KTOOLS_ERROR_PUSH("cannot deserialize");
             break;
         }
+        buffer->pos += len;
 
-        ret = self->ops->deserialize(self, &tmp_buf);
+        if (! compact)
+            ret = self->ops->deserialize(self, &view);
+        else if (self->ops->deserialize_compact)
+            ret = self->ops->deserialize_compact(self, &view);
+        else
+            KTOOLS_ERROR_SET("no compact format for the serializable type %u", (unsigned int) type);
     } while (0);
 
     if (*serializable == NULL) {
@@ -124,11 +223,73 @@ int kserializable_deserialize (kserializable **serializable, struct kbuffer *buf
             *serializable = self;
     }
 
-    kbuffer_clean(&tmp_buf);
+    if (view_flag)
+        kbuffer_clean(&view);
 
     return ret;
 }
 
+/* Same as above, but the kbuffer elements refer to the bytes of 'buffer'
+ * instead of copying them (see KBUFFER_VIEW_BORROW): 'buffer' must not be
+ * modified, reset or cleaned while they are used. The kstr elements are
+ * copied, since a kstr owns its '0'-terminated string; kstr_deserialize_view()
+ * reads a string without copying it. An element spanning several segments of
+ * a chained buffer is copied first, as done by kbuffer_init_view().
+ */
+int kserializable_deserialize_borrow (kserializable **serializable, struct kbuffer *buffer) {
+    size_t start = buffer->pos;
+    uint32_t type, len;
+    kbuffer view;
+    int ret;
+
+    /* View only this element, so that no more than it is copied if it spans
+     * several segments of a chained buffer.
+     */
+    if (kbuffer_read32(buffer, &type) ||
+        ((type & KSERIALIZABLE_COMPACT_FLAG) ? kbuffer_read_varint32(buffer, &len) : kbuffer_read32(buffer, &len))) {
+        KTOOLS_ERROR_PUSH("cannot deserialize");
+        return -1;
+    }
+
+    len += buffer->pos - start;
+    buffer->pos = start;
+
+    if (kbuffer_init_view(&view, buffer, len, KBUFFER_VIEW_BORROW)) {
+        KTOOLS_ERROR_PUSH("cannot deserialize");
+        kbuffer_clean(&view);
+        return -1;
+    }
+
+    ret = kserializable_deserialize(serializable, &view);
+    buffer->pos += view.pos;
+    kbuffer_clean(&view);
+
+    return ret;
+}
+
+/* This function returns the size of the element serialized by
+ * kserializable_serialize(), or by kserializable_serialize_compact() if
+ * 'compact_flag' is true, including the header. It returns -1 if the size is
+ * not known. The callers can grow the destination buffer once before
+ * serializing.
+ */
+ssize_t kserializable_serialized_size(kserializable *self, int compact_flag) {
+    ssize_t size;
+
+    if (self->ops->serialized_size == NULL)
+        return -1;
+
+    /* The types without compact format are serialized in the regular format. */
+    if (self->ops->serialize_compact == NULL)
+        compact_flag = 0;
+
+    size = self->ops->serialized_size(self, compact_flag);
+    if (size < 0)
+        return -1;
+
+    return size + (compact_flag ? 4 + kvarint_size64(size) : 8);
+}
+
 void kserializable_destroy(kserializable *self) {
     if (self)
         self->ops->free(self);
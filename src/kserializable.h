@@ -4,6 +4,7 @@
 #define __KC_SERIALIZABLE_H__
 
 #include <stdio.h>
+#include <sys/types.h>
 
 #define DECLARE_KSERIALIZABLE_OPS(type) struct kserializable_ops type##_serializable_ops
 #define KSERIALIZABLE_OPS(type) type##_serializable_ops
@@ -40,16 +41,34 @@ struct kserializable_ops {
     kserializable *(*allocate) ();
     void (*free) (kserializable *self);
     void (*dump) (kserializable *self, FILE *file);
+    /* Optional compact format, with variable-length integers. NULL if the type
+     * only has the fixed-width format. */
+    int (*serialize_compact) (kserializable *self, struct kbuffer *buffer);
+    int (*deserialize_compact) (kserializable *self, struct kbuffer *buffer);
+    /* Optional. Size of the element serialized by serialize, or by
+     * serialize_compact if compact_flag is true, without the header. -1 if
+     * the size is not known, NULL if it is never known. */
+    ssize_t (*serialized_size) (kserializable *self, int compact_flag);
 };
 
-/* This is a mapping between type ids and serializable_ops. It'll be populized
- * by kserializable_initialized with ktools serializable elements. Users should
- * khash_add their own at startup. */
-extern khash *kserializable_ops_index;
+/* This bit is set in the type id of the elements serialized in the compact
+ * format. The length that follows is then a varint. Older readers reject
+ * these elements as an unknown type. */
+#define KSERIALIZABLE_COMPACT_FLAG 0x80000000u
 
-/* This function add elements to the above index */
+/* The type ids below this value are looked up in a table indexed by type id.
+ * The table is generated at build time with the ops of the library (see
+ * extract_serializable() in kenv.py), so their type ids must be below it. The
+ * other type ids are looked up by binary search. */
+#define KSERIALIZABLE_DENSE_COUNT (1 << 8)
+
+/* This function adds user ops to the lookup tables. Call it at startup, before
+ * deserializing. It returns -1 if the type id is already used. */
 int kserializable_add_ops(const struct kserializable_ops *ops);
 
+/* This function returns the ops of a type id, or NULL if it is unknown. */
+const struct kserializable_ops *kserializable_get_ops(unsigned int type);
+
 /* Initialize/finalize the module */
 void kserializable_initialize();
 void kserializable_finalize();
@@ -65,7 +84,10 @@ struct kserializable {
 void kserializable_init(kserializable *self, struct kserializable_ops *ops);
 
 int kserializable_serialize(kserializable *self, struct kbuffer *buffer);
+int kserializable_serialize_compact(kserializable *self, struct kbuffer *buffer);
 int kserializable_deserialize(kserializable **self, struct kbuffer *buffer);
+int kserializable_deserialize_borrow(kserializable **self, struct kbuffer *buffer);
+ssize_t kserializable_serialized_size(kserializable *self, int compact_flag);
 
 int kserializable_serialize_no_header(kserializable *self, struct kbuffer *buffer);
 int kserializable_deserialize_no_header(kserializable *self, struct kbuffer *buffer);
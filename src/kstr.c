@@ -4,7 +4,11 @@
  */
 
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "kstr.h"
+#include "kfmt.h"
 #include "kmem.h"
 #include "kutils.h"
 #include "kerror.h"
@@ -25,7 +29,7 @@ int kstr_deserialize (kserializable *serializable, kbuffer *buffer) {
         KTOOLS_ERROR_PUSH("could not read kstr length");
         return -1;
     }
-    self->slen = (int)len;
+    self->slen = len;
     kstr_grow(self, self->slen + 1);
     if (kbuffer_read(buffer, (uint8_t *)self->data, self->slen)) {
         kstr_reset(self);
@@ -35,6 +39,80 @@ int kstr_deserialize (kserializable *serializable, kbuffer *buffer) {
     return 0;
 }
 
+/* Compact format: the length is a varint. */
+int kstr_serialize_compact (kserializable *serializable, kbuffer *buffer) {
+    kstr *self = (kstr *)serializable;
+    kbuffer_write_varint32(buffer, self->slen);
+    kbuffer_write(buffer, (uint8_t *)self->data, self->slen);
+    return 0;
+}
+
+int kstr_deserialize_compact (kserializable *serializable, kbuffer *buffer) {
+    kstr *self = (kstr *)serializable;
+    uint32_t len;
+
+    if (kbuffer_read_varint32(buffer, &len)) {
+        KTOOLS_ERROR_PUSH("could not read kstr length");
+        return -1;
+    }
+    if (len > buffer->len - buffer->pos) {
+        KTOOLS_ERROR_SET("kstr length %u exceeds the data available", (unsigned int) len);
+        return -1;
+    }
+    kstr_grow(self, len + 1);
+    kbuffer_read(buffer, (uint8_t *)self->data, len);
+    self->slen = len;
+    self->data[self->slen] = '\0';
+    return 0;
+}
+
+/* This function reads a kstr serialized by kserializable_serialize() or
+ * kserializable_serialize_compact() without copying it: 'view' refers to the
+ * bytes of the buffer, which must not be modified while it is used. The bytes
+ * spanning several segments of a chained buffer are copied, as done by
+ * kbuffer_read_nbytes(). This function returns -1 on error.
+ */
+int kstr_deserialize_view(kbuffer *buffer, kstr_view *view) {
+    size_t pos = buffer->pos, start;
+    uint32_t type, len, slen;
+    int compact, ret;
+
+    if (kbuffer_read32(buffer, &type)) {
+        KTOOLS_ERROR_PUSH("could not read the type");
+        return -1;
+    }
+
+    compact = (type & KSERIALIZABLE_COMPACT_FLAG) != 0;
+
+    if ((type & ~KSERIALIZABLE_COMPACT_FLAG) != KSERIALIZABLE_TYPE_KSTR) {
+        KTOOLS_ERROR_SET("trying to deserialize the wrong type, %u instead of %u",
+                         (unsigned int) (type & ~KSERIALIZABLE_COMPACT_FLAG), (unsigned int) KSERIALIZABLE_TYPE_KSTR);
+        buffer->pos = pos;
+        return -1;
+    }
+
+    ret = compact ? kbuffer_read_varint32(buffer, &len) : kbuffer_read32(buffer, &len);
+    start = buffer->pos;
+    if (! ret) ret = compact ? kbuffer_read_varint32(buffer, &slen) : kbuffer_read32(buffer, &slen);
+
+    if (ret || len > buffer->len - start || slen > len - (buffer->pos - start)) {
+        KTOOLS_ERROR_SET("not enough data");
+        buffer->pos = pos;
+        return -1;
+    }
+
+    view->p = slen ? (const char *) kbuffer_read_nbytes(buffer, slen) : "";
+    view->n = slen;
+    buffer->pos = start + len;
+    return 0;
+}
+
+/* This function returns the size of the serialized string. */
+ssize_t kstr_serialized_size (kserializable *serializable, int compact_flag) {
+    kstr *self = (kstr *)serializable;
+    return (compact_flag ? kvarint_size64(self->slen) : 4) + self->slen;
+}
+
 kserializable *kstr_new_serializable() {
     return (kserializable *)kstr_new();
 }
@@ -54,6 +132,9 @@ DECLARE_KSERIALIZABLE_OPS(kstr) = {
     kstr_new_serializable,
     kstr_destroy_serializable,
     kstr_dump,
+    kstr_serialize_compact,
+    kstr_deserialize_compact,
+    kstr_serialized_size,
 };
 
 kstr *kstr_new() {
@@ -85,8 +166,8 @@ void kstr_destroy(kstr *str) {
 void kstr_init(kstr *self) {
     kserializable_init(&self->serializable, &KSERIALIZABLE_OPS(kstr));
     self->slen = 0;
-    self->mlen = 8;
-    self->data = (char *) kmalloc(self->mlen);
+    self->mlen = KSTR_SSO_SIZE;
+    self->data = self->sso;
     self->data[0] = 0;
 }
 
@@ -102,11 +183,21 @@ void kstr_init_kstr(kstr *self, kstr *init_str) {
     kstr_init_buf(self, init_str->data, init_str->slen);
 }
 
-void kstr_init_buf(kstr *self, const void *buf, int buf_len) {
+void kstr_init_buf(kstr *self, const void *buf, size_t buf_len) {
     kserializable_init(&self->serializable, &KSERIALIZABLE_OPS(kstr));
     self->slen = buf_len;
-    self->mlen = buf_len + 1;
-    self->data = (char *) kmalloc(self->mlen);
+
+    /* Store the string inline if it fits. */
+    if (buf_len < KSTR_SSO_SIZE) {
+        self->mlen = KSTR_SSO_SIZE;
+        self->data = self->sso;
+    }
+
+    else {
+        self->mlen = buf_len + 1;
+        self->data = (char *) kmalloc(self->mlen);
+    }
+
     memcpy(self->data, buf, buf_len);
     self->data[buf_len] = 0;
 }
@@ -129,27 +220,30 @@ void kstr_clean(kstr *self) {
     if (self == NULL)
     	return;
 
-    kfree(self->data);
+    if (self->data != self->sso) kfree(self->data);
 }
 
-void kstr_grow(kstr *self, int min_slen) {
-    assert(min_slen >= 0);
-    
+void kstr_grow(kstr *self, size_t min_slen) {
     if (min_slen >= self->mlen) {
+        size_t old_mlen = self->mlen;
     
         /* Compute the snapped size for a given requested size. By snapping to powers
          * of 2 like this, repeated reallocations are avoided.
          */
-        if (min_slen < 8) {
-            self->mlen = 8;
+        self->mlen = next_power_of_2_size(min_slen);
+        assert(self->mlen > min_slen);    
+
+        /* The string is stored inline. Move it to the heap. Note that the
+         * callers may have updated slen already, so we copy the whole buffer.
+         */
+        if (self->data == self->sso) {
+            self->data = (char *) kmalloc(self->mlen);
+            memcpy(self->data, self->sso, old_mlen);
         }
-        
+
         else {
-	    self->mlen = next_power_of_2(min_slen);
+            self->data = (char *) krealloc(self->data, self->mlen);
         }
-        
-        assert(self->mlen > min_slen);    
-        self->data = (char *) krealloc(self->data, self->mlen);
     }
 }
 
@@ -158,7 +252,7 @@ void kstr_reset(kstr *self) {
     self->data[0] = 0;
 }
 
-void kstr_shrink(kstr *self, int max_size) {
+void kstr_shrink(kstr *self, size_t max_size) {
     if (self->slen > max_size) {
     	kstr_clean(self);
 	kstr_init(self);
@@ -179,7 +273,7 @@ void kstr_assign_kstr(kstr *self, kstr *assign_str) {
     kstr_assign_buf(self, assign_str->data, assign_str->slen);   
 }
 
-void kstr_assign_buf(kstr *self, const void *buf, int buf_len) {
+void kstr_assign_buf(kstr *self, const void *buf, size_t buf_len) {
     kstr_grow(self, buf_len);
     memcpy(self->data, buf, buf_len);
     self->data[buf_len] = 0;
@@ -201,7 +295,7 @@ void kstr_append_kstr(kstr *self, kstr *append_str) {
     kstr_append_buf(self, append_str->data, append_str->slen);
 }
 
-void kstr_append_buf(kstr *self, const void *buf, int buf_len) {
+void kstr_append_buf(kstr *self, const void *buf, size_t buf_len) {
     kstr_grow(self, self->slen + buf_len);
     memcpy(self->data + self->slen, buf, buf_len);
     self->slen += buf_len;
@@ -215,49 +309,17 @@ void kstr_append_sf(kstr *self, const char *format, ...) {
     va_end(arg);
 }
 
-void kstr_append_sfv(kstr *self, const char *format, va_list arg) {
+/* This function appends 'len' bytes to the string for the formatter. */
+static char * kstr_write_nbytes(void *dst, size_t len) {
+    kstr *self = (kstr *) dst;
+    kstr_grow(self, self->slen + len);
+    self->slen += len;
+    return self->data + self->slen - len;
+}
 
-    /* vsnprintf() is defined in a standard. Some UNIX systems implement it
-     * correctly.
-     */
-    #ifndef __WINDOWS__
-    
-    /* Determine the size of the resulting string. */
-    int print_size;
-    int pos;
-    va_list arg2;
-    
-    va_copy(arg2, arg);
-    print_size = vsnprintf(NULL, 0, format, arg2);
-    va_end(arg2);
-    
-    pos = self->slen;
-    self->slen += print_size;
-    kstr_grow(self, self->slen);
-    
-    /* Do the sprintf(). */
-    print_size = vsnprintf(self->data + pos, self->slen - pos + 1, format, arg);
-    /* Windows doesn't support it correctly, though. */
-    #else
-    while (1) {
-        /* Use _vsnprintf() with its ugly semantics. */
-        va_list arg2;
-        int print_size;
-        
-        va_copy(arg2, arg);
-        print_size = _vsnprintf(self->data + self->slen, self->mlen - self->slen, format, arg2);
-        va_end(arg2);
-        
-        if (print_size == -1 || print_size == self->mlen - self->slen) {
-            kstr_grow(self, self->mlen * 2);
-        }
-        
-        else {
-            self->slen += print_size;
-            break;
-        }
-    }
-    #endif
+void kstr_append_sfv(kstr *self, const char *format, va_list arg) {
+    kfmt_vformat(kstr_write_nbytes, self, format, arg);
+    self->data[self->slen] = 0;
 }
 
 void kstr_sf(kstr *self, const char *format, ...) {
@@ -274,12 +336,10 @@ void kstr_sfv(kstr *self, const char *format, va_list arg) {
 
 /* This function puts all the characters of a string in lowercase. */
 void kstr_tolower(kstr *str) {
-    int i;
-    for (i = 0 ; i < str->slen ; i++) 
-        str->data[i] = tolower(str->data[i]);
+    kutil_ascii_tolower(str->data, str->data, str->slen);
 }
 
-void kstr_mid(kstr *self, kstr *mid_str, int begin_pos, int size) {
+void kstr_mid(kstr *self, kstr *mid_str, size_t begin_pos, size_t size) {
     assert(begin_pos + size <= self->slen);
     kstr_grow(mid_str, size);
     memcpy(mid_str->data, self->data + begin_pos, size);
@@ -287,28 +347,350 @@ void kstr_mid(kstr *self, kstr *mid_str, int begin_pos, int size) {
     mid_str->slen = size;
 }
 
+/* This function returns the position of the first occurrence of 'needle' in
+ * 'hay', or -1.
+ *
+ * When SSE2 is available, 16 positions are tested at once by comparing the
+ * first and the last bytes of the needle, and only the positions that pass
+ * this filter are compared with memcmp(). If the filter lets too many
+ * positions through (e.g. on repetitive input), the rest of the search is
+ * done with the two-way algorithm to keep it linear.
+ */
+static ssize_t kstr_search(const char *hay, size_t hay_len, const char *needle, size_t len) {
+    size_t i = 0;
+    
+    if (len == 0) return 0;
+    if (len > hay_len) return -1;
+    
+    if (len == 1) {
+        const char *p = (const char *) memchr(hay, needle[0], hay_len);
+        return p ? p - hay : -1;
+    }
+    
+#ifdef __SSE2__
+    {
+        __m128i first = _mm_set1_epi8(needle[0]);
+        __m128i last = _mm_set1_epi8(needle[len - 1]);
+        size_t nb_false = 0;
+        
+        for (; i + len + 15 <= hay_len; i += 16) {
+            __m128i block_first = _mm_loadu_si128((const __m128i *) (hay + i));
+            __m128i block_last = _mm_loadu_si128((const __m128i *) (hay + i + len - 1));
+            unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                                _mm_cmpeq_epi8(last, block_last)));
+            
+            while (mask) {
+                size_t pos = i + __builtin_ctz(mask);
+                if (! memcmp(hay + pos + 1, needle + 1, len - 2)) return pos;
+                nb_false++;
+                mask &= mask - 1;
+            }
+            
+            /* Too many candidates. Switch to the two-way algorithm. */
+            if (nb_false > 64 && nb_false * len > 4 * i) break;
+        }
+    }
+#endif
+    
+    {
+        ssize_t pos = kutil_two_way_search(hay + i, hay_len - i, needle, len, 0);
+        return (pos == -1) ? -1 : (ssize_t) i + pos;
+    }
+}
+
+ssize_t kstr_find_buf(kstr *self, size_t start, const void *buf, size_t buf_len) {
+    ssize_t pos;
+    
+    if (start > self->slen) return -1;
+    pos = kstr_search(self->data + start, self->slen - start, (const char *) buf, buf_len);
+    return (pos == -1) ? -1 : (ssize_t) start + pos;
+}
+
+/* This function replaces the content of the string by the content of 'tmp',
+ * taking its buffer if it is on the heap. 'tmp' must not be used afterwards.
+ */
+static void kstr_take(kstr *self, kstr *tmp) {
+    if (tmp->data == tmp->sso) {
+        kstr_assign_buf(self, tmp->data, tmp->slen);
+        return;
+    }
+    
+    if (self->data != self->sso) kfree(self->data);
+    self->data = tmp->data;
+    self->mlen = tmp->mlen;
+    self->slen = tmp->slen;
+}
+
 void kstr_replace(kstr *self, char *from, char *to) {
+    size_t from_len = strlen(from);
+    size_t to_len = strlen(to);
+    size_t src = 0, dst = 0;
+    ssize_t match;
+    
+    assert(from_len);
+    
+    /* The string does not grow. Replace in place. */
+    if (to_len <= from_len) {
+        while ((match = kstr_search(self->data + src, self->slen - src, from, from_len)) != -1) {
+            memmove(self->data + dst, self->data + src, match);
+            dst += match;
+            memcpy(self->data + dst, to, to_len);
+            dst += to_len;
+            src += match + from_len;
+        }
+        
+        memmove(self->data + dst, self->data + src, self->slen - src);
+        self->slen = dst + self->slen - src;
+        self->data[self->slen] = 0;
+    }
+    
+    /* Count the matches, then build the result in a buffer of the right size. */
+    else {
+        size_t nb_match = 0;
+        kstr tmp;
+        
+        while ((match = kstr_search(self->data + src, self->slen - src, from, from_len)) != -1) {
+            nb_match++;
+            src += match + from_len;
+        }
+        
+        if (nb_match == 0) return;
+        
+        kstr_init(&tmp);
+        tmp.slen = self->slen + nb_match * (to_len - from_len);
+        kstr_grow(&tmp, tmp.slen);
+        src = 0;
+        
+        while ((match = kstr_search(self->data + src, self->slen - src, from, from_len)) != -1) {
+            memcpy(tmp.data + dst, self->data + src, match);
+            dst += match;
+            memcpy(tmp.data + dst, to, to_len);
+            dst += to_len;
+            src += match + from_len;
+        }
+        
+        memcpy(tmp.data + dst, self->data + src, self->slen - src);
+        tmp.data[tmp.slen] = 0;
+        kstr_take(self, &tmp);
+    }
+}
+
+/* Node of the Aho-Corasick automaton used by kstr_replace_multi(). */
+struct kstr_ac_node {
+    
+    /* First child and next sibling in the trie, or 0. */
+    int child;
+    int sibling;
+    
+    /* Failure link: node of the longest proper suffix that is in the trie. */
+    int fail;
+    
+    /* Length of the string leading to this node. */
+    int depth;
+    
+    /* Longest pattern that is a suffix of the string leading to this node, or
+     * -1 if there is none.
+     */
+    int out;
+    
+    /* Character leading to this node. */
+    unsigned char c;
+};
+
+/* Aho-Corasick automaton. The root is node 0. */
+struct kstr_ac {
+    struct kstr_ac_node *nodes;
+    int nb_node;
+    int alloc_node;
+    
+    /* Transitions from the root, for speed. */
+    int root_next[256];
+};
+
+/* This function returns the child of 'node' for 'c', or 0. */
+static inline int kstr_ac_child(struct kstr_ac *self, int node, unsigned char c) {
+    int child;
+    if (node == 0) return self->root_next[c];
+    for (child = self->nodes[node].child; child && self->nodes[child].c != c; child = self->nodes[child].sibling);
+    return child;
+}
+
+/* This function returns the state following 'node' when 'c' is read. */
+static inline int kstr_ac_next(struct kstr_ac *self, int node, unsigned char c) {
+    int child;
+    
+    while (1) {
+        if ((child = kstr_ac_child(self, node, c))) return child;
+        if (node == 0) return 0;
+        node = self->nodes[node].fail;
+    }
+}
+
+static void kstr_ac_build(struct kstr_ac *self, char **from, int nb) {
+    int i, head = 0, tail = 0;
+    int *queue;
+    
+    self->alloc_node = 16;
+    self->nb_node = 1;
+    self->nodes = (struct kstr_ac_node *) kcalloc(self->alloc_node * sizeof(struct kstr_ac_node));
+    self->nodes[0].out = -1;
+    memset(self->root_next, 0, sizeof(self->root_next));
+    
+    /* Build the trie. */
+    for (i = 0; i < nb; i++) {
+        const unsigned char *p = (const unsigned char *) from[i];
+        int node = 0;
+        
+        assert(*p);
+        
+        for (; *p; p++) {
+            int child = kstr_ac_child(self, node, *p);
+            
+            if (child == 0) {
+                if (self->nb_node == self->alloc_node) {
+                    self->alloc_node *= 2;
+                    self->nodes = (struct kstr_ac_node *) krealloc(self->nodes, self->alloc_node * sizeof(struct kstr_ac_node));
+                }
+                
+                child = self->nb_node++;
+                self->nodes[child].child = 0;
+                self->nodes[child].fail = 0;
+                self->nodes[child].depth = self->nodes[node].depth + 1;
+                self->nodes[child].out = -1;
+                self->nodes[child].c = *p;
+                
+                if (node == 0) {
+                    self->nodes[child].sibling = 0;
+                    self->root_next[*p] = child;
+                }
+                
+                else {
+                    self->nodes[child].sibling = self->nodes[node].child;
+                    self->nodes[node].child = child;
+                }
+            }
+            
+            node = child;
+        }
+        
+        if (self->nodes[node].out == -1) self->nodes[node].out = i;
+    }
+    
+    /* Compute the failure links in breadth-first order. A node inherits the
+     * output of its failure node if it has none.
+     */
+    queue = (int *) kmalloc(self->nb_node * sizeof(int));
+    for (i = 0; i < 256; i++) if (self->root_next[i]) queue[tail++] = self->root_next[i];
+    
+    while (head < tail) {
+        int node = queue[head++];
+        int child;
+        
+        for (child = self->nodes[node].child; child; child = self->nodes[child].sibling) {
+            int fail = kstr_ac_next(self, self->nodes[node].fail, self->nodes[child].c);
+            self->nodes[child].fail = fail;
+            if (self->nodes[child].out == -1) self->nodes[child].out = self->nodes[fail].out;
+            queue[tail++] = child;
+        }
+    }
+    
+    kfree(queue);
+}
+
+/* The leftmost-longest matches are found without reading any byte twice. The
+ * string is first scanned backwards with the automaton of the reversed
+ * strings of 'from', whose output at each position is the longest string of
+ * 'from' starting there. The matches are then replaced from left to right.
+ */
+void kstr_replace_multi(kstr *self, char **from, char **to, int nb) {
+    struct kstr_ac ac;
     kstr tmp;
-    int i = 0;
-    int l = strlen(from);
+    char **reversed;
+    size_t *from_len;
+    int *longest;
+    size_t pos, copied = 0;
+    int node = 0;
+    int i;
+    
+    if (nb == 0 || self->slen == 0) return;
+    
+    from_len = (size_t *) kmalloc(nb * sizeof(size_t));
+    reversed = (char **) kmalloc(nb * sizeof(char *));
+    
+    for (i = 0; i < nb; i++) {
+        size_t j;
+        from_len[i] = strlen(from[i]);
+        reversed[i] = (char *) kmalloc(from_len[i] + 1);
+        for (j = 0; j < from_len[i]; j++) reversed[i][j] = from[i][from_len[i] - 1 - j];
+        reversed[i][from_len[i]] = 0;
+    }
+    
+    kstr_ac_build(&ac, reversed, nb);
+    
+    /* After reading the string backwards down to 'pos', the state is the
+     * longest string starting at 'pos' that ends a string of 'from', so its
+     * output is the longest string of 'from' starting at 'pos'.
+     */
+    longest = (int *) kmalloc(self->slen * sizeof(int));
+    
+    for (pos = self->slen; pos-- > 0; ) {
+        node = kstr_ac_next(&ac, node, self->data[pos]);
+        longest[pos] = ac.nodes[node].out;
+    }
     
-    assert(l);
     kstr_init(&tmp);
     
-    while (i < self->slen) {
-        if (! strncmp(self->data + i, from, l)) {
-            kstr_append_cstr(&tmp, to);
-            i += l;
-        }
+    for (pos = 0; pos < self->slen; ) {
+        int match = longest[pos];
         
-        else {
-            kstr_append_char(&tmp, self->data[i]);
-            i++;
+        if (match == -1) {
+            pos++;
+            continue;
         }
+        
+        kstr_append_buf(&tmp, self->data + copied, pos - copied);
+        kstr_append_cstr(&tmp, to[match]);
+        copied = pos = pos + from_len[match];
+    }
+    
+    if (copied) {
+        kstr_append_buf(&tmp, self->data + copied, self->slen - copied);
+        kstr_take(self, &tmp);
+    }
+    
+    else {
+        kstr_clean(&tmp);
+    }
+    
+    for (i = 0; i < nb; i++) kfree(reversed[i]);
+    kfree(reversed);
+    kfree(longest);
+    kfree(from_len);
+    kfree(ac.nodes);
+}
+
+/* This function stores the next field in 'field' and returns true, or returns
+ * false if there are no more fields.
+ */
+int kstr_split_next(struct kstr_split *self, kstr_view *field) {
+    const char *delim;
+    
+    if (self->p == NULL) return 0;
+    
+    delim = (const char *) memchr(self->p, self->delim, self->end - self->p);
+    field->p = self->p;
+    
+    if (delim) {
+        field->n = delim - self->p;
+        self->p = delim + 1;
+    }
+    
+    else {
+        field->n = self->end - self->p;
+        self->p = NULL;
     }
     
-    kstr_assign_kstr(self, &tmp);
-    kstr_clean(&tmp);
+    return 1;
 }
 
 int kstr_equal_cstr(kstr *first, const char *second) {
@@ -6,26 +6,71 @@
 #ifndef __K_STR_H__
 #define __K_STR_H__
 
+#include <assert.h>
 #include <stdarg.h>
+#include <string.h>
+#include <sys/types.h>
 #include <kserializable.h>
 
+/* Size of the buffer used to store short strings inside the kstr structure,
+ * including the terminating '0'.
+ */
+#define KSTR_SSO_SIZE 24
+
+/* Short strings are stored inside the kstr structure itself, so that creating
+ * them does not allocate memory. The string moves to the heap when it grows
+ * beyond KSTR_SSO_SIZE - 1 characters. Since 'data' may point inside the
+ * structure, a kstr must never be copied by value (use kstr_assign_kstr()).
+ */
 typedef struct kstr
 {
     /* Implement the serializable interface */
     kserializable serializable;
 
     /* The allocated buffer size. */
-    int mlen;
+    size_t mlen;
     
     /* The string length, not including the final '0'. */
-    int slen;
+    size_t slen;
     
-    /* The character buffer, always terminated by a '0'.
+    /* The character buffer, always terminated by a '0'. It points to 'sso'
+     * when the string is stored inline.
      * Note that there may be other '0' in the string.
      */
     char *data;
+
+    /* Inline buffer for short strings. */
+    char sso[KSTR_SSO_SIZE];
 } kstr;
 
+/* Struct kstr_view is a non-owning reference to a range of bytes, usually a
+ * part of a kstr. The bytes are not copied and are not '0'-terminated. A view
+ * is valid as long as the bytes it refers to are not modified or freed, e.g.
+ * a view on a kstr is invalidated when the kstr is modified. Views are small
+ * and are passed by value.
+ */
+typedef struct kstr_view
+{
+    /* Pointer to the first byte. */
+    const char *p;
+    
+    /* Number of bytes. */
+    size_t n;
+} kstr_view;
+
+/* Iterator over the fields of a view separated by a delimiter. See
+ * kstr_split_init().
+ */
+struct kstr_split {
+    
+    /* Remaining bytes, or NULL when the iteration is done. */
+    const char *p;
+    const char *end;
+    
+    /* Delimiter. */
+    char delim;
+};
+
 #include <kbuffer.h>
 
 /* This function allocates and returns an empty kstr. */
@@ -54,7 +99,7 @@ void kstr_init_cstr(kstr *self, const char *init_str);
 void kstr_init_kstr(kstr *self, kstr *init_str);
 
 /* This function initializes the string to the buffer 'buf'. */
-void kstr_init_buf(kstr *self, const void *buf, int buf_len);
+void kstr_init_buf(kstr *self, const void *buf, size_t buf_len);
 
 /* This function initializes the string in the sprintf manner. */
 void kstr_init_sf(kstr *self, const char *format, ...);
@@ -62,7 +107,9 @@ void kstr_init_sf(kstr *self, const char *format, ...);
 /* This function initializes the string in the vsprintf manner. */
 void kstr_init_sfv(kstr *self, const char *format, va_list args);
 
-/* This function convert every upper case characters into lower case. */
+/* This function convert every upper case characters into lower case. Only the
+ * ASCII letters are converted, regardless of the locale.
+ */
 void kstr_tolower(kstr *str);
 
 /* This function frees the string data. */
@@ -71,7 +118,7 @@ void kstr_clean(kstr *self);
 /* This function increases the size of the memory containing the string so that it
  * may contain at least 'min_slen' characters (not counting the terminating '0').
  */
-void kstr_grow(kstr *self, int min_slen);
+void kstr_grow(kstr *self, size_t min_slen);
 
 /* This function assigns the empty string to the string. */
 void kstr_reset(kstr *self);
@@ -81,7 +128,7 @@ void kstr_reset(kstr *self);
  * specified, the memory associated to the string is released and a new, small
  * buffer is allocated for the string. In all cases, the string is cleared.
  */
-void kstr_shrink(kstr *self, int max_size);
+void kstr_shrink(kstr *self, size_t max_size);
 
 /* This function assigns a C string to this string. */
 void kstr_assign_cstr(kstr *self, const char *assign_str);
@@ -90,7 +137,7 @@ void kstr_assign_cstr(kstr *self, const char *assign_str);
 void kstr_assign_kstr(kstr *self, kstr *assign_str);
 
 /* This function assigns the content of a raw buffer to the string. */
-void kstr_assign_buf(kstr *self, const void *buf, int buf_len);
+void kstr_assign_buf(kstr *self, const void *buf, size_t buf_len);
 
 /* This function appends a character to the string. */
 void kstr_append_char(kstr *self, char c);
@@ -104,13 +151,13 @@ void kstr_append_kstr(kstr *self, kstr *append_str);
 /* This function appends a raw buffer to the string (zeros are appended like
  * other characters).
  */
-void kstr_append_buf(kstr *self, const void *buf, int buf_len);
+void kstr_append_buf(kstr *self, const void *buf, size_t buf_len);
 
 /* This function sprintf at the end of the string. */
 void kstr_append_sf(kstr *self, const char *format, ...);
 
-/* SYSTEM-DEPENDENT function.
- * This function vsprintf at the end of the string.
+/* This function vsprintf at the end of the string. The string is formatted in
+ * a single pass by kfmt_vformat().
  */
 void kstr_append_sfv(kstr *self, const char *format, va_list arg);
 
@@ -132,13 +179,106 @@ void kstr_sfv(kstr *self, const char *format, va_list arg);
  * Beginning of the substring in this string.
  * Size of the substring.
  */
-void kstr_mid(kstr *self, kstr *mid_str, int begin_pos, int size);
+void kstr_mid(kstr *self, kstr *mid_str, size_t begin_pos, size_t size);
+
+/* This function returns the position of the first occurrence of the buffer
+ * 'buf' in the string, starting at position 'start', or -1 if there is none.
+ * An empty buffer is found at position 'start'. The search is linear in the
+ * length of the string.
+ */
+ssize_t kstr_find_buf(kstr *self, size_t start, const void *buf, size_t buf_len);
+
+/* Same as above, for a C string. */
+static inline ssize_t kstr_find_cstr(kstr *self, size_t start, const char *str) {
+    return kstr_find_buf(self, start, str, strlen(str));
+}
+
+/* Same as above, for a kstr. */
+static inline ssize_t kstr_find_kstr(kstr *self, size_t start, kstr *str) {
+    return kstr_find_buf(self, start, str->data, str->slen);
+}
 
 /* Replace all occurences of the string 'from' with the string 'to' in the
- * string specified.
+ * string specified. The occurrences are replaced from left to right and do not
+ * overlap.
  */
 void kstr_replace(kstr *self, char *from, char *to);
 
+/* Replace all occurences of the strings 'from[i]' with the strings 'to[i]' in
+ * the string specified, in linear time. The matches are replaced from left to
+ * right and do not overlap: at each position, the longest string matching is
+ * replaced. If several entries of 'from' are the same, the first one is used.
+ * The strings in 'from' must not be empty.
+ */
+void kstr_replace_multi(kstr *self, char **from, char **to, int nb);
+
+/* This function returns a view on the C string specified. */
+static inline kstr_view kstr_view_cstr(const char *str) {
+    kstr_view view = { str, strlen(str) };
+    return view;
+}
+
+/* This function returns a view on the buffer specified. */
+static inline kstr_view kstr_view_buf(const void *buf, size_t len) {
+    kstr_view view = { (const char *) buf, len };
+    return view;
+}
+
+/* This function returns a view on the whole string. */
+static inline kstr_view kstr_view_kstr(kstr *str) {
+    kstr_view view = { str->data, str->slen };
+    return view;
+}
+
+/* Same as kstr_mid(), but returns a view instead of copying the substring. */
+static inline kstr_view kstr_mid_view(kstr *self, size_t begin_pos, size_t size) {
+    kstr_view view = { self->data + begin_pos, size };
+    assert(begin_pos + size <= self->slen);
+    return view;
+}
+
+/* This function reads a serialized kstr as a view on the bytes of the buffer. */
+int kstr_deserialize_view(kbuffer *buffer, kstr_view *view);
+
+/* This function returns true if the two views have the same bytes. */
+static inline int kstr_view_equal(kstr_view first, kstr_view second) {
+    return (first.n == second.n && ! memcmp(first.p, second.p, first.n));
+}
+
+/* This function returns true if the view has the bytes of the C string. */
+static inline int kstr_view_equal_cstr(kstr_view first, const char *second) {
+    return kstr_view_equal(first, kstr_view_cstr(second));
+}
+
+/* This function assigns the bytes of a view to the string. */
+static inline void kstr_assign_view(kstr *self, kstr_view view) {
+    kstr_assign_buf(self, view.p, view.n);
+}
+
+/* This function appends the bytes of a view to the string. */
+static inline void kstr_append_view(kstr *self, kstr_view view) {
+    kstr_append_buf(self, view.p, view.n);
+}
+
+/* This function starts iterating over the fields of 'str' separated by
+ * 'delim'. Every field is returned, including the empty ones: "a,,b" yields
+ * "a", "" and "b", and "" yields "". The fields are views on 'str'; nothing is
+ * allocated.
+ *
+ * Example:
+ *   struct kstr_split split;
+ *   kstr_view field;
+ *   kstr_split_init(&split, kstr_view_kstr(&line), ',');
+ *   while (kstr_split_next(&split, &field)) { ... }
+ */
+static inline void kstr_split_init(struct kstr_split *self, kstr_view str, char delim) {
+    self->p = str.p;
+    self->end = str.p + str.n;
+    self->delim = delim;
+}
+
+int kstr_split_next(struct kstr_split *self, kstr_view *field);
+
 /* This function returns true if the two strings are the same. */
 int kstr_equal_cstr(kstr *first, const char *second);
 
@@ -0,0 +1,192 @@
+/**
+ * src/kstrbuf.c
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ *
+ * Chunked string builder.
+ */
+
+#include "kstrbuf.h"
+#include "kfmt.h"
+#include "kmem.h"
+#include "kutils.h"
+
+/* Size of the first chunk. The size doubles with each chunk up to the maximum
+ * size, except for the chunks allocated for larger appends.
+ */
+#define KSTRBUF_MIN_CHUNK_SIZE 1024
+#define KSTRBUF_MAX_CHUNK_SIZE (64 * 1024)
+
+/* Chunk of data. The data follows the header. */
+struct kstrbuf_chunk {
+
+    /* Next chunk in the list. */
+    struct kstrbuf_chunk *next;
+    
+    /* Number of bytes allocated and used after the header. */
+    size_t size;
+    size_t used;
+};
+
+/* This function returns the data of the chunk. */
+static inline char * kstrbuf_chunk_data(struct kstrbuf_chunk *chunk) {
+    return (char *) (chunk + 1);
+}
+
+void kstrbuf_init(kstrbuf *self) {
+    self->seg_array = NULL;
+    self->nb_seg = 0;
+    self->alloc_seg = 0;
+    self->len = 0;
+    self->chunk_list = NULL;
+    self->last_end = NULL;
+}
+
+void kstrbuf_clean(kstrbuf *self) {
+    if (self == NULL)
+        return;
+    
+    while (self->chunk_list) {
+        struct kstrbuf_chunk *next = self->chunk_list->next;
+        kfree(self->chunk_list);
+        self->chunk_list = next;
+    }
+    
+    kfree(self->seg_array);
+}
+
+/* This function empties the builder. The current chunk is kept for reuse. */
+void kstrbuf_reset(kstrbuf *self) {
+    struct kstrbuf_chunk *chunk = self->chunk_list;
+    
+    if (chunk) {
+        while (chunk->next) {
+            struct kstrbuf_chunk *next = chunk->next->next;
+            kfree(chunk->next);
+            chunk->next = next;
+        }
+        
+        chunk->used = 0;
+    }
+    
+    self->nb_seg = 0;
+    self->len = 0;
+    self->last_end = NULL;
+}
+
+/* This function adds a segment. */
+static void kstrbuf_add_seg(kstrbuf *self, const void *buf, size_t len) {
+    if (self->nb_seg == self->alloc_seg) {
+        self->alloc_seg = self->alloc_seg ? self->alloc_seg * 2 : 16;
+        self->seg_array = (struct iovec *) krealloc(self->seg_array, self->alloc_seg * sizeof(struct iovec));
+    }
+    
+    self->seg_array[self->nb_seg].iov_base = (void *) buf;
+    self->seg_array[self->nb_seg].iov_len = len;
+    self->nb_seg++;
+}
+
+/* This function returns a pointer to at least 'len' free bytes in the current
+ * chunk, allocating a new chunk if needed. The bytes are not used yet.
+ */
+static char * kstrbuf_reserve(kstrbuf *self, size_t len) {
+    struct kstrbuf_chunk *chunk = self->chunk_list;
+    size_t size;
+    
+    if (chunk && chunk->size - chunk->used >= len)
+        return kstrbuf_chunk_data(chunk) + chunk->used;
+    
+    size = chunk ? MIN(chunk->size * 2, (size_t) KSTRBUF_MAX_CHUNK_SIZE) : KSTRBUF_MIN_CHUNK_SIZE;
+    if (size < len) size = len;
+    
+    chunk = (struct kstrbuf_chunk *) kmalloc(sizeof(struct kstrbuf_chunk) + size);
+    chunk->next = self->chunk_list;
+    chunk->size = size;
+    chunk->used = 0;
+    self->chunk_list = chunk;
+    self->last_end = NULL;
+    
+    return kstrbuf_chunk_data(chunk);
+}
+
+/* This function marks 'len' bytes written at 'ptr', as returned by
+ * kstrbuf_reserve(), as used.
+ */
+static void kstrbuf_commit(kstrbuf *self, char *ptr, size_t len) {
+    if (len == 0) return;
+    
+    /* Extend the last segment if it ends here. */
+    if (ptr == self->last_end)
+        self->seg_array[self->nb_seg - 1].iov_len += len;
+    else
+        kstrbuf_add_seg(self, ptr, len);
+    
+    self->chunk_list->used += len;
+    self->last_end = ptr + len;
+    self->len += len;
+}
+
+/* This function copies a buffer at the end of the builder. */
+void kstrbuf_append_buf(kstrbuf *self, const void *buf, size_t len) {
+    char *ptr = kstrbuf_reserve(self, len);
+    memcpy(ptr, buf, len);
+    kstrbuf_commit(self, ptr, len);
+}
+
+/* This function sprintf at the end of the builder. */
+void kstrbuf_append_sf(kstrbuf *self, const char *format, ...) {
+    va_list arg;
+    va_start(arg, format);
+    kstrbuf_append_sfv(self, format, arg);
+    va_end(arg);
+}
+
+/* This function appends 'len' bytes to the builder for the formatter. */
+static char * kstrbuf_write_nbytes(void *dst, size_t len) {
+    kstrbuf *self = (kstrbuf *) dst;
+    char *ptr = kstrbuf_reserve(self, len);
+    kstrbuf_commit(self, ptr, len);
+    return ptr;
+}
+
+/* This function vsprintf at the end of the builder. */
+void kstrbuf_append_sfv(kstrbuf *self, const char *format, va_list arg) {
+    kfmt_vformat(kstrbuf_write_nbytes, self, format, arg);
+}
+
+/* This function references a buffer at the end of the builder without copying
+ * it.
+ */
+void kstrbuf_borrow_buf(kstrbuf *self, const void *buf, size_t len) {
+    if (len == 0) return;
+    kstrbuf_add_seg(self, buf, len);
+    self->last_end = NULL;
+    self->len += len;
+}
+
+/* This function appends the content of the builder to the buffer. */
+void kstrbuf_flatten(kstrbuf *self, kbuffer *buffer) {
+    uint8_t *ptr = kbuffer_write_nbytes(buffer, self->len);
+    int i;
+    
+    for (i = 0; i < self->nb_seg; i++) {
+        memcpy(ptr, self->seg_array[i].iov_base, self->seg_array[i].iov_len);
+        ptr += self->seg_array[i].iov_len;
+    }
+}
+
+/* This function assigns the content of the builder to the string. */
+void kstrbuf_flatten_kstr(kstrbuf *self, kstr *str) {
+    char *ptr;
+    int i;
+    
+    kstr_grow(str, self->len);
+    ptr = str->data;
+    
+    for (i = 0; i < self->nb_seg; i++) {
+        memcpy(ptr, self->seg_array[i].iov_base, self->seg_array[i].iov_len);
+        ptr += self->seg_array[i].iov_len;
+    }
+    
+    str->slen = self->len;
+    str->data[str->slen] = 0;
+}
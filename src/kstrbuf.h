@@ -0,0 +1,104 @@
+/**
+ * src/kstrbuf.h
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ */
+
+#ifndef __KSTRBUF_H__
+#define __KSTRBUF_H__
+
+#include <stdarg.h>
+#include <string.h>
+#include <sys/types.h>
+#include "kbuffer.h"
+#include "kstr.h"
+
+/* Struct kstrbuf is a string builder for large strings made of many fragments,
+ * e.g. a response built piece by piece.
+ *
+ * The data appended is copied in a chain of chunks. A chunk is never
+ * reallocated, so appending never copies the data appended before. Data that
+ * outlives the builder (e.g. a kstr or a kbuffer holding a large body) can be
+ * referenced instead of copied with the borrow methods. The borrowed data
+ * must not be modified or freed until the builder is flattened, reset or
+ * cleaned.
+ *
+ * The content is a sequence of segments, each one referring either to a chunk
+ * or to borrowed data. It can be flattened in a single pass into a kbuffer or
+ * a kstr, or it can be written as is with writev() by using the segment array,
+ * which has the layout of an iovec array.
+ */
+typedef struct kstrbuf {
+
+    /* Segment array. */
+    struct iovec *seg_array;
+
+    /* Number of segments used and allocated. */
+    int nb_seg;
+    int alloc_seg;
+
+    /* Total number of bytes. */
+    size_t len;
+
+    /* List of chunks. The first chunk is the one being filled. */
+    struct kstrbuf_chunk *chunk_list;
+
+    /* End of the last segment copied in the current chunk, or NULL if the last
+     * segment is not in the current chunk. Used to extend the last segment.
+     */
+    char *last_end;
+} kstrbuf;
+
+void kstrbuf_init(kstrbuf *self);
+void kstrbuf_clean(kstrbuf *self);
+void kstrbuf_reset(kstrbuf *self);
+void kstrbuf_append_buf(kstrbuf *self, const void *buf, size_t len);
+void kstrbuf_append_sf(kstrbuf *self, const char *format, ...);
+void kstrbuf_append_sfv(kstrbuf *self, const char *format, va_list arg);
+void kstrbuf_borrow_buf(kstrbuf *self, const void *buf, size_t len);
+void kstrbuf_flatten(kstrbuf *self, kbuffer *buffer);
+void kstrbuf_flatten_kstr(kstrbuf *self, kstr *str);
+
+/* This function appends a character. */
+static inline void kstrbuf_append_char(kstrbuf *self, char c) {
+    kstrbuf_append_buf(self, &c, 1);
+}
+
+/* This function appends a C string. */
+static inline void kstrbuf_append_cstr(kstrbuf *self, const char *str) {
+    kstrbuf_append_buf(self, str, strlen(str));
+}
+
+/* This function appends a kstr. */
+static inline void kstrbuf_append_kstr(kstrbuf *self, kstr *str) {
+    kstrbuf_append_buf(self, str->data, str->slen);
+}
+
+/* This function references the content of a kstr without copying it. */
+static inline void kstrbuf_borrow_kstr(kstrbuf *self, kstr *str) {
+    kstrbuf_borrow_buf(self, str->data, str->slen);
+}
+
+/* This function references the content of a kbuffer, from the start to 'len',
+ * without copying it.
+ */
+static inline void kstrbuf_borrow_kbuffer(kstrbuf *self, kbuffer *buffer) {
+    struct kbuffer_seg *seg;
+
+    if (! kbuffer_is_chained(buffer)) {
+        kstrbuf_borrow_buf(self, buffer->data, buffer->len);
+        return;
+    }
+
+    for (seg = buffer->first_seg; seg; seg = seg->next) kstrbuf_borrow_buf(self, seg->data, seg->len);
+}
+
+/* This function returns the segment array and stores the number of segments in
+ * 'count'. The array is valid until the builder is modified. Note that
+ * writev() accepts at most IOV_MAX segments per call.
+ */
+static inline struct iovec * kstrbuf_iovec(kstrbuf *self, int *count) {
+    *count = self->nb_seg;
+    return self->seg_array;
+}
+
+#endif
@@ -125,6 +125,7 @@ static struct kthread_specific * kthread_specific_new() {
     struct kthread_specific *self = (struct kthread_specific *) kcalloc(sizeof(struct kthread_specific));
     kerror_init(&self->error_stack);
     kstr_init(&self->err_str);
+    kpool_init(&self->pool);
     return self;
 }
 
@@ -132,6 +133,7 @@ static void kthread_specific_destroy(struct kthread_specific *self) {
     if (self) {
 	kerror_clean(&self->error_stack);
 	kstr_clean(&self->err_str);
+	kpool_clean(&self->pool);
 	kfree(self);
     }
 }
@@ -13,6 +13,7 @@
 
 #include <pthread.h>
 #include "kerror.h"
+#include "kpool.h"
 
 /* This flag is true if the library is operating in multithreaded mode. */
 extern int ktools_use_mt;
@@ -51,6 +52,9 @@ struct kthread_specific {
     
     /* Buffer used to format an error string. */
     kstr err_str;
+    
+    /* Pool of temporary buffers and strings used by this thread. */
+    struct kpool pool;
 };
 
 
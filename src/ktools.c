@@ -1,6 +1,8 @@
 #include "ktools.h"
 #include "kserializable.h"
 #include "kerror.h"
+#include "katom.h"
+#include "kpool.h"
 
 #define __BUILD_ID(ID) #ID
 #define _BUILD_ID(ID) __BUILD_ID(ID)
@@ -8,11 +10,16 @@
 char *build_id = _BUILD_ID(BUILD_ID);
 
 void ktools_initialize() {
+    kcpu_detect();
     kerror_initialize();
     kserializable_initialize();
+    katom_initialize();
+    kpool_initialize();
 }
 
 void ktools_finalize() {
+    kpool_finalize();
     kerror_finalize();
     kserializable_finalize();
+    katom_finalize();
 }
@@ -3,21 +3,31 @@
 
 #include "base64.h"
 #include "karray.h"
+#include "katom.h"
 #include "kbuffer.h"
+#include "kcpu.h"
 #include "kerror.h"
 #include "kthread.h"
+#include "kfmt.h"
 #include "kfs.h"
 #include "khash.h"
+#include "khex.h"
 #include "kindex.h"
+#include "kinterval.h"
 #include "kiter.h"
 #include "klist.h"
 #include "kmem.h"
 #include "kpath.h"
+#include "kpool.h"
+#include "kprb_tree.h"
 #include "krb_tree.h"
 #include "kserializable.h"
 #include "ksock.h"
 #include "kstr.h"
+#include "kstrbuf.h"
 #include "ktime.h"
+#include "kutf8.h"
+#include "kvarint.h"
 #include "kutils.h"
 
 void ktools_initialize();
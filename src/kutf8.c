@@ -0,0 +1,844 @@
+/**
+ * src/kutf8.c
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ *
+ * UTF-8 validation and transcoding.
+ */
+
+#include <string.h>
+#include "kutf8.h"
+#include "kcpu.h"
+#include "kerror.h"
+
+#ifdef KCPU_X86
+#include <immintrin.h>
+#define KUTF8_SSE2 __attribute__((target("sse2")))
+#define KUTF8_SSSE3 __attribute__((target("ssse3")))
+#define KUTF8_AVX2 __attribute__((target("avx2")))
+#endif
+
+/******************************************/
+/* ASCII blocks. */
+
+/* The functions below process the ASCII bytes at the beginning of the input
+ * and stop at the first non-ASCII byte. They return the number of bytes (or
+ * code units) processed.
+ */
+
+/* This function copies the ASCII prefix of 'src' into 'dst'. 'dst' may be
+ * lower than or equal to 'src' in the same buffer.
+ */
+static size_t kutf8_copy_ascii_scalar(char *dst, const char *src, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n && (unsigned char) src[i] < 0x80; i++) dst[i] = src[i];
+    return i;
+}
+
+/* Same as above, without writing. */
+static size_t kutf8_ascii_len_scalar(const char *src, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n && (unsigned char) src[i] < 0x80; i++);
+    return i;
+}
+
+/* This function returns the number of bytes greater than 0x7f. */
+static size_t kutf8_count_high_scalar(const char *src, size_t n) {
+    size_t i, count = 0;
+
+    for (i = 0; i < n; i++) count += (unsigned char) src[i] >> 7;
+    return count;
+}
+
+/* This function copies the ASCII prefix of the UTF-16 string 'src' into the
+ * UTF-8 string 'dst'.
+ */
+static size_t kutf8_narrow_ascii_scalar(char *dst, const uint16_t *src, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n && src[i] < 0x80; i++) dst[i] = src[i];
+    return i;
+}
+
+/* This function copies the ASCII prefix of the UTF-8 string 'src' into the
+ * UTF-16 string 'dst'. The destination may be unaligned.
+ */
+static size_t kutf8_widen_ascii_scalar(char *dst, const char *src, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n && (unsigned char) src[i] < 0x80; i++) {
+        uint16_t c = src[i];
+        memcpy(dst + 2 * i, &c, 2);
+    }
+
+    return i;
+}
+
+#ifdef KCPU_X86
+KUTF8_SSE2 static size_t kutf8_copy_ascii_sse2(char *dst, const char *src, size_t n) {
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+        if (_mm_movemask_epi8(v)) break;
+        _mm_storeu_si128((__m128i *) (dst + i), v);
+    }
+
+    return i + kutf8_copy_ascii_scalar(dst + i, src + i, n - i);
+}
+
+KUTF8_AVX2 static size_t kutf8_copy_ascii_avx2(char *dst, const char *src, size_t n) {
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (src + i));
+        if (_mm256_movemask_epi8(v)) break;
+        _mm256_storeu_si256((__m256i *) (dst + i), v);
+    }
+
+    return i + kutf8_copy_ascii_sse2(dst + i, src + i, n - i);
+}
+
+KUTF8_SSE2 static size_t kutf8_ascii_len_sse2(const char *src, size_t n) {
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        unsigned int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (src + i)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+
+    return i + kutf8_ascii_len_scalar(src + i, n - i);
+}
+
+KUTF8_AVX2 static size_t kutf8_ascii_len_avx2(const char *src, size_t n) {
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        unsigned int mask = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *) (src + i)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+
+    return i + kutf8_ascii_len_sse2(src + i, n - i);
+}
+
+KUTF8_SSE2 static size_t kutf8_count_high_sse2(const char *src, size_t n) {
+    size_t i = 0, count = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (src + i))));
+    }
+
+    return count + kutf8_count_high_scalar(src + i, n - i);
+}
+
+KUTF8_AVX2 static size_t kutf8_count_high_avx2(const char *src, size_t n) {
+    size_t i = 0, count = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        count += __builtin_popcount(_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *) (src + i))));
+    }
+
+    return count + kutf8_count_high_sse2(src + i, n - i);
+}
+
+/* The UTF-16 blocks are converted 8 code units at a time. A block is ASCII if
+ * none of its units has a bit set above bit 6.
+ */
+KUTF8_SSE2 static size_t kutf8_narrow_ascii_sse2(char *dst, const uint16_t *src, size_t n) {
+    __m128i high = _mm_set1_epi16((short) 0xff80);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, high), _mm_setzero_si128())) != 0xffff) break;
+        _mm_storel_epi64((__m128i *) (dst + i), _mm_packus_epi16(v, v));
+    }
+
+    return i + kutf8_narrow_ascii_scalar(dst + i, src + i, n - i);
+}
+
+KUTF8_SSE2 static size_t kutf8_widen_ascii_sse2(char *dst, const char *src, size_t n) {
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+        if (_mm_movemask_epi8(v)) break;
+        _mm_storeu_si128((__m128i *) (dst + 2 * i), _mm_unpacklo_epi8(v, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i *) (dst + 2 * i + 16), _mm_unpackhi_epi8(v, _mm_setzero_si128()));
+    }
+
+    return i + kutf8_widen_ascii_scalar(dst + 2 * i, src + i, n - i);
+}
+#endif
+
+/******************************************/
+/* Validation blocks. */
+
+/* The blocks are validated 16 or 32 bytes at a time with the lookup algorithm
+ * of Keiser and Lemire. Each byte is classified with the high nibble of the
+ * previous byte, the low nibble of the previous byte and the high nibble of
+ * the byte itself. Each lookup returns the set of errors possible for its
+ * nibble, and the byte is invalid if the three sets intersect. The missing or
+ * extra continuation bytes of the 3 and 4-byte sequences are detected by
+ * comparing the bytes 2 and 3 positions back with the lead bytes.
+ */
+#define KUTF8_TOO_SHORT     0x01    /* Lead byte not followed by a continuation byte. */
+#define KUTF8_TOO_LONG      0x02    /* ASCII byte followed by a continuation byte. */
+#define KUTF8_OVERLONG_3    0x04    /* 3-byte form of a code point below U+0800. */
+#define KUTF8_TOO_LARGE     0x08    /* Code point above U+10FFFF. */
+#define KUTF8_SURROGATE     0x10    /* Code point between U+D800 and U+DFFF. */
+#define KUTF8_OVERLONG_2    0x20    /* 2-byte form of a code point below U+0080. */
+#define KUTF8_TOO_LARGE_2   0x40    /* Lead byte above 0xf4 followed by 0x80-0x8f. */
+#define KUTF8_OVERLONG_4    0x40    /* 4-byte form of a code point below U+10000. */
+#define KUTF8_TWO_CONTS     0x80    /* Continuation byte following another one. */
+#define KUTF8_CARRY (KUTF8_TOO_SHORT | KUTF8_TOO_LONG | KUTF8_TWO_CONTS)
+
+/* Errors indexed by the high nibble of the previous byte. */
+static const unsigned char kutf8_byte_1_high[16] = {
+    KUTF8_TOO_LONG, KUTF8_TOO_LONG, KUTF8_TOO_LONG, KUTF8_TOO_LONG,
+    KUTF8_TOO_LONG, KUTF8_TOO_LONG, KUTF8_TOO_LONG, KUTF8_TOO_LONG,
+    KUTF8_TWO_CONTS, KUTF8_TWO_CONTS, KUTF8_TWO_CONTS, KUTF8_TWO_CONTS,
+    KUTF8_TOO_SHORT | KUTF8_OVERLONG_2,
+    KUTF8_TOO_SHORT,
+    KUTF8_TOO_SHORT | KUTF8_OVERLONG_3 | KUTF8_SURROGATE,
+    KUTF8_TOO_SHORT | KUTF8_TOO_LARGE | KUTF8_TOO_LARGE_2 | KUTF8_OVERLONG_4
+};
+
+/* Errors indexed by the low nibble of the previous byte. */
+static const unsigned char kutf8_byte_1_low[16] = {
+    KUTF8_CARRY | KUTF8_OVERLONG_2 | KUTF8_OVERLONG_3 | KUTF8_OVERLONG_4,
+    KUTF8_CARRY | KUTF8_OVERLONG_2,
+    KUTF8_CARRY,
+    KUTF8_CARRY,
+    KUTF8_CARRY | KUTF8_TOO_LARGE,
+    KUTF8_CARRY | KUTF8_TOO_LARGE | KUTF8_TOO_LARGE_2,
+    KUTF8_CARRY | KUTF8_TOO_LARGE | KUTF8_TOO_LARGE_2,
+    KUTF8_CARRY | KUTF8_TOO_LARGE | KUTF8_TOO_LARGE_2,
+    KUTF8_CARRY | KUTF8_TOO_LARGE | KUTF8_TOO_LARGE_2,
+    KUTF8_CARRY | KUTF8_TOO_LARGE | KUTF8_TOO_LARGE_2,
+    KUTF8_CARRY | KUTF8_TOO_LARGE | KUTF8_TOO_LARGE_2,
+    KUTF8_CARRY | KUTF8_TOO_LARGE | KUTF8_TOO_LARGE_2,
+    KUTF8_CARRY | KUTF8_TOO_LARGE | KUTF8_TOO_LARGE_2,
+    KUTF8_CARRY | KUTF8_TOO_LARGE | KUTF8_TOO_LARGE_2 | KUTF8_SURROGATE,
+    KUTF8_CARRY | KUTF8_TOO_LARGE | KUTF8_TOO_LARGE_2,
+    KUTF8_CARRY | KUTF8_TOO_LARGE | KUTF8_TOO_LARGE_2
+};
+
+/* Errors indexed by the high nibble of the byte. */
+static const unsigned char kutf8_byte_2_high[16] = {
+    KUTF8_TOO_SHORT, KUTF8_TOO_SHORT, KUTF8_TOO_SHORT, KUTF8_TOO_SHORT,
+    KUTF8_TOO_SHORT, KUTF8_TOO_SHORT, KUTF8_TOO_SHORT, KUTF8_TOO_SHORT,
+    KUTF8_TOO_LONG | KUTF8_OVERLONG_2 | KUTF8_TWO_CONTS | KUTF8_OVERLONG_3 | KUTF8_TOO_LARGE_2 | KUTF8_OVERLONG_4,
+    KUTF8_TOO_LONG | KUTF8_OVERLONG_2 | KUTF8_TWO_CONTS | KUTF8_OVERLONG_3 | KUTF8_TOO_LARGE,
+    KUTF8_TOO_LONG | KUTF8_OVERLONG_2 | KUTF8_TWO_CONTS | KUTF8_SURROGATE | KUTF8_TOO_LARGE,
+    KUTF8_TOO_LONG | KUTF8_OVERLONG_2 | KUTF8_TWO_CONTS | KUTF8_SURROGATE | KUTF8_TOO_LARGE,
+    KUTF8_TOO_SHORT, KUTF8_TOO_SHORT, KUTF8_TOO_SHORT, KUTF8_TOO_SHORT
+};
+
+/* The functions below validate the blocks of the buffer and stop at the first
+ * invalid block or before the last partial block. They return the start of
+ * the character from which the scalar validation must continue: the bytes
+ * before it are valid.
+ */
+#ifdef KCPU_X86
+/* This function returns the start of the character containing the byte at
+ * 'i', in a buffer whose first 'i' bytes have been validated by the blocks.
+ */
+static size_t kutf8_char_start(const char *buf, size_t i) {
+    const unsigned char *s = (const unsigned char *) buf;
+    size_t j = i;
+
+    while (j > 0 && i - j < 3 && (s[j - 1] & 0xc0) == 0x80) j--;
+    if (j > 0 && s[j - 1] >= 0xc0) j--;
+    return j;
+}
+
+/* This function returns the error bits of the block 'input', which follows
+ * the block 'prev'.
+ */
+KUTF8_SSSE3 static inline __m128i kutf8_check_block_ssse3(__m128i input, __m128i prev) {
+    __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i prev1 = _mm_alignr_epi8(input, prev, 15);
+    __m128i prev2 = _mm_alignr_epi8(input, prev, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, prev, 13);
+    __m128i byte_1_high, byte_1_low, byte_2_high, must23;
+
+    byte_1_high = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) kutf8_byte_1_high),
+                                   _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    byte_1_low = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) kutf8_byte_1_low),
+                                  _mm_and_si128(prev1, nibble));
+    byte_2_high = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) kutf8_byte_2_high),
+                                   _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+
+    /* The high bit is set if the byte must be the third or fourth byte of a
+     * sequence. Such a byte is a continuation byte following another one,
+     * which sets KUTF8_TWO_CONTS in the lookups: the error is their difference.
+     */
+    must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80)),
+                          _mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80)));
+
+    return _mm_xor_si128(_mm_and_si128(must23, _mm_set1_epi8((char) 0x80)),
+                         _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high));
+}
+
+KUTF8_SSSE3 static size_t kutf8_validate_blocks_ssse3(const char *buf, size_t n) {
+    /* Nonzero if the last 3 bytes of the block start an unfinished sequence. */
+    __m128i max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                (char) 0xef, (char) 0xdf, (char) 0xbf);
+    __m128i prev = _mm_setzero_si128(), incomplete = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i input = _mm_loadu_si128((const __m128i *) (buf + i));
+        __m128i error = incomplete;
+
+        /* An ASCII block is valid if the previous block is complete. */
+        if (_mm_movemask_epi8(input)) error = kutf8_check_block_ssse3(input, prev);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xffff) break;
+
+        incomplete = _mm_subs_epu8(input, max);
+        prev = input;
+    }
+
+    return kutf8_char_start(buf, i);
+}
+
+KUTF8_AVX2 static inline __m256i kutf8_check_block_avx2(__m256i input, __m256i prev) {
+    __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i shifted = _mm256_permute2x128_si256(prev, input, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+    __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+    __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+    __m256i byte_1_high, byte_1_low, byte_2_high, must23;
+
+    byte_1_high = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) kutf8_byte_1_high)),
+                                      _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    byte_1_low = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) kutf8_byte_1_low)),
+                                     _mm256_and_si256(prev1, nibble));
+    byte_2_high = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) kutf8_byte_2_high)),
+                                      _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+
+    must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0 - 0x80)),
+                             _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xf0 - 0x80)));
+
+    return _mm256_xor_si256(_mm256_and_si256(must23, _mm256_set1_epi8((char) 0x80)),
+                            _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high));
+}
+
+KUTF8_AVX2 static size_t kutf8_validate_blocks_avx2(const char *buf, size_t n) {
+    __m256i max = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                   (char) 0xef, (char) 0xdf, (char) 0xbf);
+    __m256i prev = _mm256_setzero_si256(), incomplete = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i *) (buf + i));
+        __m256i error = incomplete;
+
+        if (_mm256_movemask_epi8(input)) error = kutf8_check_block_avx2(input, prev);
+        if (! _mm256_testz_si256(error, error)) break;
+
+        incomplete = _mm256_subs_epu8(input, max);
+        prev = input;
+    }
+
+    /* The SSSE3 blocks restart from a character boundary. */
+    i = kutf8_char_start(buf, i);
+    return i + kutf8_validate_blocks_ssse3(buf + i, n - i);
+}
+#endif
+
+/* Dispatch function. */
+static size_t kutf8_validate_blocks(const char *buf, size_t n) {
+#ifdef KCPU_X86
+    int level = kcpu_get_level();
+    if (level >= KCPU_LEVEL_AVX2) return kutf8_validate_blocks_avx2(buf, n);
+    if (level >= KCPU_LEVEL_SSSE3) return kutf8_validate_blocks_ssse3(buf, n);
+#endif
+
+    return 0;
+}
+
+/* Dispatch functions. */
+static size_t kutf8_copy_ascii(char *dst, const char *src, size_t n) {
+#ifdef KCPU_X86
+    int level = kcpu_get_level();
+    if (level >= KCPU_LEVEL_AVX2) return kutf8_copy_ascii_avx2(dst, src, n);
+    if (level >= KCPU_LEVEL_SSE2) return kutf8_copy_ascii_sse2(dst, src, n);
+#endif
+
+    return kutf8_copy_ascii_scalar(dst, src, n);
+}
+
+static size_t kutf8_ascii_len(const char *src, size_t n) {
+#ifdef KCPU_X86
+    int level = kcpu_get_level();
+    if (level >= KCPU_LEVEL_AVX2) return kutf8_ascii_len_avx2(src, n);
+    if (level >= KCPU_LEVEL_SSE2) return kutf8_ascii_len_sse2(src, n);
+#endif
+
+    return kutf8_ascii_len_scalar(src, n);
+}
+
+static size_t kutf8_count_high(const char *src, size_t n) {
+#ifdef KCPU_X86
+    int level = kcpu_get_level();
+    if (level >= KCPU_LEVEL_AVX2) return kutf8_count_high_avx2(src, n);
+    if (level >= KCPU_LEVEL_SSE2) return kutf8_count_high_sse2(src, n);
+#endif
+
+    return kutf8_count_high_scalar(src, n);
+}
+
+static size_t kutf8_narrow_ascii(char *dst, const uint16_t *src, size_t n) {
+#ifdef KCPU_X86
+    if (kcpu_get_level() >= KCPU_LEVEL_SSE2) return kutf8_narrow_ascii_sse2(dst, src, n);
+#endif
+
+    return kutf8_narrow_ascii_scalar(dst, src, n);
+}
+
+static size_t kutf8_widen_ascii(char *dst, const char *src, size_t n) {
+#ifdef KCPU_X86
+    if (kcpu_get_level() >= KCPU_LEVEL_SSE2) return kutf8_widen_ascii_sse2(dst, src, n);
+#endif
+
+    return kutf8_widen_ascii_scalar(dst, src, n);
+}
+
+/******************************************/
+/* Code points. */
+
+/* This function decodes the UTF-8 sequence at the beginning of 's', which has
+ * 'n' bytes left. It returns the length of the sequence, or 0 if the sequence
+ * is invalid. The code point is set to U+FFFD if the sequence is invalid.
+ */
+static inline size_t kutf8_decode(const unsigned char *s, size_t n, uint32_t *cp) {
+    unsigned char c = s[0];
+    uint32_t c32;
+
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    }
+
+    *cp = 0xfffd;
+
+    /* 0x80 to 0xc1 are continuation bytes or overlong forms. */
+    if (c < 0xc2) return 0;
+
+    if (c < 0xe0) {
+        if (n < 2 || (s[1] & 0xc0) != 0x80) return 0;
+        *cp = ((c & 0x1f) << 6) | (s[1] & 0x3f);
+        return 2;
+    }
+
+    if (c < 0xf0) {
+        if (n < 3 || (s[1] & 0xc0) != 0x80 || (s[2] & 0xc0) != 0x80) return 0;
+        c32 = ((c & 0x0f) << 12) | ((s[1] & 0x3f) << 6) | (s[2] & 0x3f);
+        if (c32 < 0x800 || (c32 >= 0xd800 && c32 <= 0xdfff)) return 0;
+        *cp = c32;
+        return 3;
+    }
+
+    if (c < 0xf5) {
+        if (n < 4 || (s[1] & 0xc0) != 0x80 || (s[2] & 0xc0) != 0x80 || (s[3] & 0xc0) != 0x80) return 0;
+        c32 = ((c & 0x07) << 18) | ((s[1] & 0x3f) << 12) | ((s[2] & 0x3f) << 6) | (s[3] & 0x3f);
+        if (c32 < 0x10000 || c32 > 0x10ffff) return 0;
+        *cp = c32;
+        return 4;
+    }
+
+    return 0;
+}
+
+/* This function encodes the code point specified in 'dst' and returns the
+ * number of bytes written.
+ */
+static inline size_t kutf8_encode(char *dst, uint32_t cp) {
+    if (cp < 0x80) {
+        dst[0] = cp;
+        return 1;
+    }
+
+    if (cp < 0x800) {
+        dst[0] = 0xc0 | (cp >> 6);
+        dst[1] = 0x80 | (cp & 0x3f);
+        return 2;
+    }
+
+    if (cp < 0x10000) {
+        dst[0] = 0xe0 | (cp >> 12);
+        dst[1] = 0x80 | ((cp >> 6) & 0x3f);
+        dst[2] = 0x80 | (cp & 0x3f);
+        return 3;
+    }
+
+    dst[0] = 0xf0 | (cp >> 18);
+    dst[1] = 0x80 | ((cp >> 12) & 0x3f);
+    dst[2] = 0x80 | ((cp >> 6) & 0x3f);
+    dst[3] = 0x80 | (cp & 0x3f);
+    return 4;
+}
+
+/* This function returns true if the code unit is a high (first) surrogate. */
+static inline int kutf8_is_high_surrogate(uint16_t c) {
+    return (c & 0xfc00) == 0xd800;
+}
+
+/* This function returns true if the code unit is a low (second) surrogate. */
+static inline int kutf8_is_low_surrogate(uint16_t c) {
+    return (c & 0xfc00) == 0xdc00;
+}
+
+/******************************************/
+/* Validation and conversion. */
+
+/* This function returns the length of the longest valid UTF-8 prefix of the
+ * buffer. The buffer is valid if the length returned is 'n'. The blocks are
+ * validated with the vector instructions, and the decoder finds the exact
+ * position of the error in the first invalid block.
+ */
+size_t kutf8_validate(const char *buf, size_t n) {
+    const unsigned char *s = (const unsigned char *) buf;
+    size_t i = kutf8_validate_blocks(buf, n), len;
+    uint32_t cp;
+
+    while (i < n) {
+        if (s[i] < 0x80) {
+            i += kutf8_ascii_len(buf + i, n - i);
+            continue;
+        }
+
+        len = kutf8_decode(s + i, n - i, &cp);
+        if (len == 0) break;
+        i += len;
+    }
+
+    return i;
+}
+
+/* This function returns the size of the UTF-8 string corresponding to the
+ * Latin-1 string specified.
+ */
+size_t kutf8_from_latin1_size(const char *src, size_t n) {
+    return n + kutf8_count_high(src, n);
+}
+
+/* This function converts the Latin-1 string 'src' to UTF-8 and returns the
+ * number of bytes written in 'dst'.
+ */
+size_t kutf8_from_latin1(char *dst, const char *src, size_t n) {
+    size_t i = 0, j = 0, len;
+
+    while (i < n) {
+        unsigned char c = src[i];
+
+        if (c < 0x80) {
+            len = kutf8_copy_ascii(dst + j, src + i, n - i);
+            i += len;
+            j += len;
+            continue;
+        }
+
+        dst[j++] = 0xc0 | (c >> 6);
+        dst[j++] = 0x80 | (c & 0x3f);
+        i++;
+    }
+
+    return j;
+}
+
+/* This function returns the size of the Latin-1 string corresponding to the
+ * UTF-8 string specified, or -1 if the string is invalid or contains characters
+ * that Latin-1 cannot represent.
+ */
+ssize_t kutf8_to_latin1_size(const char *src, size_t n) {
+    const unsigned char *s = (const unsigned char *) src;
+    size_t i = 0, size = 0, len;
+    uint32_t cp;
+
+    while (i < n) {
+        if (s[i] < 0x80) {
+            len = kutf8_ascii_len(src + i, n - i);
+            i += len;
+            size += len;
+            continue;
+        }
+
+        len = kutf8_decode(s + i, n - i, &cp);
+        if (len == 0 || cp > 0xff) return -1;
+        i += len;
+        size++;
+    }
+
+    return size;
+}
+
+/* This function converts the UTF-8 string 'src' to Latin-1 and returns the
+ * number of bytes written in 'dst'. The conversion can be done in place. The
+ * invalid bytes and the characters above U+00FF are replaced by '?'.
+ */
+size_t kutf8_to_latin1(char *dst, const char *src, size_t n) {
+    const unsigned char *s = (const unsigned char *) src;
+    size_t i = 0, j = 0, len;
+    uint32_t cp;
+
+    while (i < n) {
+        if (s[i] < 0x80) {
+            len = kutf8_copy_ascii(dst + j, src + i, n - i);
+            i += len;
+            j += len;
+            continue;
+        }
+
+        /* An invalid sequence is skipped one byte at a time. */
+        len = kutf8_decode(s + i, n - i, &cp);
+        i += len ? len : 1;
+        dst[j++] = (cp > 0xff) ? '?' : cp;
+    }
+
+    return j;
+}
+
+/* This function returns the size of the UTF-8 string corresponding to the
+ * UTF-16 string specified, or -1 if the string contains unpaired surrogates.
+ */
+ssize_t kutf8_from_utf16_size(const uint16_t *src, size_t n) {
+    size_t i, size = 0;
+
+    for (i = 0; i < n; i++) {
+        uint16_t c = src[i];
+
+        if (c < 0x80) size += 1;
+        else if (c < 0x800) size += 2;
+        else if (kutf8_is_high_surrogate(c)) {
+            if (i + 1 == n || ! kutf8_is_low_surrogate(src[i + 1])) return -1;
+            size += 4;
+            i++;
+        }
+        else if (kutf8_is_low_surrogate(c)) return -1;
+        else size += 3;
+    }
+
+    return size;
+}
+
+/* This function converts the UTF-16 string 'src' to UTF-8 and returns the
+ * number of bytes written in 'dst'. The unpaired surrogates are replaced by
+ * U+FFFD.
+ */
+size_t kutf8_from_utf16(char *dst, const uint16_t *src, size_t n) {
+    size_t i = 0, j = 0, len;
+
+    while (i < n) {
+        uint32_t c = src[i];
+
+        if (c < 0x80) {
+            len = kutf8_narrow_ascii(dst + j, src + i, n - i);
+            i += len;
+            j += len;
+            continue;
+        }
+
+        if (kutf8_is_high_surrogate(c) && i + 1 < n && kutf8_is_low_surrogate(src[i + 1])) {
+            c = 0x10000 + ((c - 0xd800) << 10) + (src[i + 1] - 0xdc00);
+            i++;
+        }
+
+        else if ((c & 0xf800) == 0xd800) {
+            c = 0xfffd;
+        }
+
+        j += kutf8_encode(dst + j, c);
+        i++;
+    }
+
+    return j;
+}
+
+/* This function returns the number of UTF-16 code units corresponding to the
+ * UTF-8 string specified, or -1 if the string is invalid.
+ */
+ssize_t kutf8_to_utf16_size(const char *src, size_t n) {
+    const unsigned char *s = (const unsigned char *) src;
+    size_t i = 0, size = 0, len;
+    uint32_t cp;
+
+    while (i < n) {
+        if (s[i] < 0x80) {
+            len = kutf8_ascii_len(src + i, n - i);
+            i += len;
+            size += len;
+            continue;
+        }
+
+        len = kutf8_decode(s + i, n - i, &cp);
+        if (len == 0) return -1;
+        i += len;
+        size += (len == 4) ? 2 : 1;
+    }
+
+    return size;
+}
+
+/* This function converts the UTF-8 string 'src' to UTF-16 in 'dst', which
+ * need not be aligned. It returns the number of code units written. The
+ * invalid bytes are replaced by U+FFFD.
+ */
+static size_t kutf8_to_utf16_unaligned(char *dst, const char *src, size_t n) {
+    const unsigned char *s = (const unsigned char *) src;
+    size_t i = 0, j = 0, len;
+    uint32_t cp;
+    uint16_t unit[2];
+
+    while (i < n) {
+        if (s[i] < 0x80) {
+            len = kutf8_widen_ascii(dst + 2 * j, src + i, n - i);
+            i += len;
+            j += len;
+            continue;
+        }
+
+        /* An invalid sequence is skipped one byte at a time. */
+        len = kutf8_decode(s + i, n - i, &cp);
+        i += len ? len : 1;
+
+        if (cp < 0x10000) {
+            unit[0] = cp;
+            memcpy(dst + 2 * j, unit, 2);
+            j++;
+        }
+
+        else {
+            cp -= 0x10000;
+            unit[0] = 0xd800 | (cp >> 10);
+            unit[1] = 0xdc00 | (cp & 0x3ff);
+            memcpy(dst + 2 * j, unit, 4);
+            j += 2;
+        }
+    }
+
+    return j;
+}
+
+/* This function converts the UTF-8 string 'src' to UTF-16 and returns the
+ * number of code units written in 'dst'.
+ */
+size_t kutf8_to_utf16(uint16_t *dst, const char *src, size_t n) {
+    return kutf8_to_utf16_unaligned((char *) dst, src, n);
+}
+
+/******************************************/
+/* kstr and kbuffer. */
+
+/* This function converts the Latin-1 string to UTF-8 in place. The string is
+ * left unchanged if it is ASCII.
+ */
+void kutf8_kstr_from_latin1(kstr *self) {
+    size_t prefix = kutf8_ascii_len(self->data, self->slen);
+    size_t size, i, j;
+
+    if (prefix == self->slen) return;
+
+    /* Convert backward from the end, so that the bytes are not overwritten
+     * before being read.
+     */
+    size = prefix + kutf8_from_latin1_size(self->data + prefix, self->slen - prefix);
+    kstr_grow(self, size);
+
+    for (i = self->slen, j = size; i > prefix; i--) {
+        unsigned char c = self->data[i - 1];
+
+        if (c < 0x80) {
+            self->data[--j] = c;
+        }
+
+        else {
+            self->data[--j] = 0x80 | (c & 0x3f);
+            self->data[--j] = 0xc0 | (c >> 6);
+        }
+    }
+
+    self->slen = size;
+    self->data[size] = 0;
+}
+
+/* This function converts the UTF-8 string to Latin-1 in place. The string is
+ * left unchanged if it is invalid or if it contains characters that Latin-1
+ * cannot represent.
+ */
+int kutf8_kstr_to_latin1(kstr *self) {
+    ssize_t size = kutf8_to_latin1_size(self->data, self->slen);
+
+    if (size == -1) {
+        KTOOLS_ERROR_SET("the string is not UTF-8 or cannot be represented in Latin-1");
+        return -1;
+    }
+
+    if ((size_t) size != self->slen) {
+        kutf8_to_latin1(self->data, self->data, self->slen);
+        self->slen = size;
+        self->data[size] = 0;
+    }
+
+    return 0;
+}
+
+/* This function assigns the UTF-8 conversion of the UTF-16 string specified to
+ * the string.
+ */
+int kutf8_kstr_from_utf16(kstr *self, const uint16_t *src, size_t n) {
+    ssize_t size = kutf8_from_utf16_size(src, n);
+
+    if (size == -1) {
+        KTOOLS_ERROR_SET("invalid UTF-16 string");
+        return -1;
+    }
+
+    kstr_grow(self, size);
+    kutf8_from_utf16(self->data, src, n);
+    self->slen = size;
+    self->data[size] = 0;
+    return 0;
+}
+
+/* This function writes the UTF-8 conversion of the Latin-1 string specified in
+ * the buffer.
+ */
+void kutf8_write_from_latin1(kbuffer *self, const char *src, size_t n) {
+    size_t size = kutf8_from_latin1_size(src, n);
+    kutf8_from_latin1((char *) kbuffer_write_nbytes(self, size), src, n);
+}
+
+/* This function writes the UTF-8 conversion of the UTF-16 string specified in
+ * the buffer.
+ */
+int kutf8_write_from_utf16(kbuffer *self, const uint16_t *src, size_t n) {
+    ssize_t size = kutf8_from_utf16_size(src, n);
+
+    if (size == -1) {
+        KTOOLS_ERROR_SET("invalid UTF-16 string");
+        return -1;
+    }
+
+    kutf8_from_utf16((char *) kbuffer_write_nbytes(self, size), src, n);
+    return 0;
+}
+
+/* This function writes the UTF-16 conversion of the UTF-8 string specified in
+ * the buffer, in the host byte order.
+ */
+int kutf8_write_to_utf16(kbuffer *self, const char *src, size_t n) {
+    ssize_t size = kutf8_to_utf16_size(src, n);
+
+    if (size == -1) {
+        KTOOLS_ERROR_SET("invalid UTF-8 string");
+        return -1;
+    }
+
+    kutf8_to_utf16_unaligned((char *) kbuffer_write_nbytes(self, 2 * size), src, n);
+    return 0;
+}
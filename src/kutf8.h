@@ -0,0 +1,59 @@
+/**
+ * src/kutf8.h
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ */
+
+#ifndef __KUTF8_H__
+#define __KUTF8_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "kstr.h"
+#include "kbuffer.h"
+
+/* The kutf8 module validates UTF-8 and converts between UTF-8, Latin-1 and
+ * UTF-16.
+ *
+ * Each conversion has a function returning the exact size of the output, so
+ * that the destination can be allocated once, and a function doing the
+ * conversion into a buffer of that size. The size functions also validate the
+ * input: they return -1 if the input cannot be converted. The conversion
+ * functions do not fail: they replace each invalid byte of UTF-8 and each
+ * unpaired surrogate of UTF-16 by U+FFFD, and each character that Latin-1
+ * cannot represent by '?'. The output then has at most 'n' bytes or code units
+ * when converting from UTF-8, and at most '3 * n' bytes when converting from
+ * UTF-16.
+ *
+ * The ASCII blocks of the input are detected 16 or 32 bytes at a time with the
+ * vector instructions reported by kcpu, and copied as is. kutf8_validate()
+ * also checks the multibyte sequences 16 or 32 bytes at a time with SSSE3 or
+ * AVX2 shuffles, and decodes the bytes one at a time only to locate an error.
+ *
+ * The UTF-16 strings are arrays of 16-bit code units in the host byte order.
+ * The UTF-8 validation rejects the overlong forms, the surrogates and the code
+ * points above U+10FFFF.
+ */
+
+size_t kutf8_validate(const char *buf, size_t n);
+size_t kutf8_from_latin1_size(const char *src, size_t n);
+size_t kutf8_from_latin1(char *dst, const char *src, size_t n);
+ssize_t kutf8_to_latin1_size(const char *src, size_t n);
+size_t kutf8_to_latin1(char *dst, const char *src, size_t n);
+ssize_t kutf8_from_utf16_size(const uint16_t *src, size_t n);
+size_t kutf8_from_utf16(char *dst, const uint16_t *src, size_t n);
+ssize_t kutf8_to_utf16_size(const char *src, size_t n);
+size_t kutf8_to_utf16(uint16_t *dst, const char *src, size_t n);
+
+void kutf8_kstr_from_latin1(kstr *self);
+int kutf8_kstr_to_latin1(kstr *self);
+int kutf8_kstr_from_utf16(kstr *self, const uint16_t *src, size_t n);
+void kutf8_write_from_latin1(kbuffer *self, const char *src, size_t n);
+int kutf8_write_from_utf16(kbuffer *self, const uint16_t *src, size_t n);
+int kutf8_write_to_utf16(kbuffer *self, const char *src, size_t n);
+
+/* This function returns true if the buffer contains valid UTF-8. */
+static inline int kutf8_is_valid(const char *buf, size_t n) {
+    return kutf8_validate(buf, n) == n;
+}
+
+#endif
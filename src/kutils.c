@@ -1,6 +1,11 @@
 /* Copyright (C) 2006-2012 Opersys inc., All rights reserved. */
 
 #include "ktools.h"
+#include "kcpu.h"
+
+#ifdef KCPU_X86
+#include <immintrin.h>
+#endif
 
 /* Clone the C string specified. */
 char* kutil_strdup(char *s) {
@@ -10,19 +15,426 @@ char* kutil_strdup(char *s) {
     return r;
 }
 
-/* This function implements a portable version of strcasestr(). */
-char * kutil_strcasestr(const char *haystack, const char *needle) {
-    size_t needle_len = strlen(needle);
-    const char *last_start = haystack + strlen(haystack) - needle_len;
+/* Vector implementations. The functions are compiled for their instruction
+ * set with the target attribute and are only called when kcpu reports that
+ * the processor supports it.
+ */
+#ifdef KCPU_X86
+#define KUTIL_SSE2 __attribute__((target("sse2")))
+#define KUTIL_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* This function returns the ASCII lowercase of a character. */
+static inline unsigned char kutil_lower(unsigned char c) {
+    return ((unsigned char) (c - 'A') < 26) ? (c | 0x20) : c;
+}
 
-    while (haystack <= last_start) {
-        if (portable_strncasecmp(haystack, needle, needle_len) == 0)
-            return (char *) haystack;
+/* This function returns true if the 'n' bytes of 'a' and 'b' are the same,
+ * ignoring the ASCII case.
+ */
+static inline int kutil_casecmp_eq(const char *a, const char *b, size_t n) {
+    size_t i;
+    
+    for (i = 0; i < n; i++) {
+        if (kutil_lower(a[i]) != kutil_lower(b[i])) return 0;
+    }
+    
+    return 1;
+}
 
-        haystack++;
+/******************************************/
+/* ASCII case conversion. */
+
+/* The ASCII case conversion flips the 0x20 bit of the letters between 'first'
+ * and 'first' + 25, i.e. 'A' to convert to lowercase and 'a' to convert to
+ * uppercase.
+ */
+static void kutil_ascii_case_scalar(char *dst, const char *src, size_t n, char first) {
+    size_t i;
+    
+    for (i = 0; i < n; i++) {
+        unsigned char c = src[i];
+        dst[i] = ((unsigned char) (c - first) < 26) ? (c ^ 0x20) : c;
     }
+}
 
-    return NULL;
+#ifdef KCPU_X86
+KUTIL_SSE2 static inline __m128i kutil_case_sse2(__m128i v, char first) {
+    
+    /* Move the letters to the bottom of the signed range to test them with a
+     * single signed comparison.
+     */
+    __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8((char) (128 - first)));
+    __m128i letter = _mm_cmplt_epi8(shifted, _mm_set1_epi8((char) (-128 + 26)));
+    return _mm_xor_si128(v, _mm_and_si128(letter, _mm_set1_epi8(0x20)));
+}
+
+KUTIL_SSE2 static void kutil_ascii_case_sse2(char *dst, const char *src, size_t n, char first) {
+    size_t i = 0;
+    
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+        _mm_storeu_si128((__m128i *) (dst + i), kutil_case_sse2(v, first));
+    }
+    
+    kutil_ascii_case_scalar(dst + i, src + i, n - i, first);
+}
+
+KUTIL_AVX2 static inline __m256i kutil_case_avx2(__m256i v, char first) {
+    __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8((char) (128 - first)));
+    __m256i letter = _mm256_cmpgt_epi8(_mm256_set1_epi8((char) (-128 + 26)), shifted);
+    return _mm256_xor_si256(v, _mm256_and_si256(letter, _mm256_set1_epi8(0x20)));
+}
+
+KUTIL_AVX2 static void kutil_ascii_case_avx2(char *dst, const char *src, size_t n, char first) {
+    size_t i = 0;
+    
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (src + i));
+        _mm256_storeu_si256((__m256i *) (dst + i), kutil_case_avx2(v, first));
+    }
+    
+    kutil_ascii_case_sse2(dst + i, src + i, n - i, first);
+}
+#endif
+
+/* This function dispatches the case conversion. */
+static void kutil_ascii_case(char *dst, const char *src, size_t n, char first) {
+#ifdef KCPU_X86
+    int level = kcpu_get_level();
+    
+    if (level >= KCPU_LEVEL_AVX2) {
+        kutil_ascii_case_avx2(dst, src, n, first);
+        return;
+    }
+    
+    if (level >= KCPU_LEVEL_SSE2) {
+        kutil_ascii_case_sse2(dst, src, n, first);
+        return;
+    }
+#endif
+    
+    kutil_ascii_case_scalar(dst, src, n, first);
+}
+
+/* This function converts the 'n' bytes of 'src' to ASCII lowercase in 'dst'.
+ * The buffers may be the same but must not overlap otherwise. The bytes
+ * other than 'A' to 'Z' are copied as is.
+ */
+void kutil_ascii_tolower(char *dst, const char *src, size_t n) {
+    kutil_ascii_case(dst, src, n, 'A');
+}
+
+/* Same as above, to convert to ASCII uppercase. */
+void kutil_ascii_toupper(char *dst, const char *src, size_t n) {
+    kutil_ascii_case(dst, src, n, 'a');
+}
+
+/******************************************/
+/* Byte swapping. */
+
+static void kutil_bswap_scalar(uint8_t *dst, const uint8_t *src, size_t count, size_t width) {
+    size_t i;
+
+    for (i = 0; i < count; i++, dst += width, src += width) {
+        if (width == 2) {
+            uint16_t v;
+            memcpy(&v, src, 2);
+            v = __builtin_bswap16(v);
+            memcpy(dst, &v, 2);
+        } else if (width == 4) {
+            uint32_t v;
+            memcpy(&v, src, 4);
+            v = __builtin_bswap32(v);
+            memcpy(dst, &v, 4);
+        } else {
+            uint64_t v;
+            memcpy(&v, src, 8);
+            v = __builtin_bswap64(v);
+            memcpy(dst, &v, 8);
+        }
+    }
+}
+
+#ifdef KCPU_X86
+/* SSE2 has no byte shuffle: the 16-bit words are reordered within each value,
+ * then the bytes of each word are swapped with shifts.
+ */
+KUTIL_SSE2 static void kutil_bswap_sse2(uint8_t *dst, const uint8_t *src, size_t count, size_t width) {
+    size_t n = count * width, i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+        if (width == 4) v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+        else if (width == 8) v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x1b), 0x1b);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *) (dst + i), v);
+    }
+
+    kutil_bswap_scalar(dst + i, src + i, (n - i) / width, width);
+}
+
+KUTIL_AVX2 static void kutil_bswap_avx2(uint8_t *dst, const uint8_t *src, size_t count, size_t width) {
+    size_t n = count * width, i = 0;
+    __m256i mask;
+
+    if (width == 2) mask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    else if (width == 4) mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                                 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    else mask = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (src + i));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_shuffle_epi8(v, mask));
+    }
+
+    kutil_bswap_sse2(dst + i, src + i, (n - i) / width, width);
+}
+#endif
+
+/* This function reverses the byte order of the 'count' values of 'width'
+ * bytes (2, 4 or 8) of 'src' into 'dst'. The buffers may be the same but must
+ * not overlap otherwise. They do not need to be aligned.
+ */
+void kutil_bswap_array(void *dst, const void *src, size_t count, size_t width) {
+#ifdef KCPU_X86
+    int level = kcpu_get_level();
+    if (level >= KCPU_LEVEL_AVX2) {
+        kutil_bswap_avx2(dst, src, count, width);
+        return;
+    }
+    if (level >= KCPU_LEVEL_SSE2) {
+        kutil_bswap_sse2(dst, src, count, width);
+        return;
+    }
+#endif
+
+    kutil_bswap_scalar(dst, src, count, width);
+}
+
+/******************************************/
+/* Substring search. */
+
+/* This function returns the index of the maximal suffix of 'x' for the order
+ * specified ('rev' reverses the alphabet order), and its period in 'period'.
+ * The characters are compared in lowercase if 'nocase' is true.
+ */
+static inline __attribute__((always_inline)) ssize_t kutil_max_suffix(const unsigned char *x, ssize_t m,
+                                                                       ssize_t *period, int rev, int nocase) {
+    ssize_t ms = -1, j = 0, k = 1;
+    *period = 1;
+    
+    while (j + k < m) {
+        unsigned char a = nocase ? kutil_lower(x[j + k]) : x[j + k];
+        unsigned char b = nocase ? kutil_lower(x[ms + k]) : x[ms + k];
+        
+        if (a == b) {
+            if (k != *period) k++;
+            else {
+                j += *period;
+                k = 1;
+            }
+        }
+        
+        else if ((a < b) != rev) {
+            j += k;
+            k = 1;
+            *period = j - ms;
+        }
+        
+        else {
+            ms = j;
+            j = ms + 1;
+            k = *period = 1;
+        }
+    }
+    
+    return ms;
+}
+
+/* Two-way algorithm of Crochemore and Perrin. It uses constant space and
+ * linear time. This function is specialized by the compiler for each value of
+ * 'nocase'.
+ */
+static inline __attribute__((always_inline)) ssize_t kutil_two_way(const unsigned char *hay, ssize_t n,
+                                                                    const unsigned char *x, ssize_t m, int nocase) {
+    ssize_t i, j, ell, memory, p, q, per;
+    
+#define KUTIL_EQ(a, b) (nocase ? kutil_lower(a) == kutil_lower(b) : (a) == (b))
+    
+    /* Critical factorization of the needle. */
+    i = kutil_max_suffix(x, m, &p, 0, nocase);
+    j = kutil_max_suffix(x, m, &q, 1, nocase);
+    
+    if (i > j) {
+        ell = i;
+        per = p;
+    }
+    
+    else {
+        ell = j;
+        per = q;
+    }
+    
+    /* The needle is periodic. Remember the prefix matched after a shift by the
+     * period.
+     */
+    if (nocase ? kutil_casecmp_eq((const char *) x, (const char *) x + per, ell + 1) : ! memcmp(x, x + per, ell + 1)) {
+        j = 0;
+        memory = -1;
+        
+        while (j <= n - m) {
+            i = MAX(ell, memory) + 1;
+            while (i < m && KUTIL_EQ(x[i], hay[i + j])) i++;
+            
+            if (i >= m) {
+                i = ell;
+                while (i > memory && KUTIL_EQ(x[i], hay[i + j])) i--;
+                if (i <= memory) return j;
+                j += per;
+                memory = m - per - 1;
+            }
+            
+            else {
+                j += i - ell;
+                memory = -1;
+            }
+        }
+    }
+    
+    else {
+        per = MAX(ell + 1, m - ell - 1) + 1;
+        j = 0;
+        
+        while (j <= n - m) {
+            i = ell + 1;
+            while (i < m && KUTIL_EQ(x[i], hay[i + j])) i++;
+            
+            if (i >= m) {
+                i = ell;
+                while (i >= 0 && KUTIL_EQ(x[i], hay[i + j])) i--;
+                if (i < 0) return j;
+                j += per;
+            }
+            
+            else {
+                j += i - ell;
+            }
+        }
+    }
+    
+#undef KUTIL_EQ
+    
+    return -1;
+}
+
+/* This function returns the position of the first occurrence of 'needle' in
+ * 'haystack', or -1, using the two-way algorithm. The search ignores the ASCII
+ * case if 'nocase_flag' is true. The search is linear in the length of the
+ * haystack.
+ */
+ssize_t kutil_two_way_search(const char *haystack, size_t haystack_len, const char *needle, size_t needle_len,
+                             int nocase_flag) {
+    if (needle_len > haystack_len) return -1;
+    
+    if (nocase_flag)
+        return kutil_two_way((const unsigned char *) haystack, haystack_len, (const unsigned char *) needle, needle_len, 1);
+    
+    return kutil_two_way((const unsigned char *) haystack, haystack_len, (const unsigned char *) needle, needle_len, 0);
+}
+
+/* The vector search tests 16 or 32 positions at a time by comparing the first
+ * and the last bytes of the needle in lowercase. The positions passing this
+ * filter are verified. If too many positions pass the filter (e.g. on
+ * repetitive input), the search continues with the two-way algorithm to stay
+ * linear. The functions return the position where the vector search stopped
+ * in 'pos', and the position of the match or -1.
+ */
+#ifdef KCPU_X86
+KUTIL_SSE2 static ssize_t kutil_memcasemem_sse2(const char *hay, size_t n, const char *needle, size_t m, size_t *pos) {
+    __m128i first = _mm_set1_epi8(kutil_lower(needle[0]));
+    __m128i last = _mm_set1_epi8(kutil_lower(needle[m - 1]));
+    size_t i = 0, nb_false = 0;
+    
+    for (; i + m + 15 <= n; i += 16) {
+        __m128i block_first = kutil_case_sse2(_mm_loadu_si128((const __m128i *) (hay + i)), 'A');
+        __m128i block_last = kutil_case_sse2(_mm_loadu_si128((const __m128i *) (hay + i + m - 1)), 'A');
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                            _mm_cmpeq_epi8(last, block_last)));
+        
+        while (mask) {
+            size_t match = i + __builtin_ctz(mask);
+            if (kutil_casecmp_eq(hay + match + 1, needle + 1, m - 2)) return match;
+            nb_false++;
+            mask &= mask - 1;
+        }
+        
+        if (nb_false > 64 && nb_false * m > 4 * i) break;
+    }
+    
+    *pos = i;
+    return -1;
+}
+
+KUTIL_AVX2 static ssize_t kutil_memcasemem_avx2(const char *hay, size_t n, const char *needle, size_t m, size_t *pos) {
+    __m256i first = _mm256_set1_epi8(kutil_lower(needle[0]));
+    __m256i last = _mm256_set1_epi8(kutil_lower(needle[m - 1]));
+    size_t i = 0, nb_false = 0;
+    
+    for (; i + m + 31 <= n; i += 32) {
+        __m256i block_first = kutil_case_avx2(_mm256_loadu_si256((const __m256i *) (hay + i)), 'A');
+        __m256i block_last = kutil_case_avx2(_mm256_loadu_si256((const __m256i *) (hay + i + m - 1)), 'A');
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                                                                  _mm256_cmpeq_epi8(last, block_last)));
+        
+        while (mask) {
+            size_t match = i + __builtin_ctz(mask);
+            if (kutil_casecmp_eq(hay + match + 1, needle + 1, m - 2)) return match;
+            nb_false++;
+            mask &= mask - 1;
+        }
+        
+        if (nb_false > 64 && nb_false * m > 4 * i) break;
+    }
+    
+    *pos = i;
+    return -1;
+}
+#endif
+
+/* This function returns a pointer to the first occurrence of 'needle' in
+ * 'haystack', ignoring the ASCII case, or NULL.
+ */
+const char * kutil_memcasemem(const char *haystack, size_t haystack_len, const char *needle, size_t needle_len) {
+    size_t pos = 0;
+    ssize_t match;
+    
+    if (needle_len == 0) return haystack;
+    if (needle_len > haystack_len) return NULL;
+    
+#ifdef KCPU_X86
+    if (needle_len >= 2) {
+        int level = kcpu_get_level();
+        
+        if (level >= KCPU_LEVEL_AVX2) match = kutil_memcasemem_avx2(haystack, haystack_len, needle, needle_len, &pos);
+        else if (level >= KCPU_LEVEL_SSE2) match = kutil_memcasemem_sse2(haystack, haystack_len, needle, needle_len, &pos);
+        else match = -1;
+        
+        if (match != -1) return haystack + match;
+    }
+#endif
+    
+    match = kutil_two_way_search(haystack + pos, haystack_len - pos, needle, needle_len, 1);
+    return (match == -1) ? NULL : haystack + pos + match;
+}
+
+/* This function implements a portable version of strcasestr(). Only the ASCII
+ * letters are folded.
+ */
+char * kutil_strcasestr(const char *haystack, const char *needle) {
+    return (char *) kutil_memcasemem(haystack, strlen(haystack), needle, strlen(needle));
 }
 
 /* This function looks for 'needle' inside 'haystack' like in
@@ -31,9 +443,21 @@ char * kutil_strcasestr(const char *haystack, const char *needle) {
  */
 char * kutil_reverse_strcasestr(const char *start, const char *haystack, const char *needle) {
     size_t needle_len = strlen(needle);
-
+    unsigned char first;
+    const char *end;
+    
+    if (needle_len == 0) return (char *) haystack;
+    
+    /* A match cannot extend past the end of the string. */
+    end = haystack + strnlen(haystack, needle_len);
+    if ((size_t) (end - start) < needle_len) return NULL;
+    if ((size_t) (end - haystack) < needle_len) haystack = end - needle_len;
+    
+    /* Test the first character before comparing the rest. */
+    first = kutil_lower(needle[0]);
+    
     while (haystack >= start) {
-        if (portable_strncasecmp(haystack, needle, needle_len) == 0)
+        if (kutil_lower(*haystack) == first && kutil_casecmp_eq(haystack + 1, needle + 1, needle_len - 1))
             return (char *) haystack;
 
         haystack--;
@@ -42,44 +466,122 @@ char * kutil_reverse_strcasestr(const char *start, const char *haystack, const c
     return NULL;
 }
 
-/* This function dumps the content of a buffer on the stream specified, in
- * ASCII. A newline is inserted after 20 characters have been printed on a line.
- */
-void kutil_dump_buf_ascii(unsigned char *buf, int n, FILE *stream) {
-    int i;
+/******************************************/
+/* Byte set scan. */
 
+/* This function returns a pointer to the first byte of 'buf' that is in 'set'
+ * using a bitmap, or NULL.
+ */
+static const char * kutil_find_any_scalar(const char *buf, size_t n, const char *set, size_t set_len) {
+    uint32_t bitmap[8] = { 0 };
+    size_t i;
+    
+    for (i = 0; i < set_len; i++) bitmap[(unsigned char) set[i] >> 5] |= 1u << (set[i] & 31);
+    
     for (i = 0; i < n; i++) {
-        if (i > 0 && i % 20 == 0) fprintf(stream, "\n");
-        else if (i % 20) fprintf(stream, " ");
+        unsigned char c = buf[i];
+        if (bitmap[c >> 5] & (1u << (c & 31))) return buf + i;
+    }
+    
+    return NULL;
+}
 
-        if (buf[i] == '\n') fprintf(stream, "\\n");
-        else if (buf[i] == '\r') fprintf(stream, "\\r");
-        else fprintf(stream, "%c ", buf[i]);
+/* The vector scans compare each block with every byte of the set. They are
+ * used for sets of up to KUTIL_FIND_ANY_MAX bytes.
+ */
+#define KUTIL_FIND_ANY_MAX 16
+
+#ifdef KCPU_X86
+KUTIL_SSE2 static const char * kutil_find_any_sse2(const char *buf, size_t n, const char *set, size_t set_len) {
+    __m128i set_vec[KUTIL_FIND_ANY_MAX];
+    size_t i, j;
+    
+    for (j = 0; j < set_len; j++) set_vec[j] = _mm_set1_epi8(set[j]);
+    
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (buf + i));
+        __m128i found = _mm_cmpeq_epi8(v, set_vec[0]);
+        unsigned int mask;
+        
+        for (j = 1; j < set_len; j++) found = _mm_or_si128(found, _mm_cmpeq_epi8(v, set_vec[j]));
+        mask = _mm_movemask_epi8(found);
+        if (mask) return buf + i + __builtin_ctz(mask);
     }
+    
+    return kutil_find_any_scalar(buf + i, n - i, set, set_len);
 }
 
-/* This function converts an ISO-8859-1 string to an UTF8 string. */
-void kutil_latin1_to_utf8(kstr *name) {
-    int i;
-    kstr tmp;
-    kstr_init(&tmp);
+KUTIL_AVX2 static const char * kutil_find_any_avx2(const char *buf, size_t n, const char *set, size_t set_len) {
+    __m256i set_vec[KUTIL_FIND_ANY_MAX];
+    size_t i, j;
+    
+    for (j = 0; j < set_len; j++) set_vec[j] = _mm256_set1_epi8(set[j]);
+    
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (buf + i));
+        __m256i found = _mm256_cmpeq_epi8(v, set_vec[0]);
+        unsigned int mask;
+        
+        for (j = 1; j < set_len; j++) found = _mm256_or_si256(found, _mm256_cmpeq_epi8(v, set_vec[j]));
+        mask = _mm256_movemask_epi8(found);
+        if (mask) return buf + i + __builtin_ctz(mask);
+    }
+    
+    return kutil_find_any_scalar(buf + i, n - i, set, set_len);
+}
+#endif
+
+/* This function returns a pointer to the first byte of 'buf' that is one of
+ * the 'set_len' bytes of 'set', or NULL if there is none.
+ */
+const char * kutil_find_any(const char *buf, size_t n, const char *set, size_t set_len) {
+    if (set_len == 0) return NULL;
+    
+#ifdef KCPU_X86
+    if (set_len <= KUTIL_FIND_ANY_MAX) {
+        int level = kcpu_get_level();
+        if (level >= KCPU_LEVEL_AVX2) return kutil_find_any_avx2(buf, n, set, set_len);
+        if (level >= KCPU_LEVEL_SSE2) return kutil_find_any_sse2(buf, n, set, set_len);
+    }
+#endif
+    
+    return kutil_find_any_scalar(buf, n, set, set_len);
+}
 
-    for (i = 0; i < name->slen; i++) {
-        unsigned char latin1_char = name->data[i];
+/* This function dumps the content of a buffer on the stream specified, in
+ * ASCII. A newline is inserted after 20 characters have been printed on a line.
+ * The lines are formatted in memory and written at once.
+ */
+void kutil_dump_buf_ascii(unsigned char *buf, int n, FILE *stream) {
+    char line[64];
+    int i, len = 0;
 
-        if (latin1_char < 128) {
-            kstr_append_char(&tmp, latin1_char);
+    for (i = 0; i < n; i++) {
+        if (i > 0 && i % 20 == 0) {
+            fwrite(line, 1, len, stream);
+            line[0] = '\n';
+            len = 1;
+        }
+
+        else if (i % 20) line[len++] = ' ';
+
+        if (buf[i] == '\n' || buf[i] == '\r') {
+            line[len++] = '\\';
+            line[len++] = (buf[i] == '\n') ? 'n' : 'r';
         }
 
         else {
-            unsigned char utf8_char[2] = { 0xC0 | ((latin1_char & 0xC0) >> 6), 0x80 | (latin1_char & 0x3F) };
-            kstr_append_char(&tmp, utf8_char[0]);
-            kstr_append_char(&tmp, utf8_char[1]);
+            line[len++] = buf[i];
+            line[len++] = ' ';
         }
     }
 
-    kstr_assign_kstr(name, &tmp);
-    kstr_clean(&tmp);
+    fwrite(line, 1, len, stream);
+}
+
+/* This function converts an ISO-8859-1 string to an UTF8 string. */
+void kutil_latin1_to_utf8(kstr *name) {
+    kutf8_kstr_from_latin1(name);
 }
 
 /* This function dumps the content of a buffer on the stream specified, in
@@ -87,14 +589,46 @@ void kutil_latin1_to_utf8(kstr *name) {
  * line.
  */
 void kutil_dump_buf_hex(unsigned char *buf, int n, FILE *stream) {
-    int i;
-
-    for (i = 0; i < n; i++) {
-        if (i > 0 && i % 16 == 0) fprintf(stream, "\n");
-        fprintf(stream, "%.2x", buf[i]);
+    char line[33];
+    int i, len;
+
+    for (i = 0; i < n; i += 16) {
+        len = MIN(n - i, 16);
+        khex_encode(line, buf + i, len);
+        line[2 * len] = '\n';
+        fwrite(line, 1, 2 * len + 1, stream);
     }
 
-    printf("\n");
+    if (n == 0) fputc('\n', stream);
+}
+
+/* This function dumps the content of a buffer on the stream specified in the
+ * layout of 'hexdump -C': the offset, 16 bytes in hexadecimal and the same
+ * bytes in ASCII, with a dot for the non printable characters.
+ */
+void kutil_hexdump(const void *buf, size_t n, FILE *stream) {
+    const uint8_t *p = (const uint8_t *) buf;
+    char line[80], hex[32];
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += 16) {
+        len = MIN(n - i, (size_t) 16);
+        memset(line, ' ', sizeof(line));
+        khex_encode(hex, p + i, len);
+
+        /* Offset on 8 digits. */
+        for (j = 0; j < 8; j++) line[7 - j] = "0123456789abcdef"[(i >> (4 * j)) & 0xf];
+
+        for (j = 0; j < len; j++) {
+            memcpy(line + 10 + 3 * j + (j >= 8), hex + 2 * j, 2);
+            line[61 + j] = (p[i + j] >= 0x20 && p[i + j] < 0x7f) ? p[i + j] : '.';
+        }
+
+        line[60] = '|';
+        line[61 + len] = '|';
+        line[62 + len] = '\n';
+        fwrite(line, 1, 63 + len, stream);
+    }
 }
 
 /* This function generates 'len' bytes of random data.
@@ -210,6 +744,58 @@ int kutil_get_random_int(int max) {
     return num_int;
 }
 
+/* This function returns true if the byte is a control character other than
+ * '\r' and '\n'.
+ */
+static inline int kutil_is_binary_char(uint8_t c) {
+    return (c < 32 && c != 13 && c != 10);
+}
+
+static int kutils_string_is_binary_scalar(const char *str, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (kutil_is_binary_char(str[i]))
+            return 1;
+    }
+
+    return 0;
+}
+
+#ifdef KCPU_X86
+KUTIL_SSE2 static int kutils_string_is_binary_sse2(const char *str, size_t n) {
+    __m128i max = _mm_set1_epi8(31);
+    __m128i cr = _mm_set1_epi8(13);
+    __m128i lf = _mm_set1_epi8(10);
+    size_t i = 0;
+    
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (str + i));
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(v, max), v);
+        __m128i newline = _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf));
+        if (_mm_movemask_epi8(_mm_andnot_si128(newline, control))) return 1;
+    }
+    
+    return kutils_string_is_binary_scalar(str + i, n - i);
+}
+
+KUTIL_AVX2 static int kutils_string_is_binary_avx2(const char *str, size_t n) {
+    __m256i max = _mm256_set1_epi8(31);
+    __m256i cr = _mm256_set1_epi8(13);
+    __m256i lf = _mm256_set1_epi8(10);
+    size_t i = 0;
+    
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (str + i));
+        __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(v, max), v);
+        __m256i newline = _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf));
+        if (_mm256_movemask_epi8(_mm256_andnot_si256(newline, control))) return 1;
+    }
+    
+    return kutils_string_is_binary_sse2(str + i, n - i);
+}
+#endif
+
 /** Returns 1 if if the passed string has binary characters.
  *
  * This function uses simple heuristics to determine if a string is
@@ -217,15 +803,13 @@ int kutil_get_random_int(int max) {
  * !13 or !10.
  */
 int kutils_string_is_binary(const char *str, size_t n) {
-    uint32_t i;
+#ifdef KCPU_X86
+    int level = kcpu_get_level();
+    if (level >= KCPU_LEVEL_AVX2) return kutils_string_is_binary_avx2(str, n);
+    if (level >= KCPU_LEVEL_SSE2) return kutils_string_is_binary_sse2(str, n);
+#endif
 
-    for (i = 0; i < n; i++) {
-        if (!((uint8_t)str[i] == 13 || (uint8_t)str[i] == 10)
-            && (uint8_t)str[i] < 32)
-            return 1;
-    }
-
-    return 0;
+    return kutils_string_is_binary_scalar(str, n);
 }
 
 /** Uncleverly wrap a block of text.  XXX: THIS FUNCTION IS NOT USED
@@ -4,7 +4,11 @@
 #define __K_UTILS_H__
 
 #include <inttypes.h>
+#include <stdint.h>
 #include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
 
 /* Return the number of elements in a static array of pointers. */
 #define KUTIL_ARRAY_SIZE(NAME) (sizeof(NAME) / sizeof(void *))
@@ -104,20 +108,46 @@ static inline int next_power_of_2(int val)
     return val;
 }
 
-/* This function puts all the characters of a string in lowercase. */
-static inline void strntolower(char *str, size_t max_len) {
-    for (; max_len-- > 0 && *str; str++)
-        *str = tolower(*str);
+/* Same as next_power_of_2(), for size_t values. */
+static inline size_t next_power_of_2_size(size_t val)
+{
+    val |= (val >>  1);
+    val |= (val >>  2);
+    val |= (val >>  4);
+    val |= (val >>  8);
+    val |= (val >> 16);
+#if SIZE_MAX > 0xffffffffu
+    val |= (val >> 32);
+#endif
+    val += 1;
+
+    return val;
 }
 
 /* Forward declaration. */
 struct kstr;
 
+void kutil_ascii_tolower(char *dst, const char *src, size_t n);
+void kutil_ascii_toupper(char *dst, const char *src, size_t n);
+
+/* This function puts all the characters of a string in lowercase. Only the
+ * ASCII letters are converted, regardless of the locale.
+ */
+static inline void strntolower(char *str, size_t max_len) {
+    kutil_ascii_tolower(str, str, strnlen(str, max_len));
+}
+
 char* kutil_strdup(char *s);
 char * kutil_strcasestr(const char *haystack, const char *needle);
 char * kutil_reverse_strcasestr(const char *start, const char *haystack, const char *needle);
+const char * kutil_memcasemem(const char *haystack, size_t haystack_len, const char *needle, size_t needle_len);
+ssize_t kutil_two_way_search(const char *haystack, size_t haystack_len, const char *needle, size_t needle_len,
+                             int nocase_flag);
+const char * kutil_find_any(const char *buf, size_t n, const char *set, size_t set_len);
+void kutil_bswap_array(void *dst, const void *src, size_t count, size_t width);
 void kutil_dump_buf_ascii(unsigned char *buf, int n, FILE *stream);
 void kutil_dump_buf_hex(unsigned char *buf, int n, FILE *stream);
+void kutil_hexdump(const void *buf, size_t n, FILE *stream);
 void kutil_latin1_to_utf8(struct kstr *name);
 int kutil_generate_random(char *buf, int len);
 int kutil_generate_alpha_random(char *buf, size_t len);
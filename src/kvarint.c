@@ -0,0 +1,301 @@
+/**
+ * src/kvarint.c
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ *
+ * LEB128 varint encoding.
+ */
+
+#include <string.h>
+#include "kvarint.h"
+#include "kcpu.h"
+
+#ifdef KCPU_X86
+#include <immintrin.h>
+#define KVARINT_SSE2 __attribute__((target("sse2")))
+#define KVARINT_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* This function encodes the value in 'buf', which must have room for
+ * KVARINT_MAX32 bytes, and returns the number of bytes written.
+ */
+size_t kvarint_encode32(uint8_t *buf, uint32_t value) {
+    size_t i = 0;
+
+    while (value >= 0x80) {
+        buf[i++] = (uint8_t) value | 0x80;
+        value >>= 7;
+    }
+
+    buf[i++] = (uint8_t) value;
+    return i;
+}
+
+/* Same as above for a 64-bit value. 'buf' must have room for KVARINT_MAX64
+ * bytes.
+ */
+size_t kvarint_encode64(uint8_t *buf, uint64_t value) {
+    size_t i = 0;
+
+    while (value >= 0x80) {
+        buf[i++] = (uint8_t) value | 0x80;
+        value >>= 7;
+    }
+
+    buf[i++] = (uint8_t) value;
+    return i;
+}
+
+/* This function decodes the value at the beginning of the 'n' bytes of 'buf'.
+ * It returns the number of bytes read, or 0 if the value is truncated or does
+ * not fit in 32 bits.
+ */
+size_t kvarint_decode32(const uint8_t *buf, size_t n, uint32_t *value) {
+    uint32_t v = 0;
+    size_t i;
+
+    for (i = 0; i < n && i < KVARINT_MAX32; i++) {
+        uint8_t b = buf[i];
+        if (i == KVARINT_MAX32 - 1 && b > 0x0f) return 0;
+        v |= (uint32_t) (b & 0x7f) << (7 * i);
+
+        if (! (b & 0x80)) {
+            *value = v;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Same as above for a 64-bit value. */
+size_t kvarint_decode64(const uint8_t *buf, size_t n, uint64_t *value) {
+    uint64_t v = 0;
+    size_t i;
+
+    for (i = 0; i < n && i < KVARINT_MAX64; i++) {
+        uint8_t b = buf[i];
+        if (i == KVARINT_MAX64 - 1 && b > 0x01) return 0;
+        v |= (uint64_t) (b & 0x7f) << (7 * i);
+
+        if (! (b & 0x80)) {
+            *value = v;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+/* The vector decoders extract the continuation bits of a block of bytes. If
+ * none is set, the block contains only single-byte values, which are widened
+ * directly. Otherwise, the clear bits mark the last byte of each value and the
+ * values ending in the block are decoded from the mask, without testing the
+ * bytes one by one. The decoders stop before a block that could produce more
+ * values than requested, and before an invalid value, which the scalar loop
+ * then reports.
+ */
+
+/* This function decodes the values whose last byte is marked in 'ends' and
+ * returns the number of bytes consumed.
+ */
+static inline size_t kvarint_decode32_block(const uint8_t *p, uint32_t ends, uint32_t *out, size_t *i) {
+    size_t start = 0;
+
+    while (ends) {
+        size_t end = __builtin_ctz(ends), len = end - start + 1, k;
+        uint32_t v = 0;
+
+        if (len > KVARINT_MAX32 || (len == KVARINT_MAX32 && p[end] > 0x0f)) break;
+        for (k = 0; k < len; k++) v |= (uint32_t) (p[start + k] & 0x7f) << (7 * k);
+        out[(*i)++] = v;
+        start = end + 1;
+        ends &= ends - 1;
+    }
+
+    return start;
+}
+
+static inline size_t kvarint_decode64_block(const uint8_t *p, uint32_t ends, uint64_t *out, size_t *i) {
+    size_t start = 0;
+
+    while (ends) {
+        size_t end = __builtin_ctz(ends), len = end - start + 1, k;
+        uint64_t v = 0;
+
+        if (len > KVARINT_MAX64 || (len == KVARINT_MAX64 && p[end] > 0x01)) break;
+        for (k = 0; k < len; k++) v |= (uint64_t) (p[start + k] & 0x7f) << (7 * k);
+        out[(*i)++] = v;
+        start = end + 1;
+        ends &= ends - 1;
+    }
+
+    return start;
+}
+
+#ifdef KCPU_X86
+KVARINT_SSE2 static size_t kvarint_decode32_sse2(const uint8_t *buf, size_t n, uint32_t *out, size_t count,
+                                                 size_t *pos_out) {
+    __m128i zero = _mm_setzero_si128();
+    size_t pos = 0, i = 0, used;
+
+    while (pos + 16 <= n && i + 16 <= count) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (buf + pos));
+        unsigned int mask = _mm_movemask_epi8(v);
+
+        if (mask == 0) {
+            __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+            _mm_storeu_si128((__m128i *) (out + i), _mm_unpacklo_epi16(lo, zero));
+            _mm_storeu_si128((__m128i *) (out + i + 4), _mm_unpackhi_epi16(lo, zero));
+            _mm_storeu_si128((__m128i *) (out + i + 8), _mm_unpacklo_epi16(hi, zero));
+            _mm_storeu_si128((__m128i *) (out + i + 12), _mm_unpackhi_epi16(hi, zero));
+            pos += 16;
+            i += 16;
+            continue;
+        }
+
+        used = kvarint_decode32_block(buf + pos, ~mask & 0xffff, out, &i);
+        pos += used;
+        if (used == 0) break;
+    }
+
+    *pos_out = pos;
+    return i;
+}
+
+KVARINT_AVX2 static size_t kvarint_decode32_avx2(const uint8_t *buf, size_t n, uint32_t *out, size_t count,
+                                                 size_t *pos_out) {
+    size_t pos = 0, i = 0, used;
+
+    while (pos + 32 <= n && i + 32 <= count) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (buf + pos));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(v);
+
+        if (mask == 0) {
+            size_t k;
+            for (k = 0; k < 32; k += 8) {
+                __m128i b = _mm_loadl_epi64((const __m128i *) (buf + pos + k));
+                _mm256_storeu_si256((__m256i *) (out + i + k), _mm256_cvtepu8_epi32(b));
+            }
+            pos += 32;
+            i += 32;
+            continue;
+        }
+
+        used = kvarint_decode32_block(buf + pos, ~mask, out, &i);
+        pos += used;
+        if (used == 0) break;
+    }
+
+    *pos_out = pos;
+    return i;
+}
+
+KVARINT_SSE2 static size_t kvarint_decode64_sse2(const uint8_t *buf, size_t n, uint64_t *out, size_t count,
+                                                 size_t *pos_out) {
+    __m128i zero = _mm_setzero_si128();
+    size_t pos = 0, i = 0, used;
+
+    while (pos + 16 <= n && i + 16 <= count) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (buf + pos));
+        unsigned int mask = _mm_movemask_epi8(v);
+
+        if (mask == 0) {
+            __m128i w[4];
+            size_t k;
+            __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+            w[0] = _mm_unpacklo_epi16(lo, zero);
+            w[1] = _mm_unpackhi_epi16(lo, zero);
+            w[2] = _mm_unpacklo_epi16(hi, zero);
+            w[3] = _mm_unpackhi_epi16(hi, zero);
+
+            for (k = 0; k < 4; k++) {
+                _mm_storeu_si128((__m128i *) (out + i + 4 * k), _mm_unpacklo_epi32(w[k], zero));
+                _mm_storeu_si128((__m128i *) (out + i + 4 * k + 2), _mm_unpackhi_epi32(w[k], zero));
+            }
+
+            pos += 16;
+            i += 16;
+            continue;
+        }
+
+        used = kvarint_decode64_block(buf + pos, ~mask & 0xffff, out, &i);
+        pos += used;
+        if (used == 0) break;
+    }
+
+    *pos_out = pos;
+    return i;
+}
+
+KVARINT_AVX2 static size_t kvarint_decode64_avx2(const uint8_t *buf, size_t n, uint64_t *out, size_t count,
+                                                 size_t *pos_out) {
+    size_t pos = 0, i = 0, used;
+
+    while (pos + 32 <= n && i + 32 <= count) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (buf + pos));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(v);
+
+        if (mask == 0) {
+            size_t k;
+            for (k = 0; k < 32; k += 4) {
+                int word;
+                __m128i b;
+                memcpy(&word, buf + pos + k, 4);
+                b = _mm_cvtsi32_si128(word);
+                _mm256_storeu_si256((__m256i *) (out + i + k), _mm256_cvtepu8_epi64(b));
+            }
+            pos += 32;
+            i += 32;
+            continue;
+        }
+
+        used = kvarint_decode64_block(buf + pos, ~mask, out, &i);
+        pos += used;
+        if (used == 0) break;
+    }
+
+    *pos_out = pos;
+    return i;
+}
+#endif
+
+/* This function decodes 'count' values from the 'n' bytes of 'buf' into
+ * 'out'. It returns the number of bytes read, or -1 if a value is truncated or
+ * does not fit in 32 bits.
+ */
+ssize_t kvarint_decode32_array(const uint8_t *buf, size_t n, uint32_t *out, size_t count) {
+    size_t pos = 0, i = 0, len;
+
+#ifdef KCPU_X86
+    int level = kcpu_get_level();
+    if (level >= KCPU_LEVEL_AVX2) i = kvarint_decode32_avx2(buf, n, out, count, &pos);
+    else if (level >= KCPU_LEVEL_SSE2) i = kvarint_decode32_sse2(buf, n, out, count, &pos);
+#endif
+
+    for (; i < count; i++) {
+        len = kvarint_decode32(buf + pos, n - pos, out + i);
+        if (len == 0) return -1;
+        pos += len;
+    }
+
+    return pos;
+}
+
+/* Same as above for 64-bit values. */
+ssize_t kvarint_decode64_array(const uint8_t *buf, size_t n, uint64_t *out, size_t count) {
+    size_t pos = 0, i = 0, len;
+
+#ifdef KCPU_X86
+    int level = kcpu_get_level();
+    if (level >= KCPU_LEVEL_AVX2) i = kvarint_decode64_avx2(buf, n, out, count, &pos);
+    else if (level >= KCPU_LEVEL_SSE2) i = kvarint_decode64_sse2(buf, n, out, count, &pos);
+#endif
+
+    for (; i < count; i++) {
+        len = kvarint_decode64(buf + pos, n - pos, out + i);
+        if (len == 0) return -1;
+        pos += len;
+    }
+
+    return pos;
+}
@@ -0,0 +1,66 @@
+/**
+ * src/kvarint.h
+ * Copyright (C) 2005-2012 Opersys inc., All rights reserved.
+ */
+
+#ifndef __KVARINT_H__
+#define __KVARINT_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* The kvarint module encodes integers in LEB128 varints: 7 bits per byte,
+ * least significant group first, the high bit set on every byte but the last.
+ * Small values take less space than with the fixed-width encodings, e.g. the
+ * values below 128 take a single byte. The signed integers are mapped to
+ * unsigned integers with the zigzag encoding (0, -1, 1, -2, 2, ...) so that
+ * the values close to zero are small.
+ *
+ * The array decoders use the vector instructions reported by kcpu: the
+ * continuation bits of 16 or 32 bytes are extracted at once, the blocks of
+ * single-byte values are widened without a loop and the longer values are
+ * delimited with the bit mask.
+ *
+ * The kbuffer functions (kbuffer_write_varint32(), etc.) are built on these
+ * functions.
+ */
+
+/* Maximum size of an encoded value. */
+#define KVARINT_MAX32 5
+#define KVARINT_MAX64 10
+
+size_t kvarint_encode32(uint8_t *buf, uint32_t value);
+size_t kvarint_encode64(uint8_t *buf, uint64_t value);
+size_t kvarint_decode32(const uint8_t *buf, size_t n, uint32_t *value);
+size_t kvarint_decode64(const uint8_t *buf, size_t n, uint64_t *value);
+ssize_t kvarint_decode32_array(const uint8_t *buf, size_t n, uint32_t *out, size_t count);
+ssize_t kvarint_decode64_array(const uint8_t *buf, size_t n, uint64_t *out, size_t count);
+
+/* This function returns the size of the encoded value. */
+static inline size_t kvarint_size64(uint64_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+/* Zigzag encoding of the signed integers. */
+static inline uint32_t kvarint_zigzag32(int32_t value) {
+    return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+static inline int32_t kvarint_unzigzag32(uint32_t value) {
+    return (int32_t) ((value >> 1) ^ (0 - (value & 1)));
+}
+
+static inline uint64_t kvarint_zigzag64(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static inline int64_t kvarint_unzigzag64(uint64_t value) {
+    return (int64_t) ((value >> 1) ^ (0 - (value & 1)));
+}
+
+#endif
@@ -1,5 +1,7 @@
 #include <test.h>
 #include <base64.h>
+#include <kcpu.h>
+#include <kutils.h>
 
 const char *base64 = "VGhpcyBpcyBteSB0ZXN0";
 const char *text = "This is my test";
@@ -30,3 +32,216 @@ UNIT_TEST(base64) {
     test_b642bin();
     test_bin2b64();
 }
+
+/* Reference encoder. */
+static size_t ref_b64(char *dst, const uint8_t *src, size_t n) {
+    static const char tbl[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i, o = 0;
+
+    for (i = 0; i < n; i += 3) {
+        uint32_t v = src[i] << 16 | (i + 1 < n ? src[i + 1] << 8 : 0) | (i + 2 < n ? src[i + 2] : 0);
+        dst[o++] = tbl[v >> 18];
+        dst[o++] = tbl[(v >> 12) & 63];
+        dst[o++] = (i + 1 < n) ? tbl[(v >> 6) & 63] : '=';
+        dst[o++] = (i + 2 < n) ? tbl[v & 63] : '=';
+    }
+
+    return o;
+}
+
+/* This function decodes 'src' with the vector paths and with the character
+ * automaton alone, which is used for the chained buffers, and checks that the
+ * results are the same.
+ */
+static void check_decode(const char *src, size_t n, int ignore_invalid) {
+    kbuffer flat, chained, out1, out2;
+    uint8_t *data;
+    int ret1, ret2;
+
+    kbuffer_init(&flat);
+    kbuffer_init_chained(&chained, 7);
+    kbuffer_init(&out1);
+    kbuffer_init(&out2);
+    kbuffer_write(&flat, (uint8_t *) src, n);
+    kbuffer_write(&chained, (uint8_t *) src, n);
+
+    ret1 = kb642bin(&flat, &out1, ignore_invalid);
+    ret2 = kb642bin(&chained, &out2, ignore_invalid);
+    assert(ret1 == ret2);
+    assert(flat.pos == chained.pos);
+    assert(out1.len == out2.len);
+    kbuffer_seek(&out2, 0, SEEK_SET);
+    data = kbuffer_read_nbytes(&out2, out2.len);
+    assert(! memcmp(out1.data, data, out1.len));
+
+    kbuffer_clean(&flat);
+    kbuffer_clean(&chained);
+    kbuffer_clean(&out1);
+    kbuffer_clean(&out2);
+}
+
+static void check_kernels() {
+    static const char noise[] = "=\n\r -_.*\x80\xff";
+    uint8_t bin[700];
+    char b64[1000];
+    kbuffer buf1, buf2;
+    size_t n, m, i;
+    int iter, ret;
+
+    for (iter = 0; iter < 1000; iter++) {
+        n = kutil_get_random_int(600);
+        for (i = 0; i < n; i++) bin[i] = kutil_get_random_int(255);
+        m = ref_b64(b64, bin, n);
+
+        /* Encoding, after a byte to misalign the output. */
+        kbuffer_init(&buf1);
+        kbuffer_init(&buf2);
+        kbuffer_write(&buf1, bin, n);
+        kbuffer_write8(&buf2, '>');
+        kbin2b64(&buf1, &buf2);
+        assert(buf2.len == m + 1 && ! memcmp(buf2.data + 1, b64, m));
+
+        /* Decoding of the valid input. */
+        kbuffer_seek(&buf2, 1, SEEK_SET);
+        kbuffer_reset(&buf1);
+        ret = kb642bin(&buf2, &buf1, 0);
+        assert(ret == 0 && buf1.len == n && ! memcmp(buf1.data, bin, n));
+        kbuffer_clean(&buf1);
+        kbuffer_clean(&buf2);
+
+        /* Decoding of corrupted input, which must match the automaton. */
+        for (i = kutil_get_random_int(3); i > 0 && m; i--) {
+            b64[kutil_get_random_int(m - 1)] = noise[kutil_get_random_int(sizeof(noise) - 2)];
+        }
+        if (iter % 5 == 0) m = kutil_get_random_int(m);
+        check_decode(b64, m, 0);
+        check_decode(b64, m, 1);
+    }
+}
+
+UNIT_TEST(base64_kernels) {
+    int level;
+
+    for (level = KCPU_LEVEL_SCALAR; level <= kcpu_get_detected_level(); level++) {
+        kcpu_set_level(level);
+        check_kernels();
+    }
+
+    kcpu_set_level(KCPU_LEVEL_AVX2);
+}
+
+/* This function encodes 'bin' in random chunks with the streaming encoder. */
+static void stream_encode(kb64_state *state, const uint8_t *bin, size_t n, kbuffer *out) {
+    size_t i, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, (size_t) kutil_get_random_int(kutil_get_random_int(1) ? 5 : 300));
+        kb64_enc_update(state, bin + i, len, out);
+    }
+
+    kb64_enc_final(state, out);
+}
+
+/* Same as above for the streaming decoder. */
+static int stream_decode(kb64_state *state, const char *b64, size_t n, kbuffer *out) {
+    size_t i, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN(n - i, (size_t) kutil_get_random_int(kutil_get_random_int(1) ? 5 : 300));
+        if (kb64_dec_update(state, b64 + i, len, out)) return -1;
+    }
+
+    return kb64_dec_final(state, out);
+}
+
+/* This function decodes a string in one chunk and returns the result of
+ * kb64_dec_final().
+ */
+static int decode_str(int flags, const char *b64, kbuffer *out) {
+    kb64_state state;
+    kb64_dec_init(&state, flags);
+    kbuffer_reset(out);
+    if (kb64_dec_update(&state, b64, strlen(b64), out)) return -1;
+    return kb64_dec_final(&state, out);
+}
+
+static void check_stream() {
+    static const size_t line_lens[] = { 0, 4, 7, 76 };
+    uint8_t bin[2000];
+    char ref[3000], exp[4000];
+    kb64_state state;
+    kbuffer enc, dec;
+    size_t n, m, e, i;
+    int iter, flags, ret;
+
+    kbuffer_init(&enc);
+    kbuffer_init(&dec);
+
+    for (iter = 0; iter < 400; iter++) {
+        size_t line_len = line_lens[iter % 4];
+        flags = kutil_get_random_int(7);
+        n = kutil_get_random_int(1500);
+        for (i = 0; i < n; i++) bin[i] = kutil_get_random_int(255);
+        m = ref_b64(ref, bin, n);
+
+        /* Expected output. */
+        for (e = i = 0; i < m; i++) {
+            if (ref[i] == '=' && (flags & KB64_NO_PAD)) break;
+            if (line_len && i && i % line_len == 0) {
+                if (flags & KB64_CRLF) exp[e++] = '\r';
+                exp[e++] = '\n';
+            }
+            exp[e++] = (! (flags & KB64_URL)) ? ref[i] : ref[i] == '+' ? '-' : ref[i] == '/' ? '_' : ref[i];
+        }
+
+        kbuffer_reset(&enc);
+        kb64_enc_init(&state, flags, line_len);
+        stream_encode(&state, bin, n, &enc);
+        assert(enc.len == e && ! memcmp(enc.data, exp, e));
+
+        /* The state is reset by kb64_enc_final(). */
+        kbuffer_reset(&enc);
+        stream_encode(&state, bin, n, &enc);
+        assert(enc.len == e && ! memcmp(enc.data, exp, e));
+
+        kbuffer_reset(&dec);
+        kb64_dec_init(&state, flags);
+        ret = stream_decode(&state, exp, e, &dec);
+        assert(ret == 0 && dec.len == n && ! memcmp(dec.data, bin, n));
+    }
+
+    kbuffer_clean(&enc);
+    kbuffer_clean(&dec);
+}
+
+UNIT_TEST(base64_stream) {
+    kbuffer out;
+    int level;
+
+    kbuffer_init(&out);
+
+    TASSERT(decode_str(0, "QQ==", &out) == 0 && out.len == 1 && out.data[0] == 'A');
+    TASSERT(decode_str(0, "QUI=\r\n", &out) == 0 && out.len == 2);
+    TASSERT(decode_str(0, "QQ=", &out) == -1);
+    TASSERT(decode_str(KB64_NO_PAD, "QQ=", &out) == 0 && out.len == 1);
+    TASSERT(decode_str(KB64_NO_PAD, "QUI", &out) == 0 && out.len == 2);
+    TASSERT(decode_str(0, "QUI", &out) == -1);
+    TASSERT(decode_str(KB64_NO_PAD, "QUJDR", &out) == -1);
+    TASSERT(decode_str(0, "QR==", &out) == -1);
+    TASSERT(decode_str(0, "QQ==QQ==", &out) == -1);
+    TASSERT(decode_str(KB64_IGNORE_INVALID, "QQ==QQ==", &out) == 0 && out.len == 1);
+    TASSERT(decode_str(0, "QU*JD", &out) == -1);
+    TASSERT(decode_str(KB64_IGNORE_INVALID, "QU*JD", &out) == 0 && out.len == 3);
+    TASSERT(decode_str(0, "+/+/", &out) == 0 && out.len == 3);
+    TASSERT(decode_str(KB64_URL, "+/+/", &out) == -1);
+    TASSERT(decode_str(KB64_URL, "-_-_", &out) == 0 && ! memcmp(out.data, "\xfb\xff\xbf", 3));
+
+    kbuffer_clean(&out);
+
+    for (level = KCPU_LEVEL_SCALAR; level <= kcpu_get_detected_level(); level++) {
+        kcpu_set_level(level);
+        check_stream();
+    }
+
+    kcpu_set_level(KCPU_LEVEL_AVX2);
+}
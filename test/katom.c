@@ -0,0 +1,69 @@
+#include <string.h>
+#include "test.h"
+#include "katom.h"
+#include "khash.h"
+#include "kmem.h"
+
+UNIT_TEST(katom) {
+    const katom *atoms[2000];
+    const katom *a, *b;
+    char buf[64];
+    char *big;
+    int nb_atoms = 2000;
+    int base = katom_count();
+    int i, found;
+    khash hash;
+    void *value;
+
+    /* Interning the same bytes returns the same atom. */
+    a = katom_get_cstr("content-length");
+    b = katom_get_buf("content-length", 14);
+    TASSERT(a == b);
+    TASSERT(a->len == 14 && ! strcmp(a->data, "content-length"));
+    TASSERT(a->hash == katom_hash_buf("content-length", 14));
+    TASSERT(katom_get_cstr("content-type") != a);
+    TASSERT(katom_find_buf("content-length", 14) == a);
+    TASSERT(katom_find_buf("content-len", 11) == NULL);
+
+    /* Embedded '0' and empty strings. */
+    a = katom_get_buf("a\0b", 3);
+    TASSERT(a != katom_get_buf("a\0c", 3) && a != katom_get_cstr("a"));
+    TASSERT(a->len == 3 && a->data[3] == 0 && ! memcmp(a->data, "a\0b", 3));
+    a = katom_get_buf("", 0);
+    TASSERT(a->len == 0 && a == katom_get_cstr(""));
+
+    /* Fill several arena chunks and check that the atoms stay valid. */
+    for (i = 0; i < nb_atoms; i++) {
+        sprintf(buf, "/field/%d/name", i);
+        atoms[i] = katom_get_cstr(buf);
+        assert(((size_t) atoms[i] & 7) == 0);
+    }
+
+    for (i = 0, found = 0; i < nb_atoms; i++) {
+        sprintf(buf, "/field/%d/name", i);
+        found += (katom_get_cstr(buf) == atoms[i] && ! strcmp(atoms[i]->data, buf));
+    }
+    TASSERT(found == nb_atoms);
+    TASSERT(katom_count() == base + 6 + nb_atoms);
+
+    /* Large strings get their own chunk. */
+    big = kmalloc(100000);
+    memset(big, 'x', 100000);
+    a = katom_get_buf(big, 100000);
+    big[99999] = 'y';
+    b = katom_get_buf(big, 100000);
+    TASSERT(a != b && a->data[99999] == 'x' && b->data[99999] == 'y');
+    TASSERT(katom_get_cstr("/field/0/name") == atoms[0]);
+    kfree(big);
+
+    /* Atoms as khash keys. */
+    khash_init_func(&hash, khash_katom_key, khash_katom_cmp);
+    for (i = 0; i < nb_atoms; i++) khash_add(&hash, (void *) atoms[i], &atoms[i]);
+    for (i = 0, found = 0; i < nb_atoms; i++) {
+        sprintf(buf, "/field/%d/name", i);
+        found += (khash_get(&hash, (void *) katom_get_cstr(buf), NULL, &value) == 0 && value == &atoms[i]);
+    }
+    TASSERT(found == nb_atoms);
+    TASSERT(! khash_exist(&hash, (void *) katom_get_cstr("not there")));
+    khash_clean(&hash);
+}
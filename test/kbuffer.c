@@ -1,6 +1,17 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "kbuffer.h"
+#include "kfs.h"
+#include "kmem.h"
 #include "test.h"
 
+static int nb_alloc = 0;
+
+static void *count_malloc(size_t s) { nb_alloc++; return malloc(s); }
+static void *count_calloc(size_t s) { nb_alloc++; return calloc(1, s); }
+static void *count_realloc(void *p, size_t s) { nb_alloc++; return realloc(p, s); }
+
 UNIT_TEST(kbuffer) {
     kbuffer buf;
     uint64_t data;
@@ -11,3 +22,573 @@ UNIT_TEST(kbuffer) {
 
     kbuffer_clean(&buf);
 };
+
+/* This function checks that the chained buffer has the content specified,
+ * using the iovec array.
+ */
+static int check_iovec(kbuffer *buf, uint8_t *ref, size_t len) {
+    struct iovec iov[1024];
+    int count = kbuffer_to_iovec(buf, iov, 1024), i;
+    size_t total = 0;
+
+    if (count != kbuffer_to_iovec(buf, NULL, 0)) return 0;
+
+    for (i = 0; i < count; i++) {
+        if (iov[i].iov_len == 0 || total + iov[i].iov_len > len) return 0;
+        if (memcmp(iov[i].iov_base, ref + total, iov[i].iov_len)) return 0;
+        total += iov[i].iov_len;
+    }
+
+    return total == len;
+}
+
+UNIT_TEST(kbuffer_chained) {
+    kbuffer flat, chain, copy;
+    uint8_t data[3000], out[3000], *ptr, *ref;
+    struct iovec iov[2];
+    uint32_t v32;
+    int iter, pipe_fd[2], count, ret;
+    size_t i, n;
+
+    for (i = 0; i < sizeof(data); i++) data[i] = i * 7;
+
+    kbuffer_init(&flat);
+    kbuffer_init_chained(&chain, 100);
+    kbuffer_init(&copy);
+    TASSERT(kbuffer_is_chained(&chain));
+    TASSERT(! kbuffer_is_chained(&flat));
+
+    /* Write the same data with the various functions in both buffers. */
+    for (iter = 0; iter < 400; iter++) {
+        n = kutil_get_random_int(250);
+
+        switch (iter % 5) {
+            case 0:
+                kbuffer_write(&flat, data + iter, n);
+                kbuffer_write(&chain, data + iter, n);
+                break;
+            case 1:
+                memcpy(kbuffer_write_nbytes(&flat, n), data, n);
+                memcpy(kbuffer_write_nbytes(&chain, n), data, n);
+                break;
+            case 2:
+                kbuffer_write32(&flat, iter);
+                kbuffer_write32(&chain, iter);
+                break;
+            case 3:
+                memcpy(kbuffer_begin_write(&flat, n + 10), data + 5, n);
+                kbuffer_end_write(&flat, n);
+                memcpy(kbuffer_begin_write(&chain, n + 10), data + 5, n);
+                kbuffer_end_write(&chain, n);
+                break;
+            case 4:
+                memcpy(kbuffer_begin_write(&flat, n), data + 1, n);
+                kbuffer_end_write(&flat, n);
+                count = kbuffer_begin_write_iovec(&chain, n + 20, iov);
+                assert(count == 1 || count == 2);
+                assert(iov[0].iov_len + (count == 2 ? iov[1].iov_len : 0) == n + 20);
+                i = MIN(n, iov[0].iov_len);
+                memcpy(iov[0].iov_base, data + 1, i);
+                if (n > i) memcpy(iov[1].iov_base, data + 1 + i, n - i);
+                kbuffer_end_write(&chain, n);
+                break;
+        }
+
+        assert(chain.len == flat.len);
+    }
+
+    TASSERT(check_iovec(&chain, flat.data, flat.len));
+    TASSERT(chain.data == NULL);
+
+    /* Read with the various functions. */
+    while (! kbuffer_eof(&flat)) {
+        n = MIN(kbuffer_left(&flat), (size_t) kutil_get_random_int(300));
+
+        if (n % 2) {
+            ret = kbuffer_read(&chain, out, n);
+            ptr = out;
+        }
+
+        else {
+            ret = 0;
+            ptr = kbuffer_read_nbytes(&chain, n);
+        }
+
+        ref = kbuffer_read_nbytes(&flat, n);
+        assert(ret == 0 && ! memcmp(ptr, ref, n));
+        assert(chain.pos == flat.pos);
+        assert(check_iovec(&chain, flat.data + flat.pos, flat.len - flat.pos));
+    }
+
+    TASSERT(kbuffer_eof(&chain));
+    TASSERT(kbuffer_read8(&chain, out) == -1);
+    TASSERT(kbuffer_to_iovec(&chain, iov, 2) == 0);
+
+    /* Seek backward and forward. */
+    for (iter = 0; iter < 200; iter++) {
+        i = kutil_get_random_int(flat.len - 4);
+        kbuffer_seek(&chain, i, SEEK_SET);
+        ret = kbuffer_read32(&chain, &v32);
+        v32 = htonl(v32);
+        assert(ret == 0 && ! memcmp(&v32, flat.data + i, 4));
+        kbuffer_seek(&chain, -4, SEEK_CUR);
+        ptr = kbuffer_read_nbytes(&chain, 4);
+        assert(! memcmp(ptr, flat.data + i, 4));
+    }
+
+    /* Copies, serialization and base64. */
+    kbuffer_write_buffer(&copy, &chain);
+    TASSERT(copy.len == flat.len && ! memcmp(copy.data, flat.data, flat.len));
+    kbuffer_seek(&chain, 10, SEEK_SET);
+    kbuffer_reset(&copy);
+    TASSERT(kbuffer_read_buffer(&chain, &copy, 1000) == 0);
+    TASSERT(copy.len == 1000 && ! memcmp(copy.data, flat.data + 10, 1000));
+
+    /* writev() and readv() through a pipe. The first segment is kept by the
+     * reset and is smaller than 1000 bytes.
+     */
+    TASSERT(pipe(pipe_fd) == 0);
+    kbuffer_reset(&chain);
+    kbuffer_write(&chain, data, 1000);
+    count = kbuffer_to_iovec(&chain, iov, 2);
+    TASSERT(count == 2 && iov[0].iov_len == chain.first_seg->size);
+    TASSERT(writev(pipe_fd[1], iov, count) == 1000);
+
+    kbuffer_reset(&chain);
+    kbuffer_write(&chain, data, 50);
+    count = kbuffer_begin_write_iovec(&chain, 1000, iov);
+    TASSERT(count == 2 && iov[0].iov_len == chain.first_seg->size - 50);
+    TASSERT(readv(pipe_fd[0], iov, count) == 1000);
+    kbuffer_end_write(&chain, 1000);
+    TASSERT(chain.len == 1050);
+    TASSERT(kbuffer_read(&chain, out, 1050) == 0);
+    TASSERT(! memcmp(out, data, 50) && ! memcmp(out + 50, data, 1000));
+    close(pipe_fd[0]);
+    close(pipe_fd[1]);
+
+    /* A write larger than the segment size gets its own segment. */
+    kbuffer_shrink(&chain, 0);
+    TASSERT(chain.len == 0 && chain.first_seg == chain.last_seg);
+    ptr = kbuffer_write_nbytes(&chain, 3000);
+    memcpy(ptr, data, 3000);
+    TASSERT(chain.last_seg->len == 3000);
+    TASSERT(check_iovec(&chain, data, 3000));
+    kbuffer_write8(&chain, 1);
+    TASSERT(chain.len == 3001 && chain.last_seg->len == 1);
+
+    kbuffer_clean(&copy);
+    kbuffer_clean(&chain);
+    kbuffer_clean(&flat);
+}
+
+UNIT_TEST(kbuffer_slice) {
+    kbuffer src, slice, into, chain, *heap;
+    uint8_t data[4000];
+    size_t i;
+    int ret1, ret2, count1, count2;
+
+    for (i = 0; i < sizeof(data); i++) data[i] = i * 13;
+
+    kbuffer_init(&src);
+    kbuffer_write(&src, data, sizeof(data));
+
+    /* The slice shares the bytes of the source. Only the shared block is
+     * allocated, the first time the source is sliced.
+     */
+    kmem_set_handler(count_malloc, count_calloc, count_realloc, NULL, NULL, NULL);
+    nb_alloc = 0;
+    ret1 = kbuffer_init_slice(&slice, &src, 100, 2000);
+    count1 = nb_alloc;
+    ret2 = kbuffer_init_slice(&into, &src, 0, 10);
+    count2 = nb_alloc - count1;
+    kmem_set_handler(NULL, NULL, NULL, NULL, NULL, NULL);
+    kbuffer_clean(&into);
+    TASSERT(ret1 == 0 && count1 == 1);
+    TASSERT(ret2 == 0 && count2 == 0);
+    TASSERT(slice.data == src.data + 100);
+    TASSERT(slice.len == 2000 && slice.pos == 0);
+    TASSERT(slice.store == src.store && slice.store->ref_count == 2);
+
+    /* Writing to the source copies its bytes. */
+    kbuffer_write8(&src, 1);
+    TASSERT(slice.data != src.data + 100);
+    TASSERT(src.len == 4001 && ! memcmp(src.data, data, 4000) && src.data[4000] == 1);
+    TASSERT(src.store == NULL && slice.store->ref_count == 1);
+    TASSERT(! memcmp(slice.data, data + 100, 2000));
+
+    /* The slice of a slice, and the slice outlives its source. */
+    heap = kbuffer_slice(&slice, 1000, 1000);
+    TASSERT(heap && heap->data == slice.data + 1000);
+    kbuffer_clean(&slice);
+    TASSERT(heap->store->ref_count == 1);
+    TASSERT(! memcmp(heap->data, data + 1100, 1000));
+
+    /* Writing to a slice copies its bytes. */
+    kbuffer_write8(heap, 2);
+    TASSERT(heap->store == NULL && heap->len == 1001);
+    TASSERT(! memcmp(heap->data, data + 1100, 1000) && heap->data[1000] == 2);
+    kbuffer_destroy(heap);
+
+    /* The last user of a block starting with its data takes it back. */
+    TASSERT(kbuffer_init_slice(&slice, &src, 0, 10) == 0);
+    kbuffer_clean(&slice);
+    kbuffer_write8(&src, 3);
+    TASSERT(src.store == NULL && src.len == 4002 && ! memcmp(src.data, data, 4000));
+
+    /* Out of bounds. */
+    TASSERT(kbuffer_slice(&src, 4000, 3) == NULL);
+    TASSERT(kbuffer_slice(&src, 5000, 0) == NULL);
+
+    /* Large reads share the bytes, small reads copy them. */
+    kbuffer_init(&into);
+    kbuffer_reset(&src);
+    kbuffer_write32(&src, 3000);
+    kbuffer_write(&src, data, 3000);
+    kbuffer_write32(&src, 10);
+    kbuffer_write(&src, data, 10);
+    TASSERT(kbuffer_read_serialized(&src, &into) == 0);
+    TASSERT(into.data == src.data + 4 && into.len == 3000);
+    kbuffer_clean(&into);
+    kbuffer_init(&into);
+    TASSERT(kbuffer_read_serialized(&src, &into) == 0);
+    TASSERT(into.store == NULL && into.len == 10 && ! memcmp(into.data, data, 10));
+    TASSERT(kbuffer_read_serialized(&src, &into) == -1);
+    kbuffer_clean(&into);
+
+    /* Slices of chained buffers are copies. */
+    kbuffer_init_chained(&chain, 100);
+    kbuffer_write(&chain, data, 1000);
+    TASSERT(kbuffer_init_slice(&slice, &chain, 50, 900) == 0);
+    TASSERT(slice.store == NULL && slice.len == 900 && ! memcmp(slice.data, data + 50, 900));
+    TASSERT(chain.pos == 0);
+    kbuffer_clean(&slice);
+    kbuffer_clean(&chain);
+
+    kbuffer_clean(&src);
+}
+
+UNIT_TEST(kbuffer_view) {
+    kbuffer src, view, view2, into, chain;
+    uint8_t data[4000];
+    uint8_t b;
+    size_t i;
+
+    for (i = 0; i < sizeof(data); i++) data[i] = i * 7;
+
+    kbuffer_init(&src);
+    kbuffer_write(&src, data, sizeof(data));
+    src.pos = 100;
+
+    /* The view reads the bytes in place. The source does not move. */
+    TASSERT(kbuffer_init_view(&view, &src, 3000, 0) == 0);
+    TASSERT(view.data == src.data + 100 && view.len == 3000 && view.pos == 0);
+    TASSERT(src.pos == 100 && src.store == NULL);
+    TASSERT(kbuffer_read8(&view, &b) == 0 && b == data[100]);
+
+    /* The buffers read from a view copy the bytes. */
+    kbuffer_init(&into);
+    TASSERT(kbuffer_read_buffer(&view, &into, 2000) == 0);
+    TASSERT(into.store == NULL && ! memcmp(into.data, data + 101, 2000));
+    kbuffer_clean(&into);
+
+    /* A view of a view. */
+    TASSERT(kbuffer_init_view(&view2, &view, 10, 0) == 0 && view2.data == src.data + 2101);
+    kbuffer_clean(&view2);
+
+    /* Writing to the view copies its bytes. */
+    kbuffer_write8(&view, 1);
+    TASSERT(view.data != src.data + 100 && view.len == 3001 && view.data[3000] == 1);
+    TASSERT(! memcmp(view.data, data + 100, 3000));
+    kbuffer_clean(&view);
+    TASSERT(! memcmp(src.data, data, 4000));
+
+    /* Out of bounds. */
+    TASSERT(kbuffer_init_view(&view, &src, 3901, 0) == -1 && view.len == 0);
+    kbuffer_clean(&view);
+
+    /* Borrowing: the small and the large reads refer to the source, and so do
+     * the views of the view.
+     */
+    TASSERT(kbuffer_init_view(&view, &src, 3000, KBUFFER_VIEW_BORROW) == 0);
+    kbuffer_init(&into);
+    TASSERT(kbuffer_read_buffer(&view, &into, 10) == 0 && into.data == src.data + 100);
+    kbuffer_write8(&into, 5);
+    TASSERT(into.data != src.data + 100 && ! memcmp(into.data, data + 100, 10) && into.data[10] == 5);
+    kbuffer_clean(&into);
+    TASSERT(kbuffer_init_view(&view2, &view, 2000, 0) == 0);
+    kbuffer_init(&into);
+    TASSERT(kbuffer_read_buffer(&view2, &into, 2000) == 0 && into.data == src.data + 110);
+    kbuffer_clean(&into);
+    kbuffer_clean(&view2);
+    kbuffer_clean(&view);
+    TASSERT(src.store == NULL && ! memcmp(src.data, data, 4000));
+
+    /* Chained source: the bytes are read in place within a segment and copied
+     * across segments.
+     */
+    kbuffer_init_chained(&chain, 100);
+    for (i = 0; i < 10; i++) kbuffer_write(&chain, data + i * 100, 100);
+    chain.pos = 210;
+    TASSERT(kbuffer_init_view(&view, &chain, 50, 0) == 0 && chain.pos == 210);
+    TASSERT(view.len == 50 && ! memcmp(view.data, data + 210, 50));
+    kbuffer_clean(&view);
+    TASSERT(kbuffer_init_view(&view, &chain, 500, 0) == 0 && chain.pos == 210);
+    TASSERT(view.len == 500 && ! memcmp(view.data, data + 210, 500));
+    TASSERT(chain.scratch_list == NULL);
+    kbuffer_clean(&view);
+
+    /* The copies made by kbuffer_read_nbytes() are freed by compacting. */
+    TASSERT(! memcmp(kbuffer_read_nbytes(&chain, 500), data + 210, 500));
+    TASSERT(chain.scratch_list != NULL);
+    kbuffer_consume(&chain, 0);
+    TASSERT(chain.scratch_list == NULL);
+    chain.pos = chain.len;
+    TASSERT(kbuffer_init_view(&view, &chain, 0, 0) == 0 && view.len == 0);
+    kbuffer_clean(&view);
+    kbuffer_clean(&chain);
+
+    kbuffer_clean(&src);
+}
+
+UNIT_TEST(kbuffer_truncate) {
+    kbuffer flat, chain;
+    uint8_t data[100];
+    size_t i;
+
+    for (i = 0; i < sizeof(data); i++) data[i] = i;
+
+    kbuffer_init(&flat);
+    kbuffer_init_chained(&chain, 16);
+    kbuffer_write(&flat, data, 100);
+    kbuffer_write(&chain, data, 100);
+    flat.pos = chain.pos = 60;
+
+    kbuffer_truncate(&flat, 200);
+    TASSERT(flat.len == 100);
+    kbuffer_truncate(&flat, 50);
+    kbuffer_truncate(&chain, 50);
+    TASSERT(flat.len == 50 && flat.pos == 50 && chain.len == 50 && chain.pos == 50);
+
+    /* The chained buffer is written after the new end. */
+    kbuffer_write8(&chain, 0xff);
+    chain.pos = 0;
+    TASSERT(! memcmp(kbuffer_read_nbytes(&chain, 50), data, 50));
+    TASSERT(kbuffer_read8(&chain, &data[0]) == 0 && data[0] == 0xff && kbuffer_eof(&chain));
+    kbuffer_truncate(&chain, 0);
+    TASSERT(chain.len == 0 && chain.pos == 0);
+    kbuffer_write8(&chain, 1);
+    TASSERT(chain.len == 1);
+
+    kbuffer_clean(&flat);
+    kbuffer_clean(&chain);
+}
+
+UNIT_TEST(kbuffer_mmap) {
+    kbuffer src, buf, slice;
+    char path[64];
+    size_t i, len = 1024 * 1024 + 1000;
+    uint32_t v;
+
+    sprintf(path, "/tmp/ktools_test_mmap.%d", (int) getpid());
+    kbuffer_init(&src);
+    for (i = 0; i < len / 4; i++) kbuffer_write32(&src, i);
+    TASSERT(kfs_write_file(path, &src) == 0);
+
+    /* kfs_read_file() reads a copy, which can be written back to the file. */
+    kbuffer_init(&buf);
+    TASSERT(kfs_read_file(path, &buf) == 0);
+    TASSERT(buf.store == NULL && buf.len == len && ! memcmp(buf.data, src.data, len));
+    buf.data[0] = 0xff;
+    TASSERT(kfs_write_file(path, &buf) == 0);
+    kbuffer_clean(&buf);
+    kbuffer_init(&buf);
+    TASSERT(kfs_read_file(path, &buf) == 0);
+    TASSERT(buf.len == len && buf.data[0] == 0xff && ! memcmp(buf.data + 1, src.data + 1, len - 1));
+    kbuffer_clean(&buf);
+    TASSERT(kfs_write_file(path, &src) == 0);
+
+    /* The writable mapping is private. */
+    TASSERT(kbuffer_init_mmap(&buf, path, KBUFFER_MMAP_WRITE | KBUFFER_MMAP_SEQUENTIAL) == 0);
+    TASSERT(buf.store && buf.store->map_len == len);
+    TASSERT(buf.len == len && ! memcmp(buf.data, src.data, len));
+    buf.data[0] = 0xff;
+
+    /* A slice survives the mapped buffer. Appending copies the file. */
+    TASSERT(kbuffer_init_slice(&slice, &buf, 4, 1000) == 0);
+    kbuffer_write8(&buf, 1);
+    TASSERT(buf.store == NULL && buf.len == len + 1 && buf.data[0] == 0xff);
+    TASSERT(! memcmp(buf.data + 1, src.data + 1, len - 1));
+    kbuffer_clean(&buf);
+    TASSERT(! memcmp(slice.data, src.data + 4, 1000));
+    kbuffer_clean(&slice);
+
+    /* Read-only mapping. */
+    TASSERT(kbuffer_init_mmap(&buf, path, KBUFFER_MMAP_WILLNEED) == 0);
+    TASSERT(buf.len == len && ! memcmp(buf.data, src.data, len));
+    kbuffer_seek(&buf, 8, SEEK_SET);
+    TASSERT(kbuffer_read32(&buf, &v) == 0 && v == 2);
+    kbuffer_clean(&buf);
+
+    /* Chained buffers are read. */
+    kbuffer_init_chained(&buf, 100000);
+    TASSERT(kfs_read_file(path, &buf) == 0);
+    TASSERT(buf.len == len && buf.first_seg->len == 100000);
+    kbuffer_clean(&buf);
+
+    /* Small and empty files are read. */
+    kbuffer_reset(&src);
+    kbuffer_write_cstr(&src, "small");
+    TASSERT(kfs_write_file(path, &src) == 0);
+    kbuffer_init(&buf);
+    TASSERT(kfs_read_file(path, &buf) == 0);
+    TASSERT(buf.store == NULL && buf.len == 5 && ! memcmp(buf.data, "small", 5));
+    kbuffer_clean(&buf);
+
+    kbuffer_reset(&src);
+    TASSERT(kfs_write_file(path, &src) == 0);
+    TASSERT(kbuffer_init_mmap(&buf, path, 0) == 0);
+    TASSERT(buf.len == 0);
+    kbuffer_clean(&buf);
+
+    unlink(path);
+    TASSERT(kbuffer_init_mmap(&buf, path, 0) == -1);
+    kbuffer_clean(&buf);
+    kbuffer_clean(&src);
+}
+
+/* This function streams a sequence of bytes through the buffer, in random
+ * chunks, and returns the largest size reached by the buffer.
+ */
+static size_t stream_bytes(kbuffer *buf) {
+    uint8_t out[600], *ptr;
+    uint8_t next_in = 0, next_out = 0;
+    size_t avail, n, i, max_len = 0;
+    int iter, ret;
+
+    for (iter = 0; iter < 5000; iter++) {
+
+        /* Produce. */
+        n = kutil_get_random_int(500);
+        ptr = kbuffer_reserve_tail(buf, n, &avail);
+        assert(avail >= n);
+        for (i = 0; i < n; i++) ptr[i] = next_in++;
+        kbuffer_end_write(buf, n);
+        max_len = MAX(max_len, buf->len);
+
+        /* Consume, either by reading or by skipping. */
+        n = MIN((size_t) kutil_get_random_int(600), kbuffer_left(buf));
+
+        if (iter % 2) {
+            ret = kbuffer_read(buf, out, n);
+            assert(ret == 0);
+            for (i = 0; i < n; i++, next_out++) assert(out[i] == next_out);
+            kbuffer_consume(buf, 0);
+        }
+
+        else {
+            struct iovec iov;
+            if (n) assert(kbuffer_to_iovec(buf, &iov, 1) == 1 && ((uint8_t *) iov.iov_base)[0] == next_out);
+            next_out += n;
+            kbuffer_consume(buf, n);
+        }
+    }
+
+    return max_len;
+}
+
+UNIT_TEST(kbuffer_stream) {
+    kbuffer buf, slice;
+    size_t avail;
+    uint8_t *ptr;
+
+    /* The buffers stay small although 1.25MB go through them. */
+    kbuffer_init(&buf);
+    TASSERT(stream_bytes(&buf) < 20000);
+    TASSERT(buf.allocated <= 32768);
+    kbuffer_clean(&buf);
+
+    kbuffer_init_chained(&buf, 1000);
+    TASSERT(stream_bytes(&buf) < 20000);
+    kbuffer_clean(&buf);
+
+    /* Reading everything resets the buffer. */
+    kbuffer_init(&buf);
+    kbuffer_write_cstr(&buf, "0123456789");
+    kbuffer_consume(&buf, 4);
+    TASSERT(buf.pos == 4 && buf.len == 10);
+    kbuffer_consume(&buf, 100);
+    TASSERT(buf.pos == 0 && buf.len == 0);
+
+    /* The compaction only happens when as many bytes are discarded as moved. */
+    kbuffer_write_cstr(&buf, "0123456789");
+    kbuffer_consume(&buf, 4);
+    kbuffer_compact(&buf);
+    TASSERT(buf.pos == 4);
+    kbuffer_consume(&buf, 1);
+    kbuffer_compact(&buf);
+    TASSERT(buf.pos == 0 && buf.len == 5 && ! memcmp(buf.data, "56789", 5));
+
+    /* A shared buffer is copied instead of modified. */
+    kbuffer_write_cstr(&buf, "abcde");
+    TASSERT(kbuffer_init_slice(&slice, &buf, 0, 10) == 0);
+    kbuffer_consume(&buf, 6);
+    ptr = kbuffer_reserve_tail(&buf, 3, &avail);
+    TASSERT(buf.store == NULL && buf.pos == 0 && buf.len == 4 && avail >= 3);
+    memcpy(ptr, "xyz", 3);
+    kbuffer_end_write(&buf, 3);
+    TASSERT(! memcmp(buf.data, "bcdexyz", 7));
+    TASSERT(! memcmp(slice.data, "56789abcde", 10));
+
+    kbuffer_clean(&slice);
+    kbuffer_clean(&buf);
+}
+
+UNIT_TEST(kbuffer_array) {
+    uint16_t a16[100], b16[100], v16;
+    uint32_t a32[100], b32[100], v32;
+    uint64_t a64[100], b64[100], v64;
+    kbuffer buf;
+    int i, j, ret;
+
+    for (j = 0; j < 100; j++) {
+        a16[j] = j * 0x0103;
+        a32[j] = j * 0x01020305;
+        a64[j] = j * 0x0102030507090b0dull;
+    }
+
+    /* The arrays have the same encoding as the single values, in flat and
+     * chained buffers.
+     */
+    for (i = 0; i < 2; i++) {
+        if (i == 0) kbuffer_init(&buf);
+        else kbuffer_init_chained(&buf, 64);
+
+        kbuffer_write8(&buf, 1);
+        kbuffer_write16_array(&buf, a16, 100);
+        kbuffer_write32_array(&buf, a32, 100);
+        kbuffer_write64_array(&buf, a64, 100);
+        kbuffer_write32(&buf, 7);
+
+        kbuffer_seek(&buf, 1, SEEK_SET);
+        for (j = 0; j < 100; j++) {
+            ret = kbuffer_read16(&buf, &v16);
+            assert(ret == 0 && v16 == a16[j]);
+        }
+        for (j = 0; j < 100; j++) {
+            ret = kbuffer_read32(&buf, &v32);
+            assert(ret == 0 && v32 == a32[j]);
+        }
+        for (j = 0; j < 100; j++) {
+            ret = kbuffer_read64(&buf, &v64);
+            assert(ret == 0 && v64 == a64[j]);
+        }
+
+        kbuffer_seek(&buf, 1, SEEK_SET);
+        TASSERT(kbuffer_read16_array(&buf, b16, 100) == 0 && ! memcmp(a16, b16, sizeof(a16)));
+        TASSERT(kbuffer_read32_array(&buf, b32, 100) == 0 && ! memcmp(a32, b32, sizeof(a32)));
+        TASSERT(kbuffer_read64_array(&buf, b64, 100) == 0 && ! memcmp(a64, b64, sizeof(a64)));
+        TASSERT(kbuffer_read32_array(&buf, b32, 2) == -1);
+        TASSERT(kbuffer_read32_array(&buf, b32, 1) == 0 && b32[0] == 7);
+        kbuffer_clean(&buf);
+    }
+}
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <wchar.h>
+#include "test.h"
+#include "kstr.h"
+#include "kbuffer.h"
+#include "kutils.h"
+
+/* This function formats with kstr_sf() and snprintf() and returns true if the
+ * results are the same.
+ */
+static int check_fmt(const char *format, ...) {
+    char buf[1000];
+    kstr str;
+    va_list arg, arg2;
+    int ok;
+
+    va_start(arg, format);
+    va_copy(arg2, arg);
+    vsnprintf(buf, sizeof(buf), format, arg);
+    kstr_init(&str);
+    kstr_sfv(&str, format, arg2);
+    ok = kstr_equal_cstr(&str, buf) && str.slen == strlen(buf);
+    if (! ok) fprintf(stderr, "format '%s': '%s' != '%s'\n", format, str.data, buf);
+    kstr_clean(&str);
+    va_end(arg2);
+    va_end(arg);
+
+    return ok;
+}
+
+UNIT_TEST(kfmt) {
+    int64_t values[] = { 0, 1, -1, 9, 10, 99, 100, -100, 12345, INT32_MAX, INT32_MIN, INT64_MAX, INT64_MIN };
+    kbuffer buf;
+    kstr str;
+    int i, n = 0, ok;
+    char big[300];
+
+    /* Native conversions. */
+    TASSERT(check_fmt("plain text"));
+    TASSERT(check_fmt(""));
+    TASSERT(check_fmt("%d %i %u %x %X %c %s %%", -42, 42, 42u, 0xbeefu, 0xbeefu, 'z', "str"));
+    TASSERT(check_fmt("[%5d] [%-5d] [%05d] [%05d] [%*d] [%-*d]", 42, 42, 42, -42, 6, 42, 6, 42));
+    TASSERT(check_fmt("[%10s] [%-10s] [%.3s] [%.*s] [%.10s] [%*s]", "abc", "abc", "abcdef", 2, "abcdef", "ab", -4, "ab"));
+    TASSERT(check_fmt("%hhd %hhu %hd %hu %ld %lu %lld %llu %zu %zd %jd %td", 300, 300, 70000, 70000, -5l, 5ul,
+                      -5ll, 5ull, (size_t) 7, (ssize_t) -7, (intmax_t) -9, (ptrdiff_t) -3));
+    TASSERT(check_fmt("%p %20p %-20p|", &n, &n, &n));
+    TASSERT(check_fmt(PRINTF_64 "d " PRINTF_64 "u", (long long) INT64_MIN, (unsigned long long) UINT64_MAX));
+
+    for (i = 0, ok = 0; i < (int) (sizeof(values) / sizeof(values[0])); i++) {
+        ok += check_fmt("%lld|%llu|%llx|%llX|%020lld|%-22lld|", (long long) values[i], (unsigned long long) values[i],
+                        (unsigned long long) values[i], (unsigned long long) values[i], (long long) values[i],
+                        (long long) values[i]);
+        ok += check_fmt("%d|%u|%x|%8x|", (int) values[i], (unsigned) values[i], (unsigned) values[i], (unsigned) values[i]);
+    }
+    TASSERT(ok == 2 * (int) (sizeof(values) / sizeof(values[0])));
+
+    /* Conversions delegated to the C library. */
+    TASSERT(check_fmt("%f %.2f %10.3e %g %G %Lf %a", 3.14159, 2.5, 12345.678, 1e-10, 1e20, (long double) 1.5, 1.0));
+    TASSERT(check_fmt("%+d % d %#x %#o %o %.5d %8.3x", 5, 5, 255u, 8u, 8u, 42, 42u));
+    TASSERT(check_fmt("%s|%p|%5c|%-3c|", (char *) NULL, (void *) NULL, 'a', 'b'));
+    TASSERT(check_fmt("%ls %lc", L"wide", (wint_t) L'w'));
+    TASSERT(check_fmt("%.300f", 1.0));
+    TASSERT(check_fmt("%400f", 1.0));
+
+    /* Count of bytes written. */
+    kstr_init(&str);
+    kstr_sf(&str, "abc%nde%s", &n, "fg");
+    TASSERT(n == 3 && kstr_equal_cstr(&str, "abcdefg"));
+
+    /* Append to a non-empty string, over the inline buffer. */
+    memset(big, 'b', sizeof(big) - 1);
+    big[sizeof(big) - 1] = 0;
+    kstr_assign_cstr(&str, "prefix:");
+    kstr_append_sf(&str, "%s:%d", big, 7);
+    TASSERT(str.slen == 7 + 299 + 2 && ! strncmp(str.data, "prefix:bbb", 10) && ! strcmp(str.data + 306, ":7"));
+    kstr_clean(&str);
+
+    /* Write to a buffer. */
+    kbuffer_init(&buf);
+    kbuffer_writef(&buf, "%s=%d;", "key", -1);
+    kbuffer_writef(&buf, "%05.1f", 2.25);
+    TASSERT(buf.len == 12 && ! memcmp(buf.data, "key=-1;002.2", 12));
+    kbuffer_clean(&buf);
+}
@@ -110,6 +110,7 @@ UNIT_TEST(khash) {
     int nb2 = 4;
     int nb3 = 3;
     int *val;
+    kstr_view view1, view2;
     
     khash_init(&h);
     kstr_init(&str);
@@ -126,6 +127,17 @@ UNIT_TEST(khash) {
     khash_add(&h, &nb2, &nb2);
     TASSERT(khash_get(&h, &nb3, (void**)&val, NULL) == 0 && val == &nb1);
 
+    /* Views on parts of a larger string. */
+    khash_reset(&h);
+    khash_set_func(&h, khash_view_key, khash_view_cmp);
+    kstr_assign_cstr(&str, "key=one;key=two");
+    view1 = kstr_mid_view(&str, 4, 3);
+    view2 = kstr_view_cstr("one");
+    khash_add(&h, &view1, &a);
+    TASSERT(khash_get(&h, &view2, NULL, (void **)&val) == 0 && val == &a);
+    view2 = kstr_mid_view(&str, 12, 3);
+    TASSERT(! khash_exist(&h, &view2));
+
     test_khash_iter();
     
     khash_clean(&h);
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <string.h>
+#include "test.h"
+#include "kcpu.h"
+#include "khex.h"
+#include "kbuffer.h"
+#include "kutils.h"
+
+/* This function checks the conversions at the current level. */
+static void check_kernels() {
+    static const char digits[] = "0123456789abcdef";
+    uint8_t bin[300], out[300];
+    char hex[600], ref[600];
+    size_t n, i;
+    ssize_t ret;
+    int iter;
+
+    for (iter = 0; iter < 1000; iter++) {
+        n = kutil_get_random_int(299);
+        for (i = 0; i < n; i++) {
+            bin[i] = kutil_get_random_int(255);
+            ref[2 * i] = digits[bin[i] >> 4];
+            ref[2 * i + 1] = digits[bin[i] & 0xf];
+        }
+
+        khex_encode(hex, bin, n);
+        assert(! memcmp(hex, ref, 2 * n));
+        ret = khex_decode(out, hex, 2 * n);
+        assert(ret == (ssize_t) n && ! memcmp(out, bin, n));
+
+        /* Uppercase digits. */
+        for (i = 0; i < 2 * n; i++) if (kutil_get_random_int(1)) hex[i] = toupper(hex[i]);
+        ret = khex_decode(out, hex, 2 * n);
+        assert(ret == (ssize_t) n && ! memcmp(out, bin, n));
+
+        /* An invalid character anywhere. */
+        if (n) {
+            static const char noise[] = "/:@G`g \xff";
+            hex[kutil_get_random_int(2 * n - 1)] = noise[kutil_get_random_int(sizeof(noise) - 2)];
+            ret = khex_decode(out, hex, 2 * n);
+            assert(ret == -1);
+        }
+
+        ret = khex_decode(out, ref, 2 * n + 1);
+        assert(ret == -1);
+    }
+}
+
+UNIT_TEST(khex) {
+    kbuffer bin, hex, chained;
+    int level, i;
+
+    for (level = KCPU_LEVEL_SCALAR; level <= kcpu_get_detected_level(); level++) {
+        kcpu_set_level(level);
+        check_kernels();
+    }
+
+    kcpu_set_level(KCPU_LEVEL_AVX2);
+
+    /* kbuffer, flat and chained. */
+    kbuffer_init(&bin);
+    kbuffer_init(&hex);
+    kbuffer_init_chained(&chained, 7);
+
+    for (i = 0; i < 100; i++) kbuffer_write8(&bin, i * 3);
+    kbuffer_write8(&hex, '>');
+    kbin2hex(&bin, &hex);
+    TASSERT(hex.len == 201 && ! memcmp(hex.data, ">00030609", 9));
+
+    hex.pos = 1;
+    kbuffer_write(&chained, hex.data + 1, 200);
+    kbuffer_reset(&bin);
+    TASSERT(khex2bin(&hex, &bin) == 0 && bin.len == 100 && bin.data[99] == (uint8_t) (99 * 3));
+    TASSERT(hex.pos == hex.len);
+
+    kbuffer_reset(&bin);
+    TASSERT(khex2bin(&chained, &bin) == 0 && bin.len == 100 && bin.data[99] == (uint8_t) (99 * 3));
+
+    kbuffer_reset(&hex);
+    kbuffer_write(&hex, (uint8_t *) "0aF", 3);
+    TASSERT(khex2bin(&hex, &bin) == -1);
+    kbuffer_reset(&hex);
+    kbuffer_write(&hex, (uint8_t *) "0aFx", 4);
+    TASSERT(khex2bin(&hex, &bin) == -1);
+
+    kbuffer_clean(&bin);
+    kbuffer_clean(&hex);
+    kbuffer_clean(&chained);
+}
+
+UNIT_TEST(kutil_dump) {
+    static const char *expected =
+        "00000000  48 65 6c 6c 6f 2c 20 77  6f 72 6c 64 21 0a 00 01  |Hello, world!...|\n"
+        "00000010  ff 41                                             |.A|\n";
+    char out[400];
+    FILE *f = tmpfile();
+    size_t len;
+
+    TASSERT(f);
+    kutil_hexdump("Hello, world!\n\0\1\377A", 18, f);
+    kutil_dump_buf_hex((unsigned char *) "0123456789abcdefXY", 18, f);
+    kutil_dump_buf_ascii((unsigned char *) "ab\ncd", 5, f);
+    rewind(f);
+    len = fread(out, 1, sizeof(out), f);
+    fclose(f);
+
+    TASSERT(len == strlen(expected) + 38 + 14);
+    TASSERT(! memcmp(out, expected, strlen(expected)));
+    TASSERT(! memcmp(out + strlen(expected), "30313233343536373839616263646566\n5859\n", 38));
+    TASSERT(! memcmp(out + strlen(expected) + 38, "a  b  \\n c  d ", 14));
+}
@@ -0,0 +1,96 @@
+#include <string.h>
+#include "test.h"
+#include "kinterval.h"
+#include "kutils.h"
+
+/* This function verifies that the result array contains exactly the intervals
+ * of the array specified that overlap [low, high], in order.
+ */
+static void check_overlap(struct kinterval **intervals, int nb_intervals, int64_t low, int64_t high,
+                          karray *result) {
+    int i, count = 0;
+
+    for (i = 0; i < nb_intervals; i++) {
+        struct kinterval *interval = intervals[i];
+        if (interval == NULL || interval->high < low || interval->low > high) continue;
+        count++;
+    }
+
+    assert(result->size == count);
+
+    for (i = 0; i < result->size; i++) {
+        struct kinterval *interval = (struct kinterval *) result->data[i];
+        assert(interval->low <= high && interval->high >= low);
+        assert(interval->value == interval);
+        if (i > 0) assert(((struct kinterval *) result->data[i - 1])->low <= interval->low);
+    }
+}
+
+UNIT_TEST(kinterval) {
+    kinterval_tree tree;
+    karray result;
+    struct kinterval *intervals[2000];
+    int nb_intervals = 2000;
+    int index, i;
+
+    kinterval_tree_init(&tree);
+    karray_init(&result);
+    memset(intervals, 0, sizeof(intervals));
+
+    /* Empty tree. */
+    TASSERT(kinterval_tree_stab(&tree, 10, &result) == 0);
+
+    for (index = 0; index < 10000; index++) {
+        int slot = kutil_get_random_int(nb_intervals - 1);
+
+        /* Add or remove an interval. */
+        if (intervals[slot] == NULL) {
+            int64_t low = kutil_get_random_int(100000);
+            int64_t high = low + kutil_get_random_int(kutil_get_random_int(10) ? 100 : 5000);
+            intervals[slot] = kinterval_tree_add(&tree, low, high, NULL);
+            intervals[slot]->value = intervals[slot];
+        }
+
+        else {
+            kinterval_tree_remove(&tree, intervals[slot]);
+            intervals[slot] = NULL;
+        }
+
+        /* Query. */
+        if (index % 20 == 0) {
+            int64_t low = kutil_get_random_int(100000);
+            int64_t high = low + kutil_get_random_int(1000);
+
+            karray_reset(&result);
+            i = kinterval_tree_overlap(&tree, low, high, &result);
+            assert(i == result.size);
+            check_overlap(intervals, nb_intervals, low, high, &result);
+
+            karray_reset(&result);
+            kinterval_tree_stab(&tree, low, &result);
+            check_overlap(intervals, nb_intervals, low, low, &result);
+        }
+
+        if (index % 500 == 0) kinterval_tree_check_consistency(&tree);
+    }
+
+    kinterval_tree_check_consistency(&tree);
+
+    /* Intervals sharing endpoints. */
+    kinterval_tree_clean(&tree);
+    kinterval_tree_init(&tree);
+    kinterval_tree_add(&tree, 5, 10, NULL);
+    kinterval_tree_add(&tree, 5, 10, NULL);
+    kinterval_tree_add(&tree, 10, 20, NULL);
+    kinterval_tree_add(&tree, 21, 30, NULL);
+    karray_reset(&result);
+    TASSERT(kinterval_tree_stab(&tree, 10, &result) == 3);
+    karray_reset(&result);
+    TASSERT(kinterval_tree_overlap(&tree, 11, 20, &result) == 1);
+    karray_reset(&result);
+    TASSERT(kinterval_tree_overlap(&tree, 31, 40, &result) == 0);
+    TASSERT(kinterval_tree_overlap(&tree, 20, 10, &result) == 0);
+
+    kinterval_tree_clean(&tree);
+    karray_clean(&result);
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "test.h"
 #include "kpath.h"
 #include "kstr.h"
@@ -6,6 +7,7 @@
 
 static void test_split_check(char *path_s, char *dir_s, char *name_s, char *ext_s, int format) {
     kstr path, dir, name, ext;
+    kstr_view dir_view, name_view, ext_view;
     kstr_init(&path);
     kstr_init(&dir);
     kstr_init(&name);
@@ -17,6 +19,14 @@ static void test_split_check(char *path_s, char *dir_s, char *name_s, char *ext_
     assert(kstr_equal_cstr(&name, name_s));
     assert(kstr_equal_cstr(&ext, ext_s));
     
+    /* The views have the same file name and extension, and the directory is
+     * a prefix of the path.
+     */
+    kpath_split_view(kstr_view_kstr(&path), &dir_view, &name_view, &ext_view, format);
+    assert(kstr_view_equal_cstr(name_view, name_s));
+    assert(kstr_view_equal_cstr(ext_view, ext_s));
+    assert(dir_view.p == path.data && dir_view.n <= dir.slen && ! memcmp(dir.data, dir_view.p, dir_view.n));
+    
     kstr_clean(&path);
     kstr_clean(&dir);
     kstr_clean(&name);
@@ -47,6 +57,7 @@ static void test_basename_check(char *path_s, char *name_s, int format) {
     kstr_assign_cstr(&path, path_s);
     kpath_basename(&path, &base, format);
     assert(kstr_equal_cstr(&base, name_s));
+    assert(kstr_view_equal_cstr(kpath_basename_view(kstr_view_kstr(&path), format), name_s));
     
     kstr_clean(&path);
     kstr_clean(&base);
@@ -88,9 +99,35 @@ static void test_normalize() {
     test_normalize_check("", "", KPATH_FORMAT_UNIX);
 }
 
+static void test_decompose() {
+    struct kpath_dir dir;
+    kstr path;
+    kstr_view abs_part, components[4];
+    
+    kpath_dir_init(&dir);
+    kstr_init_cstr(&path, "//usr/local//lib/");
+    kpath_decompose_dir(&path, &dir, KPATH_FORMAT_UNIX);
+    TASSERT(kstr_equal_cstr(&dir.abs_part, "/") && dir.components.size == 3);
+    TASSERT(kstr_equal_cstr((kstr *) dir.components.data[2], "lib"));
+    
+    TASSERT(kpath_decompose_dir_view(kstr_view_kstr(&path), &abs_part, components, 4, KPATH_FORMAT_UNIX) == 3);
+    TASSERT(kstr_view_equal_cstr(abs_part, "/") && kstr_view_equal_cstr(components[0], "usr") &&
+            kstr_view_equal_cstr(components[1], "local") && kstr_view_equal_cstr(components[2], "lib"));
+    TASSERT(kpath_decompose_dir_view(kstr_view_kstr(&path), NULL, components, 1, KPATH_FORMAT_UNIX) == 3);
+    TASSERT(kstr_view_equal_cstr(components[0], "usr"));
+    
+    TASSERT(kpath_decompose_dir_view(kstr_view_cstr("C:/a\\b"), &abs_part, components, 4, KPATH_FORMAT_WINDOWS_ALT) == 2);
+    TASSERT(kstr_view_equal_cstr(abs_part, "C:/") && kstr_view_equal_cstr(components[1], "b"));
+    TASSERT(kpath_decompose_dir_view(kstr_view_cstr(""), &abs_part, components, 4, KPATH_FORMAT_UNIX) == 0);
+    
+    kpath_dir_clean(&dir);
+    kstr_clean(&path);
+}
+
 UNIT_TEST(kpath) {
     test_split();
     test_basename();
+    test_decompose();
     test_normalize();
 }
 
@@ -0,0 +1,77 @@
+#include <string.h>
+#include "test.h"
+#include "kpool.h"
+
+UNIT_TEST(kpool) {
+    kbuffer *buf, *other;
+    kstr *str, *str2;
+    size_t i;
+
+    /* A released buffer is reused, empty, by the next request of its class. */
+    buf = kbuffer_acquire(3000);
+    TASSERT(buf->allocated >= 3000 && buf->len == 0);
+    kbuffer_write_cstr(buf, "abc");
+    kbuffer_release(buf);
+    other = kbuffer_acquire(2000);
+    TASSERT(other == buf && other->len == 0 && other->pos == 0);
+
+    /* A smaller request may take a larger buffer, not the opposite. */
+    kbuffer_release(other);
+    TASSERT(kbuffer_acquire(10) == buf);
+    other = kbuffer_acquire(5000);
+    TASSERT(other != buf && other->allocated >= 5000);
+    kbuffer_release(other);
+    kbuffer_release(buf);
+
+    /* An oversized buffer is trimmed. */
+    buf = kbuffer_acquire(1000000);
+    TASSERT(buf->allocated >= 1000000);
+    kbuffer_release(buf);
+    buf = kbuffer_acquire(KPOOL_MAX_SIZE + 1);
+    TASSERT(buf->allocated > KPOOL_MAX_SIZE);
+    kbuffer_release(buf);
+    buf = kbuffer_acquire(0);
+    TASSERT(buf->allocated <= KPOOL_MAX_SIZE);
+    kbuffer_release(buf);
+
+    /* The pool keeps a bounded number of objects per class. */
+    {
+        kbuffer *bufs[KPOOL_CLASS_DEPTH + 2];
+        for (i = 0; i < KPOOL_CLASS_DEPTH + 2; i++) bufs[i] = kbuffer_acquire(100);
+        for (i = 0; i < KPOOL_CLASS_DEPTH + 2; i++) kbuffer_release(bufs[i]);
+        TASSERT(kpool_get_current()->nb_buffers[0] == KPOOL_CLASS_DEPTH);
+    }
+
+    /* Chained buffers are not kept. */
+    buf = kbuffer_new();
+    kbuffer_clean(buf);
+    kbuffer_init_chained(buf, 0);
+    kbuffer_release(buf);
+
+    /* Strings. */
+    str = kstr_acquire(1000);
+    TASSERT(str->mlen > 1000 && str->slen == 0);
+    kstr_append_cstr(str, "hello");
+    kstr_release(str);
+    str2 = kstr_acquire(500);
+    TASSERT(str2 == str && str2->slen == 0 && str2->data[0] == 0);
+    kstr_release(str2);
+
+    str = kstr_acquire(5);
+    TASSERT(str->slen == 0);
+    kstr_release(str);
+
+    /* The serialization temporaries go through the pool. */
+    buf = kbuffer_new();
+    str = kstr_new();
+    kstr_assign_cstr(str, "pooled");
+    for (i = 0; i < 3; i++) {
+        kserializable *copy = NULL;
+        TASSERT(kserializable_serialize((kserializable *)str, buf) == 0);
+        TASSERT(kserializable_deserialize(&copy, buf) == 0);
+        TASSERT(! strcmp(((kstr *)copy)->data, "pooled"));
+        kserializable_destroy(copy);
+    }
+    kstr_destroy(str);
+    kbuffer_destroy(buf);
+}
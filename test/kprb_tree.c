@@ -0,0 +1,210 @@
+#include <string.h>
+#include "test.h"
+#include "kprb_tree.h"
+#include "krb_tree.h"
+#include "kutils.h"
+#include "kthread.h"
+#include "kmem.h"
+
+/* This function verifies that the snapshot contains exactly the keys marked in
+ * the presence array.
+ */
+static void check_snapshot(struct kprb_snapshot *snapshot, int *keys, char *present, int nb_keys) {
+    struct kprb_iter iter;
+    struct kprb_node *node;
+    int i = 0, count = 0;
+
+    kprb_snapshot_check_consistency(snapshot);
+    kprb_iter_start(snapshot, &iter);
+
+    while ((node = kprb_iter_next(&iter)) != NULL) {
+        while (! present[i]) i++;
+        assert(node->key == &keys[i]);
+        assert(kprb_snapshot_get(snapshot, &keys[i]) == &keys[i]);
+        i++;
+        count++;
+    }
+
+    for (; i < nb_keys; i++) assert(! present[i]);
+    assert(kprb_snapshot_size(snapshot) == count);
+}
+
+UNIT_TEST(kprb_tree) {
+    kprb_tree tree;
+    struct kprb_snapshot snapshots[4];
+    int keys[1000];
+    char present[1000];
+    char snapshot_present[4][1000];
+    int nb_keys = 1000;
+    int nb_op = 20000;
+    int index, i;
+
+    kprb_tree_init(&tree, krb_tree_int_cmp);
+    for (i = 0; i < nb_keys; i++) keys[i] = i;
+    memset(present, 0, sizeof(present));
+
+    /* Snapshot of the empty tree. */
+    kprb_tree_snapshot(&tree, &snapshots[0]);
+    TASSERT(kprb_snapshot_size(&snapshots[0]) == 0);
+    TASSERT(kprb_snapshot_get(&snapshots[0], &keys[0]) == NULL);
+    memset(snapshot_present, 0, sizeof(snapshot_present));
+    for (i = 1; i < 4; i++) snapshots[i].root_node = NULL;
+
+    for (index = 0; index < nb_op; index++) {
+        int nb = kutil_get_random_int(nb_keys - 1);
+
+        /* Insert or remove. */
+        if (kutil_get_random_int(10) <= 5) {
+            kprb_tree_add(&tree, &keys[nb], &keys[nb]);
+            present[nb] = 1;
+        }
+
+        else {
+            void *value = kprb_tree_remove(&tree, &keys[nb]);
+            assert(value == (present[nb] ? &keys[nb] : NULL));
+            present[nb] = 0;
+        }
+
+        assert(kprb_tree_get(&tree, &keys[nb]) == (present[nb] ? &keys[nb] : NULL));
+
+        /* Periodically replace a snapshot, after checking that it still
+         * contains the keys it had when it was taken.
+         */
+        if (index % 500 == 0) {
+            int slot = kutil_get_random_int(3);
+            check_snapshot(&snapshots[slot], keys, snapshot_present[slot], nb_keys);
+            kprb_snapshot_release(&snapshots[slot]);
+            kprb_tree_snapshot(&tree, &snapshots[slot]);
+            memcpy(snapshot_present[slot], present, nb_keys);
+            check_snapshot(&snapshots[slot], keys, present, nb_keys);
+        }
+    }
+
+    /* Check the snapshots then the tree itself. */
+    for (i = 0; i < 4; i++) {
+        if (snapshots[i].root_node == NULL) continue;
+        check_snapshot(&snapshots[i], keys, snapshot_present[i], nb_keys);
+        if (kprb_snapshot_size(&snapshots[i])) {
+            TASSERT(kprb_snapshot_get_node_by_index(&snapshots[i], 0) != NULL);
+        }
+    }
+
+    kprb_snapshot_release(&snapshots[0]);
+    kprb_tree_snapshot(&tree, &snapshots[0]);
+    check_snapshot(&snapshots[0], keys, present, nb_keys);
+    TASSERT(kprb_tree_size(&tree) == kprb_snapshot_size(&snapshots[0]));
+
+    /* The snapshots survive the tree. */
+    kprb_tree_clean(&tree);
+    check_snapshot(&snapshots[0], keys, present, nb_keys);
+    for (i = 0; i < 4; i++) kprb_snapshot_release(&snapshots[i]);
+}
+
+/* Threaded test. The writer slides a window of keys over the tree, so every
+ * version holds consecutive keys. The readers hold several versions while the
+ * writer drops them, and walk them again later.
+ */
+#define KPRB_WINDOW 200
+#define KPRB_NB_STEP 20000
+#define KPRB_NB_READER 3
+#define KPRB_NB_HELD 3
+
+struct kprb_thread_test {
+    kprb_tree tree;
+    int keys[KPRB_NB_STEP + KPRB_WINDOW];
+    int done;
+    int nb_error;
+    int nb_snapshot;
+};
+
+/* This function returns 0 if the snapshot holds consecutive keys with the key
+ * as value, and -1 otherwise.
+ */
+static int check_window(struct kprb_thread_test *test, struct kprb_snapshot *snapshot) {
+    struct kprb_iter iter;
+    struct kprb_node *node;
+    int *prev = NULL;
+    int count = 0;
+
+    kprb_iter_start(snapshot, &iter);
+
+    while ((node = kprb_iter_next(&iter)) != NULL) {
+        int *key = node->key;
+        if (key < test->keys || key >= test->keys + KPRB_NB_STEP + KPRB_WINDOW) return -1;
+        if (node->value != key || *key != key - test->keys) return -1;
+        if (prev && key != prev + 1) return -1;
+        if (kprb_snapshot_get(snapshot, key) != key) return -1;
+        prev = key;
+        count++;
+    }
+
+    if (count != kprb_snapshot_size(snapshot) || count > KPRB_WINDOW) return -1;
+    if (count && kprb_snapshot_get_node_by_index(snapshot, count - 1)->key != prev) return -1;
+    return 0;
+}
+
+static void kprb_reader(struct kthread *thread, void *arg) {
+    struct kprb_thread_test *test = arg;
+    struct kprb_snapshot snapshots[KPRB_NB_HELD];
+    int nb_held = 0, nb_snapshot = 0, i;
+    (void) thread;
+
+    while (! __sync_add_and_fetch(&test->done, 0)) {
+        /* Replace the oldest snapshot by the latest version. */
+        if (nb_held == KPRB_NB_HELD) {
+            kprb_snapshot_release(&snapshots[0]);
+            memmove(snapshots, snapshots + 1, (KPRB_NB_HELD - 1) * sizeof(snapshots[0]));
+            nb_held--;
+        }
+
+        kprb_tree_snapshot(&test->tree, &snapshots[nb_held++]);
+        nb_snapshot++;
+
+        /* The older versions must be intact. */
+        for (i = 0; i < nb_held; i++) {
+            if (check_window(test, &snapshots[i])) __sync_add_and_fetch(&test->nb_error, 1);
+        }
+    }
+
+    for (i = 0; i < nb_held; i++) kprb_snapshot_release(&snapshots[i]);
+    __sync_add_and_fetch(&test->nb_snapshot, nb_snapshot);
+}
+
+UNIT_TEST(kprb_tree_threads) {
+    struct kprb_thread_test *test = kcalloc(sizeof(struct kprb_thread_test));
+    struct kthread readers[KPRB_NB_READER];
+    int i;
+
+    kthread_enter_mt_mode();
+    kprb_tree_init(&test->tree, krb_tree_int_cmp);
+    for (i = 0; i < KPRB_NB_STEP + KPRB_WINDOW; i++) test->keys[i] = i;
+    for (i = 0; i < KPRB_WINDOW; i++) kprb_tree_add(&test->tree, &test->keys[i], &test->keys[i]);
+
+    for (i = 0; i < KPRB_NB_READER; i++) {
+        kthread_init(&readers[i]);
+        kthread_start(&readers[i], kprb_reader, test);
+    }
+
+    /* Each step publishes two versions, which drops the previous ones if no
+     * reader holds them.
+     */
+    for (i = 0; i < KPRB_NB_STEP; i++) {
+        kprb_tree_remove(&test->tree, &test->keys[i]);
+        kprb_tree_add(&test->tree, &test->keys[i + KPRB_WINDOW], &test->keys[i + KPRB_WINDOW]);
+    }
+
+    __sync_add_and_fetch(&test->done, 1);
+
+    for (i = 0; i < KPRB_NB_READER; i++) {
+        kthread_join(&readers[i]);
+        kthread_clean(&readers[i]);
+    }
+
+    TASSERT(test->nb_error == 0);
+    TASSERT(test->nb_snapshot >= KPRB_NB_READER);
+    TASSERT(kprb_tree_size(&test->tree) == KPRB_WINDOW);
+
+    kprb_tree_clean(&test->tree);
+    kthread_exit_mt_mode();
+    kfree(test);
+}
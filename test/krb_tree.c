@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "test.h"
 #include "krb_tree.h"
 #include "khash.h"
@@ -66,3 +67,161 @@ UNIT_TEST(krb_tree) {
     krb_tree_clean(&tree);
     khash_clean(&nb_hash);
 }
+
+/* This function returns the number of keys of the presence array that are in
+ * the range [low, high].
+ */
+static int count_present(char *present, int low, int high) {
+    int i, count = 0;
+    for (i = low; i <= high; i++) count += present[i];
+    return count;
+}
+
+UNIT_TEST(krb_tree_range) {
+    krb_tree tree, removed;
+    struct krb_node *node;
+    int keys[500];
+    char present[500];
+    int nb_keys = 500;
+    int round, i;
+
+    krb_tree_init_func(&tree, krb_tree_int_cmp);
+    krb_tree_init_func(&removed, krb_tree_int_cmp);
+    for (i = 0; i < nb_keys; i++) keys[i] = i;
+
+    /* Empty tree. */
+    TASSERT(krb_tree_lower_bound(&tree, &keys[0]) == NULL);
+    TASSERT(krb_tree_count_range(&tree, &keys[0], &keys[10]) == 0);
+    TASSERT(krb_tree_remove_range(&tree, &keys[0], &keys[10], NULL) == 0);
+
+    for (round = 0; round < 200; round++) {
+        int low = kutil_get_random_int(nb_keys - 1);
+        int high = kutil_get_random_int(nb_keys - 1);
+        int count, tmp;
+
+        /* Fill the tree randomly. */
+        memset(present, 0, sizeof(present));
+        for (i = 0; i < nb_keys; i++) {
+            if (kutil_get_random_int(3) == 0) {
+                present[i] = 1;
+                krb_tree_add_fast(&tree, &keys[i], &keys[i]);
+            }
+        }
+
+        /* Check the bounds. */
+        node = krb_tree_lower_bound(&tree, &keys[low]);
+        for (i = low; i < nb_keys && ! present[i]; i++) ;
+        TASSERT(i == nb_keys ? node == NULL : node->key == &keys[i]);
+
+        node = krb_tree_upper_bound(&tree, &keys[low]);
+        for (i = low + 1; i < nb_keys && ! present[i]; i++) ;
+        TASSERT(i == nb_keys ? node == NULL : node->key == &keys[i]);
+
+        if (low > high) { tmp = low; low = high; high = tmp; }
+
+        /* Check the range count and iteration. */
+        count = count_present(present, low, high);
+        TASSERT(krb_tree_count_range(&tree, &keys[low], &keys[high]) == count);
+        TASSERT(krb_tree_count_range(&tree, &keys[high], &keys[low]) == (low == high ? count : 0));
+
+        i = low;
+        for (node = krb_tree_range_start(&tree, &keys[low], &keys[high]); node;
+             node = krb_tree_range_next(&tree, node, &keys[high])) {
+            while (! present[i]) i++;
+            assert(node->key == &keys[i]);
+            i++;
+            count--;
+        }
+
+        TASSERT(count == 0);
+
+        /* Remove the range, alternatively keeping and destroying the removed
+         * nodes.
+         */
+        count = count_present(present, low, high);
+
+        if (round % 2) {
+            TASSERT(krb_tree_remove_range(&tree, &keys[low], &keys[high], &removed) == count);
+            krb_tree_check_consistency(&removed);
+            TASSERT(krb_tree_size(&removed) == count);
+            TASSERT(krb_tree_count_range(&removed, &keys[low], &keys[high]) == count);
+            krb_tree_reset(&removed);
+        }
+
+        else {
+            TASSERT(krb_tree_remove_range(&tree, &keys[low], &keys[high], NULL) == count);
+        }
+
+        krb_tree_check_consistency(&tree);
+        TASSERT(krb_tree_size(&tree) == count_present(present, 0, nb_keys - 1) - count);
+        TASSERT(krb_tree_count_range(&tree, &keys[low], &keys[high]) == 0);
+
+        for (i = 0; i < nb_keys; i++) {
+            int expected = present[i] && (i < low || i > high);
+            assert(krb_tree_exist(&tree, &keys[i]) == expected);
+        }
+
+        /* The tree must still be usable. */
+        krb_tree_add(&tree, &keys[low], &keys[low]);
+        krb_tree_check_consistency(&tree);
+        krb_tree_remove(&tree, &keys[low]);
+        krb_tree_reset(&tree);
+    }
+
+    krb_tree_clean(&tree);
+    krb_tree_clean(&removed);
+}
+
+KRB_TREE_DECLARE(u64_tree, uint64_t, int, KRB_TREE_NUM_CMP)
+
+UNIT_TEST(krb_tree_typed) {
+    krb_tree tree;
+    struct u64_tree_node *node;
+    char present[1000];
+    int nb_keys = 1000;
+    int index, i, value, ret;
+
+    u64_tree_init(&tree);
+    memset(present, 0, sizeof(present));
+
+    for (index = 0; index < 5000; index++) {
+        uint64_t key = (uint64_t) kutil_get_random_int(nb_keys - 1);
+
+        /* Insert, or replace the value. */
+        if (kutil_get_random_int(10) <= 5) {
+            node = u64_tree_add(&tree, key, (int) key + 1);
+            assert(node->key == key && node->value == (int) key + 1);
+            present[key] = 1;
+        }
+
+        /* Delete. */
+        else {
+            value = -1;
+            ret = u64_tree_remove(&tree, key, &value);
+            assert(ret == present[key]);
+            assert(value == (present[key] ? (int) key + 1 : -1));
+            present[key] = 0;
+        }
+
+        assert((u64_tree_get(&tree, key) != NULL) == present[key]);
+    }
+
+    /* The generic functions work on the typed tree. */
+    krb_tree_check_consistency(&tree);
+
+    for (i = 0, node = u64_tree_first(&tree); node; node = u64_tree_next(&tree, node)) {
+        while (! present[i]) i++;
+        assert(node->key == (uint64_t) i);
+        assert(krb_tree_get_node(&tree, &node->key) == &node->rb);
+        i++;
+    }
+
+    for (; i < nb_keys; i++) assert(! present[i]);
+
+    node = u64_tree_lower_bound(&tree, 500);
+    for (i = 500; i < nb_keys && ! present[i]; i++) ;
+    TASSERT(i == nb_keys ? node == NULL : node->key == (uint64_t) i);
+
+    u64_tree_clean(&tree);
+    TASSERT(u64_tree_first(&tree) == NULL);
+}
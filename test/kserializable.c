@@ -39,3 +39,309 @@ UNIT_TEST(kserializable) {
     kserializable_destroy((kserializable *)hash);
     kbuffer_destroy(serialized_data);
 }
+
+UNIT_TEST(kserializable_compact) {
+    kindex *hash = kindex_new();
+    kbuffer regular, compact;
+    kstr *str;
+    int i;
+
+    kbuffer_init(&regular);
+    kbuffer_init(&compact);
+
+    for (i = 0; i < 100; i++) {
+        str = kstr_new();
+        kstr_sf(str, "value %d", i);
+        kindex_add(hash, i, (kserializable *)str);
+    }
+
+    kserializable_serialize((kserializable *)hash, &regular);
+    kserializable_serialize_compact((kserializable *)hash, &compact);
+    TASSERT(compact.len < regular.len * 2 / 3);
+    kserializable_destroy((kserializable *)hash);
+    hash = NULL;
+
+    /* Both formats are read by kserializable_deserialize(). */
+    TASSERT(kserializable_deserialize((kserializable **)&hash, &compact) == 0);
+    TASSERT(compact.pos == compact.len);
+    TASSERT(kindex_get(hash, 42, (kserializable **)&str) == 0);
+    TASSERT(strcmp(str->data, "value 42") == 0);
+    kserializable_destroy((kserializable *)hash);
+    hash = NULL;
+
+    TASSERT(kserializable_deserialize((kserializable **)&hash, &regular) == 0);
+    TASSERT(kindex_get(hash, 99, (kserializable **)&str) == 0);
+    TASSERT(strcmp(str->data, "value 99") == 0);
+    kserializable_destroy((kserializable *)hash);
+
+    /* A truncated compact element. */
+    compact.pos = 0;
+    compact.len -= 1;
+    hash = NULL;
+    TASSERT(kserializable_deserialize((kserializable **)&hash, &compact) == -1);
+    TASSERT(hash == NULL);
+
+    kbuffer_clean(&regular);
+    kbuffer_clean(&compact);
+}
+
+UNIT_TEST(kserializable_borrow) {
+    kindex *hash = kindex_new();
+    kbuffer serialized, *value;
+    kstr *str = kstr_new(), *got;
+    kstr_view view;
+    uint8_t *begin, *end;
+    int i, j;
+
+    kbuffer_init(&serialized);
+    value = kbuffer_new();
+    for (i = 0; i < 2000; i++) kbuffer_write8(value, i);
+    kindex_add(hash, 1, (kserializable *)value);
+    value = kbuffer_new();
+    kbuffer_write_cstr(value, "small");
+    kindex_add(hash, 2, (kserializable *)value);
+    kstr_assign_cstr(str, "a string");
+    kindex_add(hash, 3, (kserializable *)str);
+
+    for (j = 0; j < 2; j++) {
+        kbuffer_reset(&serialized);
+        if (j == 0) kserializable_serialize((kserializable *)hash, &serialized);
+        else kserializable_serialize_compact((kserializable *)hash, &serialized);
+        begin = serialized.data;
+        end = serialized.data + serialized.len;
+
+        /* The regular deserializer copies the buffers. */
+        value = NULL;
+        {
+            kindex *copy = NULL;
+            TASSERT(kserializable_deserialize((kserializable **)&copy, &serialized) == 0);
+            TASSERT(serialized.pos == serialized.len);
+            TASSERT(kindex_get(copy, 1, (kserializable **)&value) == 0 && value->len == 2000);
+            TASSERT(value->data < begin || value->data >= end);
+            TASSERT(kindex_get(copy, 3, (kserializable **)&got) == 0 && strcmp(got->data, "a string") == 0);
+            kserializable_destroy((kserializable *)copy);
+        }
+
+        /* The borrowing deserializer refers to the serialized bytes. */
+        serialized.pos = 0;
+        {
+            kindex *borrowed = NULL;
+            TASSERT(kserializable_deserialize_borrow((kserializable **)&borrowed, &serialized) == 0);
+            TASSERT(serialized.pos == serialized.len);
+            TASSERT(kindex_get(borrowed, 1, (kserializable **)&value) == 0);
+            TASSERT(value->data >= begin && value->data + 2000 <= end && value->data[1999] == (uint8_t) 1999);
+            TASSERT(kindex_get(borrowed, 2, (kserializable **)&value) == 0);
+            TASSERT(value->data >= begin && value->data < end && value->len == 5);
+            TASSERT(kindex_get(borrowed, 3, (kserializable **)&got) == 0 && strcmp(got->data, "a string") == 0);
+            kserializable_destroy((kserializable *)borrowed);
+        }
+    }
+
+    /* A kstr read as a view, in both formats. */
+    for (j = 0; j < 2; j++) {
+        kbuffer_reset(&serialized);
+        if (j == 0) kserializable_serialize((kserializable *)str, &serialized);
+        else kserializable_serialize_compact((kserializable *)str, &serialized);
+        kbuffer_write8(&serialized, 0x42);
+        TASSERT(kstr_deserialize_view(&serialized, &view) == 0);
+        TASSERT(kstr_view_equal_cstr(view, "a string"));
+        TASSERT((uint8_t *) view.p > serialized.data && (uint8_t *) view.p < serialized.data + serialized.len);
+        TASSERT(serialized.pos == serialized.len - 1);
+
+        /* Truncated. */
+        serialized.pos = 0;
+        serialized.len -= 2;
+        TASSERT(kstr_deserialize_view(&serialized, &view) == -1 && serialized.pos == 0);
+    }
+
+    /* Wrong type. */
+    kbuffer_reset(&serialized);
+    kserializable_serialize((kserializable *)hash, &serialized);
+    TASSERT(kstr_deserialize_view(&serialized, &view) == -1);
+
+    kserializable_destroy((kserializable *)hash);
+    kbuffer_clean(&serialized);
+}
+
+/* An element that cannot be serialized. */
+static int failing_serialize(kserializable *self, kbuffer *buffer) {
+    (void) self;
+    kbuffer_write32(buffer, 0xdeadbeef);
+    return -1;
+}
+
+static void failing_free(kserializable *self) {
+    (void) self;
+}
+
+static struct kserializable_ops failing_ops = {
+    KSERIALIZABLE_TYPE_NONE, failing_serialize, NULL, NULL, failing_free, NULL, NULL, NULL, NULL
+};
+
+UNIT_TEST(kserializable_in_place) {
+    kindex *outer = kindex_new(), *inner = kindex_new(), *copy;
+    kserializable failing;
+    kbuffer flat, chained, *value;
+    kstr *str;
+    ssize_t size;
+    int i, compact;
+
+    for (i = 0; i < 50; i++) {
+        str = kstr_new();
+        kstr_sf(str, "inner %d", i);
+        kindex_add(inner, i * 1000, (kserializable *)str);
+    }
+    value = kbuffer_new();
+    for (i = 0; i < 300; i++) kbuffer_write8(value, i);
+    kindex_add(inner, 7, (kserializable *)value);
+    kindex_add(outer, 1, (kserializable *)inner);
+    str = kstr_new();
+    kstr_assign_cstr(str, "outer");
+    kindex_add(outer, 2, (kserializable *)str);
+
+    for (compact = 0; compact < 2; compact++) {
+        kbuffer_init(&flat);
+        kbuffer_init_chained(&chained, 16);
+        kbuffer_write8(&flat, 0xaa);
+        kbuffer_write8(&chained, 0xaa);
+
+        /* The size is exact, and the chained buffer gets the same bytes. */
+        size = kserializable_serialized_size((kserializable *)outer, compact);
+        if (compact) {
+            TASSERT(kserializable_serialize_compact((kserializable *)outer, &flat) == 0);
+            TASSERT(kserializable_serialize_compact((kserializable *)outer, &chained) == 0);
+        } else {
+            TASSERT(kserializable_serialize((kserializable *)outer, &flat) == 0);
+            TASSERT(kserializable_serialize((kserializable *)outer, &chained) == 0);
+        }
+        TASSERT(size > 0 && flat.len == (size_t) size + 1 && chained.len == flat.len);
+        TASSERT(! memcmp(kbuffer_read_nbytes(&chained, chained.len), flat.data, flat.len));
+
+        flat.pos = 1;
+        copy = NULL;
+        TASSERT(kserializable_deserialize((kserializable **)&copy, &flat) == 0 && flat.pos == flat.len);
+        TASSERT(kindex_get(copy, 1, (kserializable **)&inner) == 0);
+        TASSERT(kindex_get(inner, 49000, (kserializable **)&str) == 0 && strcmp(str->data, "inner 49") == 0);
+        TASSERT(kindex_get(inner, 7, (kserializable **)&value) == 0 && value->len == 300);
+        kserializable_destroy((kserializable *)copy);
+
+        kbuffer_clean(&flat);
+        kbuffer_clean(&chained);
+    }
+
+    /* Nothing is written when an element fails, and its size is unknown. */
+    kserializable_init(&failing, &failing_ops);
+    kindex_get(outer, 1, (kserializable **)&inner);
+    kindex_add(inner, 8, &failing);
+    TASSERT(kserializable_serialized_size((kserializable *)outer, 0) == -1);
+
+    for (compact = 0; compact < 2; compact++) {
+        kbuffer_init(&flat);
+        kbuffer_init_chained(&chained, 16);
+        kbuffer_write(&chained, (uint8_t *) "0123456789", 10);
+        if (compact) {
+            TASSERT(kserializable_serialize_compact((kserializable *)outer, &flat) == -1);
+            TASSERT(kserializable_serialize_compact((kserializable *)outer, &chained) == -1);
+        } else {
+            TASSERT(kserializable_serialize((kserializable *)outer, &flat) == -1);
+            TASSERT(kserializable_serialize((kserializable *)outer, &chained) == -1);
+        }
+        TASSERT(flat.len == 0 && chained.len == 10);
+        kbuffer_write(&chained, (uint8_t *) "ab", 2);
+        TASSERT(! memcmp(kbuffer_read_nbytes(&chained, 12), "0123456789ab", 12));
+        kbuffer_clean(&flat);
+        kbuffer_clean(&chained);
+    }
+
+    kserializable_destroy((kserializable *)outer);
+}
+
+UNIT_TEST(kserializable_ops_lookup) {
+    static struct kserializable_ops sparse_ops[3];
+    unsigned int types[3] = { (1 << 8) + 3, 1 << 8, 5000 };
+    const struct kserializable_ops *kbuffer_ops = kserializable_get_ops(KSERIALIZABLE_TYPE_KBUFFER);
+    kbuffer *buffer = kbuffer_new(), *copy = NULL;
+    kbuffer serialized;
+    int i;
+
+    TASSERT(kbuffer_ops && kbuffer_ops->type == KSERIALIZABLE_TYPE_KBUFFER);
+    TASSERT(kserializable_get_ops(KSERIALIZABLE_TYPE_KSTR)->type == KSERIALIZABLE_TYPE_KSTR);
+    TASSERT(kserializable_get_ops(KSERIALIZABLE_TYPE_KINDEX)->type == KSERIALIZABLE_TYPE_KINDEX);
+    TASSERT(kserializable_get_ops(KSERIALIZABLE_TYPE_NONE) == NULL);
+    TASSERT(kserializable_get_ops(200) == NULL);
+    TASSERT(kserializable_get_ops(1 << 8) == NULL);
+
+    /* The types out of the dense range are added out of order. */
+    for (i = 0; i < 3; i++) {
+        sparse_ops[i] = *kbuffer_ops;
+        sparse_ops[i].type = types[i];
+        TASSERT(kserializable_add_ops(&sparse_ops[i]) == 0);
+    }
+    TASSERT(kserializable_add_ops(&sparse_ops[1]) == -1);
+    TASSERT(kserializable_add_ops(kbuffer_ops) == -1);
+
+    for (i = 0; i < 3; i++)
+        TASSERT(kserializable_get_ops(types[i]) == &sparse_ops[i]);
+    TASSERT(kserializable_get_ops((1 << 8) + 1) == NULL);
+    TASSERT(kserializable_get_ops(6000) == NULL);
+
+    /* An element of an added type is deserialized with its ops. */
+    kbuffer_write(buffer, (uint8_t *) "sparse", 6);
+    buffer->serializable.ops = &sparse_ops[2];
+    kbuffer_init(&serialized);
+    TASSERT(kserializable_serialize((kserializable *)buffer, &serialized) == 0);
+    TASSERT(kserializable_deserialize((kserializable **)&copy, &serialized) == 0);
+    TASSERT(copy->len == 6 && ! memcmp(copy->data, "sparse", 6));
+
+    kbuffer_destroy(copy);
+    kbuffer_destroy(buffer);
+    kbuffer_clean(&serialized);
+
+    /* Remove the added types. */
+    kserializable_finalize();
+    TASSERT(kserializable_get_ops(5000) == NULL);
+    TASSERT(kserializable_get_ops(KSERIALIZABLE_TYPE_KBUFFER) == kbuffer_ops);
+}
+
+/* Elements streamed through a chained buffer span its segments. Deserializing
+ * and consuming them must not accumulate copies in the buffer.
+ */
+UNIT_TEST(kserializable_stream) {
+    kbuffer chain, flat, *value, *copy;
+    struct kbuffer_seg *seg;
+    size_t len, seg_count, max_seg_count = 0;
+    int i;
+
+    kbuffer_init_chained(&chain, 64);
+    kbuffer_init(&flat);
+    value = kbuffer_new();
+
+    for (i = 0; i < 2000; i++) {
+        len = 10 + kutil_get_random_int(300);
+        kbuffer_reset(value);
+        memset(kbuffer_write_nbytes(value, len), i, len);
+        kbuffer_reset(&flat);
+        TASSERT(kserializable_serialize((kserializable *)value, &flat) == 0);
+        kbuffer_write(&chain, flat.data, flat.len);
+
+        copy = NULL;
+        if (i % 2)
+            TASSERT(kserializable_deserialize_borrow((kserializable **)&copy, &chain) == 0);
+        else
+            TASSERT(kserializable_deserialize((kserializable **)&copy, &chain) == 0);
+        assert(copy->len == len && copy->data[0] == (uint8_t)i && copy->data[len - 1] == (uint8_t)i);
+        kbuffer_destroy(copy);
+
+        kbuffer_consume(&chain, 0);
+        assert(chain.pos == chain.len && chain.scratch_list == NULL);
+        for (seg_count = 0, seg = chain.first_seg; seg; seg = seg->next) seg_count++;
+        max_seg_count = MAX(max_seg_count, seg_count);
+    }
+
+    /* Each element fills the last segment and at most one new segment. */
+    TASSERT(max_seg_count <= 3);
+
+    kbuffer_destroy(value);
+    kbuffer_clean(&flat);
+    kbuffer_clean(&chain);
+}
@@ -1,6 +1,18 @@
+#include <stdlib.h>
+#include <string.h>
 #include <kstr.h>
+#include <kmem.h>
+#include <kpath.h>
+#include <kutils.h>
 #include "test.h"
 
+/* Number of allocations made through kmem since the counter was reset. */
+static int nb_alloc = 0;
+
+static void *count_malloc(size_t s) { nb_alloc++; return malloc(s); }
+static void *count_calloc(size_t s) { nb_alloc++; return calloc(1, s); }
+static void *count_realloc(void *p, size_t s) { nb_alloc++; return realloc(p, s); }
+
 UNIT_TEST(kstr) {
     kstr str1, str2, str3;
     kstr_init(&str1);
@@ -34,3 +46,252 @@ UNIT_TEST(kstr) {
     kstr_clean(&str2);
     kstr_clean(&str3);
 }
+
+UNIT_TEST(kstr_sso) {
+    kstr str1, str2;
+    char buf[100];
+    int i;
+
+    /* Grow one character at a time past the inline buffer. */
+    kstr_init(&str1);
+    for (i = 0; i < 99; i++) {
+        buf[i] = 'a' + i % 26;
+        kstr_append_char(&str1, buf[i]);
+        assert(str1.slen == (size_t) i + 1 && ! memcmp(str1.data, buf, i + 1) && str1.data[i + 1] == 0);
+    }
+    buf[99] = 0;
+    TASSERT(kstr_equal_cstr(&str1, buf));
+
+    /* Inline and heap strings mix freely. */
+    kstr_init_buf(&str2, buf, KSTR_SSO_SIZE - 1);
+    TASSERT(str2.data == str2.sso);
+    kstr_append_kstr(&str2, &str1);
+    TASSERT(str2.data != str2.sso && str2.slen == KSTR_SSO_SIZE - 1 + 99);
+    kstr_mid(&str2, &str1, 0, 5);
+    TASSERT(kstr_equal_cstr(&str1, "abcde"));
+    kstr_shrink(&str2, 64);
+    TASSERT(str2.data == str2.sso && str2.slen == 0);
+    kstr_sf(&str2, "%s", buf);
+    TASSERT(kstr_equal_cstr(&str2, buf));
+
+    kstr_clean(&str1);
+    kstr_clean(&str2);
+}
+
+UNIT_TEST(kstr_alloc) {
+    kstr str;
+    struct kpath_dir dir;
+    kstr path;
+    struct kerror_node *node;
+    int count;
+
+    /* Warm up the error stack and the component array so that only the
+     * string allocations are counted below.
+     */
+    KERROR_PUSH(0, 0, "warm up");
+    kerror_reset();
+    kstr_init_cstr(&path, "/usr/local/lib/ktools/");
+    kpath_dir_init(&dir);
+    kpath_decompose_dir(&path, &dir, KPATH_FORMAT_UNIX);
+    kpath_dir_reset(&dir);
+
+    kmem_set_handler(count_malloc, count_calloc, count_realloc, NULL, NULL, NULL);
+
+    /* Short strings do not allocate. */
+    nb_alloc = 0;
+    kstr_init_cstr(&str, "short");
+    kstr_append_sf(&str, " %d", 42);
+    kstr_append_char(&str, '!');
+    count = nb_alloc;
+    kstr_clean(&str);
+    TASSERT(count == 0);
+
+    /* Formatting a short error message only allocates the error node. */
+    nb_alloc = 0;
+    node = kerror_node_new(__FILE__, __LINE__, __FUNCTION__, 0, 0, "error %d", 42);
+    count = nb_alloc;
+    kerror_node_destroy(node);
+    TASSERT(count == 1);
+
+    /* Splitting a path allocates one kstr per component. */
+    nb_alloc = 0;
+    kpath_decompose_dir(&path, &dir, KPATH_FORMAT_UNIX);
+    count = nb_alloc;
+    TASSERT(dir.components.size == 4 && count == 4);
+
+    kmem_set_handler(NULL, NULL, NULL, NULL, NULL, NULL);
+
+    kpath_dir_clean(&dir);
+    kstr_clean(&path);
+}
+
+/* Reference implementation of kstr_find_buf(). */
+static ssize_t naive_find(kstr *str, size_t start, const char *buf, size_t len) {
+    size_t i;
+    for (i = start; i + len <= str->slen; i++) if (! memcmp(str->data + i, buf, len)) return i;
+    return -1;
+}
+
+/* Reference implementation of kstr_replace_multi(). */
+static void naive_replace_multi(kstr *str, char **from, char **to, int nb) {
+    kstr tmp;
+    size_t i = 0;
+    int j;
+    
+    kstr_init(&tmp);
+    
+    while (i < str->slen) {
+        int best = -1;
+        
+        for (j = 0; j < nb; j++) {
+            if (! strncmp(str->data + i, from[j], strlen(from[j])) &&
+                (best == -1 || strlen(from[j]) > strlen(from[best]))) best = j;
+        }
+        
+        if (best == -1) kstr_append_char(&tmp, str->data[i++]);
+        else {
+            kstr_append_cstr(&tmp, to[best]);
+            i += strlen(from[best]);
+        }
+    }
+    
+    kstr_assign_kstr(str, &tmp);
+    kstr_clean(&tmp);
+}
+
+UNIT_TEST(kstr_find_replace) {
+    kstr str, ref;
+    char needle[80];
+    char *from[5] = { "ab", "abc", "b", "cab", "ab" };
+    char *to[5] = { "1", "22", "", "4444", "5" };
+    int index, i, ok;
+    
+    kstr_init(&str);
+    kstr_init(&ref);
+    
+    TASSERT(kstr_find_cstr(&str, 0, "") == 0 && kstr_find_cstr(&str, 0, "a") == -1);
+    kstr_assign_cstr(&str, "the quick brown fox jumps over the lazy dog");
+    TASSERT(kstr_find_cstr(&str, 0, "the") == 0);
+    TASSERT(kstr_find_cstr(&str, 1, "the") == 31);
+    TASSERT(kstr_find_cstr(&str, 0, "dog") == 40);
+    TASSERT(kstr_find_cstr(&str, 0, "cat") == -1);
+    TASSERT(kstr_find_cstr(&str, 100, "") == -1);
+    
+    /* Compare with the reference implementation on random strings over small
+     * alphabets, to exercise the periodic cases.
+     */
+    for (index = 0, ok = 0; index < 2000; index++) {
+        int alphabet = 1 + kutil_get_random_int(3);
+        int len = kutil_get_random_int(300);
+        int needle_len = kutil_get_random_int(index % 10 ? 8 : 70);
+        size_t start = kutil_get_random_int(10);
+        
+        kstr_reset(&str);
+        for (i = 0; i < len; i++) kstr_append_char(&str, 'a' + kutil_get_random_int(alphabet));
+        for (i = 0; i < needle_len; i++) needle[i] = 'a' + kutil_get_random_int(alphabet);
+        
+        /* Take the needle from the string half of the time. */
+        if (index % 2 && needle_len < len) memcpy(needle, str.data + kutil_get_random_int(len - needle_len), needle_len);
+        
+        if (start > str.slen) ok += (kstr_find_buf(&str, start, needle, needle_len) == -1);
+        else ok += (kstr_find_buf(&str, start, needle, needle_len) == naive_find(&str, start, needle, needle_len));
+    }
+    TASSERT(ok == 2000);
+    
+    /* Long periodic input. */
+    kstr_reset(&str);
+    for (i = 0; i < 100000; i++) kstr_append_char(&str, 'a');
+    memset(needle, 'a', 63);
+    needle[63] = 'b';
+    TASSERT(kstr_find_buf(&str, 0, needle, 64) == -1);
+    str.data[99999] = 'b';
+    TASSERT(kstr_find_buf(&str, 0, needle, 64) == 99936);
+    
+    /* Single replacement, shrinking and growing. */
+    kstr_assign_cstr(&str, "a-b-c--d-");
+    kstr_replace(&str, "-", "");
+    TASSERT(kstr_equal_cstr(&str, "abcd"));
+    kstr_assign_cstr(&str, "aaaa");
+    kstr_replace(&str, "aa", "b");
+    TASSERT(kstr_equal_cstr(&str, "bb"));
+    kstr_replace(&str, "b", "{long replacement}");
+    TASSERT(kstr_equal_cstr(&str, "{long replacement}{long replacement}"));
+    kstr_replace(&str, "x", "yz");
+    TASSERT(kstr_equal_cstr(&str, "{long replacement}{long replacement}"));
+    
+    /* Multiple replacement. */
+    kstr_assign_cstr(&str, "cabcab abab abcb");
+    kstr_replace_multi(&str, from, to, 5);
+    TASSERT(kstr_equal_cstr(&str, "44444444 11 22"));
+    
+    for (index = 0, ok = 0; index < 500; index++) {
+        int len = kutil_get_random_int(200);
+        kstr_reset(&str);
+        for (i = 0; i < len; i++) kstr_append_char(&str, 'a' + kutil_get_random_int(3));
+        kstr_assign_kstr(&ref, &str);
+        kstr_replace_multi(&str, from, to, 5);
+        naive_replace_multi(&ref, from, to, 5);
+        ok += kstr_equal_kstr(&str, &ref);
+    }
+    TASSERT(ok == 500);
+    
+    /* Overlapping patterns sharing their prefixes. A shorter match is
+     * replaced when the longer one fails, and the bytes read past it may
+     * contain the next match.
+     */
+    {
+        char *from2[8] = { "ab", "abcd", "c", "abcabd", "bca", "cab", "d", "abcab" };
+        char *to2[8] = { "1", "2", "3", "4", "5", "6", "7", "8" };
+        
+        kstr_assign_cstr(&str, "abce abcabcd abcabe");
+        kstr_replace_multi(&str, from2, to2, 8);
+        TASSERT(kstr_equal_cstr(&str, "13e 837 8e"));
+        
+        for (index = 0, ok = 0; index < 500; index++) {
+            int len = kutil_get_random_int(200);
+            kstr_reset(&str);
+            for (i = 0; i < len; i++) kstr_append_char(&str, 'a' + kutil_get_random_int(4));
+            kstr_assign_kstr(&ref, &str);
+            kstr_replace_multi(&str, from2, to2, 8);
+            naive_replace_multi(&ref, from2, to2, 8);
+            ok += kstr_equal_kstr(&str, &ref);
+        }
+        TASSERT(ok == 500);
+    }
+    
+    kstr_clean(&str);
+    kstr_clean(&ref);
+}
+
+UNIT_TEST(kstr_view) {
+    kstr str;
+    kstr_view view, field;
+    struct kstr_split split;
+    const char *fields[] = { "a", "", "bc", "" };
+    int i, ok;
+    
+    kstr_init_cstr(&str, "a,,bc,");
+    view = kstr_mid_view(&str, 3, 2);
+    TASSERT(view.p == str.data + 3 && kstr_view_equal_cstr(view, "bc"));
+    TASSERT(! kstr_view_equal(view, kstr_view_cstr("b")));
+    
+    /* Split into fields without allocating. */
+    kstr_split_init(&split, kstr_view_kstr(&str), ',');
+    for (i = 0, ok = 0; kstr_split_next(&split, &field); i++) {
+        ok += (i < 4 && kstr_view_equal_cstr(field, fields[i]) && field.p >= str.data);
+    }
+    TASSERT(i == 4 && ok == 4);
+    
+    kstr_split_init(&split, kstr_view_cstr(""), ',');
+    TASSERT(kstr_split_next(&split, &field) && field.n == 0 && ! kstr_split_next(&split, &field));
+    
+    kstr_split_init(&split, kstr_view_cstr("no delimiter"), ',');
+    TASSERT(kstr_split_next(&split, &field) && kstr_view_equal_cstr(field, "no delimiter"));
+    TASSERT(! kstr_split_next(&split, &field));
+    
+    kstr_assign_view(&str, view);
+    kstr_append_view(&str, kstr_view_buf("def", 2));
+    TASSERT(kstr_equal_cstr(&str, "bcde"));
+    
+    kstr_clean(&str);
+}
@@ -0,0 +1,73 @@
+#include <string.h>
+#include "test.h"
+#include "kstrbuf.h"
+
+UNIT_TEST(kstrbuf) {
+    kstrbuf sb;
+    kstr ref, str, body;
+    kbuffer buf;
+    struct iovec *iov;
+    int count, i, ok;
+    size_t total;
+
+    kstrbuf_init(&sb);
+    kstr_init(&ref);
+    kstr_init(&str);
+    kbuffer_init(&buf);
+    kstr_init_cstr(&body, "<borrowed body>");
+
+    /* Empty builder. */
+    kstrbuf_flatten_kstr(&sb, &str);
+    TASSERT(sb.len == 0 && kstr_equal_cstr(&str, ""));
+
+    /* Mix copies, formatted fragments and borrowed data over several chunks. */
+    for (i = 0; i < 5000; i++) {
+        kstrbuf_append_sf(&sb, "<%d>", i);
+        kstr_append_sf(&ref, "<%d>", i);
+        kstrbuf_append_char(&sb, ',');
+        kstr_append_char(&ref, ',');
+
+        if (i % 100 == 0) {
+            kstrbuf_borrow_kstr(&sb, &body);
+            kstr_append_kstr(&ref, &body);
+        }
+    }
+
+    kstrbuf_append_cstr(&sb, "end");
+    kstr_append_cstr(&ref, "end");
+    TASSERT(sb.len == ref.slen);
+
+    kstrbuf_flatten_kstr(&sb, &str);
+    TASSERT(kstr_equal_kstr(&str, &ref));
+    kbuffer_write8(&buf, '>');
+    kstrbuf_flatten(&sb, &buf);
+    TASSERT(buf.len == ref.slen + 1 && ! memcmp(buf.data + 1, ref.data, ref.slen));
+
+    /* The copied fragments are merged: there are about two segments per
+     * borrowed block and one per chunk.
+     */
+    iov = kstrbuf_iovec(&sb, &count);
+    TASSERT(count < 200);
+    for (i = 0, ok = 0, total = 0; i < count; i++) {
+        ok += (iov[i].iov_base == body.data);
+        total += iov[i].iov_len;
+    }
+    TASSERT(ok == 50 && total == ref.slen);
+
+    /* Large appends. */
+    kstrbuf_reset(&sb);
+    kstr_reset(&ref);
+    for (i = 0; i < 200000; i++) kstr_append_char(&ref, 'a' + i % 26);
+    kstrbuf_append_cstr(&sb, "x");
+    kstrbuf_append_kstr(&sb, &ref);
+    kstrbuf_append_sf(&sb, "%s", ref.data);
+    kstrbuf_flatten_kstr(&sb, &str);
+    TASSERT(str.slen == 400001 && str.data[0] == 'x' && ! memcmp(str.data + 1, ref.data, ref.slen) &&
+            ! memcmp(str.data + 1 + ref.slen, ref.data, ref.slen));
+
+    kstrbuf_clean(&sb);
+    kstr_clean(&ref);
+    kstr_clean(&str);
+    kstr_clean(&body);
+    kbuffer_clean(&buf);
+}
@@ -0,0 +1,307 @@
+#include <string.h>
+#include "test.h"
+#include "kcpu.h"
+#include "kutf8.h"
+#include "kutils.h"
+
+/* Reference validator following the table of well-formed byte sequences of
+ * the Unicode standard. It returns the length of the valid prefix.
+ */
+static size_t ref_validate(const unsigned char *s, size_t n) {
+    size_t i = 0;
+
+    while (i < n) {
+        unsigned char c = s[i];
+        unsigned char lo = 0x80, hi = 0xbf;
+        size_t len, k;
+
+        if (c <= 0x7f) len = 1;
+        else if (c >= 0xc2 && c <= 0xdf) len = 2;
+        else if (c >= 0xe0 && c <= 0xef) len = 3;
+        else if (c >= 0xf0 && c <= 0xf4) len = 4;
+        else break;
+
+        if (c == 0xe0) lo = 0xa0;
+        if (c == 0xed) hi = 0x9f;
+        if (c == 0xf0) lo = 0x90;
+        if (c == 0xf4) hi = 0x8f;
+
+        if (i + len > n) break;
+        if (len > 1 && (s[i + 1] < lo || s[i + 1] > hi)) break;
+        for (k = 2; k < len; k++) if (s[i + k] < 0x80 || s[i + k] > 0xbf) break;
+        if (k < len) break;
+        i += len;
+    }
+
+    return i;
+}
+
+/* This function returns a random code point, mostly ASCII. */
+static uint32_t random_code_point() {
+    switch (kutil_get_random_int(5)) {
+        case 0: return 0x80 + kutil_get_random_int(0x7f);
+        case 1: return 0x100 + kutil_get_random_int(0x7ff - 0x100);
+        case 2: {
+            uint32_t cp = 0x800 + kutil_get_random_int(0xffff - 0x800);
+            return (cp >= 0xd800 && cp <= 0xdfff) ? 0xe9 : cp;
+        }
+        case 3: return 0x10000 + kutil_get_random_int(0x10ffff - 0x10000);
+        default: return 'a' + kutil_get_random_int(25);
+    }
+}
+
+/* Reference encoders. */
+static size_t ref_utf8(unsigned char *dst, uint32_t cp) {
+    if (cp < 0x80) { dst[0] = cp; return 1; }
+    if (cp < 0x800) { dst[0] = 0xc0 | (cp >> 6); dst[1] = 0x80 | (cp & 0x3f); return 2; }
+    if (cp < 0x10000) {
+        dst[0] = 0xe0 | (cp >> 12); dst[1] = 0x80 | ((cp >> 6) & 0x3f); dst[2] = 0x80 | (cp & 0x3f);
+        return 3;
+    }
+    dst[0] = 0xf0 | (cp >> 18); dst[1] = 0x80 | ((cp >> 12) & 0x3f);
+    dst[2] = 0x80 | ((cp >> 6) & 0x3f); dst[3] = 0x80 | (cp & 0x3f);
+    return 4;
+}
+
+static size_t ref_utf16(uint16_t *dst, uint32_t cp) {
+    if (cp < 0x10000) { dst[0] = cp; return 1; }
+    dst[0] = 0xd800 + ((cp - 0x10000) >> 10);
+    dst[1] = 0xdc00 + ((cp - 0x10000) & 0x3ff);
+    return 2;
+}
+
+/* Reference decoder replacing each invalid byte by U+FFFD. It returns the
+ * number of code points.
+ */
+static size_t ref_decode(uint32_t *dst, const unsigned char *s, size_t n) {
+    size_t i = 0, j = 0, len, k;
+
+    while (i < n) {
+        len = (s[i] < 0x80) ? 1 : (s[i] < 0xe0) ? 2 : (s[i] < 0xf0) ? 3 : 4;
+
+        if (ref_validate(s + i, MIN(len, n - i)) != len) {
+            dst[j++] = 0xfffd;
+            i++;
+            continue;
+        }
+
+        dst[j] = (len == 1) ? s[i] : s[i] & (0xff >> (len + 1));
+        for (k = 1; k < len; k++) dst[j] = (dst[j] << 6) | (s[i + k] & 0x3f);
+        i += len;
+        j++;
+    }
+
+    return j;
+}
+
+/* This function checks the conversions of the invalid UTF-8 string specified
+ * against the reference decoder.
+ */
+static void check_invalid(const unsigned char *utf8, size_t n8) {
+    uint32_t cps[600];
+    uint16_t ref16[1200], out16[1200];
+    char ref1[600], out1[600];
+    size_t nb_cp, n16 = 0, i, ret;
+
+    nb_cp = ref_decode(cps, utf8, n8);
+    for (i = 0; i < nb_cp; i++) {
+        n16 += ref_utf16(ref16 + n16, cps[i]);
+        ref1[i] = (cps[i] > 0xff) ? '?' : cps[i];
+    }
+
+    ret = kutf8_to_utf16(out16, (char *) utf8, n8);
+    assert(ret == n16 && n16 <= n8 && ! memcmp(out16, ref16, 2 * n16));
+    ret = kutf8_to_latin1(out1, (char *) utf8, n8);
+    assert(ret == nb_cp && ! memcmp(out1, ref1, nb_cp));
+}
+
+/* This function checks the conversions at the current level. */
+static void check_conversions() {
+    unsigned char utf8[600], out[600];
+    uint16_t utf16[300], out16[300];
+    char latin1[200], latin1_out[200];
+    size_t nb_cp, n8, n16, n1, i, ret;
+    int iter, latin1_flag;
+
+    for (iter = 0; iter < 2000; iter++) {
+        nb_cp = kutil_get_random_int(120);
+        latin1_flag = 1;
+        n8 = n16 = n1 = 0;
+
+        /* Long ASCII runs exercise the vector paths. */
+        for (i = 0; i < nb_cp; i++) {
+            uint32_t cp = (iter % 4 == 0 && i < 100) ? 'x' : random_code_point();
+            if (iter % 3 == 0 && cp > 0xff) cp = 0xe9;
+            n8 += ref_utf8(utf8 + n8, cp);
+            n16 += ref_utf16(utf16 + n16, cp);
+            if (cp > 0xff) latin1_flag = 0;
+            else latin1[n1++] = cp;
+        }
+
+        /* Valid strings. */
+        assert(kutf8_validate((char *) utf8, n8) == n8);
+        assert(kutf8_to_utf16_size((char *) utf8, n8) == (ssize_t) n16);
+        ret = kutf8_to_utf16(out16, (char *) utf8, n8);
+        assert(ret == n16 && ! memcmp(out16, utf16, 2 * n16));
+        assert(kutf8_from_utf16_size(utf16, n16) == (ssize_t) n8);
+        ret = kutf8_from_utf16((char *) out, utf16, n16);
+        assert(ret == n8 && ! memcmp(out, utf8, n8));
+
+        if (latin1_flag) {
+            assert(kutf8_from_latin1_size(latin1, n1) == n8);
+            ret = kutf8_from_latin1((char *) out, latin1, n1);
+            assert(ret == n8 && ! memcmp(out, utf8, n8));
+            assert(kutf8_to_latin1_size((char *) utf8, n8) == (ssize_t) n1);
+            ret = kutf8_to_latin1(latin1_out, (char *) utf8, n8);
+            assert(ret == n1 && ! memcmp(latin1_out, latin1, n1));
+        }
+
+        else {
+            assert(kutf8_to_latin1_size((char *) utf8, n8) == -1);
+        }
+
+        /* Corrupt a byte or truncate the string. */
+        if (n8) {
+            size_t valid;
+            if (iter % 2) utf8[kutil_get_random_int(n8 - 1)] = 0x80 + kutil_get_random_int(0x7f);
+            else n8 = kutil_get_random_int(n8 - 1);
+            valid = ref_validate(utf8, n8);
+            assert(kutf8_validate((char *) utf8, n8) == valid);
+            assert((kutf8_to_utf16_size((char *) utf8, n8) == -1) == (valid != n8));
+            check_invalid(utf8, n8);
+        }
+
+        /* Unpaired surrogates. */
+        if (n16) {
+            utf16[kutil_get_random_int(n16 - 1)] = 0xd800 + kutil_get_random_int(0x7ff);
+            for (i = 0; i < n16; i++) {
+                if ((utf16[i] & 0xfc00) == 0xd800 && i + 1 < n16 && (utf16[i + 1] & 0xfc00) == 0xdc00) i++;
+                else if ((utf16[i] & 0xf800) == 0xd800) break;
+            }
+            assert((kutf8_from_utf16_size(utf16, n16) == -1) == (i < n16));
+
+            /* The unpaired surrogates are replaced by U+FFFD, which is encoded
+             * in 3 bytes like any other unit of the range.
+             */
+            n8 = 0;
+            for (i = 0; i < n16; i++) {
+                if ((utf16[i] & 0xfc00) == 0xd800 && i + 1 < n16 && (utf16[i + 1] & 0xfc00) == 0xdc00) {
+                    n8 += ref_utf8(utf8 + n8, 0x10000 + ((utf16[i] - 0xd800) << 10) + (utf16[i + 1] - 0xdc00));
+                    i++;
+                }
+                else n8 += ref_utf8(utf8 + n8, ((utf16[i] & 0xf800) == 0xd800) ? 0xfffd : utf16[i]);
+            }
+            ret = kutf8_from_utf16((char *) out, utf16, n16);
+            assert(ret == n8 && ! memcmp(out, utf8, n8));
+        }
+    }
+
+    /* Random bytes, mostly invalid. */
+    for (iter = 0; iter < 2000; iter++) {
+        n8 = kutil_get_random_int(64);
+        for (i = 0; i < n8; i++) utf8[i] = (iter % 2) ? 0xc0 + kutil_get_random_int(0x3f) : kutil_get_random_int(255);
+        for (i = 0; i < n8; i++) if (kutil_get_random_int(2) == 0) utf8[i] = 0x80 + kutil_get_random_int(0x3f);
+        assert(kutf8_validate((char *) utf8, n8) == ref_validate(utf8, n8));
+        check_invalid(utf8, n8);
+    }
+}
+
+/* This function checks the validation of the sequences of up to 4 bytes
+ * starting with a lead byte, across the boundaries of the vector blocks.
+ */
+static void check_sequences() {
+    static const unsigned char conts[] = { 'x', 0x80, 0x8f, 0x90, 0x9f, 0xa0, 0xbf, 0xc2, 0xf0 };
+    static const size_t offs[] = { 13, 14, 15, 29, 30 };
+    unsigned char buf[80];
+    size_t nb = sizeof(conts), off, i, k;
+    int lead, a, b, c;
+
+    for (k = 0; k < sizeof(offs) / sizeof(offs[0]); k++) {
+        off = offs[k];
+        for (lead = 0xbf; lead < 0x100; lead++) {
+            for (a = 0; a < (int) nb; a++) for (b = 0; b < (int) nb; b++) for (c = 0; c < (int) nb; c++) {
+                memset(buf, 'x', sizeof(buf));
+                buf[off] = lead;
+                buf[off + 1] = conts[a];
+                buf[off + 2] = conts[b];
+                buf[off + 3] = conts[c];
+                assert(kutf8_validate((char *) buf, sizeof(buf)) == ref_validate(buf, sizeof(buf)));
+
+                /* The sequence at the end of the buffer. */
+                for (i = off + 1; i < off + 4; i++) {
+                    assert(kutf8_validate((char *) buf, i) == ref_validate(buf, i));
+                }
+            }
+        }
+    }
+}
+
+UNIT_TEST(kutf8) {
+    kstr str;
+    kbuffer buf;
+    uint16_t utf16[4] = { 'a', 0xe9, 0xd83d, 0xde00 };
+    uint16_t bad16[5] = { 0xd800, 'b', 0xde00, 0xd83d, 0xd83d };
+    uint16_t out16[8];
+    char out[16];
+    int level;
+
+    for (level = KCPU_LEVEL_SCALAR; level <= kcpu_get_detected_level(); level++) {
+        kcpu_set_level(level);
+        check_conversions();
+        check_sequences();
+    }
+
+    kcpu_set_level(KCPU_LEVEL_AVX2);
+
+    /* Edge cases of the validation. */
+    TASSERT(kutf8_is_valid("", 0));
+    TASSERT(kutf8_is_valid("\xf4\x8f\xbf\xbf", 4));
+    TASSERT(! kutf8_is_valid("\xf4\x90\x80\x80", 4));
+    TASSERT(! kutf8_is_valid("\xed\xa0\x80", 3));
+    TASSERT(! kutf8_is_valid("\xc0\xaf", 2));
+    TASSERT(! kutf8_is_valid("\xe0\x80\xaf", 3));
+    TASSERT(kutf8_validate("abc\xc3", 4) == 3);
+
+    /* Conversions of invalid input. */
+    TASSERT(kutf8_to_utf16(out16, "ab\xff" "cd", 5) == 5);
+    TASSERT(out16[0] == 'a' && out16[2] == 0xfffd && out16[4] == 'd');
+    TASSERT(kutf8_to_utf16(out16, "a\xe2\x82", 3) == 3);
+    TASSERT(out16[1] == 0xfffd && out16[2] == 0xfffd);
+    TASSERT(kutf8_to_latin1(out, "a\xff" "b\xe2\x82\xac\xc3\xa9", 8) == 5);
+    TASSERT(! memcmp(out, "a?b?\xe9", 5));
+    TASSERT(kutf8_from_utf16(out, bad16, 5) == 13);
+    TASSERT(! memcmp(out, "\xef\xbf\xbd" "b\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd", 13));
+
+    /* In place conversions of kstr. */
+    kstr_init_cstr(&str, "caf\xe9 cr\xe8me");
+    kutf8_kstr_from_latin1(&str);
+    TASSERT(! strcmp(str.data, "caf\xc3\xa9 cr\xc3\xa8me"));
+    TASSERT(str.slen == 12);
+    TASSERT(kutf8_kstr_to_latin1(&str) == 0);
+    TASSERT(! strcmp(str.data, "caf\xe9 cr\xe8me"));
+    kutil_latin1_to_utf8(&str);
+    TASSERT(! strcmp(str.data, "caf\xc3\xa9 cr\xc3\xa8me"));
+
+    kstr_assign_cstr(&str, "\xe2\x82\xac");
+    TASSERT(kutf8_kstr_to_latin1(&str) == -1);
+    TASSERT(! strcmp(str.data, "\xe2\x82\xac"));
+
+    TASSERT(kutf8_kstr_from_utf16(&str, utf16, 4) == 0);
+    TASSERT(! strcmp(str.data, "a\xc3\xa9\xf0\x9f\x98\x80"));
+    TASSERT(kutf8_kstr_from_utf16(&str, utf16, 3) == -1);
+
+    /* kbuffer output, at an odd offset. */
+    kbuffer_init(&buf);
+    kbuffer_write8(&buf, 0);
+    kutf8_write_from_latin1(&buf, "\xe9t\xe9", 3);
+    TASSERT(buf.len == 6 && ! memcmp(buf.data + 1, "\xc3\xa9t\xc3\xa9", 5));
+    TASSERT(kutf8_write_to_utf16(&buf, str.data, str.slen) == 0);
+    TASSERT(buf.len == 14 && ! memcmp(buf.data + 6, utf16, 8));
+    TASSERT(kutf8_write_to_utf16(&buf, "\xff", 1) == -1);
+    TASSERT(kutf8_write_from_utf16(&buf, utf16, 4) == 0);
+    TASSERT(buf.len == 21 && ! memcmp(buf.data + 14, str.data, 7));
+    TASSERT(kutf8_write_from_utf16(&buf, utf16 + 3, 1) == -1);
+
+    kbuffer_clean(&buf);
+    kstr_clean(&str);
+}
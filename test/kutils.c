@@ -0,0 +1,178 @@
+#include <string.h>
+#include "test.h"
+#include "kcpu.h"
+#include "kutils.h"
+
+/* Reference implementations. */
+static char ref_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static char ref_upper(char c) {
+    return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+static int ref_case_eq(const char *a, const char *b, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++) if (ref_lower(a[i]) != ref_lower(b[i])) return 0;
+    return 1;
+}
+
+static ssize_t ref_search(const char *hay, size_t n, const char *needle, size_t m, int nocase) {
+    size_t i;
+
+    for (i = 0; i + m <= n; i++) {
+        if (nocase ? ref_case_eq(hay + i, needle, m) : ! memcmp(hay + i, needle, m)) return i;
+    }
+
+    return -1;
+}
+
+static const char * ref_find_any(const char *buf, size_t n, const char *set, size_t set_len) {
+    size_t i;
+    for (i = 0; i < n; i++) if (memchr(set, buf[i], set_len)) return buf + i;
+    return NULL;
+}
+
+static int ref_is_binary(const char *str, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++) if ((unsigned char) str[i] < 32 && str[i] != 10 && str[i] != 13) return 1;
+    return 0;
+}
+
+/* This function fills the buffer with random characters taken from the
+ * alphabet, so that the searches find matches and near misses.
+ */
+static void fill_random(char *buf, size_t n, const char *alphabet) {
+    size_t i, len = strlen(alphabet);
+    for (i = 0; i < n; i++) buf[i] = alphabet[kutil_get_random_int(len - 1)];
+}
+
+/* This function checks the kernels against the reference implementations at
+ * the current level.
+ */
+static void check_kernels() {
+    char hay[300], needle[40], out[300], set[32];
+    char all[256];
+    size_t n, m, off, i;
+    int iter;
+
+    /* Case conversion of every byte value, in and out of place. */
+    for (i = 0; i < 256; i++) all[i] = (char) i;
+
+    for (off = 0; off < 40; off++) {
+        kutil_ascii_tolower(out, all + off, 256 - off);
+        for (i = 0; i < 256 - off; i++) assert(out[i] == ref_lower(all[off + i]));
+        kutil_ascii_toupper(out, all + off, 256 - off);
+        for (i = 0; i < 256 - off; i++) assert(out[i] == ref_upper(all[off + i]));
+    }
+
+    memcpy(out, all, 256);
+    kutil_ascii_toupper(out + 1, out + 1, 255);
+    for (i = 1; i < 256; i++) assert(out[i] == ref_upper(all[i]));
+
+    /* Searches. */
+    for (iter = 0; iter < 3000; iter++) {
+        const char *alphabet = (iter % 3) ? "aAbB" : "abcdefghABCDEFGH01\n\r\t";
+        const char *found;
+        ssize_t pos;
+
+        n = kutil_get_random_int(200);
+        m = kutil_get_random_int(iter % 2 ? 4 : 36);
+        off = kutil_get_random_int(15);
+        fill_random(hay + off, n, alphabet);
+        fill_random(needle, m, alphabet);
+
+        /* Take the needle from the haystack half of the time. */
+        if (iter % 2 && m && m <= n) memcpy(needle, hay + off + kutil_get_random_int(n - m), m);
+
+        found = kutil_memcasemem(hay + off, n, needle, m);
+        pos = ref_search(hay + off, n, needle, m, 1);
+        assert(found == (pos == -1 ? NULL : hay + off + pos));
+
+        assert(kutil_two_way_search(hay + off, n, needle, m, 1) == pos);
+        assert(kutil_two_way_search(hay + off, n, needle, m, 0) == ref_search(hay + off, n, needle, m, 0));
+
+        /* Same searches on C strings. */
+        hay[off + n] = 0;
+        needle[m] = 0;
+        pos = ref_search(hay + off, strlen(hay + off), needle, m, 1);
+        assert(kutil_strcasestr(hay + off, needle) == (pos == -1 ? NULL : hay + off + pos));
+
+        /* Reverse search from a random position. */
+        if (n) {
+            size_t start = kutil_get_random_int(n - 1);
+            char *expected = NULL;
+            ssize_t j;
+
+            for (j = start; j >= 0; j--) {
+                if (j + m <= strlen(hay + off) && ref_case_eq(hay + off + j, needle, m)) {
+                    expected = hay + off + j;
+                    break;
+                }
+            }
+
+            assert(kutil_reverse_strcasestr(hay + off, hay + off + start, needle) == expected);
+        }
+
+        /* Byte sets. */
+        i = kutil_get_random_int(iter % 2 ? 4 : 20);
+        fill_random(set, i, alphabet);
+        assert(kutil_find_any(hay + off, n, set, i) == ref_find_any(hay + off, n, set, i));
+
+        assert(kutils_string_is_binary(hay + off, n) == ref_is_binary(hay + off, n));
+    }
+
+    /* Binary detection of a single control byte at every position. */
+    memset(hay, 'x', sizeof(hay));
+
+    for (i = 0; i < 100; i++) {
+        hay[i] = 10;
+        assert(! kutils_string_is_binary(hay, 100));
+        hay[i] = (char) 0xff;
+        assert(! kutils_string_is_binary(hay, 100));
+        hay[i] = 31;
+        assert(kutils_string_is_binary(hay, 100));
+        assert(! kutils_string_is_binary(hay, i));
+        hay[i] = 'x';
+    }
+
+    /* Byte swapping of every width, at unaligned offsets. */
+    for (off = 0; off < 8; off++) {
+        size_t width;
+
+        for (width = 2; width <= 8; width *= 2) {
+            n = (256 - off) / width;
+            kutil_bswap_array(out, all + off, n, width);
+            for (i = 0; i < n * width; i++) assert(out[i] == all[off + (i / width) * width + width - 1 - i % width]);
+            kutil_bswap_array(out, out, n, width);
+            assert(! memcmp(out, all + off, n * width));
+        }
+    }
+}
+
+UNIT_TEST(kutils) {
+    char str[32];
+    int level;
+
+    /* The results must be the same at every level. */
+    for (level = KCPU_LEVEL_SCALAR; level <= kcpu_get_detected_level(); level++) {
+        kcpu_set_level(level);
+        TASSERT(kcpu_get_level() == level);
+        check_kernels();
+    }
+
+    kcpu_set_level(KCPU_LEVEL_AVX2);
+    TASSERT(kcpu_get_level() == kcpu_get_detected_level());
+
+    /* Long needles. */
+    TASSERT(kutil_strcasestr("abc", "abcd") == NULL);
+    TASSERT(kutil_reverse_strcasestr("abc", "abc", "abcd") == NULL);
+    strcpy(str, "Hello World");
+    TASSERT(kutil_strcasestr(str, "WORLD") == str + 6);
+    TASSERT(kutil_reverse_strcasestr(str, str + 10, "O") == str + 7);
+    TASSERT(kutil_strcasestr(str, "") == str);
+
+    strntolower(str, 5);
+    TASSERT(! strcmp(str, "hello World"));
+}
@@ -0,0 +1,131 @@
+#include <string.h>
+#include "test.h"
+#include "kcpu.h"
+#include "kvarint.h"
+#include "kbuffer.h"
+#include "kutils.h"
+
+/* This function returns a random value, mostly small. */
+static uint64_t random_value(int bits) {
+    uint64_t v = ((uint64_t) kutil_get_random_int(0x7ffffffe) << 33) ^ (uint64_t) kutil_get_random_int(0x7ffffffe) << 2;
+    v = v >> kutil_get_random_int(63);
+    if (kutil_get_random_int(3) == 0) v = kutil_get_random_int(127);
+    return bits == 32 ? (uint32_t) v : v;
+}
+
+/* This function checks the array decoders at the current level. */
+static void check_arrays() {
+    uint8_t enc[300 * KVARINT_MAX64 + 1];
+    uint32_t in32[300], out32[300];
+    uint64_t in64[300], out64[300];
+    size_t count, n32, n64, i;
+    ssize_t ret;
+    int iter;
+
+    for (iter = 0; iter < 1000; iter++) {
+        count = kutil_get_random_int(299);
+
+        for (i = 0; i < count; i++) {
+            in64[i] = random_value(iter % 4 == 0 ? 0 : 64);
+            in32[i] = (uint32_t) random_value(32);
+            if (iter % 4 == 0) in32[i] = in32[i] & 0x7f;
+        }
+
+        for (n32 = i = 0; i < count; i++) n32 += kvarint_encode32(enc + n32, in32[i]);
+        ret = kvarint_decode32_array(enc, n32, out32, count);
+        assert(ret == (ssize_t) n32 && ! memcmp(in32, out32, count * 4));
+
+        /* Truncated input. */
+        if (count) {
+            ret = kvarint_decode32_array(enc, n32 - 1, out32, count);
+            assert(ret == -1);
+        }
+
+        for (n64 = i = 0; i < count; i++) n64 += kvarint_encode64(enc + n64, in64[i]);
+        ret = kvarint_decode64_array(enc, n64, out64, count);
+        assert(ret == (ssize_t) n64 && ! memcmp(in64, out64, count * 8));
+
+        /* A value too large for 32 bits. */
+        if (count > 20) {
+            size_t pos = 0;
+            for (i = 0; i < 10; i++) pos += kvarint_encode64(enc + pos, in64[i]);
+            memcpy(enc + pos, "\xff\xff\xff\xff\x7f", 5);
+            for (i = 0; i < 11; i++) enc[pos + 5 + i] = 1;
+            ret = kvarint_decode32_array(enc, pos + 16, out32, 20);
+            assert(ret == -1);
+            ret = kvarint_decode64_array(enc, pos + 16, out64, 22);
+            assert(ret == (ssize_t) pos + 16);
+        }
+    }
+}
+
+UNIT_TEST(kvarint) {
+    uint8_t enc[KVARINT_MAX64];
+    uint32_t v32, a32[40];
+    uint64_t v64;
+    int32_t s32;
+    int64_t s64;
+    kbuffer buf;
+    int level, i;
+
+    /* Boundaries of the encoding. */
+    TASSERT(kvarint_encode32(enc, 0) == 1 && enc[0] == 0);
+    TASSERT(kvarint_encode32(enc, 127) == 1);
+    TASSERT(kvarint_encode32(enc, 128) == 2 && enc[0] == 0x80 && enc[1] == 0x01);
+    TASSERT(kvarint_encode32(enc, 300) == 2 && enc[0] == 0xac && enc[1] == 0x02);
+    TASSERT(kvarint_encode32(enc, UINT32_MAX) == KVARINT_MAX32);
+    TASSERT(kvarint_decode32(enc, KVARINT_MAX32, &v32) == KVARINT_MAX32 && v32 == UINT32_MAX);
+    TASSERT(kvarint_decode32(enc, KVARINT_MAX32 - 1, &v32) == 0);
+    TASSERT(kvarint_encode64(enc, UINT64_MAX) == KVARINT_MAX64);
+    TASSERT(kvarint_decode64(enc, KVARINT_MAX64, &v64) == KVARINT_MAX64 && v64 == UINT64_MAX);
+    TASSERT(kvarint_size64(UINT64_MAX) == KVARINT_MAX64 && kvarint_size64(127) == 1);
+
+    /* Overflows. */
+    TASSERT(kvarint_decode32((uint8_t *) "\xff\xff\xff\xff\x10", 5, &v32) == 0);
+    TASSERT(kvarint_decode32((uint8_t *) "\x80\x80\x80\x80\x80\x00", 6, &v32) == 0);
+    TASSERT(kvarint_decode64((uint8_t *) "\xff\xff\xff\xff\xff\xff\xff\xff\xff\x02", 10, &v64) == 0);
+    TASSERT(kvarint_decode64((uint8_t *) "\xff\xff\xff\xff\xff", 5, &v64) == 0);
+
+    /* Zigzag. */
+    TASSERT(kvarint_zigzag32(0) == 0 && kvarint_zigzag32(-1) == 1 && kvarint_zigzag32(1) == 2);
+    TASSERT(kvarint_zigzag32(INT32_MIN) == UINT32_MAX && kvarint_unzigzag32(UINT32_MAX) == INT32_MIN);
+    TASSERT(kvarint_unzigzag32(kvarint_zigzag32(INT32_MAX)) == INT32_MAX);
+    TASSERT(kvarint_zigzag64(-2) == 3 && kvarint_unzigzag64(kvarint_zigzag64(INT64_MIN)) == INT64_MIN);
+
+    for (level = KCPU_LEVEL_SCALAR; level <= kcpu_get_detected_level(); level++) {
+        kcpu_set_level(level);
+        check_arrays();
+    }
+
+    kcpu_set_level(KCPU_LEVEL_AVX2);
+
+    /* kbuffer, flat and chained with values spanning the segments. */
+    for (i = 0; i < 2; i++) {
+        int j;
+
+        if (i == 0) kbuffer_init(&buf);
+        else kbuffer_init_chained(&buf, 16);
+
+        for (j = 0; j < 40; j++) a32[j] = j * 1000;
+        kbuffer_write_varint32(&buf, 300);
+        kbuffer_write_varint64(&buf, UINT64_MAX);
+        kbuffer_write_zigzag32(&buf, -5);
+        kbuffer_write_zigzag64(&buf, INT64_MIN);
+        kbuffer_write_varint32_array(&buf, a32, 40);
+        kbuffer_write8(&buf, 0x80);
+
+        memset(a32, 0, sizeof(a32));
+        TASSERT(kbuffer_read_varint32(&buf, &v32) == 0 && v32 == 300);
+        TASSERT(kbuffer_read_varint64(&buf, &v64) == 0 && v64 == UINT64_MAX);
+        TASSERT(kbuffer_read_zigzag32(&buf, &s32) == 0 && s32 == -5);
+        TASSERT(kbuffer_read_zigzag64(&buf, &s64) == 0 && s64 == INT64_MIN);
+        TASSERT(kbuffer_read_varint32_array(&buf, a32, 40) == 0);
+        for (j = 0; j < 40; j++) assert(a32[j] == (uint32_t) j * 1000);
+
+        /* Truncated value: the position does not move. */
+        TASSERT(kbuffer_read_varint32(&buf, &v32) == -1);
+        TASSERT(kbuffer_read_varint32_array(&buf, a32, 1) == -1);
+        TASSERT(buf.pos == buf.len - 1);
+        kbuffer_clean(&buf);
+    }
+}